@@ -0,0 +1,616 @@
+#include "image.hh"
+
+#include <charconv>
+#include <ext2++/core.hh>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <unistd.h>
+
+namespace chr = std::chrono;
+using namespace Ext2;
+using namespace Ext2::Bench;
+
+namespace {
+/// ===========================================================================
+///  Configuration.
+/// ===========================================================================
+struct Config {
+    ImageOptions Image;
+
+    /// Where to put the image. If empty, a temporary image is
+    /// generated and deleted afterwards.
+    std::string ImagePath;
+
+    /// Benchmark an existing image at ImagePath instead of generating one.
+    bool Existing = false;
+
+    /// Device to mount the image on: fd, mapped, or uring.
+    std::string Device = "fd";
+
+    /// Mount the image read-write instead of read-only. Access times
+    /// are not updated either way.
+    bool ReadWrite = false;
+
+    /// Drop the image from the page cache before each benchmark.
+    bool Cold = false;
+
+    /// Print the results as JSON.
+    bool Json = false;
+
+    /// Only run benchmarks whose name contains this.
+    std::string Filter;
+
+    /// Operations per lookup, stat, and random read benchmark, and
+    /// number of mounts to time.
+    usz Iterations = 10'000;
+    usz Mounts = 20;
+
+    /// Size of random reads and of the buffer for sequential reads.
+    usz RandomReadSize = 4096;
+    usz SequentialReadSize = 128 * 1024;
+
+    /// Block cache size of the mounted drive.
+    usz CacheBlocks = MountOptions{}.CacheBlocks;
+};
+
+/// Parse a number with an optional K, M, or G suffix.
+template <typename Integer>
+bool ParseNumber(std::string_view Str, Integer& Out) {
+    u64 Value{};
+    auto [Ptr, Err] = std::from_chars(Str.data(), Str.data() + Str.size(), Value);
+    if (Err != std::errc{}) return false;
+
+    std::string_view Suffix{Ptr, Str.data() + Str.size()};
+    if (Suffix == "K" or Suffix == "k") Value <<= 10;
+    else if (Suffix == "M" or Suffix == "m") Value <<= 20;
+    else if (Suffix == "G" or Suffix == "g") Value <<= 30;
+    else if (not Suffix.empty()) return false;
+
+    if (Value > std::numeric_limits<Integer>::max()) return false;
+    Out = Integer(Value);
+    return true;
+}
+
+bool ParseFraction(std::string_view Str, f64& Out) {
+    auto [Ptr, Err] = std::from_chars(Str.data(), Str.data() + Str.size(), Out);
+    return Err == std::errc{} and Ptr == Str.data() + Str.size() and Out >= 0 and Out <= 1;
+}
+
+struct Option {
+    std::string_view Name;
+    std::string_view Help;
+
+    /// Null for options that don’t take a value.
+    std::function<bool(std::string_view)> Set;
+    std::function<void()> SetFlag;
+};
+
+auto Options(Config& C) -> std::vector<Option> {
+    auto Number = [](auto& Field) { return [&Field](std::string_view S) { return ParseNumber(S, Field); }; };
+    auto String = [](std::string& Field) { return [&Field](std::string_view S) { Field = S; return true; }; };
+    auto Flag = [](bool& Field) { return [&Field] { Field = true; }; };
+    return {
+        {"--block-size", "Block size of the generated image (1K, 2K, or 4K)", Number(C.Image.BlockSize), {}},
+        {"--depth", "Levels of directories below the root", Number(C.Image.Depth), {}},
+        {"--fan-out", "Subdirectories per directory", Number(C.Image.FanOut), {}},
+        {"--files-per-dir", "Files per directory", Number(C.Image.FilesPerDir), {}},
+        {"--min-file-size", "Smallest file size", Number(C.Image.MinFileSize), {}},
+        {"--max-file-size", "Largest file size; sizes are log-uniform in between", Number(C.Image.MaxFileSize), {}},
+        {"--fragmentation", "Probability that a block is placed somewhere random (0–1)", [&C](std::string_view S) { return ParseFraction(S, C.Image.Fragmentation); }, {}},
+        {"--seed", "Seed for the generated image", Number(C.Image.Seed), {}},
+        {"--image", "Write the image here and keep it", String(C.ImagePath), {}},
+        {"--existing", "Benchmark the existing image given by --image", {}, Flag(C.Existing)},
+        {"--device", "Block device to use: fd, mapped, or uring", String(C.Device), {}},
+        {"--read-write", "Mount read-write instead of read-only", {}, Flag(C.ReadWrite)},
+        {"--cold", "Drop the image from the page cache before each benchmark", {}, Flag(C.Cold)},
+        {"--json", "Print the results as JSON", {}, Flag(C.Json)},
+        {"--filter", "Only run benchmarks whose name contains this", String(C.Filter), {}},
+        {"--iterations", "Operations per lookup, stat, and random read benchmark", Number(C.Iterations), {}},
+        {"--mounts", "Number of mounts to time", Number(C.Mounts), {}},
+        {"--random-read-size", "Size of random reads", Number(C.RandomReadSize), {}},
+        {"--sequential-read-size", "Buffer size for sequential reads", Number(C.SequentialReadSize), {}},
+        {"--cache-blocks", "Block cache size of the mounted drive", Number(C.CacheBlocks), {}},
+    };
+}
+
+void PrintUsage(const char* Program, const std::vector<Option>& Opts) {
+    fmt::print("Usage: {} [options]\n\nOptions:\n", Program);
+    for (auto& O : Opts) fmt::print("    {:<24} {}\n", fmt::format("{}{}", O.Name, O.Set ? " <value>" : ""), O.Help);
+    fmt::print("    {:<24} {}\n", "--help", "Print this help");
+}
+
+/// Parse the command line. Options take their value either after
+/// an equals sign or as the next argument.
+bool ParseCommandLine(int argc, char** argv, Config& C) {
+    auto Opts = Options(C);
+    for (int Arg = 1; Arg < argc; Arg++) {
+        std::string_view Str = argv[Arg];
+        if (Str == "--help" or Str == "-h") {
+            PrintUsage(argv[0], Opts);
+            std::exit(0);
+        }
+
+        auto Eq = Str.find('=');
+        auto Name = Str.substr(0, Eq);
+        auto It = std::ranges::find(Opts, Name, &Option::Name);
+        if (It == Opts.end()) {
+            fmt::print(stderr, "Unknown option '{}'. Try --help.\n", Name);
+            return false;
+        }
+
+        if (not It->Set) {
+            if (Eq != std::string_view::npos) {
+                fmt::print(stderr, "Option '{}' does not take a value\n", Name);
+                return false;
+            }
+            It->SetFlag();
+            continue;
+        }
+
+        std::string_view Value;
+        if (Eq != std::string_view::npos) Value = Str.substr(Eq + 1);
+        else if (Arg + 1 < argc) Value = argv[++Arg];
+        else {
+            fmt::print(stderr, "Option '{}' requires a value\n", Name);
+            return false;
+        }
+
+        if (not It->Set(Value)) {
+            fmt::print(stderr, "Invalid value '{}' for option '{}'\n", Value, Name);
+            return false;
+        }
+    }
+
+    if (C.Existing and C.ImagePath.empty()) {
+        fmt::print(stderr, "--existing requires --image\n");
+        return false;
+    }
+
+    if (C.Device != "fd" and C.Device != "mapped" and C.Device != "uring") {
+        fmt::print(stderr, "Unknown device '{}'\n", C.Device);
+        return false;
+    }
+
+    return true;
+}
+
+/// ===========================================================================
+///  Measurement.
+/// ===========================================================================
+/// Result of a benchmark.
+struct Result {
+    std::string Name;
+
+    /// What each operation processes, e.g. bytes or directory entries.
+    std::string_view Unit;
+
+    usz Ops{};
+    usz Failures{};
+    u64 Units{};
+    f64 Seconds{};
+
+    /// Latency of each operation in nanoseconds, sorted.
+    std::vector<u64> Latencies;
+
+    /// Number of read and write system calls, if the kernel reports them.
+    std::optional<u64> Syscalls;
+
+    [[nodiscard]] auto Percentile(f64 P) const -> u64 {
+        if (Latencies.empty()) return 0;
+        auto Rank = usz(std::ceil(P * f64(Latencies.size())));
+        return Latencies[std::clamp<usz>(Rank, 1, Latencies.size()) - 1];
+    }
+};
+
+/// Number of read and write system calls made by this process so far,
+/// including positional and vectored ones. This includes the read of
+/// /proc/self/io itself, which is negligible over a whole benchmark.
+/// I/O submitted through io_uring is not counted.
+auto IoSyscalls() -> std::optional<u64> {
+    std::ifstream In{"/proc/self/io"};
+    std::string Key;
+    u64 Value, Total = 0;
+    usz Found = 0;
+    while (In >> Key >> Value) {
+        if (Key == "syscr:" or Key == "syscw:") {
+            Total += Value;
+            Found++;
+        }
+    }
+
+    if (Found != 2) return {};
+    return Total;
+}
+
+/// Run a benchmark. Op(i) performs the i-th operation and returns
+/// the number of units it processed, or nothing if it failed. Setup(i)
+/// is called before it; the time spent in Setup() is not measured.
+template <typename Callback, typename SetupCallback>
+auto Measure(std::string Name, std::string_view Unit, usz Ops, Callback Op, SetupCallback Setup) -> Result {
+    Result R;
+    R.Name = std::move(Name);
+    R.Unit = Unit;
+    R.Latencies.reserve(Ops);
+
+    auto SyscallsBefore = IoSyscalls();
+    chr::nanoseconds Excluded{};
+    auto Start = chr::steady_clock::now();
+    for (usz I = 0; I < Ops; I++) {
+        auto SetupStart = chr::steady_clock::now();
+        Setup(I);
+        auto OpStart = chr::steady_clock::now();
+        auto Units = Op(I);
+        auto OpEnd = chr::steady_clock::now();
+        Excluded += OpStart - SetupStart;
+        R.Latencies.push_back(u64(chr::duration_cast<chr::nanoseconds>(OpEnd - OpStart).count()));
+        if (Units) R.Units += *Units;
+        else R.Failures++;
+    }
+    R.Seconds = chr::duration<f64>(chr::steady_clock::now() - Start - Excluded).count();
+
+    auto SyscallsAfter = IoSyscalls();
+    if (SyscallsBefore and SyscallsAfter) R.Syscalls = *SyscallsAfter - *SyscallsBefore;
+
+    R.Ops = Ops;
+    std::ranges::sort(R.Latencies);
+    return R;
+}
+
+/// Run a benchmark that needs no setup between operations.
+template <typename Callback>
+auto Measure(std::string Name, std::string_view Unit, usz Ops, Callback Op) -> Result {
+    return Measure(std::move(Name), Unit, Ops, Op, [](usz) {});
+}
+
+/// ===========================================================================
+///  Benchmarks.
+/// ===========================================================================
+/// Mount the image as configured.
+auto Mount(const Config& C) -> std::shared_ptr<Drive> {
+    auto Fd = open(C.ImagePath.c_str(), C.ReadWrite ? O_RDWR : O_RDONLY);
+    if (Fd < 0) {
+        Log("Failed to open {}: {}", C.ImagePath, strerror(errno));
+        return {};
+    }
+
+    std::unique_ptr<BlockDevice> Dev;
+    if (C.Device == "mapped") Dev = MappedBlockDevice::Open(Fd);
+    else if (C.Device == "uring") Dev = UringBlockDevice::Open(Fd);
+    else Dev = std::make_unique<FdBlockDevice>(Fd);
+    if (not Dev) {
+        Log("Failed to open {} device", C.Device);
+        close(Fd);
+        return {};
+    }
+
+    return Drive::TryMount(std::move(Dev), {.CacheBlocks = C.CacheBlocks, .Atime = AtimeUpdate::Never, .ReadOnly = not C.ReadWrite});
+}
+
+class Suite {
+    const Config& C;
+    const Image& Img;
+    Random Rng;
+    std::vector<Result> Results;
+
+    /// Files that aren’t empty, for random reads.
+    std::vector<usz> NonEmpty;
+
+    /// Evict the image from the page cache if requested.
+    void DropCaches() {
+        if (not C.Cold) return;
+        auto Fd = open(C.ImagePath.c_str(), O_RDONLY);
+        if (Fd < 0) return;
+        fdatasync(Fd);
+        posix_fadvise(Fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(Fd);
+    }
+
+    /// Pick N operations from a range of candidates, in random order.
+    auto Sample(usz Candidates, usz N) -> std::vector<usz> {
+        std::vector<usz> Picks(N);
+        for (auto& P : Picks) P = usz(Rng.Below(Candidates));
+        return Picks;
+    }
+
+    /// Pick up to N distinct candidates, in random order.
+    auto Shuffle(usz Candidates, usz N) -> std::vector<usz> {
+        std::vector<usz> Picks(Candidates);
+        for (usz I = 0; I < Candidates; I++) Picks[I] = I;
+        for (usz I = Candidates; I > 1; I--) std::swap(Picks[I - 1], Picks[usz(Rng.Below(I))]);
+        Picks.resize(std::min(Candidates, N));
+        return Picks;
+    }
+
+    /// Whether a benchmark was selected with --filter.
+    bool Enabled(std::string_view Name) const { return C.Filter.empty() or Name.find(C.Filter) != std::string_view::npos; }
+
+    void Add(Result R) { Results.push_back(std::move(R)); }
+
+public:
+    Suite(const Config& C_, const Image& Img_) : C(C_), Img(Img_), Rng(C_.Image.Seed ^ 0x5EED) {
+        for (usz I = 0; I < Img.Files.size(); I++)
+            if (Img.FileSizes[I]) NonEmpty.push_back(I);
+    }
+
+    /// Time mounting the image. Unmounting is not included.
+    void MountTime() {
+        if (not Enabled("mount")) return;
+        std::shared_ptr<Drive> D;
+        auto Setup = [&](usz) {
+            D.reset();
+            DropCaches();
+        };
+
+        Add(Measure("mount", "", C.Mounts, [&](usz) -> std::optional<u64> {
+            D = Mount(C);
+            if (not D) return {};
+            return 0;
+        }, Setup));
+    }
+
+    /// Resolve paths, on a freshly mounted drive and with warm caches.
+    void Lookup(Drive& D, bool Cold) {
+        auto Name = Cold ? "lookup-cold" : "lookup";
+        if (not Enabled(Name) or Img.Files.empty()) return;
+        /// Cold lookups visit each file at most once.
+        auto Picks = Cold ? Shuffle(Img.Files.size(), C.Iterations) : Sample(Img.Files.size(), C.Iterations);
+        if (not Cold)
+            for (auto& F : Img.Files) (void) D.InodeFromPath(F);
+        Add(Measure(Name, "", Picks.size(), [&](usz I) -> std::optional<u64> {
+            if (not D.InodeFromPath(Img.Files[Picks[I]])) return {};
+            return 0;
+        }));
+    }
+
+    /// Stat files with warm caches.
+    void Stat(Drive& D) {
+        if (not Enabled("stat") or Img.Files.empty()) return;
+        auto Picks = Sample(Img.Files.size(), C.Iterations);
+        for (auto& F : Img.Files) (void) D.Stat(F);
+        Add(Measure("stat", "", Picks.size(), [&](usz I) -> std::optional<u64> {
+            if (not D.Stat(Img.Files[Picks[I]])) return {};
+            return 0;
+        }));
+    }
+
+    /// Open and list every directory.
+    void ReadDir(Drive& D) {
+        if (not Enabled("readdir")) return;
+        Add(Measure("readdir", "entries", Img.Directories.size(), [&](usz I) -> std::optional<u64> {
+            auto Dir = D.OpenDir(Img.Directories[I]);
+            if (not Dir) return {};
+            u64 Entries = 0;
+            if (not Dir->ForEachEntry([&](const DirEntryView&) { Entries++; })) return {};
+            return Entries;
+        }));
+    }
+
+    /// Read every file from start to end.
+    void SequentialRead(Drive& D) {
+        if (not Enabled("read-seq")) return;
+        std::vector<u8> Buffer(C.SequentialReadSize);
+        std::unique_ptr<File> F;
+        usz Next = 0;
+
+        /// One operation is one call to Read(); move on to the next file
+        /// when the current one is done.
+        usz Ops = 0;
+        for (auto S : Img.FileSizes) Ops += usz((S + Buffer.size() - 1) / Buffer.size());
+        Add(Measure("read-seq", "bytes", Ops, [&](usz) -> std::optional<u64> {
+            for (;;) {
+                if (not F) {
+                    while (Next < Img.Files.size() and Img.FileSizes[Next] == 0) Next++;
+                    if (Next == Img.Files.size()) return {};
+                    F = D.OpenFile(Img.Files[Next++]);
+                    if (not F) return {};
+                }
+
+                auto Read = F->Read(Buffer.data(), Buffer.size());
+                if (not Read) return {};
+                if (*Read == 0) {
+                    F.reset();
+                    continue;
+                }
+
+                if (*Read < Buffer.size()) F.reset();
+                return *Read;
+            }
+        }));
+    }
+
+    /// Read blocks from random offsets in random files.
+    void RandomRead(Drive& D) {
+        if (not Enabled("read-random") or NonEmpty.empty()) return;
+        std::vector<std::unique_ptr<File>> Handles(Img.Files.size());
+        for (auto I : NonEmpty) {
+            Handles[I] = D.OpenFile(Img.Files[I]);
+            if (Handles[I]) Handles[I]->SetReadahead(0);
+        }
+
+        std::vector<u8> Buffer(C.RandomReadSize);
+        std::vector<std::pair<usz, u64>> Picks;
+        for (usz I = 0; I < C.Iterations; I++) {
+            auto F = NonEmpty[Rng.Below(NonEmpty.size())];
+            auto Chunks = (Img.FileSizes[F] + Buffer.size() - 1) / Buffer.size();
+            Picks.emplace_back(F, Rng.Below(Chunks) * Buffer.size());
+        }
+
+        Add(Measure("read-random", "bytes", Picks.size(), [&](usz I) -> std::optional<u64> {
+            auto [F, Offset] = Picks[I];
+            if (not Handles[F]) return {};
+            return Handles[F]->PRead(Offset, Buffer);
+        }));
+    }
+
+    /// Run everything, each benchmark on a freshly mounted drive.
+    bool Run() {
+        MountTime();
+        for (auto Bench : std::initializer_list<std::function<void(Drive&)>>{
+                 [&](Drive& D) { Lookup(D, true); },
+                 [&](Drive& D) { Lookup(D, false); },
+                 [&](Drive& D) { Stat(D); },
+                 [&](Drive& D) { ReadDir(D); },
+                 [&](Drive& D) { SequentialRead(D); },
+                 [&](Drive& D) { RandomRead(D); },
+             }) {
+            DropCaches();
+            auto D = Mount(C);
+            if (not D) return false;
+            Bench(*D);
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto Get() const -> const std::vector<Result>& { return Results; }
+};
+
+/// Collect the files and directories of an existing image.
+auto ScanImage(const Config& C) -> std::optional<Image> {
+    auto D = Mount(C);
+    if (not D) return {};
+
+    Image Img;
+    std::mutex Lock;
+    bool Ok = D->Walk("/", [&](std::string_view Path, InodeNumberType, const struct stat& St) {
+        std::unique_lock Guard{Lock};
+        if (S_ISDIR(St.st_mode)) Img.Directories.emplace_back(Path);
+        else if (S_ISREG(St.st_mode)) {
+            Img.Files.emplace_back(Path);
+            Img.FileSizes.push_back(u64(St.st_size));
+            Img.DataSize += u64(St.st_size);
+        }
+    });
+
+    /// The order in which Walk() visits files depends on timing.
+    std::vector<usz> Order(Img.Files.size());
+    for (usz I = 0; I < Order.size(); I++) Order[I] = I;
+    std::ranges::sort(Order, {}, [&](usz I) -> const std::string& { return Img.Files[I]; });
+    Image Sorted{{}, {}, {}, 0, Img.DataSize};
+    for (auto I : Order) {
+        Sorted.Files.push_back(std::move(Img.Files[I]));
+        Sorted.FileSizes.push_back(Img.FileSizes[I]);
+    }
+
+    /// The root comes first, followed by the other directories in order.
+    std::ranges::sort(Img.Directories);
+    Sorted.Directories.reserve(Img.Directories.size() + 1);
+    Sorted.Directories.emplace_back("/");
+    for (auto& Dir : Img.Directories) Sorted.Directories.push_back(std::move(Dir));
+
+    struct stat St;
+    if (stat(C.ImagePath.c_str(), &St) == 0) Sorted.Size = u64(St.st_size);
+    if (not Ok) Log("Some directories of the image could not be read");
+    return Sorted;
+}
+
+/// ===========================================================================
+///  Reporting.
+/// ===========================================================================
+auto FormatDuration(f64 Ns) -> std::string {
+    if (Ns < 1e3) return fmt::format("{:.0f} ns", Ns);
+    if (Ns < 1e6) return fmt::format("{:.1f} µs", Ns / 1e3);
+    if (Ns < 1e9) return fmt::format("{:.2f} ms", Ns / 1e6);
+    return fmt::format("{:.2f} s", Ns / 1e9);
+}
+
+auto FormatThroughput(const Result& R) -> std::string {
+    if (R.Unit.empty() or R.Seconds == 0) return "-";
+    auto PerSecond = f64(R.Units) / R.Seconds;
+    if (R.Unit == "bytes") return fmt::format("{:.1f} MiB/s", PerSecond / (1 << 20));
+    return fmt::format("{:.0f} {}/s", PerSecond, R.Unit);
+}
+
+auto JsonString(std::string_view Str) -> std::string {
+    std::string Out = "\"";
+    for (char Ch : Str) {
+        if (Ch == '"' or Ch == '\\') Out += '\\';
+        if (u8(Ch) < 0x20) Out += fmt::format("\\u{:04x}", u8(Ch));
+        else Out += Ch;
+    }
+    return Out + '"';
+}
+
+void PrintText(const Config& C, const Image& Img, const std::vector<Result>& Results) {
+    fmt::print("Image: {} ({:.1f} MiB, {} files, {} directories, {:.1f} MiB of data)\n", C.ImagePath, f64(Img.Size) / (1 << 20), Img.Files.size(), Img.Directories.size(), f64(Img.DataSize) / (1 << 20));
+    fmt::print("Device: {}, mounted {}{}\n\n", C.Device, C.ReadWrite ? "read-write" : "read-only", C.Cold ? ", cold page cache" : "");
+    fmt::print("{:<12} {:>8} {:>12} {:>10} {:>10} {:>16} {:>12}\n", "benchmark", "ops", "ops/s", "p50", "p99", "throughput", "syscalls/op");
+    for (auto& R : Results) {
+        fmt::print(
+            "{:<12} {:>8} {:>12.0f} {:>10} {:>10} {:>16} {:>12}{}\n",
+            R.Name,
+            R.Ops,
+            R.Seconds ? f64(R.Ops) / R.Seconds : 0,
+            FormatDuration(f64(R.Percentile(.5))),
+            FormatDuration(f64(R.Percentile(.99))),
+            FormatThroughput(R),
+            R.Syscalls ? fmt::format("{:.2f}", f64(*R.Syscalls) / f64(R.Ops)) : "-",
+            R.Failures ? fmt::format(" ({} failed)", R.Failures) : ""
+        );
+    }
+}
+
+void PrintJson(const Config& C, const Image& Img, const std::vector<Result>& Results) {
+    auto& O = C.Image;
+    fmt::print("{{\n  \"image\": {{\n");
+    fmt::print("    \"path\": {},\n", JsonString(C.ImagePath));
+    if (not C.Existing) {
+        fmt::print("    \"block_size\": {},\n    \"depth\": {},\n    \"fan_out\": {},\n    \"files_per_dir\": {},\n", O.BlockSize, O.Depth, O.FanOut, O.FilesPerDir);
+        fmt::print("    \"min_file_size\": {},\n    \"max_file_size\": {},\n    \"fragmentation\": {},\n    \"seed\": {},\n", O.MinFileSize, O.MaxFileSize, O.Fragmentation, O.Seed);
+    }
+    fmt::print("    \"size\": {},\n    \"data_size\": {},\n    \"files\": {},\n    \"directories\": {}\n  }},\n", Img.Size, Img.DataSize, Img.Files.size(), Img.Directories.size());
+    fmt::print("  \"device\": {},\n  \"read_only\": {},\n  \"cold\": {},\n", JsonString(C.Device), not C.ReadWrite, C.Cold);
+    fmt::print("  \"results\": [");
+    for (usz I = 0; I < Results.size(); I++) {
+        auto& R = Results[I];
+        fmt::print("{}\n    {{\n", I ? "," : "");
+        fmt::print("      \"name\": {},\n      \"ops\": {},\n      \"failures\": {},\n      \"seconds\": {},\n", JsonString(R.Name), R.Ops, R.Failures, R.Seconds);
+        fmt::print("      \"ops_per_sec\": {},\n", R.Seconds ? f64(R.Ops) / R.Seconds : 0);
+        fmt::print("      \"p50_ns\": {},\n      \"p99_ns\": {},\n", R.Percentile(.5), R.Percentile(.99));
+        if (not R.Unit.empty()) fmt::print("      \"unit\": {},\n      \"units\": {},\n      \"units_per_sec\": {},\n", JsonString(R.Unit), R.Units, R.Seconds ? f64(R.Units) / R.Seconds : 0);
+        if (R.Syscalls) fmt::print("      \"syscalls_per_op\": {}\n    }}", f64(*R.Syscalls) / f64(R.Ops));
+        else fmt::print("      \"syscalls_per_op\": null\n    }}");
+    }
+    fmt::print("\n  ]\n}}\n");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    Config C;
+    if (not ParseCommandLine(argc, argv, C)) return 1;
+
+    /// Generate the image in a temporary file unless told where to put it.
+    bool Temporary = C.ImagePath.empty();
+    if (Temporary) {
+        char Template[] = "/tmp/ext2++-bench-XXXXXX.img";
+        auto Fd = mkstemps(Template, 4);
+        if (Fd < 0) {
+            fmt::print(stderr, "Failed to create temporary image: {}\n", strerror(errno));
+            return 1;
+        }
+        close(Fd);
+        C.ImagePath = Template;
+    }
+
+    std::optional<Image> Img;
+    if (C.Existing) {
+        Img = ScanImage(C);
+    } else {
+        auto Start = chr::steady_clock::now();
+        Img = GenerateImage(C.ImagePath, C.Image);
+        if (Img and not C.Json) fmt::print("Generated image in {:.2f} s\n", chr::duration<f64>(chr::steady_clock::now() - Start).count());
+    }
+
+    int Status = 1;
+    if (Img) {
+        Suite S{C, *Img};
+        if (S.Run()) {
+            if (C.Json) PrintJson(C, *Img, S.Get());
+            else PrintText(C, *Img, S.Get());
+            Status = 0;
+        }
+    }
+
+    if (Temporary) unlink(C.ImagePath.c_str());
+    return Status;
+}
@@ -0,0 +1,409 @@
+#include "image.hh"
+
+#include <bit>
+#include <ext2++/core.hh>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Ext2::Bench {
+namespace {
+constexpr u32 ROOT_INODE_NUMBER = 2;
+constexpr u32 FIRST_INODE_NUMBER = 11;
+constexpr u16 INODE_SIZE = 128;
+constexpr u16 SUPERBLOCK_OFFSET = 1024;
+constexpr u16 MAGIC = 0xEF53;
+constexpr u32 DIRECT_BLOCK_COUNT = 12;
+constexpr u32 SECTOR_SIZE = 512;
+
+/// All timestamps in the image, so that it doesn’t depend on when it
+/// was generated.
+constexpr u32 TIMESTAMP = 1'700'000'000;
+
+/// File types in directory entries.
+constexpr u8 ENTRY_TYPE_FILE = 1;
+constexpr u8 ENTRY_TYPE_DIRECTORY = 2;
+
+/// Size of the runs in which file data is written.
+constexpr usz WRITE_CHUNK_SIZE = 1 << 20;
+
+static_assert(sizeof(Inode) == INODE_SIZE);
+static_assert(sizeof(BlockGroupDescriptor) == 32);
+
+/// A file or directory in the generated tree.
+struct Node {
+    std::string Path;
+    std::string Name;
+    usz Parent;
+    u32 Depth;
+    InodeNumberType InodeNumber;
+    bool IsDirectory;
+
+    /// Contents of a directory.
+    std::vector<usz> Children;
+    std::vector<u8> Entries;
+
+    Inode I{};
+};
+
+/// Check whether a group has a backup of the superblock.
+bool GroupHasSuperblock(u32 Group) {
+    if (Group <= 1) return true;
+    for (u32 Base : {3u, 5u, 7u}) {
+        u64 N = Base;
+        while (N < Group) N *= Base;
+        if (N == Group) return true;
+    }
+    return false;
+}
+
+/// Lay out the entries of a directory in blocks. The last entry in
+/// each block extends to the end of the block.
+void BuildEntries(Node& D, const std::vector<Node>& Nodes, const Node& Parent, u32 BlockSize) {
+    usz Pos = 0, Last = 0;
+    auto SetRecLen = [&](usz Offset, usz Len) {
+        auto RecLen = u16(Len);
+        std::memcpy(D.Entries.data() + Offset + offsetof(LinkedDirEntryHeader, rec_len), &RecLen, sizeof RecLen);
+    };
+
+    auto Add = [&](InodeNumberType INum, std::string_view Name, u8 Type) {
+        usz Len = (sizeof(LinkedDirEntryHeader) + Name.size() + 3) & ~usz(3);
+        if (Pos + Len > D.Entries.size()) {
+            if (not D.Entries.empty()) SetRecLen(Last, D.Entries.size() - Last);
+            Pos = D.Entries.size();
+            D.Entries.resize(D.Entries.size() + BlockSize);
+        }
+
+        LinkedDirEntryHeader Hdr{INum, u16(Len), u8(Name.size()), Type};
+        std::memcpy(D.Entries.data() + Pos, &Hdr, sizeof Hdr);
+        std::memcpy(D.Entries.data() + Pos + sizeof Hdr, Name.data(), Name.size());
+        Last = Pos;
+        Pos += Len;
+    };
+
+    Add(D.InodeNumber, ".", ENTRY_TYPE_DIRECTORY);
+    Add(Parent.InodeNumber, "..", ENTRY_TYPE_DIRECTORY);
+    for (auto C : D.Children) {
+        auto& Child = Nodes[C];
+        Add(Child.InodeNumber, Child.Name, Child.IsDirectory ? ENTRY_TYPE_DIRECTORY : ENTRY_TYPE_FILE);
+    }
+    SetRecLen(Last, D.Entries.size() - Last);
+}
+
+/// Number of indirect blocks needed to map a number of blocks.
+auto IndirectBlocks(u64 Blocks, u64 PerBlock) -> u64 {
+    if (Blocks <= DIRECT_BLOCK_COUNT) return 0;
+    Blocks -= DIRECT_BLOCK_COUNT;
+    u64 Count = 1;
+    if (Blocks <= PerBlock) return Count;
+    Blocks -= PerBlock;
+    Count += 1 + (std::min(Blocks, PerBlock * PerBlock) + PerBlock - 1) / PerBlock;
+    if (Blocks <= PerBlock * PerBlock) return Count;
+    Blocks -= PerBlock * PerBlock;
+    return Count + 1 + (Blocks + PerBlock * PerBlock - 1) / (PerBlock * PerBlock) + (Blocks + PerBlock - 1) / PerBlock;
+}
+} // namespace
+
+auto GenerateImage(const std::string& Path, const ImageOptions& Options) -> std::optional<Image> {
+    const u32 BlockSize = Options.BlockSize;
+    if (BlockSize != 1024 and BlockSize != 2048 and BlockSize != 4096) {
+        Log("Unsupported block size {}", BlockSize);
+        return {};
+    }
+
+    if (Options.MinFileSize > Options.MaxFileSize) {
+        Log("Minimum file size {} is larger than maximum file size {}", Options.MinFileSize, Options.MaxFileSize);
+        return {};
+    }
+
+    Random Rng{Options.Seed};
+    auto FileSize = [&] {
+        /// Pick the number of bits first, then a size with that many bits.
+        auto Lo = u64(std::bit_width(Options.MinFileSize)), Hi = u64(std::bit_width(Options.MaxFileSize));
+        auto Bits = Lo + Rng.Below(Hi - Lo + 1);
+        u64 From = Bits ? u64(1) << (Bits - 1) : 0;
+        u64 To = Bits == 64 ? ~u64(0) : (u64(1) << Bits) - 1;
+        From = std::max(From, Options.MinFileSize);
+        To = std::min(To, Options.MaxFileSize);
+        return From + Rng.Below(To - From + 1);
+    };
+
+    /// Build the tree breadth-first, numbering inodes as we go, so that
+    /// the entries of a directory have consecutive inode numbers.
+    static constexpr std::string_view Extensions[]{"txt", "bin", "dat", "log"};
+    std::vector<Node> Nodes;
+    InodeNumberType NextInode = FIRST_INODE_NUMBER;
+    Nodes.push_back({"/", "", 0, 0, ROOT_INODE_NUMBER, true, {}, {}, {}});
+    Nodes.push_back({"/lost+found", "lost+found", 0, 0, NextInode++, true, {}, {}, {}});
+    Nodes[0].Children.push_back(1);
+    for (usz N = 0; N < Nodes.size(); N++) {
+        if (not Nodes[N].IsDirectory or N == 1) continue;
+        auto Prefix = N == 0 ? std::string{} : Nodes[N].Path;
+        auto Add = [&](std::string Name, bool IsDirectory) {
+            auto Depth = Nodes[N].Depth + 1;
+            Nodes[N].Children.push_back(Nodes.size());
+            Nodes.push_back({Prefix + "/" + Name, Name, N, Depth, NextInode++, IsDirectory, {}, {}, {}});
+        };
+
+        if (Nodes[N].Depth < Options.Depth)
+            for (u32 J = 0; J < Options.FanOut; J++) Add(fmt::format("dir{:03}", J), true);
+        for (u32 J = 0; J < Options.FilesPerDir; J++)
+            Add(fmt::format("file{:04}.{}", J, Extensions[Rng.Below(std::size(Extensions))]), false);
+    }
+
+    /// Sizes of files and directories.
+    Image Result;
+    std::vector<u64> Sizes(Nodes.size());
+    u64 NeededBlocks = 0;
+    const u64 PerBlock = BlockSize / sizeof(u32);
+    for (usz N = 0; N < Nodes.size(); N++) {
+        auto& Nd = Nodes[N];
+        if (Nd.IsDirectory) {
+            BuildEntries(Nd, Nodes, Nodes[Nd.Parent], BlockSize);
+            Sizes[N] = Nd.Entries.size();
+            Result.Directories.push_back(Nd.Path);
+        } else {
+            Sizes[N] = FileSize();
+            Result.Files.push_back(Nd.Path);
+            Result.FileSizes.push_back(Sizes[N]);
+            Result.DataSize += Sizes[N];
+        }
+
+        u64 Blocks = (Sizes[N] + BlockSize - 1) / BlockSize;
+        NeededBlocks += Blocks + IndirectBlocks(Blocks, PerBlock);
+    }
+
+    /// Pick the smallest number of block groups that leaves a quarter
+    /// of the data blocks free, so that fragmented files have room to
+    /// spread out.
+    const u64 BlocksPerGroup = u64(BlockSize) * 8;
+    const u32 FirstDataBlock = BlockSize == 1024 ? 1 : 0;
+    const u64 InodesNeeded = NextInode - 1 + (NextInode - 1) / 8;
+    const u64 InodesPerBlock = BlockSize / INODE_SIZE;
+    u64 Groups = 1, InodesPerGroup, TableBlocks, DescriptorBlocks;
+    for (;; Groups++) {
+        /// The reserved inodes must all be in the first group.
+        InodesPerGroup = std::max<u64>((InodesNeeded + Groups - 1) / Groups, FIRST_INODE_NUMBER);
+        InodesPerGroup = (InodesPerGroup + InodesPerBlock - 1) / InodesPerBlock * InodesPerBlock;
+        if (InodesPerGroup > BlocksPerGroup) continue;
+        TableBlocks = InodesPerGroup / InodesPerBlock;
+        DescriptorBlocks = (Groups * sizeof(BlockGroupDescriptor) + BlockSize - 1) / BlockSize;
+        u64 Metadata = 0;
+        for (u32 G = 0; G < Groups; G++) Metadata += (GroupHasSuperblock(G) ? 1 + DescriptorBlocks : 0) + 2 + TableBlocks;
+        if (Groups * BlocksPerGroup - Metadata >= NeededBlocks + NeededBlocks / 4 + 16) break;
+    }
+
+    const u64 TotalBlocks = FirstDataBlock + Groups * BlocksPerGroup;
+    if (TotalBlocks > std::numeric_limits<u32>::max()) {
+        Log("Image would have too many blocks: {}", TotalBlocks);
+        return {};
+    }
+
+    /// Reserve the metadata of each group.
+    std::vector<u8> Used(TotalBlocks);
+    std::vector<BlockGroupDescriptor> Descriptors(Groups);
+    for (u32 G = 0; G < Groups; G++) {
+        u64 Block = FirstDataBlock + G * BlocksPerGroup;
+        if (GroupHasSuperblock(G)) Block += 1 + DescriptorBlocks;
+        auto& Desc = Descriptors[G];
+        Desc.bg_block_bitmap = u32(Block);
+        Desc.bg_inode_bitmap = u32(Block + 1);
+        Desc.bg_inode_table = u32(Block + 2);
+        std::fill(Used.begin() + isz(FirstDataBlock + G * BlocksPerGroup), Used.begin() + isz(Block + 2 + TableBlocks), 1);
+    }
+
+    /// Allocate the blocks of every inode, the indirect blocks just
+    /// before the data they map, as ext2 would.
+    std::unordered_map<u64, std::vector<u32>> Tables;
+    u64 Cursor = FirstDataBlock;
+    auto Allocate = [&] -> u32 {
+        if (Options.Fragmentation > 0 and Rng.Fraction() < Options.Fragmentation)
+            Cursor = FirstDataBlock + Rng.Below(TotalBlocks - FirstDataBlock);
+        while (Used[Cursor]) Cursor = Cursor + 1 == TotalBlocks ? FirstDataBlock : Cursor + 1;
+        Used[Cursor] = 1;
+        return u32(Cursor);
+    };
+
+    auto Table = [&](u32& Ptr) -> std::vector<u32>& {
+        if (not Ptr) {
+            Ptr = Allocate();
+            Tables[Ptr].resize(PerBlock);
+        }
+        return Tables[Ptr];
+    };
+
+    std::vector<std::vector<u32>> Physical(Nodes.size());
+    for (usz N = 0; N < Nodes.size(); N++) {
+        auto& I = Nodes[N].I;
+        u64 Blocks = (Sizes[N] + BlockSize - 1) / BlockSize;
+        for (u64 L = 0; L < Blocks; L++) {
+            u32* Slot;
+            if (L < DIRECT_BLOCK_COUNT) {
+                Slot = &I.i_block[L];
+            } else if (u64 K = L - DIRECT_BLOCK_COUNT; K < PerBlock) {
+                Slot = &Table(I.i_block[12])[K];
+            } else if (K -= PerBlock; K < PerBlock * PerBlock) {
+                Slot = &Table(Table(I.i_block[13])[K / PerBlock])[K % PerBlock];
+            } else {
+                K -= PerBlock * PerBlock;
+                auto& Middle = Table(Table(I.i_block[14])[K / (PerBlock * PerBlock)]);
+                Slot = &Table(Middle[K / PerBlock % PerBlock])[K % PerBlock];
+            }
+
+            *Slot = Allocate();
+            Physical[N].push_back(*Slot);
+        }
+
+        I.i_blocks = u32((Blocks + IndirectBlocks(Blocks, PerBlock)) * (BlockSize / SECTOR_SIZE));
+    }
+
+    /// Fill in the inodes.
+    bool LargeFile = false;
+    for (usz N = 0; N < Nodes.size(); N++) {
+        auto& Nd = Nodes[N];
+        auto& I = Nd.I;
+        I.i_mode = Nd.IsDirectory ? u16(Inode::Directory | 0755) : u16(Inode::RegularFile | 0644);
+        I.i_atime = I.i_ctime = I.i_mtime = TIMESTAMP;
+        I.i_links_count = 1;
+        if (Nd.IsDirectory) {
+            I.i_links_count = 2;
+            for (auto C : Nd.Children) I.i_links_count = u16(I.i_links_count + Nodes[C].IsDirectory);
+        }
+        I.SetSize(Sizes[N]);
+        LargeFile |= Sizes[N] > u64(std::numeric_limits<i32>::max());
+    }
+
+    /// Write everything out.
+    auto Fd = open(Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (Fd < 0) {
+        Log("Failed to create {}: {}", Path, strerror(errno));
+        return {};
+    }
+
+    bool Ok = ftruncate(Fd, off_t(TotalBlocks * BlockSize)) == 0;
+    auto Put = [&](u64 Offset, const void* Data, usz Size) {
+        auto Ptr = static_cast<const u8*>(Data);
+        while (Ok and Size) {
+            auto Written = pwrite(Fd, Ptr, Size, off_t(Offset));
+            if (Written <= 0) {
+                Ok = false;
+                break;
+            }
+            Ptr += Written;
+            Offset += u64(Written);
+            Size -= usz(Written);
+        }
+    };
+
+    /// File and directory data, in runs of physically consecutive blocks.
+    std::vector<u8> Run;
+    for (usz N = 0; N < Nodes.size() and Ok; N++) {
+        auto& Nd = Nodes[N];
+        auto& Blocks = Physical[N];
+        for (usz L = 0; L < Blocks.size();) {
+            usz Count = 1;
+            while (L + Count < Blocks.size() and Blocks[L + Count] == Blocks[L] + Count and Count * BlockSize < WRITE_CHUNK_SIZE) Count++;
+            Run.assign(Count * BlockSize, 0);
+            for (usz J = 0; J < Count; J++) {
+                u64 Offset = (L + J) * BlockSize;
+                usz Len = usz(std::min<u64>(BlockSize, Sizes[N] - Offset));
+                if (Nd.IsDirectory) std::memcpy(Run.data() + J * BlockSize, Nd.Entries.data() + Offset, Len);
+                else std::memset(Run.data() + J * BlockSize, u8(Nd.InodeNumber * 131 + L + J), Len);
+            }
+            Put(u64(Blocks[L]) * BlockSize, Run.data(), Run.size());
+            L += Count;
+        }
+    }
+
+    for (auto& [Block, Entries] : Tables) Put(Block * BlockSize, Entries.data(), BlockSize);
+
+    /// Inode tables and bitmaps.
+    std::vector<Inode> InodeTable(InodesPerGroup);
+    std::vector<u8> Bitmap(BlockSize);
+    u64 FreeBlocks = 0, FreeInodes = 0;
+    for (u32 G = 0; G < Groups and Ok; G++) {
+        auto& Desc = Descriptors[G];
+        std::ranges::fill(InodeTable, Inode{});
+        std::ranges::fill(Bitmap, 0);
+        auto MarkUsed = [&](u64 Bit) { Bitmap[Bit / 8] = u8(Bitmap[Bit / 8] | 1 << (Bit % 8)); };
+
+        /// Reserved inodes are all in the first group.
+        u64 UsedInodes = 0;
+        if (G == 0) {
+            for (u64 J = 0; J < FIRST_INODE_NUMBER - 1; J++) MarkUsed(J);
+            UsedInodes = FIRST_INODE_NUMBER - 1;
+        }
+
+        for (auto& Nd : Nodes) {
+            u64 Index = Nd.InodeNumber - 1;
+            if (Index / InodesPerGroup != G) continue;
+            InodeTable[Index % InodesPerGroup] = Nd.I;
+            MarkUsed(Index % InodesPerGroup);
+            if (Nd.InodeNumber != ROOT_INODE_NUMBER) UsedInodes++;
+            if (Nd.IsDirectory) Desc.bg_used_dirs_count++;
+        }
+
+        for (u64 J = InodesPerGroup; J < u64(BlockSize) * 8; J++) MarkUsed(J);
+        Put(u64(Desc.bg_inode_bitmap) * BlockSize, Bitmap.data(), BlockSize);
+        Put(u64(Desc.bg_inode_table) * BlockSize, InodeTable.data(), InodeTable.size() * sizeof(Inode));
+
+        std::ranges::fill(Bitmap, 0);
+        u64 UsedBlocks = 0;
+        for (u64 J = 0; J < BlocksPerGroup; J++) {
+            if (not Used[FirstDataBlock + G * BlocksPerGroup + J]) continue;
+            MarkUsed(J);
+            UsedBlocks++;
+        }
+        Put(u64(Desc.bg_block_bitmap) * BlockSize, Bitmap.data(), BlockSize);
+
+        Desc.bg_free_blocks_count = u16(BlocksPerGroup - UsedBlocks);
+        Desc.bg_free_inodes_count = u16(InodesPerGroup - UsedInodes);
+        FreeBlocks += Desc.bg_free_blocks_count;
+        FreeInodes += Desc.bg_free_inodes_count;
+    }
+
+    /// The superblock and its backups, each followed by the descriptor table.
+    Superblock Sb{};
+    Sb.s_inodes_count = u32(Groups * InodesPerGroup);
+    Sb.s_blocks_count = u32(TotalBlocks);
+    Sb.s_free_blocks_count = u32(FreeBlocks);
+    Sb.s_free_inodes_count = u32(FreeInodes);
+    Sb.s_first_data_block = FirstDataBlock;
+    Sb.s_log_block_size = u32(std::countr_zero(BlockSize) - 10);
+    Sb.s_log_frag_size = Sb.s_log_block_size;
+    Sb.s_blocks_per_group = u32(BlocksPerGroup);
+    Sb.s_frags_per_group = u32(BlocksPerGroup);
+    Sb.s_inodes_per_group = u32(InodesPerGroup);
+    Sb.s_wtime = TIMESTAMP;
+    Sb.s_max_mnt_count = std::numeric_limits<u16>::max();
+    Sb.s_magic = MAGIC;
+    Sb.s_state = FsState::Valid;
+    Sb.s_errors = ErrorHandling::Ignore;
+    Sb.s_lastcheck = TIMESTAMP;
+    Sb.s_creator_os = CreatorOS::Linux;
+    Sb.s_rev_level = RevisionLevel::DynamicRev;
+    Sb.s_first_ino = FIRST_INODE_NUMBER;
+    Sb.s_inode_size = INODE_SIZE;
+    Sb.s_feature_incompat = u32(IncompatFeature::FileType);
+    Sb.s_feature_ro_compat = u32(RoFeature::SparseSuper) | (LargeFile ? u32(RoFeature::LargeFile) : 0);
+    for (auto& B : Sb.s_uuid) B = u8(Rng());
+    std::memcpy(Sb.s_volume_name, "ext2++-bench", sizeof "ext2++-bench");
+
+    for (u32 G = 0; G < Groups and Ok; G++) {
+        if (not GroupHasSuperblock(G)) continue;
+        u64 Block = FirstDataBlock + G * BlocksPerGroup;
+        Sb.s_block_group_nr = u16(G);
+        Put(G == 0 ? SUPERBLOCK_OFFSET : Block * BlockSize, &Sb, sizeof Sb);
+        Put((Block + 1) * BlockSize, Descriptors.data(), Descriptors.size() * sizeof(BlockGroupDescriptor));
+    }
+
+    if (Ok) Ok = fsync(Fd) == 0;
+    close(Fd);
+    if (not Ok) {
+        Log("Failed to write {}: {}", Path, strerror(errno));
+        return {};
+    }
+
+    Result.Size = TotalBlocks * BlockSize;
+    return Result;
+}
+} // namespace Ext2::Bench
@@ -0,0 +1,75 @@
+#ifndef EXT2_BENCH_IMAGE_HH
+#define EXT2_BENCH_IMAGE_HH
+
+#include <ext2++/bits/utils.hh>
+#include <string>
+
+namespace Ext2::Bench {
+/// SplitMix64. Unlike the standard distributions, this produces
+/// the same sequence with every standard library.
+class Random {
+    u64 State;
+
+public:
+    explicit Random(u64 Seed) : State(Seed) {}
+
+    auto operator()() -> u64 {
+        u64 Z = (State += 0x9E37'79B9'7F4A'7C15);
+        Z = (Z ^ (Z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+        Z = (Z ^ (Z >> 27)) * 0x94D0'49BB'1331'11EB;
+        return Z ^ (Z >> 31);
+    }
+
+    /// Uniform in [0, N).
+    auto Below(u64 N) -> u64 { return N ? (*this)() % N : 0; }
+
+    /// Uniform in [0, 1).
+    auto Fraction() -> f64 { return f64((*this)() >> 11) * 0x1p-53; }
+};
+
+/// Parameters of a generated image. The same parameters always
+/// produce the same image, byte for byte.
+struct ImageOptions {
+    /// Block size in bytes: 1024, 2048, or 4096.
+    u32 BlockSize = 4096;
+
+    /// Levels of directories below the root, and the number of
+    /// subdirectories and files in every directory.
+    u32 Depth = 3;
+    u32 FanOut = 6;
+    u32 FilesPerDir = 16;
+
+    /// File sizes are distributed log-uniformly between these, so
+    /// there are about as many files of 1–2 KiB as of 1–2 MiB.
+    u64 MinFileSize = 0;
+    u64 MaxFileSize = 256 * 1024;
+
+    /// Probability that a block is not allocated right after the
+    /// previous block of the same file but somewhere random instead.
+    f64 Fragmentation = 0;
+
+    /// Seed for file sizes, names, and block placement.
+    u64 Seed = 1;
+};
+
+/// What a generated image contains.
+struct Image {
+    /// Absolute paths of all regular files and their sizes.
+    std::vector<std::string> Files;
+    std::vector<u64> FileSizes;
+
+    /// Absolute paths of all directories, including the root.
+    std::vector<std::string> Directories;
+
+    /// Size of the image in bytes, and bytes of file data.
+    u64 Size{};
+    u64 DataSize{};
+};
+
+/// Write an ext2 image with a directory tree as described by the
+/// options. File contents are a pattern derived from the inode number
+/// and offset. Returns nothing if the image could not be written.
+auto GenerateImage(const std::string& Path, const ImageOptions& Options) -> std::optional<Image>;
+} // namespace Ext2::Bench
+
+#endif // EXT2_BENCH_IMAGE_HH
@@ -0,0 +1,53 @@
+#ifndef EXT2_BITMAP_HH
+#define EXT2_BITMAP_HH
+
+#include <ext2++/bits/utils.hh>
+
+namespace Ext2 {
+/// Operations on block and inode bitmaps. Bit i of a bitmap is bit
+/// i % 8 of byte i / 8, and a set bit means that the block or inode
+/// is in use. Ranges are half-open and must lie within the bitmap.
+///
+/// The byte-aligned middle of every range is processed with AVX2 or
+/// NEON if the CPU supports it and with 64-bit words otherwise; the
+/// implementation is selected once, at runtime.
+
+/// Count the set bits in [First, End).
+[[nodiscard]] auto BitmapCount(std::span<const u8> Bits, u64 First, u64 End) -> u64;
+
+/// Find the first clear bit in [First, End). Returns End if all are set.
+[[nodiscard]] auto BitmapFindClear(std::span<const u8> Bits, u64 First, u64 End) -> u64;
+
+/// Find the first set bit in [First, End). Returns End if none is set.
+[[nodiscard]] auto BitmapFindSet(std::span<const u8> Bits, u64 First, u64 End) -> u64;
+
+/// Find the first run of at least Length clear bits in [First, End).
+/// Returns End if there is none.
+[[nodiscard]] auto BitmapFindClearRun(std::span<const u8> Bits, u64 First, u64 End, u64 Length) -> u64;
+
+/// Set or clear all bits in [First, End).
+void BitmapFill(std::span<u8> Bits, u64 First, u64 End, bool Value);
+
+/// Get the name of the implementation in use: avx2, neon, or scalar.
+[[nodiscard]] auto BitmapImplementation() -> std::string_view;
+
+namespace detail {
+/// Operations on whole bytes that the bit operations are built on.
+struct BitmapKernels {
+    std::string_view Name;
+
+    /// Count the set bits in N bytes.
+    u64 (*Popcount)(const u8* Data, usz N);
+
+    /// Find the first of N bytes that is not equal to Byte. Returns N
+    /// if they all are.
+    usz (*FindNotByte)(const u8* Data, usz N, u8 Byte);
+};
+
+/// Get the implementations that this CPU supports. The first is the
+/// scalar one and the last is the one in use; tests compare them.
+[[nodiscard]] auto AvailableBitmapKernels() -> std::span<const BitmapKernels* const>;
+} // namespace detail
+} // namespace Ext2
+
+#endif // EXT2_BITMAP_HH
@@ -0,0 +1,23 @@
+#ifndef EXT2_HASH_HH
+#define EXT2_HASH_HH
+
+#include <ext2++/bits/utils.hh>
+
+namespace Ext2 {
+/// Hash functions used by indexed (HTree) directories.
+enum struct HashVersion : u8 {
+    Legacy = 0,
+    HalfMD4 = 1,
+    Tea = 2,
+    LegacyUnsigned = 3,
+    HalfMD4Unsigned = 4,
+    TeaUnsigned = 5,
+};
+
+/// Compute the hash of a directory entry name as it is stored in the
+/// index. If the seed is all zeroes, the default seed is used. Returns
+/// nothing if the hash version is not supported.
+auto DirHash(std::string_view Name, HashVersion Version, const u32 (&Seed)[4]) -> std::optional<u32>;
+} // namespace Ext2
+
+#endif // EXT2_HASH_HH
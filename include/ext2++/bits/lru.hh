@@ -0,0 +1,95 @@
+#ifndef EXT2_LRU_HH
+#define EXT2_LRU_HH
+
+#include <ext2++/bits/utils.hh>
+#include <list>
+
+namespace Ext2 {
+/// Map with a fixed capacity that evicts the least recently used
+/// entry when it is full. This is not thread-safe.
+///
+/// If Hash and KeyEqual are transparent, Get() also accepts other types
+/// of keys that they can compare, so that looking up doesn’t require
+/// constructing a Key.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class LruMap {
+    using Entry = std::pair<Key, Value>;
+
+    std::list<Entry> Entries;
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash, KeyEqual> Index;
+    usz Capacity;
+
+public:
+    explicit LruMap(usz Capacity_) : Capacity(Capacity_) {}
+
+    /// Remove all entries.
+    void Clear() {
+        Entries.clear();
+        Index.clear();
+    }
+
+    /// Remove an entry.
+    void Erase(const Key& K) {
+        if (auto It = Index.find(K); It != Index.end()) {
+            Entries.erase(It->second);
+            Index.erase(It);
+        }
+    }
+
+    /// Remove all entries for which a predicate returns true.
+    template <typename Predicate>
+    void EraseIf(Predicate P) {
+        for (auto It = Entries.begin(); It != Entries.end();) {
+            if (P(It->first, It->second)) {
+                Index.erase(It->first);
+                It = Entries.erase(It);
+            } else {
+                ++It;
+            }
+        }
+    }
+
+    /// Look up an entry and mark it as recently used.
+    template <typename Lookup = Key>
+    auto Get(const Lookup& K) -> Value* {
+        auto It = Index.find(K);
+        if (It == Index.end()) return nullptr;
+        Entries.splice(Entries.begin(), Entries, It->second);
+        return &It->second->second;
+    }
+
+    /// Insert or replace an entry. If the map is full, entries are evicted
+    /// starting with the least recently used one for which CanEvict returns
+    /// true. If none can be evicted, the map grows past its capacity. With a
+    /// capacity of 0, only entries that can’t be evicted are kept; others
+    /// are not inserted, and nullptr is returned.
+    template <typename Predicate>
+    auto Put(Key K, Value V, Predicate CanEvict) -> Value* {
+        if (auto Existing = Get(K)) {
+            *Existing = std::move(V);
+            return Existing;
+        }
+
+        if (Capacity == 0 and CanEvict(K, V)) return nullptr;
+        for (auto It = Entries.end(); Index.size() >= Capacity and It != Entries.begin();) {
+            --It;
+            if (not CanEvict(It->first, It->second)) continue;
+            Index.erase(It->first);
+            It = Entries.erase(It);
+        }
+
+        Entries.emplace_front(std::move(K), std::move(V));
+        Index.emplace(Entries.front().first, Entries.begin());
+        return &Entries.front().second;
+    }
+
+    auto Put(Key K, Value V) -> Value* {
+        return Put(std::move(K), std::move(V), [](const Key&, const Value&) { return true; });
+    }
+
+    /// Get the number of entries.
+    [[nodiscard]] auto Size() const -> usz { return Index.size(); }
+};
+} // namespace Ext2
+
+#endif // EXT2_LRU_HH
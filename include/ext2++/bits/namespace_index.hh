@@ -0,0 +1,152 @@
+#ifndef EXT2_NAMESPACE_INDEX_HH
+#define EXT2_NAMESPACE_INDEX_HH
+
+#include <ext2++/bits/utils.hh>
+#include <string>
+
+namespace Ext2 {
+/// Identifies the state of a drive that a namespace index describes.
+/// Anything that mounts the drive for writing changes the mount count
+/// or the write time, so an index is only used if all of these match.
+struct NamespaceIndexKey {
+    std::array<u8, 16> Uuid{};
+    u32 WriteTime{};
+    u32 MountCount{};
+    u32 BlockSize{};
+
+    bool operator==(const NamespaceIndexKey&) const = default;
+};
+
+/// Header of a namespace index file. All offsets are in bytes from the
+/// start of the file, all counts in records, and everything is stored
+/// in native byte order so the file can be used as mapped.
+struct NamespaceIndexHeader {
+    std::array<char, 8> Magic;
+    u32 Version;
+    u32 Reserved;
+    NamespaceIndexKey Key;
+    u32 KeyPad;
+    u64 EntryCount;
+    u64 EntriesOffset;
+    u64 InodeCount;
+    u64 InodesOffset;
+    u64 ExtentCount;
+    u64 ExtentsOffset;
+    u64 MetadataCount;
+    u64 MetadataOffset;
+    u64 StringsSize;
+    u64 StringsOffset;
+};
+
+/// A path and what it refers to. Entries are sorted by path, which is
+/// absolute and has no trailing or repeated slashes.
+struct NamespaceIndexEntry {
+    u64 PathOffset;
+    u32 PathSize;
+    u32 InodeNumber;
+
+    /// The file format bits of the mode of the inode.
+    u16 Format;
+    u16 Pad[3];
+};
+
+/// The block map of an inode and the inode fields it was built from.
+/// Inodes are sorted by number.
+struct NamespaceIndexInode {
+    u32 InodeNumber;
+    u32 Sectors;
+    u64 Size;
+    std::array<u32, 15> Blocks;
+    u32 Pad;
+    u64 FirstExtent;
+    u64 ExtentCount;
+    u64 FirstMetadata;
+    u64 MetadataCount;
+};
+
+/// A run of blocks of an inode, as in a BlockMap.
+struct NamespaceIndexExtent {
+    u64 Logical;
+    u64 Physical;
+    u64 Length;
+};
+
+/// A namespace index that has been mapped into memory. This is a sidecar
+/// file that records every path on a drive along with the block maps of
+/// its files and directories, so that a process can resolve paths and
+/// read files without first scanning directories and indirect blocks.
+class NamespaceIndex {
+    const u8* Base;
+    usz Length;
+    const NamespaceIndexHeader* Header;
+
+    NamespaceIndex(const u8* Base_, usz Length_)
+        : Base(Base_),
+          Length(Length_),
+          Header(reinterpret_cast<const NamespaceIndexHeader*>(Base_)) {}
+
+    /// Get a section of the file.
+    template <typename T>
+    [[nodiscard]] auto Section(u64 Offset, u64 Count) const -> std::span<const T> {
+        return {reinterpret_cast<const T*>(Base + Offset), usz(Count)};
+    }
+
+    /// Get the path of an entry.
+    [[nodiscard]] auto PathOf(const NamespaceIndexEntry& E) const -> std::string_view {
+        return {reinterpret_cast<const char*>(Base + Header->StringsOffset + E.PathOffset), E.PathSize};
+    }
+
+    /// Check that everything in the file is in bounds and sorted.
+    [[nodiscard]] bool Validate() const;
+
+public:
+    /// Collects the contents of an index and writes it to a file.
+    class Builder {
+        std::string Strings;
+        std::vector<NamespaceIndexEntry> Entries;
+        std::vector<NamespaceIndexInode> Inodes;
+        std::vector<NamespaceIndexExtent> Extents;
+        std::vector<u64> Metadata;
+
+    public:
+        /// Add a path, which must be in the form described above.
+        void AddPath(std::string_view Path, u32 InodeNumber, u16 Format);
+
+        /// Add the block map of an inode. Each inode may be added once.
+        void AddInode(
+            u32 InodeNumber,
+            u32 Sectors,
+            u64 Size,
+            const std::array<u32, 15>& Blocks,
+            std::span<const NamespaceIndexExtent> InodeExtents,
+            std::span<const u64> InodeMetadata
+        );
+
+        /// Write the index to a file, replacing it atomically.
+        bool Write(std::string_view Path, const NamespaceIndexKey& Key);
+    };
+
+    NamespaceIndex(const NamespaceIndex&) = delete;
+    NamespaceIndex& operator=(const NamespaceIndex&) = delete;
+    ~NamespaceIndex();
+
+    /// Map an index file. Returns nullptr if it can’t be read, is
+    /// malformed, or doesn’t match the key.
+    static auto Open(std::string_view Path, const NamespaceIndexKey& Key) -> std::unique_ptr<NamespaceIndex>;
+
+    /// Find the entry of a path.
+    [[nodiscard]] auto Find(std::string_view Path) const -> const NamespaceIndexEntry*;
+
+    /// Find the block map of an inode.
+    [[nodiscard]] auto FindInode(u32 InodeNumber) const -> const NamespaceIndexInode*;
+
+    /// Get the extents and indirect blocks of an inode.
+    [[nodiscard]] auto Extents(const NamespaceIndexInode& I) const -> std::span<const NamespaceIndexExtent>;
+    [[nodiscard]] auto Metadata(const NamespaceIndexInode& I) const -> std::span<const u64>;
+
+    /// Number of paths in the index.
+    [[nodiscard]] auto Size() const -> usz { return usz(Header->EntryCount); }
+};
+} // namespace Ext2
+
+#endif // EXT2_NAMESPACE_INDEX_HH
@@ -0,0 +1,152 @@
+#ifndef EXT2_STATS_HH
+#define EXT2_STATS_HH
+
+#include <atomic>
+#include <chrono>
+#include <ext2++/bits/utils.hh>
+#include <functional>
+#include <utility>
+
+namespace Ext2 {
+/// What a device request or cache lookup is for. Reads are attributed
+/// to whatever the thread that performs them is working on (see IoScope);
+/// writes are always counted as Write.
+enum struct IoKind : u8 {
+    /// Inode tables.
+    Inode,
+
+    /// The block group descriptor table.
+    Descriptor,
+
+    /// Directory blocks.
+    Directory,
+
+    /// File data.
+    Data,
+
+    /// Everything else: the superblock, bitmaps, and indirect blocks.
+    Metadata,
+
+    /// Writes of any kind.
+    Write,
+};
+
+constexpr inline usz IO_KIND_COUNT = 6;
+
+/// Get the name of a kind of I/O.
+auto IoKindName(IoKind K) -> std::string_view;
+
+/// Set the kind of I/O that the current thread performs until this
+/// is destroyed. Scopes nest; the outermost kind is Metadata.
+class IoScope {
+    static inline thread_local IoKind CurrentKind = IoKind::Metadata;
+    IoKind Saved;
+
+public:
+    explicit IoScope(IoKind K) : Saved(std::exchange(CurrentKind, K)) {}
+    ~IoScope() { CurrentKind = Saved; }
+    IoScope(const IoScope&) = delete;
+    IoScope& operator=(const IoScope&) = delete;
+
+    /// Get the kind of I/O the current thread performs.
+    [[nodiscard]] static auto Current() -> IoKind { return CurrentKind; }
+};
+
+/// Histogram of latencies with power-of-two buckets. Bucket i counts
+/// latencies of at least 2^i and less than 2^(i+1) nanoseconds; the
+/// first bucket also counts anything shorter and the last anything longer.
+struct LatencyHistogram {
+    static constexpr usz BUCKETS = 40;
+    std::array<u64, BUCKETS> Buckets{};
+
+    /// Get the bucket that a latency falls into.
+    [[nodiscard]] static auto Bucket(std::chrono::nanoseconds Latency) -> usz;
+
+    /// Number of latencies in the histogram.
+    [[nodiscard]] auto Count() const -> u64;
+
+    /// Get an upper bound for a percentile (0–1) of the latencies, which
+    /// is the end of the bucket that contains it.
+    [[nodiscard]] auto Percentile(f64 P) const -> std::chrono::nanoseconds;
+};
+
+/// Statistics of one kind of I/O.
+struct IoKindStatistics {
+    /// Device requests, bytes transferred by them, and those that failed.
+    u64 Requests{};
+    u64 Bytes{};
+    u64 Errors{};
+
+    /// Block cache lookups. Each block looked up counts once.
+    u64 CacheHits{};
+    u64 CacheMisses{};
+
+    /// Latencies of device requests.
+    LatencyHistogram Latency;
+};
+
+/// Snapshot of the I/O statistics of a drive.
+struct IoStatistics {
+    std::array<IoKindStatistics, IO_KIND_COUNT> Kinds;
+
+    [[nodiscard]] auto operator[](IoKind K) -> IoKindStatistics& { return Kinds[usz(K)]; }
+    [[nodiscard]] auto operator[](IoKind K) const -> const IoKindStatistics& { return Kinds[usz(K)]; }
+};
+
+/// Passed to the trace callback before and after each device request.
+struct IoTraceEvent {
+    IoKind Kind;
+
+    /// Byte range of the request.
+    u64 Offset;
+    u64 Size;
+
+    /// Set in the call after the request has completed, together with
+    /// whether it succeeded and how long it took.
+    bool Done;
+    bool Ok;
+    std::chrono::nanoseconds Latency;
+};
+
+/// Trace callback. It is called from whichever thread performs or
+/// completes the request and must be thread-safe.
+using IoTraceCallback = std::function<void(const IoTraceEvent&)>;
+
+/// Live I/O counters. These are relaxed atomics, so recording is cheap
+/// enough to leave on, but a snapshot taken while I/O is in progress
+/// may be slightly inconsistent.
+class IoCounters {
+    struct alignas(64) Counters {
+        std::atomic<u64> Requests{};
+        std::atomic<u64> Bytes{};
+        std::atomic<u64> Errors{};
+        std::atomic<u64> CacheHits{};
+        std::atomic<u64> CacheMisses{};
+        std::array<std::atomic<u64>, LatencyHistogram::BUCKETS> Latency{};
+    };
+
+    std::array<Counters, IO_KIND_COUNT> Kinds;
+
+public:
+    /// Record block cache lookups.
+    void RecordLookups(IoKind K, u64 Hits, u64 Misses) {
+        auto& C = Kinds[usz(K)];
+        if (Hits) C.CacheHits.fetch_add(Hits, std::memory_order_relaxed);
+        if (Misses) C.CacheMisses.fetch_add(Misses, std::memory_order_relaxed);
+    }
+
+    /// Record a completed device request.
+    void RecordRequest(IoKind K, u64 Bytes, std::chrono::nanoseconds Latency, bool Ok) {
+        auto& C = Kinds[usz(K)];
+        C.Requests.fetch_add(1, std::memory_order_relaxed);
+        C.Bytes.fetch_add(Bytes, std::memory_order_relaxed);
+        if (not Ok) C.Errors.fetch_add(1, std::memory_order_relaxed);
+        C.Latency[LatencyHistogram::Bucket(Latency)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Get the current values.
+    [[nodiscard]] auto Snapshot() const -> IoStatistics;
+};
+} // namespace Ext2
+
+#endif // EXT2_STATS_HH
@@ -0,0 +1,233 @@
+#ifndef EXT2_TASK_HH
+#define EXT2_TASK_HH
+
+#include <atomic>
+#include <coroutine>
+#include <ext2++/bits/utils.hh>
+
+namespace Ext2 {
+template <typename T>
+class Task;
+
+/// Coroutines that are ready to continue, e.g. because the I/O
+/// they were waiting for has completed. Completions may happen on
+/// any thread, possibly while it holds locks, so they never resume
+/// a coroutine directly but push it here instead; the thread that
+/// drains the queue resumes it.
+class ResumeQueue {
+    std::mutex Lock;
+    std::vector<std::coroutine_handle<>> Ready;
+
+public:
+    /// Queue a coroutine to be resumed. Thread-safe.
+    void Push(std::coroutine_handle<> Handle) {
+        std::unique_lock Guard{Lock};
+        Ready.push_back(Handle);
+    }
+
+    /// Resume every queued coroutine, including ones that are queued
+    /// while this runs. Returns the number of coroutines resumed.
+    auto Drain() -> usz {
+        usz Resumed = 0;
+        std::vector<std::coroutine_handle<>> Batch;
+        for (;;) {
+            {
+                std::unique_lock Guard{Lock};
+                if (Ready.empty()) return Resumed;
+                std::swap(Batch, Ready);
+            }
+
+            for (auto H : Batch) H.resume();
+            Resumed += Batch.size();
+            Batch.clear();
+        }
+    }
+};
+
+namespace detail {
+/// State shared by the promises of all tasks.
+///
+/// We don’t rely on symmetric transfer, which compilers only turn into
+/// a tail call when optimising; a loop that awaits tasks that complete
+/// without suspending would otherwise grow the stack on every iteration.
+/// Instead, the awaiter starts the task and then races it for Handoff:
+/// if the task gets there first, it has stopped and the awaiter simply
+/// continues; otherwise, the task resumes the awaiter when it stops.
+struct TaskPromiseBase {
+    /// The coroutine that awaits this task.
+    std::coroutine_handle<> Continuation;
+    std::atomic<bool> Handoff{false};
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        void await_resume() noexcept {}
+
+        template <typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> H) noexcept {
+            auto& P = H.promise();
+            if (P.Handoff.exchange(true, std::memory_order_acq_rel)) P.Continuation.resume();
+        }
+    };
+
+    /// Run the coroutine until it stops or suspends. Returns whether
+    /// the awaiter has to suspend.
+    static bool Start(TaskPromiseBase& P, std::coroutine_handle<> Self, std::coroutine_handle<> Awaiting) {
+        P.Continuation = Awaiting;
+        P.Handoff.store(false, std::memory_order_relaxed);
+        Self.resume();
+        return not P.Handoff.exchange(true, std::memory_order_acq_rel);
+    }
+
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() noexcept -> FinalAwaiter { return {}; }
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> Value;
+
+    auto get_return_object() -> Task<T>;
+    void return_value(T V) { Value.emplace(std::move(V)); }
+    auto Result() -> T { return std::move(*Value); }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    auto get_return_object() -> Task<void>;
+    void return_void() {}
+    void Result() {}
+};
+} // namespace detail
+
+/// Lazily started coroutine that produces a T. A task starts running
+/// when it is awaited and resumes its awaiter when it finishes.
+template <typename T = void>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+    Handle H;
+
+public:
+    explicit Task(Handle H_) : H(H_) {}
+    Task(Task&& Other) noexcept : H(std::exchange(Other.H, {})) {}
+    Task& operator=(Task&& Other) noexcept {
+        if (this != &Other) {
+            if (H) H.destroy();
+            H = std::exchange(Other.H, {});
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (H) H.destroy();
+    }
+
+    auto operator co_await() && {
+        struct Awaiter {
+            Handle H;
+            bool await_ready() { return H.done(); }
+            bool await_suspend(std::coroutine_handle<> Awaiting) { return promise_type::Start(H.promise(), H, Awaiting); }
+            auto await_resume() -> T { return H.promise().Result(); }
+        };
+
+        return Awaiter{H};
+    }
+};
+
+template <typename T>
+auto detail::TaskPromise<T>::get_return_object() -> Task<T> {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+inline auto detail::TaskPromise<void>::get_return_object() -> Task<void> {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+/// Asynchronous generator. The coroutine co_yields values and finally
+/// co_returns whether it succeeded. Consumers await Next() and then use
+/// Value(), which is valid until the next call to Next():
+///
+///     while (co_await Gen.Next()) Use(Gen.Value());
+///     if (Gen.Failed()) ...
+template <typename T>
+class [[nodiscard]] AsyncGenerator {
+public:
+    struct promise_type : detail::TaskPromiseBase {
+        const T* Current{};
+        bool Ok = false;
+
+        auto get_return_object() -> AsyncGenerator {
+            return AsyncGenerator{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        auto yield_value(const T& V) -> FinalAwaiter {
+            Current = &V;
+            return {};
+        }
+
+        void return_value(bool Ok_) {
+            Current = nullptr;
+            Ok = Ok_;
+        }
+    };
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+    Handle H;
+
+public:
+    explicit AsyncGenerator(Handle H_) : H(H_) {}
+    AsyncGenerator(AsyncGenerator&& Other) noexcept : H(std::exchange(Other.H, {})) {}
+    AsyncGenerator(const AsyncGenerator&) = delete;
+    AsyncGenerator& operator=(const AsyncGenerator&) = delete;
+    AsyncGenerator& operator=(AsyncGenerator&&) = delete;
+    ~AsyncGenerator() {
+        if (H) H.destroy();
+    }
+
+    /// Produce the next value. Resumes with false once there are no
+    /// more values.
+    auto Next() {
+        struct Awaiter {
+            Handle H;
+            bool await_ready() { return H.done(); }
+            bool await_suspend(std::coroutine_handle<> Awaiting) { return promise_type::Start(H.promise(), H, Awaiting); }
+            bool await_resume() { return not H.done(); }
+        };
+
+        return Awaiter{H};
+    }
+
+    /// Get the current value.
+    [[nodiscard]] auto Value() const -> const T& { return *H.promise().Current; }
+
+    /// Check whether the generator stopped because of an error.
+    [[nodiscard]] bool Failed() const { return H.done() and not H.promise().Ok; }
+};
+
+namespace detail {
+struct DetachedTask {
+    struct promise_type {
+        auto get_return_object() -> DetachedTask { return {}; }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+inline auto RunDetached(Task<void> T) -> DetachedTask { co_await std::move(T); }
+} // namespace detail
+
+/// Start a task without awaiting it. It runs until it first has to wait
+/// and is destroyed once it has finished.
+inline void Detach(Task<void> T) { detail::RunDetached(std::move(T)); }
+} // namespace Ext2
+
+#endif // EXT2_TASK_HH
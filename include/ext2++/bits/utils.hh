@@ -2,11 +2,20 @@
 #define EXT2_UTILS_HH
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <shared_mutex>
+#include <span>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -34,6 +43,12 @@
 #    define EXT2XX_FORMAT fmt::format
 #endif
 
+/// Messages below this level are compiled out entirely. One of Debug,
+/// Info, Warning, Error, or Off.
+#ifndef EXT2XX_MIN_LOG_LEVEL
+#    define EXT2XX_MIN_LOG_LEVEL Debug
+#endif
+
 /// ===========================================================================
 ///  Forward declarations and primitive types.
 /// ===========================================================================
@@ -51,20 +66,138 @@ using f64 = double;
 using usz = EXT2XX_UNSIGNED_SIZE_TYPE;
 using isz = EXT2XX_SIGNED_SIZE_TYPE;
 
+/// ===========================================================================
+///  Logging and errors.
+/// ===========================================================================
+/// Severity of a log message.
+enum struct LogLevel : u8 {
+    /// Diagnostics, e.g. the superblock on every mount.
+    Debug,
+
+    /// Noteworthy events that are not problems.
+    Info,
+
+    /// Invalid requests and conditions that we recover from.
+    Warning,
+
+    /// Failures, e.g. I/O errors and corruption.
+    Error,
+
+    /// Disables logging.
+    Off,
+};
+
+/// Minimum level that is compiled in at all.
+constexpr inline LogLevel MIN_LOG_LEVEL = LogLevel::EXT2XX_MIN_LOG_LEVEL;
+
+/// Minimum level that is logged at runtime.
+inline std::atomic<LogLevel> CurrentLogLevel = LogLevel::Warning;
+
+/// Set the minimum level that is logged. Thread-safe.
+inline void SetLogLevel(LogLevel Level) { CurrentLogLevel.store(Level, std::memory_order_relaxed); }
+
+/// Check whether messages of a level are logged. Use this to avoid
+/// computing expensive arguments for messages that are discarded.
+template <LogLevel Level>
+[[nodiscard]] bool LogEnabled() {
+    if constexpr (Level < MIN_LOG_LEVEL or Level == LogLevel::Off) return false;
+    else return Level >= CurrentLogLevel.load(std::memory_order_relaxed);
+}
+
 #ifdef EXT2XX_LOG_IMPL
-/// Log a message to stderr.
-void Log(auto&& fmt, auto&&... args) {
+/// Log a message to stderr if its level is enabled.
+template <LogLevel Level>
+void LogAt(auto&& fmt, auto&&... args) {
+    if (not LogEnabled<Level>()) return;
     EXT2XX_LOG_IMPL(std::forward<decltype(fmt)>(fmt), std::forward<decltype(args)>(args)...);
     EXT2XX_LOG_IMPL("\n");
 }
+
+/// Log an error.
+void Log(auto&& fmt, auto&&... args) {
+    LogAt<LogLevel::Error>(std::forward<decltype(fmt)>(fmt), std::forward<decltype(args)>(args)...);
+}
 #else
-/// Log a message to stderr.
-template <typename... Arguments>
-void Log(fmt::format_string<Arguments...> Format, Arguments&&... Args) {
+/// Log a message to stderr if its level is enabled. Nothing is
+/// formatted otherwise.
+template <LogLevel Level, typename... Arguments>
+void LogAt(fmt::format_string<Arguments...> Format, Arguments&&... Args) {
+    if (not LogEnabled<Level>()) return;
     fmt::print(stderr, Format, std::forward<Arguments>(Args)...);
     fmt::print(stderr, "\n");
 }
+
+/// Log an error.
+template <typename... Arguments>
+void Log(fmt::format_string<Arguments...> Format, Arguments&&... Args) {
+    LogAt<LogLevel::Error>(Format, std::forward<Arguments>(Args)...);
+}
 #endif
+
+/// Why an operation failed. Functions that return nothing on failure
+/// set this for the calling thread, like errno; it is only meaningful
+/// right after such a call. Conditions that callers routinely expect,
+/// such as a path that doesn’t exist, are reported only through this
+/// and not logged unless debug logging is enabled.
+enum struct ErrorCode : u8 {
+    None,
+
+    /// A path component does not exist.
+    NotFound,
+
+    /// A path component that must be a directory isn’t one.
+    NotADirectory,
+
+    /// The operation requires a regular file.
+    NotARegularFile,
+
+    /// The path is empty, or relative without an absolute origin.
+    InvalidPath,
+
+    /// The drive is mounted read-only.
+    ReadOnly,
+
+    /// The file would be too large for this filesystem.
+    FileTooLarge,
+
+    /// No free blocks or inodes are left.
+    NoSpace,
+
+    /// The filesystem uses features we don’t support.
+    Unsupported,
+
+    /// On-disk structures are invalid.
+    Corrupted,
+
+    /// The device failed to read or write.
+    Io,
+};
+
+inline thread_local ErrorCode CurrentError = ErrorCode::None;
+
+/// Get why the last failed operation on this thread failed.
+[[nodiscard]] inline auto LastError() -> ErrorCode { return CurrentError; }
+
+/// Record why an operation is about to fail.
+inline void SetError(ErrorCode Code) { CurrentError = Code; }
+
+/// Get the name of an error code.
+[[nodiscard]] constexpr auto ErrorName(ErrorCode Code) -> std::string_view {
+    switch (Code) {
+        case ErrorCode::None: return "no error";
+        case ErrorCode::NotFound: return "not found";
+        case ErrorCode::NotADirectory: return "not a directory";
+        case ErrorCode::NotARegularFile: return "not a regular file";
+        case ErrorCode::InvalidPath: return "invalid path";
+        case ErrorCode::ReadOnly: return "drive is mounted read-only";
+        case ErrorCode::FileTooLarge: return "file too large";
+        case ErrorCode::NoSpace: return "no space left on drive";
+        case ErrorCode::Unsupported: return "unsupported filesystem features";
+        case ErrorCode::Corrupted: return "filesystem is corrupted";
+        case ErrorCode::Io: return "I/O error";
+    }
+    return "unknown error";
+}
 } // namespace Ext2
 
 #endif // EXT2_UTILS_HH
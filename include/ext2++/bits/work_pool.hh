@@ -0,0 +1,112 @@
+#ifndef EXT2_WORK_POOL_HH
+#define EXT2_WORK_POOL_HH
+
+#include <atomic>
+#include <deque>
+#include <ext2++/bits/utils.hh>
+#include <thread>
+
+namespace Ext2 {
+/// Pool of worker threads with one task queue per worker. Workers take
+/// the most recently pushed task from their own queue and steal the
+/// oldest one from other queues when theirs is empty. Tasks may push
+/// more tasks; Run() returns once every task has been processed.
+template <typename Task>
+class WorkStealingPool {
+    struct Queue {
+        std::mutex Lock;
+        std::deque<Task> Tasks;
+    };
+
+    std::deque<Queue> Queues;
+
+    /// Number of tasks that have been pushed but not finished.
+    std::atomic<usz> Pending{0};
+
+    /// Idle workers sleep until a task is pushed or all work is done.
+    std::mutex SleepLock;
+    std::condition_variable Wake;
+    u64 Generation = 0;
+
+    bool TryPop(usz Worker, Task& T) {
+        {
+            auto& Q = Queues[Worker];
+            std::unique_lock Guard{Q.Lock};
+            if (not Q.Tasks.empty()) {
+                T = std::move(Q.Tasks.back());
+                Q.Tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (usz i = 1; i < Queues.size(); i++) {
+            auto& Q = Queues[(Worker + i) % Queues.size()];
+            std::unique_lock Guard{Q.Lock};
+            if (not Q.Tasks.empty()) {
+                T = std::move(Q.Tasks.front());
+                Q.Tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template <typename Callback>
+    void Work(usz Worker, Callback& Process) {
+        for (;;) {
+            u64 Seen;
+            {
+                std::unique_lock Guard{SleepLock};
+                Seen = Generation;
+            }
+
+            if (Task T; TryPop(Worker, T)) {
+                Process(Worker, std::move(T));
+                if (Pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::unique_lock Guard{SleepLock};
+                    Wake.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock Guard{SleepLock};
+            Wake.wait(Guard, [&] { return Pending.load(std::memory_order_acquire) == 0 or Generation != Seen; });
+            if (Pending.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(usz Workers) : Queues(std::max<usz>(Workers, 1)) {}
+
+    /// Number of workers.
+    [[nodiscard]] auto Workers() const -> usz { return Queues.size(); }
+
+    /// Add a task to the queue of a worker.
+    void Push(usz Worker, Task T) {
+        Pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            auto& Q = Queues[Worker % Queues.size()];
+            std::unique_lock Guard{Q.Lock};
+            Q.Tasks.push_back(std::move(T));
+        }
+
+        std::unique_lock Guard{SleepLock};
+        Generation++;
+        Wake.notify_one();
+    }
+
+    /// Process tasks until there are none left. This is called as
+    /// Process(Worker, Task), concurrently from all workers. The
+    /// calling thread is worker 0.
+    template <typename Callback>
+    void Run(Callback Process) {
+        std::vector<std::thread> Threads;
+        for (usz i = 1; i < Queues.size(); i++) Threads.emplace_back([this, i, &Process] { Work(i, Process); });
+        Work(0, Process);
+        for (auto& T : Threads) T.join();
+    }
+};
+} // namespace Ext2
+
+#endif // EXT2_WORK_POOL_HH
@@ -0,0 +1,317 @@
+#ifndef EXT2_BLOCK_DEVICE_HH
+#define EXT2_BLOCK_DEVICE_HH
+
+#include <atomic>
+#include <ext2++/bits/stats.hh>
+#include <ext2++/bits/task.hh>
+#include <ext2++/bits/utils.hh>
+#include <functional>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace Ext2 {
+using FdType = EXT2XX_FILE_DESCRIPTOR_TYPE;
+
+/// How a range of a device is going to be accessed.
+enum struct AccessPattern {
+    Normal,
+    Sequential,
+    Random,
+
+    /// The range will be accessed soon.
+    WillNeed,
+};
+
+/// A single read or write in a batch of requests.
+struct IoRequest {
+    enum struct Kind : u8 {
+        Read,
+        Write,
+    };
+
+    Kind Op = Kind::Read;
+
+    /// Byte offset on the device. The buffers are filled or written
+    /// in order from consecutive ranges starting at this offset. The
+    /// device may modify the buffer list while processing the request.
+    u64 Offset{};
+    iovec* Iov{};
+    usz Count{};
+
+    /// Set once the request has completed.
+    bool Ok{};
+};
+
+/// Interface to the storage that holds a filesystem.
+class BlockDevice {
+public:
+    /// Invoked when an asynchronous batch has completed.
+    using Completion = std::function<void(bool Ok)>;
+
+    virtual ~BlockDevice() = default;
+
+    /// Hint how a range of the device is going to be accessed. Devices
+    /// that can’t apply a hint to just part of the device ignore it.
+    virtual void Advise(u64 Offset, u64 Size, AccessPattern Pattern) {}
+
+    /// Make sure that everything written so far has reached stable storage.
+    virtual bool Flush() = 0;
+
+    /// Get the file descriptor backing this device.
+    [[nodiscard]] virtual auto Handle() const -> FdType = 0;
+
+    /// Get a pointer to a range of the device if it is mapped into
+    /// memory. Returns nullptr if the device isn’t mapped or if the
+    /// range is out of bounds.
+    [[nodiscard]] virtual auto Map(u64 Offset, usz Size) const -> const u8* { return nullptr; }
+
+    /// Process completed asynchronous batches and invoke their completion
+    /// callbacks. If Wait is true, block until at least one batch has
+    /// completed, unless none are pending. Returns the number of batches
+    /// that have completed.
+    virtual auto Poll(bool Wait) -> usz { return 0; }
+
+    /// Read from the device.
+    virtual bool Read(u64 Offset, void* Dest, usz Size) = 0;
+
+    /// Read from the device into several buffers. The buffers are
+    /// filled in order from consecutive ranges of the device.
+    virtual bool ReadV(u64 Offset, iovec* Iov, usz Count) = 0;
+
+    /// Submit a batch of requests and wait until all of them have
+    /// completed. Returns false if any of them failed.
+    virtual bool Submit(std::span<IoRequest> Requests);
+
+    /// Submit a batch of requests without waiting for them. Done is invoked
+    /// from Poll() once every request in the batch has completed; the
+    /// requests and their buffers must stay alive until then. Devices that
+    /// can’t perform asynchronous I/O complete the batch immediately. Done
+    /// is invoked even if submission fails, in which case this returns false.
+    virtual bool SubmitAsync(std::span<IoRequest> Requests, Completion Done);
+
+    /// Write to the device.
+    virtual bool Write(u64 Offset, const void* Src, usz Size) = 0;
+
+    /// Write several buffers to consecutive ranges of the device.
+    virtual bool WriteV(u64 Offset, const iovec* Iov, usz Count);
+
+    /// Check whether SubmitAsync() can return before the batch has
+    /// completed, in which case someone has to call Poll().
+    [[nodiscard]] virtual bool IsAsync() const { return false; }
+
+    /// Check whether this device is mapped into memory.
+    [[nodiscard]] bool IsMapped() const { return Map(0, 0) != nullptr; }
+};
+
+/// Awaitable that submits a batch with SubmitAsync() and resumes with
+/// whether every request succeeded. The awaiting coroutine continues
+/// right away if the batch completes during submission and is pushed
+/// onto Queue otherwise. If set, Finish is invoked on completion, on the
+/// completing thread and before the coroutine is queued, and says
+/// whether the batch is considered successful.
+class AsyncSubmit {
+    BlockDevice& Device;
+    std::span<IoRequest> Requests;
+    ResumeQueue& Queue;
+    IoKind Kind;
+    std::function<bool(bool Ok)> Finish;
+    std::coroutine_handle<> Awaiting;
+    std::atomic<u8> State{};
+    bool Ok;
+
+public:
+    AsyncSubmit(BlockDevice& Device_, std::span<IoRequest> Requests_, ResumeQueue& Queue_, IoKind Kind_, std::function<bool(bool Ok)> Finish_ = {})
+        : Device(Device_),
+          Requests(Requests_),
+          Queue(Queue_),
+          Kind(Kind_),
+          Finish(std::move(Finish_)),
+          Ok(Requests_.empty()) {}
+
+    AsyncSubmit(const AsyncSubmit&) = delete;
+    AsyncSubmit& operator=(const AsyncSubmit&) = delete;
+
+    bool await_ready() const { return Requests.empty(); }
+    bool await_suspend(std::coroutine_handle<> Handle);
+    bool await_resume() const { return Ok; }
+};
+
+/// Device that performs positional I/O on a file descriptor.
+class FdBlockDevice : public BlockDevice {
+protected:
+    FdType Fd;
+
+public:
+    /// Takes ownership of the file descriptor.
+    explicit FdBlockDevice(FdType Fd_) : Fd(Fd_) {}
+    ~FdBlockDevice() override;
+    FdBlockDevice(const FdBlockDevice&) = delete;
+    FdBlockDevice& operator=(const FdBlockDevice&) = delete;
+
+    bool Flush() override;
+    [[nodiscard]] auto Handle() const -> FdType override { return Fd; }
+    bool Read(u64 Offset, void* Dest, usz Size) override;
+    bool ReadV(u64 Offset, iovec* Iov, usz Count) override;
+    bool Write(u64 Offset, const void* Src, usz Size) override;
+    bool WriteV(u64 Offset, const iovec* Iov, usz Count) override;
+};
+
+/// Device backed by a memory-mapped image file. Reads are served
+/// straight from the mapping; writes go through the file descriptor,
+/// which is coherent with the shared mapping.
+class MappedBlockDevice final : public FdBlockDevice {
+    u8* Base;
+    u64 Length;
+
+    MappedBlockDevice(FdType Fd_, u8* Base_, u64 Length_) : FdBlockDevice(Fd_), Base(Base_), Length(Length_) {}
+
+public:
+    ~MappedBlockDevice() override;
+
+    void Advise(u64 Offset, u64 Size, AccessPattern Pattern) override;
+    [[nodiscard]] auto Map(u64 Offset, usz Size) const -> const u8* override;
+    bool Read(u64 Offset, void* Dest, usz Size) override;
+    bool ReadV(u64 Offset, iovec* Iov, usz Count) override;
+
+    /// Map an image file. This takes ownership of the file
+    /// descriptor if the image could be mapped.
+    static auto Open(FdType Fd) -> std::unique_ptr<MappedBlockDevice>;
+};
+
+/// Device that submits requests through io_uring. Requests in a batch
+/// are in flight at the same time, so the device sees a queue depth
+/// greater than one. Any thread may submit; completions are reaped by
+/// whichever thread is waiting for them.
+class UringBlockDevice final : public FdBlockDevice {
+    struct Batch;
+    struct Pending {
+        Batch* B;
+        IoRequest* R;
+    };
+
+    struct Batch {
+        std::vector<Pending> Requests;
+        usz Remaining;
+        bool Ok = true;
+        Completion Done;
+
+        /// Bumped after each request is queued. The kernel orders the
+        /// submission before the completion, but the reaper also acquires
+        /// this so that thread sanitisers can see that ordering.
+        std::atomic<u32> Queued{};
+    };
+
+    struct Ring {
+        void* Ptr = nullptr;
+        usz Size = 0;
+    };
+
+    int RingFd;
+    Ring SqRing, CqRing, SqeRing;
+
+    /// Submission queue. Protected by SqLock.
+    std::mutex SqLock;
+    u32* SqHead{};
+    u32* SqTail{};
+    u32* SqArray{};
+    u32 SqMask{};
+    u32 SqEntries{};
+    io_uring_sqe* Sqes{};
+
+    /// Completion queue. Only the thread that is currently
+    /// reaping (Reaping is set) may touch the queue.
+    std::mutex CqLock;
+    std::condition_variable Reaped;
+    bool Reaping = false;
+    u32* CqHead{};
+    u32* CqTail{};
+    u32 CqMask{};
+    io_uring_cqe* Cqes{};
+
+    /// Asynchronous batches that have completed but whose
+    /// callbacks haven’t been run yet. Protected by CqLock.
+    std::vector<Batch*> Completed;
+    usz AsyncPending = 0;
+
+    /// Number of requests that the kernel hasn’t completed yet.
+    usz Outstanding = 0;
+
+    UringBlockDevice(FdType Fd_, int RingFd_) : FdBlockDevice(Fd_), RingFd(RingFd_) {}
+
+    /// Finish a request whose completion has been reaped.
+    void Complete(Pending& P, i32 Result);
+
+    /// Process all available completions. Must be called by the reaper.
+    void ReapAvailable();
+
+    /// Push a batch onto the submission queue and submit it. Requests
+    /// that could not be submitted are failed.
+    bool SubmitBatch(Batch& B);
+
+    /// Block until the batch has completed.
+    void WaitFor(Batch& B);
+
+public:
+    ~UringBlockDevice() override;
+
+    [[nodiscard]] bool IsAsync() const override { return true; }
+    auto Poll(bool Wait) -> usz override;
+    bool Submit(std::span<IoRequest> Requests) override;
+    bool SubmitAsync(std::span<IoRequest> Requests, Completion Done) override;
+
+    /// Set up a ring with room for QueueDepth requests. This takes ownership
+    /// of the file descriptor if the ring could be set up. Returns nullptr
+    /// if io_uring is not supported.
+    static auto Open(FdType Fd, u32 QueueDepth = 128) -> std::unique_ptr<UringBlockDevice>;
+};
+
+/// Device that passes every request on to another device and records
+/// statistics about it. Requests are counted under the kind of I/O of the
+/// thread that submits them, or as writes. If there is a trace callback,
+/// it is called before and after each request.
+class MonitoredBlockDevice final : public BlockDevice {
+    std::unique_ptr<BlockDevice> Inner;
+    IoCounters Counters;
+    IoTraceCallback Trace;
+
+public:
+    MonitoredBlockDevice(std::unique_ptr<BlockDevice> Inner_, IoTraceCallback Trace_)
+        : Inner(std::move(Inner_)), Trace(std::move(Trace_)) {}
+
+    void Advise(u64 Offset, u64 Size, AccessPattern Pattern) override { Inner->Advise(Offset, Size, Pattern); }
+    bool Flush() override { return Inner->Flush(); }
+    [[nodiscard]] auto Handle() const -> FdType override { return Inner->Handle(); }
+    [[nodiscard]] bool IsAsync() const override { return Inner->IsAsync(); }
+    [[nodiscard]] auto Map(u64 Offset, usz Size) const -> const u8* override { return Inner->Map(Offset, Size); }
+    auto Poll(bool Wait) -> usz override { return Inner->Poll(Wait); }
+    bool Read(u64 Offset, void* Dest, usz Size) override;
+    bool ReadV(u64 Offset, iovec* Iov, usz Count) override;
+    bool Submit(std::span<IoRequest> Requests) override;
+    bool SubmitAsync(std::span<IoRequest> Requests, Completion Done) override;
+    bool Write(u64 Offset, const void* Src, usz Size) override;
+    bool WriteV(u64 Offset, const iovec* Iov, usz Count) override;
+
+    /// Get the counters of this device.
+    [[nodiscard]] auto Statistics() -> IoCounters& { return Counters; }
+
+    /// Record a request that doesn’t go through this device, such as
+    /// a transfer that the kernel performs on the file descriptor.
+    /// Request() performs it and returns whether it succeeded.
+    template <typename Callback>
+    bool Track(IoKind Kind, u64 Offset, u64 Size, Callback Request) {
+        if (Trace) Trace({Kind, Offset, Size, false, false, {}});
+        auto Start = std::chrono::steady_clock::now();
+        bool Ok = Request();
+        if (not Ok) SetError(ErrorCode::Io);
+        auto Latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start);
+        Counters.RecordRequest(Kind, Size, Latency, Ok);
+        if (Trace) Trace({Kind, Offset, Size, true, Ok, Latency});
+        return Ok;
+    }
+};
+
+} // namespace Ext2
+
+#endif // EXT2_BLOCK_DEVICE_HH
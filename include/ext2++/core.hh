@@ -1,16 +1,25 @@
 #ifndef EXT2_CORE_HH
 #define EXT2_CORE_HH
 
+#include <ext2++/bits/hash.hh>
+#include <ext2++/bits/lru.hh>
+#include <ext2++/bits/namespace_index.hh>
 #include <ext2++/bits/utils.hh>
+#include <ext2++/bits/work_pool.hh>
+#include <ext2++/block_device.hh>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <set>
 #include <sys/stat.h>
 
 namespace Ext2 {
-using FdType = EXT2XX_FILE_DESCRIPTOR_TYPE;
 using InodeNumberType = u32;
 
 constexpr inline usz MAX_NAME = 255;
 
-/// Forward declaration.
+/// Forward declarations.
+class BlockCache;
 class Drive;
 
 /// Filesystem states.
@@ -135,15 +144,92 @@ struct Superblock {
     /// Other options.
     u32 s_default_mount_options;
     u32 s_first_meta_bg;
-    u8 _padding3_[760];
+
+    /// Fields introduced by ext3/ext4. Only s_flags is used.
+    u32 s_mkfs_time;
+    u32 s_jnl_blocks[17];
+    u32 s_blocks_count_hi;
+    u32 s_r_blocks_count_hi;
+    u32 s_free_blocks_hi;
+    u16 s_min_extra_isize;
+    u16 s_want_extra_isize;
+    u32 s_flags;
+    u8 _padding3_[668];
 
     /// Size of a block.
     [[nodiscard]] u32 block_size() const { return 1024u << s_log_block_size; }
 
     /// Number of block groups.
-    [[nodiscard]] u32 block_groups() const { return (s_blocks_count / s_blocks_per_group) + (s_blocks_count % s_blocks_per_group ? 1 : 0); }
+    [[nodiscard]] u32 block_groups() const { return (s_blocks_count - s_first_data_block + s_blocks_per_group - 1) / s_blocks_per_group; }
+};
+
+/// Block size arithmetic of a drive, computed once when it is mounted
+/// so that hot paths shift and mask instead of dividing.
+struct BlockGeometry {
+    /// Log2 of the block size, and the block size minus 1.
+    u32 Shift{};
+    u64 Mask{};
+
+    /// Log2 of the number of block pointers in an indirect block.
+    u32 PointerShift{};
+
+    /// Number of inodes and blocks per group and their inverses, ⌈2⁶⁴ / n⌉,
+    /// so that inode and block numbers can be divided by them with a
+    /// multiplication.
+    u32 InodesPerGroup{};
+    u64 InodesPerGroupInverse{};
+    u32 BlocksPerGroup{};
+    u64 BlocksPerGroupInverse{};
+
+    BlockGeometry() = default;
+    explicit BlockGeometry(const Superblock& Sb)
+        : Shift(10 + Sb.s_log_block_size),
+          Mask((u64(1) << Shift) - 1),
+          PointerShift(Shift - 2),
+          InodesPerGroup(Sb.s_inodes_per_group),
+          InodesPerGroupInverse(~u64(0) / Sb.s_inodes_per_group + 1),
+          BlocksPerGroup(Sb.s_blocks_per_group),
+          BlocksPerGroupInverse(~u64(0) / Sb.s_blocks_per_group + 1) {}
+
+    /// Get the block that contains a byte offset and the offset within it.
+    [[nodiscard]] auto Block(u64 Offset) const -> u64 { return Offset >> Shift; }
+    [[nodiscard]] auto Within(u64 Offset) const -> usz { return usz(Offset & Mask); }
+
+    /// Get the number of blocks needed to hold Size bytes.
+    [[nodiscard]] auto Blocks(u64 Size) const -> u64 { return (Size + Mask) >> Shift; }
+
+    /// Get the block group of a zero-based inode index, and its index
+    /// within that group.
+    [[nodiscard]] auto InodeGroup(u32 Index) const -> u32 { return Quotient(Index, InodesPerGroup, InodesPerGroupInverse); }
+    [[nodiscard]] auto InodeInGroup(u32 Index) const -> u32 { return Remainder(Index, InodesPerGroup, InodesPerGroupInverse); }
+
+    /// Get the block group of a block, counted from the first data block,
+    /// and its index within that group.
+    [[nodiscard]] auto BlockGroup(u32 Index) const -> u32 { return Quotient(Index, BlocksPerGroup, BlocksPerGroupInverse); }
+    [[nodiscard]] auto BlockInGroup(u32 Index) const -> u32 { return Remainder(Index, BlocksPerGroup, BlocksPerGroupInverse); }
+
+private:
+    /// Divide by N given its inverse. The inverse wraps to 0 if N is 1,
+    /// which still yields the right remainder.
+    [[nodiscard]] static auto Quotient(u32 Index, u32 N, u64 Inverse) -> u32 {
+        if (N == 1) return Index;
+        return u32((static_cast<unsigned __int128>(Inverse) * Index) >> 64);
+    }
+
+    [[nodiscard]] static auto Remainder(u32 Index, u32 N, u64 Inverse) -> u32 {
+        const u64 Fraction = Inverse * Index;
+        return u32((static_cast<unsigned __int128>(Fraction) * N) >> 64);
+    }
 };
 
+/// Superblock flags.
+enum struct SuperblockFlag : u32 {
+    SignedHash = 0x0001,
+    UnsignedHash = 0x0002,
+};
+
+static_assert(sizeof(Superblock) == 1024);
+
 /// Linked directory entry.
 struct LinkedDirEntryHeader {
     InodeNumberType inode;
@@ -154,6 +240,30 @@ struct LinkedDirEntryHeader {
     u8 file_type;
 };
 
+/// Header of the root block of an indexed directory, following
+/// the entries for ‘.’ and ‘..’.
+struct DxRootInfo {
+    u32 reserved_zero;
+    u8 hash_version;
+    u8 info_length;
+    u8 indirect_levels;
+    u8 unused_flags;
+};
+
+/// Header of the entries of an index block. This overlaps
+/// the hash of the first entry.
+struct DxCountLimit {
+    u16 limit;
+    u16 count;
+};
+
+/// Index entry. The first entry in a block has no hash; it
+/// covers all hashes smaller than that of the second entry.
+struct DxEntry {
+    u32 hash;
+    u32 block;
+};
+
 /// Index node.
 struct Inode {
     static constexpr u16 FileFormatMask = 0xF000;
@@ -184,6 +294,8 @@ struct Inode {
     u32 i_block[15];
     u32 i_generation;
     u32 i_file_acl;
+
+    /// Upper 32 bits of the size of regular files (i_size_high).
     u32 i_dir_acl;
     u32 i_faddr;
     u8 i_osd2[12];
@@ -192,6 +304,102 @@ struct Inode {
     [[nodiscard]] bool Is(FileFormat FF) const {
         return (i_mode & FileFormatMask) == static_cast<u16>(FF);
     }
+
+    /// Get the size of this inode in bytes.
+    [[nodiscard]] auto Size() const -> u64 {
+        return Is(RegularFile) ? u64(i_size) | u64(i_dir_acl) << 32 : i_size;
+    }
+
+    /// Set the size of this inode.
+    void SetSize(u64 Size) {
+        i_size = u32(Size);
+        if (Is(RegularFile)) i_dir_acl = u32(Size >> 32);
+    }
+};
+
+/// Inode in the inode cache. This is only accessed with the
+/// inode cache lock held.
+struct CachedInode {
+    Inode I;
+
+    /// Incremented every time the inode is written.
+    u64 Version = 0;
+
+    /// Set if the inode has been modified but not written to the drive.
+    bool Dirty = false;
+};
+
+/// Key of the dentry cache without a copy of the name, for lookups.
+struct DentryView {
+    InodeNumberType Parent;
+    std::string_view Name;
+};
+
+/// Key of the dentry cache.
+struct DentryKey {
+    InodeNumberType Parent;
+    std::string Name;
+
+    operator DentryView() const { return {Parent, Name}; }
+};
+
+/// Hash and equality of dentry keys, which also accept views so that
+/// lookups don’t allocate.
+struct DentryKeyHash {
+    using is_transparent = void;
+    auto operator()(DentryView K) const -> usz {
+        return std::hash<std::string_view>{}(K.Name) ^ (usz(K.Parent) * 0x9E3779B97F4A7C15);
+    }
+};
+
+struct DentryKeyEqual {
+    using is_transparent = void;
+    bool operator()(DentryView A, DentryView B) const { return A.Parent == B.Parent and A.Name == B.Name; }
+};
+
+/// A run of logically and physically contiguous blocks of an inode.
+struct Extent {
+    /// First block within the inode.
+    u64 Logical;
+
+    /// First block on the drive, or 0 if this is a hole.
+    u64 Physical;
+
+    /// Number of blocks.
+    u64 Length;
+};
+
+/// Mapping from the blocks of an inode to blocks on the drive,
+/// with physically contiguous blocks merged into extents.
+class BlockMap {
+    friend class Drive;
+    friend class File;
+
+    std::vector<Extent> Extents;
+
+    /// Indirect blocks used by the inode.
+    std::vector<u64> MetadataBlocks;
+
+    /// The fields of the inode this map was built from.
+    std::array<u32, 15> Blocks;
+    u64 Size;
+    u32 Sectors;
+
+    /// Add blocks to the end of the map. Physical is the first of
+    /// Count consecutive blocks on the drive, or 0 for a hole.
+    void Append(u64 Physical, u64 Count = 1);
+
+public:
+    /// Find the extent that contains a block. Blocks past
+    /// the end of the inode are reported as a hole.
+    [[nodiscard]] auto Find(u64 Logical) const -> Extent;
+
+    /// Get the drive blocks of Count blocks starting at a logical block,
+    /// in order, skipping holes.
+    [[nodiscard]] auto DriveBlocks(u64 First, u64 Count) const -> std::vector<u64>;
+
+    /// Check whether this map is up to date for an inode.
+    [[nodiscard]] bool Matches(const Inode& I) const;
 };
 
 /// Block group descriptor.
@@ -206,6 +414,371 @@ struct BlockGroupDescriptor {
     u8 bg_reserved[12];
 };
 
+/// When the access time of an inode is updated.
+enum struct AtimeUpdate : u8 {
+    /// On every access.
+    Strict,
+
+    /// Only if it isn’t newer than the modification or change time, or
+    /// if it is more than a day old (relatime).
+    Relative,
+
+    /// Never (noatime).
+    Never,
+};
+
+/// Options that control how a drive is mounted.
+struct MountOptions {
+    /// Number of blocks held by the block cache. 0 disables caching.
+    usz CacheBlocks = 1024;
+
+    /// Number of inodes whose block maps are kept in memory.
+    usz BlockMapEntries = 256;
+
+    /// Maximum readahead window of a file handle in blocks. 0
+    /// disables readahead. See File::SetReadahead().
+    usz ReadaheadBlocks = 128;
+
+    /// Number of inodes kept in the inode cache. Inodes of open
+    /// files and directories are kept in addition to these.
+    usz InodeCacheEntries = 4096;
+
+    /// Number of (directory, name) lookups kept in the dentry cache,
+    /// including lookups of names that do not exist.
+    usz DentryCacheEntries = 16384;
+
+    /// Write-back limits, in blocks. These count both dirty blocks in the
+    /// block cache and file data that has been written but for which no
+    /// blocks have been allocated yet. Above DirtyBackgroundBlocks, the
+    /// flusher thread starts writing data back; above DirtyLimitBlocks,
+    /// writers write it back themselves before continuing. Setting
+    /// DirtyLimitBlocks to 0 disables write-back, and every write then
+    /// goes straight to the drive.
+    usz DirtyBackgroundBlocks = 4096;
+    usz DirtyLimitBlocks = 16384;
+
+    /// The flusher thread writes back all dirty data this often, in
+    /// milliseconds.
+    u32 WritebackIntervalMs = 5000;
+
+    /// When to update access times.
+    AtimeUpdate Atime = AtimeUpdate::Relative;
+
+    /// Keep changes to timestamps in the inode cache instead of writing
+    /// them right away (lazytime). They are written along with the next
+    /// other change to the inode, in batches once enough of them have
+    /// accumulated, on Sync(), and when the drive is unmounted.
+    bool LazyTime = false;
+
+    /// Mount the drive read-only. Nothing is ever written to it, not even
+    /// the superblock, so the image may be on read-only media or shared
+    /// with other processes that only read it. Read-only features are
+    /// allowed, and filesystems with errors can be mounted. Since nothing
+    /// can change, reads also skip the locking and checks that exist only
+    /// because of writes, and Drive::TryMount() maps the image into memory
+    /// if it can.
+    bool ReadOnly = false;
+
+    /// Namespace index written by Drive::WriteNamespaceIndex(). It is loaded
+    /// the first time a path is resolved or a block map is needed, and then
+    /// used instead of reading directories and indirect blocks. It is only
+    /// used if the drive is mounted read-only and is ignored if it doesn’t
+    /// match the drive. Empty means none.
+    std::string NamespaceIndexPath{};
+
+    /// Called before and after every device request. See IoTraceEvent.
+    IoTraceCallback Trace{};
+};
+
+/// Options for Drive::Walk().
+struct WalkOptions {
+    /// Number of threads that scan directories. 0 means one per CPU.
+    usz Threads = 0;
+};
+
+/// Options for Drive::ScanInodes().
+struct ScanOptions {
+    /// Number of threads that scan block groups. 0 means one per CPU.
+    usz Threads = 0;
+};
+
+/// Options for Drive::ResolveMany().
+struct ResolveOptions {
+    /// Number of threads that scan directories. 0 means one per CPU.
+    usz Threads = 0;
+};
+
+/// Result of Drive::StatFs(). Counts are in blocks and inodes.
+struct FsStatistics {
+    u64 BlockSize{};
+    u64 Blocks{};
+    u64 FreeBlocks{};
+
+    /// Free blocks that are reserved for privileged users.
+    u64 ReservedBlocks{};
+
+    u64 Inodes{};
+    u64 FreeInodes{};
+
+    /// Number of block groups whose free counts in the descriptor
+    /// table don’t match their bitmaps.
+    u32 MismatchedGroups{};
+};
+
+/// Result of File::ExtentMap().
+struct FileExtents {
+    /// Size of a block in bytes. Extents are measured in blocks.
+    u64 BlockSize{};
+
+    /// Size of the file in bytes.
+    u64 Size{};
+
+    /// The data of the file in logical order, with physically contiguous
+    /// blocks merged. Every block up to the end of the file is in exactly
+    /// one extent; holes have a physical block of 0.
+    std::vector<Extent> Data;
+
+    /// Indirect blocks of the file, in the order they are reached from
+    /// the inode.
+    std::vector<u64> Metadata;
+};
+
+/// Reference to a block held by the block cache. The block stays
+/// pinned in the cache for as long as the reference is alive.
+class BlockRef {
+    friend class BlockCache;
+    BlockCache* Cache{};
+    usz Slot{};
+    const u8* Ptr{};
+
+    /// Used if the block could not be placed in the cache.
+    std::unique_ptr<u8[]> Owned;
+
+    /// Unpin the block.
+    void Release();
+
+public:
+    BlockRef() = default;
+    BlockRef(const BlockRef&) = delete;
+    BlockRef(BlockRef&& Other) noexcept { *this = std::move(Other); }
+    BlockRef& operator=(const BlockRef&) = delete;
+    BlockRef& operator=(BlockRef&& Other) noexcept;
+    ~BlockRef() { Release(); }
+
+    /// Get the block data.
+    [[nodiscard]] auto data() const -> const u8* { return Ptr; }
+
+    /// Check if this reference is valid.
+    explicit operator bool() const { return Ptr != nullptr; }
+};
+
+/// Fixed-size cache of device blocks with CLOCK eviction.
+class BlockCache {
+    friend class BlockRef;
+
+    struct FreeDeleter {
+        void operator()(u8* Ptr) const { std::free(Ptr); }
+    };
+
+    struct Slot {
+        u64 Block{};
+        u32 Pins{};
+        bool Referenced{};
+        bool Valid{};
+        bool Loading{};
+
+        /// The block has been written but not written back. Dirty
+        /// slots aren’t evicted.
+        bool Dirty{};
+    };
+
+    /// Protects everything below. Device reads are performed without
+    /// holding the lock; slots that are being loaded are marked as such.
+    std::mutex Lock;
+    std::condition_variable LoadDone;
+
+    BlockDevice& Device;
+    usz BlockSize;
+    u32 BlockShift;
+    bool Mapped;
+    std::unique_ptr<u8, FreeDeleter> Arena;
+    std::vector<Slot> Slots;
+    std::unordered_map<u64, usz> Index;
+
+    /// Whether writes are held in the cache until they are flushed.
+    bool WriteBack;
+
+    /// Dirty blocks, in the order in which they are written back.
+    std::set<u64> DirtyBlocks;
+    usz Hand{};
+    u64 Hits{};
+    u64 Misses{};
+
+    /// Per-kind lookup counters, if any.
+    IoCounters* Counters;
+
+    /// Number of prefetches and asynchronous fetches that haven’t
+    /// completed yet.
+    usz AsyncLoads{};
+
+    /// Coroutines waiting for a slot that someone else is loading, and
+    /// where to queue them once a load completes.
+    std::vector<std::pair<std::coroutine_handle<>, ResumeQueue*>> LoadWaiters;
+
+    /// Find a slot to evict. Returns the number of slots if there is none.
+    auto Evict() -> usz;
+
+    /// Mark a slot as dirty.
+    void MarkDirty(usz Slot);
+
+    /// Wait until a load completes. If a prefetch is in flight, this
+    /// polls the device since nothing else may be reaping completions.
+    void WaitForLoad(std::unique_lock<std::mutex>& Guard);
+
+    /// Wake everything that waits for a load. Requires the lock.
+    void NotifyLoaded();
+
+public:
+    /// Maximum number of blocks fetched by a single submission.
+    static constexpr usz MAX_BATCH = 64;
+
+    /// Cache statistics.
+    struct Statistics {
+        u64 Hits;
+        u64 Misses;
+        usz Capacity;
+    };
+
+private:
+    /// One batch of blocks being fetched.
+    struct Fetch {
+        /// What we did for each block.
+        enum struct State : u8 {
+            Hit,
+            Reserved,
+            Owned,
+        };
+
+        std::array<State, MAX_BATCH> States;
+        std::array<iovec, MAX_BATCH> Iov;
+        std::array<IoRequest, MAX_BATCH> Requests;
+        std::array<usz, MAX_BATCH> RequestForBlock;
+        usz Count{};
+        usz RequestCount{};
+    };
+
+    /// Awaits a slot that someone else is loading.
+    struct LoadAwaiter {
+        BlockCache& Cache;
+        usz Slot;
+        ResumeQueue& Queue;
+
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> Handle);
+        void await_resume() {}
+    };
+
+    /// Pin the cached blocks of the next batch and reserve slots for the
+    /// others, and build one request per run of consecutive missing blocks.
+    void Reserve(Fetch& F, std::span<const u64> Blocks, std::span<BlockRef> Refs);
+
+    /// Publish the blocks that a batch has loaded. Returns false if any
+    /// of them failed to load. Requires the lock.
+    bool Publish(Fetch& F, std::span<BlockRef> Refs);
+
+public:
+    /// If the device is mapped into memory, blocks are served from the
+    /// mapping and no memory is allocated for the cache. If WriteBack is
+    /// set, writes only go to the device once they are flushed; this has
+    /// no effect if the cache has no memory of its own. Lookups are also
+    /// recorded in Counters, under the kind of I/O of the current thread.
+    BlockCache(BlockDevice& Device, usz BlockSize, usz Capacity, bool WriteBack = false, IoCounters* Counters = nullptr);
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+    ~BlockCache();
+
+    /// Number of dirty blocks.
+    [[nodiscard]] auto DirtyCount() -> usz {
+        std::unique_lock Guard{Lock};
+        return DirtyBlocks.size();
+    }
+
+    /// Write dirty blocks in a range back to the device, sorted by block
+    /// and with one request per run of consecutive blocks. The requests
+    /// are submitted in large batches. Writes that happen meanwhile are
+    /// simply flushed the next time.
+    bool Flush(u64 First = 0, u64 Count = std::numeric_limits<u64>::max());
+
+    /// Get a block, reading it from the device if it isn’t cached.
+    auto Get(u64 Block) -> BlockRef;
+
+    /// Get several blocks at once. All blocks that aren’t cached are
+    /// submitted to the device as a single batch, with one request per
+    /// run of consecutive blocks.
+    bool GetBlocks(std::span<const u64> Blocks, std::span<BlockRef> Refs);
+
+    /// Get several blocks at once without blocking, as with GetBlocks().
+    /// The coroutine is resumed through Queue once the blocks are loaded.
+    /// Blocks and Refs must stay alive until the task has completed.
+    auto AsyncGetBlocks(std::span<const u64> Blocks, std::span<BlockRef> Refs, ResumeQueue& Queue, IoKind Kind) -> Task<bool>;
+
+    /// Get consecutive blocks starting at First.
+    bool GetRange(u64 First, std::span<BlockRef> Refs);
+
+    /// Check whether any block in a range is dirty. Anything that reads
+    /// from the device without going through the cache must check this.
+    [[nodiscard]] bool HasDirty(u64 First, u64 Count) {
+        if (not WriteBack) return false;
+        std::unique_lock Guard{Lock};
+        auto It = DirtyBlocks.lower_bound(First);
+        return It != DirtyBlocks.end() and *It - First < Count;
+    }
+
+    /// Hint how consecutive blocks are going to be accessed.
+    void Advise(u64 First, u64 Count, AccessPattern Pattern);
+
+    /// Start loading consecutive blocks in the background. Blocks that
+    /// are already cached are skipped, and this stops early if there are
+    /// no free slots. A later Get() of a block that is still loading waits
+    /// for it.
+    void Prefetch(u64 First, usz Count);
+
+    /// Read data at a byte offset through the cache.
+    bool Read(u64 Offset, void* Dest, usz Size);
+
+    /// Get the cache statistics.
+    [[nodiscard]] auto Stats() -> Statistics {
+        std::unique_lock Guard{Lock};
+        return {Hits, Misses, Slots.size()};
+    }
+
+    /// Get a view of Size bytes at a byte offset. The data is copied
+    /// only if the range crosses a block boundary and the device
+    /// isn’t mapped into memory.
+    auto View(u64 Offset, usz Size) -> BlockRef;
+
+    /// Write data at a byte offset. With write-back, the blocks are loaded
+    /// into the cache if necessary and marked as dirty; blocks for which
+    /// there is no room go straight to the device. Without write-back,
+    /// all writes go straight to the device and update any cached copies.
+    bool Write(u64 Offset, const void* Src, usz Size);
+
+    /// Write data at a byte offset without adding it to the cache. Blocks
+    /// that are cached are updated in the cache as by Write() instead.
+    /// This is meant for large writes of whole blocks.
+    bool WriteAround(u64 Offset, const void* Src, usz Size);
+};
+
+/// Entry of a directory.
+struct DirEntryView {
+    InodeNumberType Inode;
+
+    /// This is Unknown if the type is not recorded in the directory.
+    Ext2::Inode::FileFormat Type;
+
+    std::string_view Name;
+};
+
 /// Directory handle.
 class Dir {
     /// The inode for this directory.
@@ -215,40 +788,78 @@ class Dir {
     /// Inode offset.
     u32 InodeOffset;
 
+    /// Keeps the inode in the inode cache.
+    std::shared_ptr<CachedInode> Pin;
+
+    /// The block map for this directory.
+    std::shared_ptr<const BlockMap> Map;
+
     /// The drive this directory is on.
     std::shared_ptr<Drive> Drv;
 
     /// Create a new directory handle.
-    Dir(Inode, InodeNumberType, std::shared_ptr<Drive>);
+    Dir(Inode, InodeNumberType, std::shared_ptr<CachedInode>, std::shared_ptr<const BlockMap>, std::shared_ptr<Drive>);
 
 public:
-    /// Directory entry.
-    struct Entry {
-        std::string name;
-    };
-
     /// Directory iterator.
     class Iterator {
         Dir* D{};
-        LinkedDirEntryHeader Hdr{};
-        std::array<char, MAX_NAME + 1> Name{};
+        DirEntryView Current{};
         usz NextOffset{};
         bool Done = true;
+        bool Error = false;
+
+        /// The directory block that is currently being parsed. This is
+        /// shared between copies of an iterator.
+        std::shared_ptr<BlockRef> Block;
+        u64 CurrentBlock{};
 
         Iterator(Dir* D_ = nullptr);
 
+        /// Stop iterating because of an error.
+        void Fail() {
+            Block.reset();
+            Done = true;
+            Error = true;
+        }
+
     public:
         friend class Dir;
-        Iterator operator++();
+        Iterator& operator++();
         Iterator operator++(int) {
             auto tmp = *this;
             ++*this;
             return tmp;
         }
-        auto operator*() const -> std::optional<Entry> { return Entry{std::string{Name.data(), std::min<usz>(MAX_NAME, Hdr.name_len)}}; }
+
+        /// The name of the entry points into the directory block and
+        /// remains valid for as long as this iterator or a copy of it
+        /// points to an entry in the same block.
+        auto operator*() const -> const DirEntryView& { return Current; }
+        auto operator->() const -> const DirEntryView* { return &Current; }
         bool operator==(std::default_sentinel_t) const { return Done; }
+
+        /// Whether iteration stopped because of an error.
+        [[nodiscard]] bool Failed() const { return Error; }
     };
 
+    /// Call a function on every entry of this directory. Iteration stops
+    /// early if the function returns false. The name of an entry is only
+    /// valid during the call. Returns false if the directory could not be
+    /// read.
+    template <typename Callback>
+    bool ForEachEntry(Callback C) {
+        auto It = begin();
+        for (; It != end(); ++It) {
+            if constexpr (std::is_same_v<std::invoke_result_t<Callback&, const DirEntryView&>, bool>) {
+                if (not C(*It)) return true;
+            } else {
+                C(*It);
+            }
+        }
+        return not It.Failed();
+    }
+
     friend class Drive;
     Dir(const Dir&) = delete;
     Dir(Dir&&) = delete;
@@ -257,22 +868,52 @@ public:
 
     Iterator begin() { return {this}; }
     std::default_sentinel_t end() { return {}; }
+
+    /// Iterate over this directory asynchronously. Directory blocks are
+    /// fetched in batches while the generator is suspended; see Drive::Poll().
+    /// A Dir may have several of these and iterators at once.
+    auto AsyncEntries() -> AsyncGenerator<DirEntryView>;
 };
 
 /// File handle.
 class File {
-    /// The inode for this file. We can’t cache the inode because
-    /// the underlying file may change while it’s open.
+    /// The inode for this file. The inode is pinned in the inode
+    /// cache, which WriteInode() keeps up to date, so we always
+    /// see the current version of the inode.
     InodeNumberType InodeNumber;
+    std::shared_ptr<CachedInode> Pin;
 
     /// File pointer.
     u64 Offset = 0;
 
+    /// Readahead state. ReadaheadNext is where the next read starts if
+    /// access is sequential, and ReadaheadUntil is the first block that
+    /// hasn’t been prefetched yet.
+    u64 ReadaheadNext = 0;
+    u64 ReadaheadUntil = 0;
+    usz ReadaheadWindow = 0;
+    usz ReadaheadMax;
+
+    /// Whether the rest of the file was advised as read sequentially.
+    bool AdvisedSequential = false;
+
+    /// Whether this handle has written to the file. Such handles keep
+    /// the write state of the inode alive until they are closed.
+    bool Writer = false;
+
     /// The drive this file is on.
     std::shared_ptr<Drive> Drv;
 
-    /// Create a new file handle.
-    File(InodeNumberType, std::shared_ptr<Drive>);
+    /// Create a new file handle. The readahead limit is passed in by the
+    /// drive that opens the file.
+    File(InodeNumberType, std::shared_ptr<CachedInode>, std::shared_ptr<Drive>, usz ReadaheadBlocks);
+
+    /// Prefetch the blocks that follow a read if access is sequential.
+    void Readahead(const BlockMap& Map, u64 Size, u64 ReadOffset, usz Len);
+
+    /// Implementation of AsyncPRead() and AsyncRead(). Reads at the file
+    /// pointer also drive readahead.
+    auto AsyncReadAt(u64 ReadOffset, std::span<u8> Buffer, bool Sequential) -> Task<std::optional<usz>>;
 
 public:
     friend class Drive;
@@ -280,42 +921,460 @@ public:
     File(File&&) = delete;
     File& operator=(const File&) = delete;
     File& operator=(File&&) = delete;
+    ~File();
+
+    /// Read at an offset without using or changing the file pointer.
+    /// Unlike everything else on a File, this and ReadV() may be called
+    /// from several threads at once. Returns the number of bytes read,
+    /// which is less than requested only at the end of the file.
+    auto PRead(u64 Offset, std::span<u8> Buffer) -> std::optional<usz>;
 
     /// Read from this file.
     auto Read(void* Buf, usz Len) -> std::optional<usz>;
+
+    /// Asynchronous versions of PRead() and Read(). The buffer must stay
+    /// valid until the task has finished. Files that have delayed writes
+    /// are read synchronously.
+    auto AsyncPRead(u64 Offset, std::span<u8> Buffer) -> Task<std::optional<usz>>;
+    auto AsyncRead(std::span<u8> Buffer) -> Task<std::optional<usz>>;
+
+    /// Read at an offset into several buffers, filling them in order.
+    /// The block map is resolved once, and each large extent is read
+    /// with a single device request across all buffers it covers.
+    auto ReadV(u64 Offset, std::span<const iovec> Iov) -> std::optional<usz>;
+
+    /// Write part of this file to a file descriptor, extent by extent,
+    /// with copy_file_range() if Out is a regular file and sendfile()
+    /// otherwise, so the data doesn’t pass through userspace. Holes are
+    /// written as zeroes. Out is written at its current position. This
+    /// neither uses nor changes the file pointer. Returns the number of
+    /// bytes transferred, which may be short at the end of the file or
+    /// if Out is non-blocking and full.
+    auto TransferTo(FdType Out, u64 Offset, usz Len) -> std::optional<usz>;
+
+    /// Get the physical layout of this file. Blocks are allocated for any
+    /// delayed data first, so that the map reflects what is on the drive.
+    auto ExtentMap() -> std::optional<FileExtents>;
+
+    /// Write at an offset without using or changing the file pointer.
+    /// Data written to holes or past the end of the file is kept in memory
+    /// until it is written back, and blocks are only allocated for it then,
+    /// unless write-back is disabled. Returns the number of bytes written,
+    /// which is less than requested only if the drive is full. Writes to a
+    /// drive are serialised.
+    auto PWrite(u64 Offset, std::span<const u8> Data) -> std::optional<usz>;
+
+    /// Write back the data of this file and all dirty metadata of the
+    /// drive, and wait until it has reached stable storage.
+    bool Sync();
+
+    /// Write to this file at the file pointer.
+    auto Write(const void* Buf, usz Len) -> std::optional<usz>;
+
+    /// Change the size of this file. Blocks past the new end are freed;
+    /// growing the file leaves a hole.
+    bool Truncate(u64 Size);
+
+    /// Set the maximum readahead window in blocks. When reads are
+    /// sequential, the window starts small and doubles up to this
+    /// size; any other read resets it. 0 disables readahead, which
+    /// is best for random access.
+    void SetReadahead(usz MaxBlocks) {
+        ReadaheadMax = MaxBlocks;
+        ReadaheadWindow = 0;
+    }
 };
 
 /// A handle to a drive.
+///
+/// Concurrency: a mounted drive may be shared by any number of threads,
+/// and lookups, Stat(), OpenFile(), OpenDir() and reads and writes through
+/// separate handles may all run concurrently. The caches, the descriptor
+/// table and the allocator are locked internally; everything else about
+/// a drive is immutable after mounting. A single File or Dir::Iterator,
+/// however, has a position and must not be used by several threads at
+/// once, except for File::PRead() and File::ReadV(), which don’t use it.
+/// A Dir may be iterated by several threads as long as each uses its own
+/// iterator. Writes are serialised, but they aren’t atomic with respect
+/// to reads: a read that overlaps a concurrent write of the same data
+/// may see part of the write.
+///
+/// Written data is held in memory and written back in the background, and
+/// blocks for new data are only allocated at that point. Call Sync() to
+/// make sure everything has reached the drive; unmounting the drive does
+/// that as well.
 class Drive final {
-    FdType FileHandle;
+    std::unique_ptr<MonitoredBlockDevice> Device;
     Superblock Sb;
+    BlockGeometry Geometry;
+
+    /// Functions on the mapping path that are specialised for the block
+    /// size of the drive. See SelectBlockOps().
+    struct BlockOps {
+        bool (Drive::*MapIndirectBlock)(BlockMap& Map, u64 Block, u32 Level, u64& Remaining);
+        bool (Drive::*ReadInodeDataV)(const BlockMap& Map, u64 Offset, std::span<const iovec> Iov, usz Size);
+    };
+
+    BlockOps Ops;
+
+    /// The block group descriptor table. This is loaded when the
+    /// drive is mounted and written through on every change.
+    std::vector<BlockGroupDescriptor> Descriptors;
+    std::shared_mutex DescriptorLock;
+
+    BlockCache Cache;
+
+    /// Serialises everything that changes the data of a file or allocates
+    /// or frees blocks. The free block counts in the superblock, the cached
+    /// block bitmaps below, and the write states are only accessed with
+    /// this held.
+    std::mutex WriteLock;
+
+    /// Set when the superblock has changed since it was last written.
+    bool SuperblockDirty = false;
+
+    /// Block bitmaps of the block groups, loaded when a group is first
+    /// used for allocation and written to the cache on every change. Empty
+    /// if not loaded yet.
+    std::vector<std::vector<u8>> BlockBitmaps;
+
+    /// State of an inode that is being written to.
+    struct WriteState {
+        /// Keeps the inode in the inode cache.
+        std::shared_ptr<CachedInode> Pin;
+
+        /// Data that has been written to holes or past the end of the file
+        /// but for which no blocks have been allocated yet, in runs of
+        /// consecutive blocks keyed by the first logical block of each run.
+        std::map<u64, std::vector<u8>> Delayed;
+
+        /// Blocks that were allocated past the end of the last allocation
+        /// so that the next one can continue contiguously. They are marked
+        /// as used but aren’t part of the file.
+        u64 PreallocFirst = 0;
+        u64 PreallocCount = 0;
+
+        /// Number of open handles that have written to the inode.
+        usz Writers = 0;
+    };
+
+    /// Inodes that are being written to. An entry is kept until no handle
+    /// that has written to the inode is open and all of its delayed data
+    /// has been written back. The map and the delayed data are only changed
+    /// with both the write lock and DelayedLock held, so readers of delayed
+    /// data only need the latter. Inodes are written back in order so
+    /// that files written one after the other are laid out that way too.
+    std::map<InodeNumberType, WriteState> WriteStates;
+    std::shared_mutex DelayedLock;
+
+    /// Number of delayed blocks of all inodes. Reads skip looking for
+    /// delayed data while this is 0.
+    std::atomic<usz> DelayedBlocks{0};
+
+    /// Write-back thresholds. See MountOptions.
+    usz DirtyBackgroundBlocks;
+    usz DirtyLimitBlocks;
+    std::chrono::milliseconds WritebackInterval;
+
+    /// Background thread that writes back dirty data. It is started by the
+    /// first write and stopped when the drive is unmounted.
+    std::thread Flusher;
+    std::mutex FlusherLock;
+    std::condition_variable FlusherWake;
+    bool FlusherStop = false;
+    bool FlusherKick = false;
+
+    /// Recently used inodes and the inodes of open handles.
+    LruMap<InodeNumberType, std::shared_ptr<CachedInode>> Inodes;
+    std::mutex InodeLock;
+
+    /// Cached inodes whose timestamps have changed but which haven’t been
+    /// written back yet. Only accessed with InodeLock held.
+    std::unordered_set<InodeNumberType> LazyInodes;
+
+    /// Block maps of recently used inodes.
+    LruMap<InodeNumberType, std::shared_ptr<const BlockMap>> BlockMaps;
+    std::mutex BlockMapLock;
+
+    /// Results of recent directory lookups. An entry whose inode is 0
+    /// records that the name does not exist. The generation is bumped
+    /// whenever entries are invalidated so that a lookup that raced with
+    /// a directory modification doesn’t insert a stale result.
+    LruMap<DentryKey, LinkedDirEntryHeader, DentryKeyHash, DentryKeyEqual> Dentries;
+    u64 DentryGeneration = 0;
+    std::mutex DentryLock;
+
+    /// Coroutines of the asynchronous API whose I/O has completed. These
+    /// are resumed by Poll().
+    ResumeQueue Ready;
+
+    /// The namespace index, loaded on first use. Null if there is none
+    /// or it couldn’t be used.
+    std::string NamespaceIndexPath;
+    std::unique_ptr<NamespaceIndex> LoadedIndex;
+    std::once_flag IndexOnce;
+
+    /// Result of looking up a path in the namespace index. If the path
+    /// doesn’t resolve, the inode number is 0 and Error says why.
+    struct IndexedPath {
+        InodeNumberType InodeNumber;
+        ErrorCode Error;
+    };
+
+    Drive(std::unique_ptr<MonitoredBlockDevice>, Superblock&&, std::vector<BlockGroupDescriptor>&&, const MountOptions&);
+
+    /// Log the contents of the superblock at debug level.
+    void LogSuperblock() const;
+
+    /// Allocate up to Count contiguous blocks, as close to Goal as possible:
+    /// at Goal if it is free, otherwise at the start of the first run of free
+    /// blocks that is long enough, searching the group of Goal first. Returns
+    /// the first block and the number of blocks allocated. The blocks
+    /// reserved for privileged users are never allocated.
+    auto AllocateBlocks(u64 Goal, u64 Count) -> std::optional<std::pair<u64, u64>>;
+
+    /// Get the number of free blocks that are not reserved.
+    [[nodiscard]] auto AvailableBlocks() const -> u64;
+
+    /// Allocate a zeroed indirect block for an inode.
+    auto AllocateIndirectBlock(Inode& I, u64 Goal) -> u32;
+
+    /// Set the large_file feature if a file has grown too large to do
+    /// without it.
+    void AllowFileSize(u64 Size);
+
+    /// Allocate up to Count contiguous blocks near Goal for an inode, using
+    /// its preallocated blocks if they start at Goal. This asks for a few
+    /// more blocks than needed and keeps the surplus as the preallocation.
+    auto AllocateRun(WriteState& S, u64 Goal, u64 Count) -> std::optional<std::pair<u64, u64>>;
 
-    Drive(FdType, Superblock&&);
+    /// Asynchronous versions of GetBlockMap(), LookupDentry(), PinInode(),
+    /// and ReadInodeDataV() with a single buffer. These fetch the blocks
+    /// they need in batches and then do the rest synchronously, from the
+    /// cache.
+    auto AsyncGetBlockMap(InodeNumberType InodeNumber, Inode I) -> Task<std::shared_ptr<const BlockMap>>;
+    auto AsyncLookupDentry(InodeNumberType Parent, std::string_view Name) -> Task<std::optional<LinkedDirEntryHeader>>;
+    auto AsyncPinInode(InodeNumberType InodeNumber) -> Task<std::shared_ptr<CachedInode>>;
+    auto AsyncReadInodeData(const BlockMap& Map, u64 Offset, std::span<u8> Buffer) -> Task<bool>;
+
+    /// Fetch Count logical blocks of an inode, skipping holes, and keep
+    /// them pinned by adding them to Held.
+    auto AsyncFetchData(const BlockMap& Map, u64 First, u64 Count, std::vector<BlockRef>& Held, IoKind Kind) -> Task<bool>;
+
+    /// Fetch the indirect blocks below an indirect block at some level of
+    /// indirection that map at most Remaining blocks, and keep them pinned
+    /// by adding them to Held.
+    auto AsyncFetchIndirect(const u8* Data, u32 Level, u64 Remaining, std::vector<BlockRef>& Held) -> Task<bool>;
+
+    /// Get the namespace index, loading it if this is the first use.
+    auto GetNamespaceIndex() -> const NamespaceIndex*;
+
+    /// Get the key that identifies the current state of the drive.
+    [[nodiscard]] auto NamespaceKey() const -> NamespaceIndexKey;
 
     /// Compute the offset of an inode.
-    auto ComputeInodeOffset(InodeNumberType InodeNumber) -> std::optional<usz>;
+    auto ComputeInodeOffset(InodeNumberType InodeNumber) -> std::optional<u64>;
+
+    /// Build the block map of an inode.
+    auto BuildBlockMap(const Inode& I) -> std::shared_ptr<const BlockMap>;
+
+    /// Get the delayed data of consecutive blocks of an inode as one buffer,
+    /// adding zeroed blocks and merging runs as necessary. Returns nullptr if
+    /// the drive doesn’t have room for the blocks that are added. DelayedLock
+    /// must be held exclusively.
+    auto DelayedRange(WriteState& S, u64 First, u64 Count) -> u8*;
+
+    /// Allocate blocks for the delayed data of an inode and write it. This
+    /// also drops the write state of the inode if nothing needs it anymore.
+    bool FlushDelayed(InodeNumberType InodeNumber);
+
+    /// Flush the delayed data of every inode.
+    bool FlushAllDelayed();
+
+    /// Main loop of the flusher thread.
+    void FlusherMain();
 
-    /// Find a directory entry.
-    [[nodiscard]] auto FindDirectoryEntry(Inode& I, std::string_view Name) -> std::optional<LinkedDirEntryHeader>;
+    /// Mark blocks as free.
+    bool FreeBlocks(u64 First, u64 Count);
+
+    /// Find a directory entry. If the directory contains no such entry,
+    /// the inode number of the returned entry is 0.
+    [[nodiscard]] auto FindDirectoryEntry(InodeNumberType InodeNumber, const Inode& I, std::string_view Name) -> std::optional<LinkedDirEntryHeader>;
+
+    /// Find a directory entry in a single block of a directory.
+    [[nodiscard]] auto FindEntryInBlock(const BlockMap& Map, u64 Block, std::string_view Name) -> std::optional<LinkedDirEntryHeader>;
+
+    /// Find a directory entry using the HTree index of a directory. Returns
+    /// nothing if the index is unusable, in which case the directory must be
+    /// searched linearly.
+    [[nodiscard]] auto FindIndexedEntry(InodeNumberType InodeNumber, const BlockMap& Map, std::string_view Name) -> std::optional<LinkedDirEntryHeader>;
+
+    /// Get the block map of an inode, building it if it isn’t cached.
+    auto GetBlockMap(InodeNumberType InodeNumber, const Inode& I) -> std::shared_ptr<const BlockMap>;
+
+    /// Get the write state of an inode, creating it if necessary.
+    auto GetWriteState(InodeNumberType InodeNumber, const std::shared_ptr<CachedInode>& Pin) -> WriteState&;
+
+    /// Check whether an inode has delayed data.
+    [[nodiscard]] bool HasDelayed(InodeNumberType InodeNumber);
+
+    /// Check whether there is room on the drive for more delayed blocks,
+    /// including any indirect blocks they may need.
+    [[nodiscard]] bool HasDelayedSpace(u64 Added) const;
 
     /// Get the type of a dir entry. This is a function because although the
-    /// header contains the file type, it is only valid for revision 1, so in
-    /// revision 0, we have to read the inode instead.
+    /// header contains the file type, it is only valid if the filetype feature
+    /// is enabled; otherwise, we have to read the inode instead.
     auto GetFileFormat(LinkedDirEntryHeader Hdr) -> std::optional<Inode::FileFormat>;
 
     /// Get an inode from a path.
-    auto InodeFromPath(std::string_view, std::string_view Origin = "") -> std::optional<InodeNumberType>;
     auto InodeFromPath(std::string_view, InodeNumberType Origin) -> std::optional<InodeNumberType>;
 
+    /// Build the block map of an inode from the namespace index. Returns
+    /// nullptr if the index has none or it is out of date.
+    auto IndexedBlockMap(InodeNumberType InodeNumber, const Inode& I) -> std::shared_ptr<const BlockMap>;
+
+    /// Look up a path in the namespace index. Returns nothing if there is
+    /// no index or the path has to be resolved by reading directories, i.e.
+    /// if it is relative without an absolute origin or contains . or ..
+    [[nodiscard]] auto IndexLookup(std::string_view Path, std::string_view Origin) -> std::optional<IndexedPath>;
+
+    /// Drop all cached lookups in a directory. This must be called
+    /// whenever the contents of a directory change.
+    void InvalidateDentries(InodeNumberType Directory);
+
+    /// Look up a name in a directory using the dentry cache. As with
+    /// FindDirectoryEntry(), the inode number is 0 if the name does
+    /// not exist.
+    auto LookupDentry(InodeNumberType Parent, std::string_view Name) -> std::optional<LinkedDirEntryHeader>;
+
+    /// Build the status of an inode.
+    auto MakeStat(InodeNumberType InodeNumber, const Inode& I) -> struct stat;
+
+    /// Check whether a block group contains a copy of the superblock
+    /// and the block group descriptor table.
+    [[nodiscard]] bool GroupHasSuperblock(u32 BlockGroupIndex) const;
+
     /// Get a descriptor table from a block group index.
     auto ReadDescriptorTable(u32 BlockGroupIndex) -> std::optional<BlockGroupDescriptor>;
 
+    /// Get an inode from the inode cache, reading it if it isn’t cached.
+    auto PinInode(InodeNumberType InodeNumber) -> std::shared_ptr<CachedInode>;
+
     /// Get an Inode from an Inode number.
     auto ReadInode(InodeNumberType InodeNumber) -> std::optional<Inode>;
 
+    /// Get a copy of a cached inode.
+    auto ReadInode(const CachedInode& Pinned) -> Inode;
+
+    /// Get the largest size a file on this drive can have.
+    [[nodiscard]] auto MaxFileSize() const -> u64;
+
+    /// Map a run of logical blocks of an inode that are holes to newly
+    /// allocated blocks. Returns the first block and the number of blocks
+    /// mapped, which may be less than Count.
+    auto MapNewBlocks(WriteState& S, Inode& I, u64 Logical, u64 Count, u64 Goal) -> std::optional<std::pair<u64, u64>>;
+
+    /// Copy the delayed data of an inode over data read from a range of
+    /// the inode. DelayedLock must be held.
+    void OverlayDelayed(InodeNumberType InodeNumber, u64 Offset, std::span<const iovec> Iov, usz Size);
+
+    /// Get the block bitmap of a block group, loading it if necessary.
+    auto LoadBlockBitmap(u32 BlockGroupIndex) -> std::vector<u8>*;
+
+    /// Get a view of an inode without copying it.
+    auto InodeView(InodeNumberType InodeNumber) -> BlockRef;
+
+    /// Get a view of inode data at an offset relative to the beginning of the
+    /// inode. The range must not cross a block boundary and must not be a hole.
+    auto InodeDataView(const BlockMap& Map, usz Offset, usz Size) -> BlockRef;
+
+    /// Free the preallocated blocks of an inode.
+    bool ReleasePrealloc(WriteState& S);
+
+    /// Cache a copy of a block map for an inode that has grown without
+    /// getting any new blocks. Blocks past the end of a map are holes,
+    /// so nothing else changes.
+    void ResizeBlockMap(InodeNumberType InodeNumber, const BlockMap& Map, u64 Size);
+
+    /// Write back too much dirty data ourselves, or wake the flusher
+    /// thread if there is enough of it.
+    void ThrottleWrites();
+
+    /// Queue a block to be freed, merging it with the previous one
+    /// if they are consecutive. Freeing is deferred until a block is
+    /// queued that doesn’t follow the pending run.
+    bool QueueFree(std::pair<u64, u64>& Pending, u64 Block);
+
+    /// Point Count consecutive blocks of an inode, starting at a logical
+    /// block, to consecutive blocks starting at Physical, allocating any
+    /// indirect blocks that are missing. Returns the number of blocks
+    /// that were mapped, which is less than Count only on error.
+    auto SetBlockPointers(Inode& I, u64 Logical, u64 Physical, u64 Count) -> u64;
+
+    /// Free every block of a subtree of the block tree of an inode that
+    /// maps data at or past logical block Keep, along with the indirect
+    /// blocks that no longer map anything. Level 0 is a data block. First
+    /// is the first logical block mapped by the subtree. The pointer is
+    /// set to 0 if the subtree is freed entirely.
+    bool TruncateBranch(Inode& I, u32& Block, u32 Level, u64 First, u64 Keep, std::pair<u64, u64>& Pending);
+
+    /// Set bits in the block bitmap of a group and adjust the free block
+    /// counts by the number of bits that actually changed.
+    bool UpdateBlockBitmap(u32 BlockGroupIndex, u64 FirstBit, u64 Count, bool Used);
+
+    /// Add the blocks referenced by an indirect block at some level of
+    /// indirection to a block map.
+    bool MapIndirectBlock(BlockMap& Map, u64 Block, u32 Level, u64& Remaining) {
+        return (this->*Ops.MapIndirectBlock)(Map, Block, Level, Remaining);
+    }
+
+    /// Implementations of MapIndirectBlock() and ReadInodeDataV() for
+    /// drives whose blocks are 1 << Shift bytes large, or for any block
+    /// size if Shift is 0.
+    template <u32 Shift>
+    bool MapIndirectBlockFor(BlockMap& Map, u64 Block, u32 Level, u64& Remaining);
+
+    template <u32 Shift>
+    bool ReadInodeDataVFor(const BlockMap& Map, u64 Offset, std::span<const iovec> Iov, usz Size);
+
+    /// Pick the implementations for a block size, given as its log2.
+    static auto SelectBlockOps(u32 Shift) -> BlockOps;
+
+    /// Hint how blocks of an inode are going to be accessed.
+    void AdviseInodeData(const BlockMap& Map, u64 FirstBlock, u64 Count, AccessPattern Pattern);
+
+    /// Start loading blocks of an inode into the cache in the background.
+    void PrefetchInodeData(const BlockMap& Map, u64 FirstBlock, u64 Count);
+
     /// Read inode data at an offset relative to the beginning of the inode.
     /// This function does not perform bounds checking on the inode data.
-    bool ReadInodeData(Inode& Inode, usz Offset, void* Buffer, usz Size);
+    bool ReadInodeData(const BlockMap& Map, usz Offset, void* Buffer, usz Size);
+
+    /// Copy inode data to a file descriptor without copying it through
+    /// userspace where possible. Returns the number of bytes transferred.
+    auto TransferInodeData(const BlockMap& Map, u64 Offset, FdType Out, usz Size) -> std::optional<usz>;
+
+    /// Read Size bytes of inode data into several buffers, in order. The
+    /// buffers must be large enough to hold Size bytes.
+    bool ReadInodeDataV(const BlockMap& Map, u64 Offset, std::span<const iovec> Iov, usz Size) {
+        return (this->*Ops.ReadInodeDataV)(Map, Offset, Iov, Size);
+    }
+
+    /// Update the access time of an inode. If Lazy is set, the update is
+    /// kept in the inode cache as it is with LazyTime.
+    void UpdateAtime(InodeNumberType InodeNumber, CachedInode& Pinned, bool Lazy = false);
+
+    /// Write back all delayed data, the superblock, and all dirty blocks.
+    /// The write lock must be held.
+    bool WriteBackAll();
+
+    /// Write back the superblock and all dirty blocks, but not delayed
+    /// data. The write lock must be held.
+    bool WriteBackBlocks();
+
+    /// Write back inodes whose timestamps have changed lazily.
+    bool WriteBackInodes();
 
     /// Write a descriptor table to a block group index.
     bool WriteDescriptorTable(u32 BlockGroupIndex, const BlockGroupDescriptor&);
@@ -323,6 +1382,17 @@ class Drive final {
     /// Write an Inode to an Inode number.
     bool WriteInode(InodeNumberType InodeNumber, const Inode&);
 
+    /// Default readahead window of new file handles.
+    usz ReadaheadBlocks;
+
+    /// How timestamps are updated. See MountOptions.
+    AtimeUpdate Atime;
+    bool LazyTime;
+
+    /// Whether the drive is mounted read-only. Cached inodes never change
+    /// then, so they can be read without locking.
+    bool ReadOnly;
+
     /// Weak pointer to this.
     std::weak_ptr<Drive> This;
 
@@ -336,17 +1406,120 @@ public:
     Drive& operator=(const Drive&) = delete;
     Drive& operator=(Drive&&) = delete;
 
+    /// Get the block cache statistics.
+    [[nodiscard]] auto CacheStats() -> BlockCache::Statistics { return Cache.Stats(); }
+
+    /// Get the device requests and cache lookups the drive has performed
+    /// so far, by kind. Reads from a mapped device don’t go through either
+    /// and aren’t counted.
+    [[nodiscard]] auto Stats() -> IoStatistics { return Device->Statistics().Snapshot(); }
+
     /// Open a directory.
     auto OpenDir(std::string_view FilePath, std::string_view origin = "") -> std::unique_ptr<Dir>;
 
     /// Open a file.
     auto OpenFile(std::string_view FilePath, std::string_view origin = "") -> std::unique_ptr<File>;
 
+    /// Look up the inode number of a path. Relative paths are resolved
+    /// against Origin, which must be absolute.
+    auto InodeFromPath(std::string_view FilePath, std::string_view Origin = "") -> std::optional<InodeNumberType>;
+
+    /// Look up the inode numbers of many paths at once. The paths are merged
+    /// into a tree, so each directory is read only once no matter how many
+    /// of the paths go through it, and all names sought in a directory are
+    /// matched in a single pass over it; independent subtrees are resolved
+    /// in parallel. For indexed directories in which only a few names are
+    /// sought, the index is used instead. Paths are looked up in the namespace
+    /// index first if there is one. This bypasses the dentry cache
+    /// and sets no error codes; paths that can’t be resolved, for whatever
+    /// reason, are simply nullopt.
+    auto ResolveMany(
+        std::span<const std::string_view> Paths,
+        std::string_view Origin = "",
+        const ResolveOptions& Options = {}
+    ) -> std::vector<std::optional<InodeNumberType>>;
+
+    /// Asynchronous versions of InodeFromPath(), OpenDir(), OpenFile(), and
+    /// Stat(). The tasks suspend while they wait for the device instead of
+    /// blocking, so one thread can keep many lookups in flight; it resumes
+    /// them by calling Poll(). Blocks that are cached are used without
+    /// suspending. Lookups in indexed directories fetch the root, interior
+    /// nodes, and leaves of the index one level at a time. Block maps that
+    /// have to be rebuilt while their blocks are being evicted are still
+    /// read synchronously. AsyncStat() doesn’t write the inode to update its
+    /// access time; the update is kept in the inode cache and written back
+    /// as with LazyTime.
+    auto AsyncInodeFromPath(std::string FilePath, std::string Origin = "") -> Task<std::optional<InodeNumberType>>;
+    auto AsyncOpenDir(std::string FilePath, std::string Origin = "") -> Task<std::unique_ptr<Dir>>;
+    auto AsyncOpenFile(std::string FilePath, std::string Origin = "") -> Task<std::unique_ptr<File>>;
+    auto AsyncStat(std::string FilePath, std::string Origin = "") -> Task<std::optional<struct stat>>;
+
+    /// Resume the tasks of the asynchronous API whose I/O has completed. If
+    /// Wait is true and there are none, wait for I/O to complete first.
+    /// Tasks are only ever resumed by this, on the thread that calls it, and
+    /// it must not be called by several threads at once. Returns the number
+    /// of times a task was resumed.
+    auto Poll(bool Wait) -> usz;
+
+    /// Check whether the drive is mounted read-only.
+    [[nodiscard]] bool IsReadOnly() const { return ReadOnly; }
+
+    /// Write back all dirty data and wait until it has reached stable
+    /// storage. Blocks are allocated for delayed data first.
+    bool Sync();
+
     /// Stat an inode.
     auto Stat(std::string_view FilePath, std::string_view origin = "") -> std::optional<struct stat>;
 
-    /// Try to mount a drive.
-    static auto TryMount(FdType Fd) -> std::shared_ptr<Drive>;
+    /// Count free blocks and inodes by scanning every bitmap, and check
+    /// the free counts in the descriptor table against them. The counts
+    /// returned are those of the bitmaps. Blocks of delayed writes count
+    /// as used.
+    auto StatFs() -> std::optional<FsStatistics>;
+
+    /// Callback for Walk().
+    using WalkCallback = std::function<void(std::string_view Path, InodeNumberType InodeNumber, const struct stat& St)>;
+
+    /// Visit every file and directory below a directory, scanning directories
+    /// in parallel. The callback is called concurrently from several threads
+    /// and must be thread-safe; the path is only valid during the call. This
+    /// does not update access times. Returns false if any directory could not
+    /// be read; the rest of the tree is still visited.
+    bool Walk(std::string_view Root, const WalkCallback& Callback, const WalkOptions& Options = {});
+
+    /// Callback for ScanGroup() and ScanInodes().
+    using InodeCallback = std::function<void(InodeNumberType InodeNumber, const Inode& I)>;
+
+    /// Visit every inode that is marked as used in the inode bitmap of a
+    /// block group, in on-disk order. This includes the reserved inodes.
+    /// The inode table is read in large sequential chunks, and chunks that
+    /// contain no used inodes are skipped. The inode is only valid during
+    /// the call.
+    bool ScanGroup(u32 BlockGroupIndex, const InodeCallback& Callback);
+
+    /// Scan all block groups, several at once. The callback is called
+    /// concurrently from several threads and must be thread-safe. Returns
+    /// false if any group could not be read; the others are still scanned.
+    bool ScanInodes(const InodeCallback& Callback, const ScanOptions& Options = {});
+
+    /// Record every path on the drive and the block maps of all files
+    /// and directories in a namespace index that later mounts can use
+    /// through MountOptions::NamespaceIndexPath. The drive must be mounted
+    /// read-only so that nothing changes after the index is written; the
+    /// index is tied to the superblock, so mounting the drive for writing
+    /// anywhere makes it stale.
+    bool WriteNamespaceIndex(std::string_view Path, const WalkOptions& Options = {});
+
+    /// Try to mount a drive. This takes ownership of the file descriptor.
+    /// Drives mounted read-only are mapped into memory if possible.
+    static auto TryMount(FdType Fd, const MountOptions& Options = {}) -> std::shared_ptr<Drive>;
+
+    /// Try to mount a drive on a block device.
+    static auto TryMount(std::unique_ptr<BlockDevice> Device, const MountOptions& Options = {}) -> std::shared_ptr<Drive>;
+
+    /// Try to mount an image file by mapping it into memory. The file is
+    /// opened read-only if the drive is mounted read-only.
+    static auto TryMountMapped(std::string_view Path, const MountOptions& Options = {}) -> std::shared_ptr<Drive>;
 };
 
 } // namespace Ext2
@@ -0,0 +1,206 @@
+#include <bit>
+#include <ext2++/bits/bitmap.hh>
+
+#if defined(__x86_64__) or defined(__i386__)
+#    define EXT2XX_BITMAP_AVX2 1
+#    include <immintrin.h>
+#elif defined(__aarch64__)
+#    define EXT2XX_BITMAP_NEON 1
+#    include <arm_neon.h>
+#endif
+
+namespace Ext2 {
+/// ===========================================================================
+///  Bitmap kernels.
+/// ===========================================================================
+namespace {
+using detail::BitmapKernels;
+
+auto PopcountScalar(const u8* Data, usz N) -> u64 {
+    u64 Total = 0;
+    usz I = 0;
+    for (; I + sizeof(u64) <= N; I += sizeof(u64)) {
+        u64 Word;
+        std::memcpy(&Word, Data + I, sizeof Word);
+        Total += u64(std::popcount(Word));
+    }
+
+    for (; I < N; I++) Total += u64(std::popcount(Data[I]));
+    return Total;
+}
+
+auto FindNotByteScalar(const u8* Data, usz N, u8 Byte) -> usz {
+    const u64 Pattern = 0x0101'0101'0101'0101 * Byte;
+    usz I = 0;
+    for (; I + sizeof(u64) <= N; I += sizeof(u64)) {
+        u64 Word;
+        std::memcpy(&Word, Data + I, sizeof Word);
+        if (Word == Pattern) continue;
+
+        /// The first differing byte is the lowest one in memory.
+        const u64 Diff = Word ^ Pattern;
+        if constexpr (std::endian::native == std::endian::little) return I + usz(std::countr_zero(Diff)) / 8;
+        else return I + usz(std::countl_zero(Diff)) / 8;
+    }
+
+    for (; I < N; I++)
+        if (Data[I] != Byte) return I;
+    return N;
+}
+
+constexpr BitmapKernels SCALAR_KERNELS{"scalar", PopcountScalar, FindNotByteScalar};
+
+#ifdef EXT2XX_BITMAP_AVX2
+/// Count bits with a nibble lookup table and sum the counts of each
+/// 8 bytes with vpsadbw.
+[[gnu::target("avx2")]] auto PopcountAvx2(const u8* Data, usz N) -> u64 {
+    const __m256i Lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const __m256i LowNibbles = _mm256_set1_epi8(0x0F);
+    __m256i Sums = _mm256_setzero_si256();
+    usz I = 0;
+    for (; I + sizeof(__m256i) <= N; I += sizeof(__m256i)) {
+        auto V = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Data + I));
+        auto Low = _mm256_shuffle_epi8(Lookup, _mm256_and_si256(V, LowNibbles));
+        auto High = _mm256_shuffle_epi8(Lookup, _mm256_and_si256(_mm256_srli_epi16(V, 4), LowNibbles));
+        Sums = _mm256_add_epi64(Sums, _mm256_sad_epu8(_mm256_add_epi8(Low, High), _mm256_setzero_si256()));
+    }
+
+    alignas(32) u64 Lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(Lanes), Sums);
+    return Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3] + PopcountScalar(Data + I, N - I);
+}
+
+[[gnu::target("avx2")]] auto FindNotByteAvx2(const u8* Data, usz N, u8 Byte) -> usz {
+    const __m256i Pattern = _mm256_set1_epi8(char(Byte));
+    usz I = 0;
+    for (; I + sizeof(__m256i) <= N; I += sizeof(__m256i)) {
+        auto V = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Data + I));
+        auto Differs = ~u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(V, Pattern)));
+        if (Differs) return I + usz(std::countr_zero(Differs));
+    }
+
+    return I + FindNotByteScalar(Data + I, N - I, Byte);
+}
+
+constexpr BitmapKernels AVX2_KERNELS{"avx2", PopcountAvx2, FindNotByteAvx2};
+#endif
+
+#ifdef EXT2XX_BITMAP_NEON
+auto PopcountNeon(const u8* Data, usz N) -> u64 {
+    u64 Total = 0;
+    usz I = 0;
+    for (; I + 16 <= N; I += 16) Total += vaddlvq_u8(vcntq_u8(vld1q_u8(Data + I)));
+    return Total + PopcountScalar(Data + I, N - I);
+}
+
+auto FindNotByteNeon(const u8* Data, usz N, u8 Byte) -> usz {
+    const uint8x16_t Pattern = vdupq_n_u8(Byte);
+    usz I = 0;
+    for (; I + 16 <= N; I += 16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(Data + I), Pattern)) != 0xFF)
+            return I + FindNotByteScalar(Data + I, 16, Byte);
+    }
+
+    return I + FindNotByteScalar(Data + I, N - I, Byte);
+}
+
+constexpr BitmapKernels NEON_KERNELS{"neon", PopcountNeon, FindNotByteNeon};
+#endif
+
+auto Kernels() -> const BitmapKernels& {
+    static const BitmapKernels& Selected = *detail::AvailableBitmapKernels().back();
+    return Selected;
+}
+
+bool TestBit(std::span<const u8> Bits, u64 Bit) {
+    return (Bits[usz(Bit / 8)] >> (Bit % 8)) & 1;
+}
+
+/// Find the first bit in [First, End) that is equal to Value.
+auto Find(std::span<const u8> Bits, u64 First, u64 End, bool Value) -> u64 {
+    for (; First < End and First % 8; First++)
+        if (TestBit(Bits, First) == Value) return First;
+    if (First >= End) return End;
+
+    /// Skip whole bytes that don’t contain such a bit. After that, we’re
+    /// either at a byte that does or in the last, partial byte.
+    const auto Bytes = usz((End - First) / 8);
+    First += u64(Kernels().FindNotByte(Bits.data() + First / 8, Bytes, Value ? 0x00 : 0xFF)) * 8;
+    for (; First < End; First++)
+        if (TestBit(Bits, First) == Value) return First;
+    return End;
+}
+} // namespace
+
+/// ===========================================================================
+///  Bitmap operations.
+/// ===========================================================================
+auto BitmapCount(std::span<const u8> Bits, u64 First, u64 End) -> u64 {
+    u64 Total = 0;
+    for (; First < End and First % 8; First++) Total += TestBit(Bits, First);
+    if (First >= End) return Total;
+
+    const auto Bytes = usz((End - First) / 8);
+    Total += Kernels().Popcount(Bits.data() + First / 8, Bytes);
+    for (First += u64(Bytes) * 8; First < End; First++) Total += TestBit(Bits, First);
+    return Total;
+}
+
+auto BitmapFindClear(std::span<const u8> Bits, u64 First, u64 End) -> u64 {
+    return Find(Bits, First, End, false);
+}
+
+auto BitmapFindSet(std::span<const u8> Bits, u64 First, u64 End) -> u64 {
+    return Find(Bits, First, End, true);
+}
+
+auto BitmapFindClearRun(std::span<const u8> Bits, u64 First, u64 End, u64 Length) -> u64 {
+    while (First < End) {
+        auto Start = BitmapFindClear(Bits, First, End);
+        if (End - Start < Length) return End;
+
+        /// The run is long enough unless there is a used bit in it, in
+        /// which case the next run starts after that bit at the earliest.
+        auto Used = BitmapFindSet(Bits, Start, Start + Length);
+        if (Used == Start + Length) return Start;
+        First = Used + 1;
+    }
+
+    return End;
+}
+
+void BitmapFill(std::span<u8> Bits, u64 First, u64 End, bool Value) {
+    auto Assign = [&](u64 Bit) {
+        const u8 Mask = u8(1u << (Bit % 8));
+        auto& Byte = Bits[usz(Bit / 8)];
+        Byte = u8(Value ? Byte | Mask : Byte & ~Mask);
+    };
+
+    for (; First < End and First % 8; First++) Assign(First);
+    if (First >= End) return;
+
+    const auto Bytes = usz((End - First) / 8);
+    std::memset(Bits.data() + First / 8, Value ? 0xFF : 0x00, Bytes);
+    for (First += u64(Bytes) * 8; First < End; First++) Assign(First);
+}
+
+auto BitmapImplementation() -> std::string_view {
+    return Kernels().Name;
+}
+
+auto detail::AvailableBitmapKernels() -> std::span<const BitmapKernels* const> {
+    static const auto Available = [] {
+        std::vector<const BitmapKernels*> Supported{&SCALAR_KERNELS};
+#if defined(EXT2XX_BITMAP_AVX2)
+        if (__builtin_cpu_supports("avx2")) Supported.push_back(&AVX2_KERNELS);
+#elif defined(EXT2XX_BITMAP_NEON)
+        Supported.push_back(&NEON_KERNELS);
+#endif
+        return Supported;
+    }();
+    return Available;
+}
+} // namespace Ext2
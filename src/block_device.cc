@@ -0,0 +1,612 @@
+#include <climits>
+#include <ext2++/block_device.hh>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Ext2 {
+
+/// ===========================================================================
+///  I/O helpers.
+/// ===========================================================================
+namespace {
+/// Wrapper around pread.
+isz ReadReentrant(FdType fd, void* Dest, usz Size, u64 Offs) {
+    auto* DestPtr = reinterpret_cast<u8*>(Dest);
+    const usz Sz = Size;
+    while (Size > 0) {
+        auto BytesRead = pread64(fd, DestPtr, Size, off64_t(Offs));
+        if (BytesRead < 0) {
+            if (errno == EINTR or errno == EAGAIN) continue;
+            return BytesRead;
+        }
+        if (BytesRead == 0) return isz(Sz - Size);
+        DestPtr += BytesRead;
+        Offs += u64(BytesRead);
+        Size -= usz(BytesRead);
+    }
+    return isz(Sz);
+}
+
+/// Wrapper around pwrite.
+isz WriteReentrant(FdType fd, const void* Src, usz Size, u64 Offs) {
+    auto* SrcPtr = static_cast<const u8*>(Src);
+    const usz Sz = Size;
+    while (Size > 0) {
+        auto BytesWritten = pwrite64(fd, SrcPtr, Size, off64_t(Offs));
+        if (BytesWritten < 0) {
+            if (errno == EINTR or errno == EAGAIN) continue;
+            return BytesWritten;
+        }
+        if (BytesWritten == 0) return isz(Sz - Size);
+        SrcPtr += BytesWritten;
+        Offs += u64(BytesWritten);
+        Size -= usz(BytesWritten);
+    }
+    return isz(Sz);
+}
+
+/// Read data from a file.
+bool FdRead(FdType Fd, u64 Offs, void* Dest, usz Size) {
+    auto BytesRead = ReadReentrant(Fd, Dest, Size, Offs);
+    if (BytesRead < 0) {
+        Log("Failed to read from file: {}", strerror(errno));
+        return false;
+    }
+    if (usz(BytesRead) != Size) {
+        Log("Failed to read from file: Unexpected EOF");
+        return false;
+    }
+    return true;
+}
+
+/// Read data from a file into several buffers.
+bool FdReadV(FdType Fd, u64 Offs, iovec* Iov, usz Count) {
+    while (Count > 0) {
+        auto BytesRead = preadv64(Fd, Iov, int(std::min<usz>(Count, IOV_MAX)), off64_t(Offs));
+        if (BytesRead < 0) {
+            if (errno == EINTR or errno == EAGAIN) continue;
+            Log("Failed to read from file: {}", strerror(errno));
+            return false;
+        }
+        if (BytesRead == 0) {
+            Log("Failed to read from file: Unexpected EOF");
+            return false;
+        }
+
+        /// Skip the buffers that have been filled.
+        Offs += u64(BytesRead);
+        auto Remaining = usz(BytesRead);
+        while (Count > 0 and Remaining >= Iov->iov_len) {
+            Remaining -= Iov->iov_len;
+            Iov++;
+            Count--;
+        }
+
+        /// Partial read into the current buffer.
+        if (Count > 0) {
+            Iov->iov_base = static_cast<u8*>(Iov->iov_base) + Remaining;
+            Iov->iov_len -= Remaining;
+        }
+    }
+    return true;
+}
+
+/// Write data to a file.
+bool FdWrite(FdType Fd, u64 Offs, void const* Src, usz Size) {
+    auto BytesWritten = WriteReentrant(Fd, Src, Size, Offs);
+    if (BytesWritten < 0 or usz(BytesWritten) != Size) {
+        Log("Failed to write to file: {}", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/// Write several buffers to a file.
+bool FdWriteV(FdType Fd, u64 Offs, const iovec* Iov, usz Count) {
+    for (usz i = 0; i < Count; i++) {
+        if (not FdWrite(Fd, Offs, Iov[i].iov_base, Iov[i].iov_len)) return false;
+        Offs += Iov[i].iov_len;
+    }
+    return true;
+}
+
+} // namespace
+
+/// ===========================================================================
+///  Generic device.
+/// ===========================================================================
+bool BlockDevice::Submit(std::span<IoRequest> Requests) {
+    bool Ok = true;
+    for (auto& R : Requests) {
+        R.Ok = R.Op == IoRequest::Kind::Read
+                 ? ReadV(R.Offset, R.Iov, R.Count)
+                 : WriteV(R.Offset, R.Iov, R.Count);
+        Ok = Ok and R.Ok;
+    }
+    return Ok;
+}
+
+bool BlockDevice::SubmitAsync(std::span<IoRequest> Requests, Completion Done) {
+    Done(Submit(Requests));
+    return true;
+}
+
+bool AsyncSubmit::await_suspend(std::coroutine_handle<> Handle) {
+    /// State is 0 until either the batch has completed (2) or we have
+    /// decided to suspend (1). Whoever comes second resumes the coroutine,
+    /// so it is never resumed from inside SubmitAsync().
+    enum : u8 { Pending, Suspended, Completed };
+    Awaiting = Handle;
+    IoScope Scope{Kind};
+    Device.SubmitAsync(Requests, [this](bool Done) {
+        Ok = Finish ? Finish(Done) : Done;
+        if (State.exchange(Completed, std::memory_order_acq_rel) == Suspended) Queue.Push(Awaiting);
+    });
+    return State.exchange(Suspended, std::memory_order_acq_rel) != Completed;
+}
+
+bool BlockDevice::WriteV(u64 Offset, const iovec* Iov, usz Count) {
+    for (usz i = 0; i < Count; i++) {
+        if (not Write(Offset, Iov[i].iov_base, Iov[i].iov_len)) return false;
+        Offset += Iov[i].iov_len;
+    }
+    return true;
+}
+
+/// ===========================================================================
+///  File descriptor device.
+/// ===========================================================================
+FdBlockDevice::~FdBlockDevice() {
+    if (Fd >= 0) close(Fd);
+}
+
+bool FdBlockDevice::Flush() {
+    if (fdatasync(Fd) == 0) return true;
+    Log("Failed to sync file: {}", strerror(errno));
+    return false;
+}
+
+bool FdBlockDevice::Read(u64 Offset, void* Dest, usz Size) { return FdRead(Fd, Offset, Dest, Size); }
+bool FdBlockDevice::ReadV(u64 Offset, iovec* Iov, usz Count) { return FdReadV(Fd, Offset, Iov, Count); }
+bool FdBlockDevice::Write(u64 Offset, const void* Src, usz Size) { return FdWrite(Fd, Offset, Src, Size); }
+bool FdBlockDevice::WriteV(u64 Offset, const iovec* Iov, usz Count) { return FdWriteV(Fd, Offset, Iov, Count); }
+
+/// ===========================================================================
+///  Monitored device.
+/// ===========================================================================
+namespace {
+/// Total size of the buffers of a request.
+auto RequestSize(const iovec* Iov, usz Count) -> u64 {
+    u64 Size = 0;
+    for (usz i = 0; i < Count; i++) Size += Iov[i].iov_len;
+    return Size;
+}
+
+auto RequestKind(const IoRequest& R) -> IoKind {
+    return R.Op == IoRequest::Kind::Write ? IoKind::Write : IoScope::Current();
+}
+} // namespace
+
+bool MonitoredBlockDevice::Read(u64 Offset, void* Dest, usz Size) {
+    return Track(IoScope::Current(), Offset, Size, [&] { return Inner->Read(Offset, Dest, Size); });
+}
+
+bool MonitoredBlockDevice::ReadV(u64 Offset, iovec* Iov, usz Count) {
+    return Track(IoScope::Current(), Offset, RequestSize(Iov, Count), [&] { return Inner->ReadV(Offset, Iov, Count); });
+}
+
+bool MonitoredBlockDevice::Submit(std::span<IoRequest> Requests) {
+    /// The requests of a batch are in flight together, so they all
+    /// get the latency of the whole batch. The device may modify the
+    /// buffer lists, so take the sizes first.
+    std::vector<u64> Sizes(Requests.size());
+    for (usz i = 0; i < Requests.size(); i++) {
+        auto& R = Requests[i];
+        Sizes[i] = RequestSize(R.Iov, R.Count);
+        if (Trace) Trace({RequestKind(R), R.Offset, Sizes[i], false, false, {}});
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    bool Ok = Inner->Submit(Requests);
+    auto Latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start);
+    for (usz i = 0; i < Requests.size(); i++) {
+        auto& R = Requests[i];
+        auto Kind = RequestKind(R);
+        Counters.RecordRequest(Kind, Sizes[i], Latency, R.Ok);
+        if (Trace) Trace({Kind, R.Offset, Sizes[i], true, R.Ok, Latency});
+    }
+    return Ok;
+}
+
+bool MonitoredBlockDevice::SubmitAsync(std::span<IoRequest> Requests, Completion Done) {
+    /// The completion may run on another thread, so remember
+    /// what the requests are for now.
+    struct Info {
+        IoKind Kind;
+        u64 Offset;
+        u64 Size;
+    };
+
+    std::vector<Info> Infos(Requests.size());
+    for (usz i = 0; i < Requests.size(); i++) {
+        auto& R = Requests[i];
+        Infos[i] = {RequestKind(R), R.Offset, RequestSize(R.Iov, R.Count)};
+        if (Trace) Trace({Infos[i].Kind, R.Offset, Infos[i].Size, false, false, {}});
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    return Inner->SubmitAsync(Requests, [this, Requests, Infos = std::move(Infos), Start, Done = std::move(Done)](bool Ok) {
+        auto Latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start);
+        for (usz i = 0; i < Infos.size(); i++) {
+            auto& I = Infos[i];
+            Counters.RecordRequest(I.Kind, I.Size, Latency, Requests[i].Ok);
+            if (Trace) Trace({I.Kind, I.Offset, I.Size, true, Requests[i].Ok, Latency});
+        }
+        Done(Ok);
+    });
+}
+
+bool MonitoredBlockDevice::Write(u64 Offset, const void* Src, usz Size) {
+    return Track(IoKind::Write, Offset, Size, [&] { return Inner->Write(Offset, Src, Size); });
+}
+
+bool MonitoredBlockDevice::WriteV(u64 Offset, const iovec* Iov, usz Count) {
+    return Track(IoKind::Write, Offset, RequestSize(Iov, Count), [&] { return Inner->WriteV(Offset, Iov, Count); });
+}
+
+/// ===========================================================================
+///  Memory-mapped device.
+/// ===========================================================================
+MappedBlockDevice::~MappedBlockDevice() { munmap(Base, Length); }
+
+void MappedBlockDevice::Advise(u64 Offset, u64 Size, AccessPattern Pattern) {
+    if (Offset >= Length) return;
+    Size = std::min(Size, Length - Offset);
+
+    /// madvise() requires a page-aligned address.
+    static const u64 PageSize = u64(sysconf(_SC_PAGESIZE));
+    auto Start = Offset & ~(PageSize - 1);
+    auto Advice = [&] {
+        switch (Pattern) {
+            case AccessPattern::Normal: return MADV_NORMAL;
+            case AccessPattern::Sequential: return MADV_SEQUENTIAL;
+            case AccessPattern::Random: return MADV_RANDOM;
+            case AccessPattern::WillNeed: return MADV_WILLNEED;
+        }
+        return MADV_NORMAL;
+    }();
+
+    if (madvise(Base + Start, Size + (Offset - Start), Advice) != 0)
+        LogAt<LogLevel::Warning>("madvise() failed: {}", strerror(errno));
+}
+
+auto MappedBlockDevice::Map(u64 Offset, usz Size) const -> const u8* {
+    if (Offset > Length or Size > Length - Offset) return nullptr;
+    return Base + Offset;
+}
+
+bool MappedBlockDevice::Read(u64 Offset, void* Dest, usz Size) {
+    auto Src = Map(Offset, Size);
+    if (not Src) {
+        Log("Failed to read from file: Unexpected EOF");
+        return false;
+    }
+
+    std::memcpy(Dest, Src, Size);
+    return true;
+}
+
+bool MappedBlockDevice::ReadV(u64 Offset, iovec* Iov, usz Count) {
+    for (usz i = 0; i < Count; i++) {
+        if (not Read(Offset, Iov[i].iov_base, Iov[i].iov_len)) return false;
+        Offset += Iov[i].iov_len;
+    }
+    return true;
+}
+
+auto MappedBlockDevice::Open(FdType Fd) -> std::unique_ptr<MappedBlockDevice> {
+    struct stat St {};
+    if (fstat(Fd, &St) != 0) {
+        Log("Failed to stat image: {}", strerror(errno));
+        return nullptr;
+    }
+
+    /// Block devices report a size of 0; ask the device instead.
+    u64 Length = u64(St.st_size);
+    if (S_ISBLK(St.st_mode)) {
+        auto End = lseek64(Fd, 0, SEEK_END);
+        if (End < 0) {
+            Log("Failed to determine device size: {}", strerror(errno));
+            return nullptr;
+        }
+        Length = u64(End);
+    }
+
+    if (Length == 0) {
+        Log("Cannot map empty image.");
+        return nullptr;
+    }
+
+    auto Base = mmap(nullptr, Length, PROT_READ, MAP_SHARED, Fd, 0);
+    if (Base == MAP_FAILED) {
+        Log("Failed to map image: {}", strerror(errno));
+        return nullptr;
+    }
+
+    return std::unique_ptr<MappedBlockDevice>{::new MappedBlockDevice(Fd, static_cast<u8*>(Base), Length)};
+}
+
+/// ===========================================================================
+///  io_uring device.
+/// ===========================================================================
+namespace {
+int IoUringSetup(u32 Entries, io_uring_params* Params) {
+    return int(syscall(__NR_io_uring_setup, Entries, Params));
+}
+
+int IoUringEnter(int RingFd, u32 ToSubmit, u32 MinComplete, u32 Flags) {
+    return int(syscall(__NR_io_uring_enter, RingFd, ToSubmit, MinComplete, Flags, nullptr, 0));
+}
+} // namespace
+
+UringBlockDevice::~UringBlockDevice() {
+    /// Wait for outstanding asynchronous batches; the kernel may
+    /// still be writing into their buffers.
+    while (AsyncPending) Poll(true);
+    if (SqeRing.Ptr) munmap(SqeRing.Ptr, SqeRing.Size);
+    if (CqRing.Ptr and CqRing.Ptr != SqRing.Ptr) munmap(CqRing.Ptr, CqRing.Size);
+    if (SqRing.Ptr) munmap(SqRing.Ptr, SqRing.Size);
+    close(RingFd);
+}
+
+void UringBlockDevice::Complete(Pending& P, i32 Result) {
+    (void) P.B->Queued.load(std::memory_order_acquire);
+    auto& R = *P.R;
+    usz Expected = 0;
+    for (usz i = 0; i < R.Count; i++) Expected += R.Iov[i].iov_len;
+
+    /// Finish short or interrupted requests synchronously.
+    if (Result == -EINTR or Result == -EAGAIN) Result = 0;
+    if (Result < 0) {
+        Log("Failed to {} file: {}", R.Op == IoRequest::Kind::Read ? "read from" : "write to", strerror(-Result));
+        R.Ok = false;
+    } else if (usz(Result) == Expected) {
+        R.Ok = true;
+    } else {
+        auto Done = usz(Result);
+        auto Iov = R.Iov;
+        auto Count = R.Count;
+        while (Count > 0 and Done >= Iov->iov_len) {
+            Done -= Iov->iov_len;
+            Iov++;
+            Count--;
+        }
+
+        Iov->iov_base = static_cast<u8*>(Iov->iov_base) + Done;
+        Iov->iov_len -= Done;
+        auto Offset = R.Offset + u64(Result);
+        R.Ok = R.Op == IoRequest::Kind::Read
+                 ? FdReadV(Fd, Offset, Iov, Count)
+                 : FdWriteV(Fd, Offset, Iov, Count);
+    }
+
+    auto& B = *P.B;
+    Outstanding--;
+    B.Ok = B.Ok and R.Ok;
+    if (--B.Remaining == 0 and B.Done) Completed.push_back(&B);
+}
+
+void UringBlockDevice::ReapAvailable() {
+    auto Head = *CqHead;
+    auto Tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+    for (; Head != Tail; Head++) {
+        auto& Cqe = Cqes[Head & CqMask];
+        Complete(*reinterpret_cast<Pending*>(Cqe.user_data), Cqe.res);
+    }
+    __atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+}
+
+bool UringBlockDevice::SubmitBatch(Batch& B) {
+    /// Account for the requests before the kernel can complete them.
+    {
+        std::unique_lock CqGuard{CqLock};
+        Outstanding += B.Requests.size();
+        if (B.Done) AsyncPending++;
+    }
+
+    std::unique_lock Guard{SqLock};
+    u32 ToSubmit = 0;
+    usz InFlight = 0;
+
+    /// Hand the queued entries to the kernel.
+    auto Enter = [&] {
+        while (ToSubmit) {
+            auto Submitted = IoUringEnter(RingFd, ToSubmit, 0, 0);
+            if (Submitted < 0) {
+                if (errno == EINTR) continue;
+
+                /// The completion queue is full; make room and try again.
+                if (errno == EAGAIN or errno == EBUSY) {
+                    Guard.unlock();
+                    Poll(false);
+                    Guard.lock();
+                    continue;
+                }
+
+                Log("Failed to submit I/O requests: {}", strerror(errno));
+                return false;
+            }
+            ToSubmit -= u32(Submitted);
+            InFlight += u32(Submitted);
+        }
+        return true;
+    };
+
+    /// The kernel hasn’t seen the entries we haven’t submitted
+    /// yet, so we can just take them back off the queue and fail
+    /// every request that isn’t in flight.
+    auto Fail = [&] {
+        __atomic_store_n(SqTail, *SqTail - ToSubmit, __ATOMIC_RELEASE);
+        Guard.unlock();
+
+        std::unique_lock CqGuard{CqLock};
+        for (usz i = InFlight; i < B.Requests.size(); i++) B.Requests[i].R->Ok = false;
+        B.Ok = false;
+        B.Remaining -= B.Requests.size() - InFlight;
+        Outstanding -= B.Requests.size() - InFlight;
+        if (B.Remaining == 0 and B.Done) Completed.push_back(&B);
+        return false;
+    };
+
+    for (auto& P : B.Requests) {
+        auto Tail = *SqTail;
+        if (Tail - __atomic_load_n(SqHead, __ATOMIC_ACQUIRE) == SqEntries) {
+            if (not Enter()) return Fail();
+            Tail = *SqTail;
+        }
+
+        auto Index = Tail & SqMask;
+        auto& Sqe = Sqes[Index];
+        std::memset(&Sqe, 0, sizeof Sqe);
+        Sqe.opcode = P.R->Op == IoRequest::Kind::Read ? IORING_OP_READV : IORING_OP_WRITEV;
+        Sqe.fd = Fd;
+        Sqe.off = P.R->Offset;
+        Sqe.addr = reinterpret_cast<u64>(P.R->Iov);
+        Sqe.len = u32(P.R->Count);
+        Sqe.user_data = reinterpret_cast<u64>(&P);
+        SqArray[Index] = Index;
+        B.Queued.fetch_add(1, std::memory_order_release);
+        __atomic_store_n(SqTail, Tail + 1, __ATOMIC_RELEASE);
+        ToSubmit++;
+    }
+
+    return Enter() or Fail();
+}
+
+void UringBlockDevice::WaitFor(Batch& B) {
+    std::unique_lock Guard{CqLock};
+    while (B.Remaining) {
+        /// Only one thread reaps at a time; the others wait for it.
+        if (Reaping) {
+            Reaped.wait(Guard);
+            continue;
+        }
+
+        Reaping = true;
+        ReapAvailable();
+        if (B.Remaining) {
+            Guard.unlock();
+            IoUringEnter(RingFd, 0, 1, IORING_ENTER_GETEVENTS);
+            Guard.lock();
+            ReapAvailable();
+        }
+        Reaping = false;
+        Reaped.notify_all();
+    }
+}
+
+auto UringBlockDevice::Poll(bool Wait) -> usz {
+    std::vector<Batch*> Done;
+    {
+        std::unique_lock Guard{CqLock};
+        while (Reaping) Reaped.wait(Guard);
+        Reaping = true;
+        ReapAvailable();
+        if (Wait and Completed.empty() and AsyncPending) {
+            Guard.unlock();
+            IoUringEnter(RingFd, 0, 1, IORING_ENTER_GETEVENTS);
+            Guard.lock();
+            ReapAvailable();
+        }
+        Reaping = false;
+        Reaped.notify_all();
+        Done.swap(Completed);
+        AsyncPending -= Done.size();
+    }
+
+    /// Run the callbacks without holding any locks.
+    for (auto B : Done) {
+        B->Done(B->Ok);
+        delete B;
+    }
+    return Done.size();
+}
+
+bool UringBlockDevice::Submit(std::span<IoRequest> Requests) {
+    if (Requests.empty()) return true;
+    Batch B{.Requests = {}, .Remaining = Requests.size(), .Ok = true, .Done = {}};
+    B.Requests.reserve(Requests.size());
+    for (auto& R : Requests) B.Requests.push_back({&B, &R});
+
+    /// Even if submission fails partway, some requests may
+    /// already be in flight, so we always have to wait.
+    SubmitBatch(B);
+    WaitFor(B);
+    return B.Ok;
+}
+
+bool UringBlockDevice::SubmitAsync(std::span<IoRequest> Requests, Completion Done) {
+    if (Requests.empty()) {
+        Done(true);
+        return true;
+    }
+
+    auto B = new Batch{.Requests = {}, .Remaining = Requests.size(), .Ok = true, .Done = std::move(Done)};
+    B->Requests.reserve(Requests.size());
+    for (auto& R : Requests) B->Requests.push_back({B, &R});
+    return SubmitBatch(*B);
+}
+
+auto UringBlockDevice::Open(FdType Fd, u32 QueueDepth) -> std::unique_ptr<UringBlockDevice> {
+    io_uring_params Params{};
+    auto RingFd = IoUringSetup(QueueDepth, &Params);
+    if (RingFd < 0) {
+        Log("io_uring is not available: {}", strerror(errno));
+        return nullptr;
+    }
+
+    auto Dev = std::unique_ptr<UringBlockDevice>{::new UringBlockDevice(Fd, RingFd)};
+    auto MapRing = [&](Ring& R, usz Size, u64 Offset) {
+        R.Size = Size;
+        R.Ptr = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, off_t(Offset));
+        if (R.Ptr != MAP_FAILED) return true;
+        R.Ptr = nullptr;
+        Log("Failed to map io_uring: {}", strerror(errno));
+        return false;
+    };
+
+    /// Older kernels need the completion queue mapped separately.
+    usz SqSize = Params.sq_off.array + Params.sq_entries * sizeof(u32);
+    usz CqSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+    bool SingleMap = Params.features & IORING_FEAT_SINGLE_MMAP;
+    if (SingleMap) SqSize = CqSize = std::max(SqSize, CqSize);
+
+    bool Ok = MapRing(Dev->SqRing, SqSize, IORING_OFF_SQ_RING)
+          and (SingleMap ? (Dev->CqRing = Dev->SqRing, true) : MapRing(Dev->CqRing, CqSize, IORING_OFF_CQ_RING))
+          and MapRing(Dev->SqeRing, Params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+
+    /// Don’t close the file descriptor if we fail here.
+    if (not Ok) {
+        Dev->Fd = -1;
+        return nullptr;
+    }
+
+    auto Sq = static_cast<u8*>(Dev->SqRing.Ptr);
+    auto Cq = static_cast<u8*>(Dev->CqRing.Ptr);
+    Dev->SqHead = reinterpret_cast<u32*>(Sq + Params.sq_off.head);
+    Dev->SqTail = reinterpret_cast<u32*>(Sq + Params.sq_off.tail);
+    Dev->SqArray = reinterpret_cast<u32*>(Sq + Params.sq_off.array);
+    Dev->SqMask = *reinterpret_cast<u32*>(Sq + Params.sq_off.ring_mask);
+    Dev->SqEntries = Params.sq_entries;
+    Dev->Sqes = static_cast<io_uring_sqe*>(Dev->SqeRing.Ptr);
+    Dev->CqHead = reinterpret_cast<u32*>(Cq + Params.cq_off.head);
+    Dev->CqTail = reinterpret_cast<u32*>(Cq + Params.cq_off.tail);
+    Dev->CqMask = *reinterpret_cast<u32*>(Cq + Params.cq_off.ring_mask);
+    Dev->Cqes = reinterpret_cast<io_uring_cqe*>(Cq + Params.cq_off.cqes);
+    return Dev;
+}
+
+} // namespace Ext2
@@ -1,108 +1,160 @@
+#include <bit>
+#include <ext2++/bits/bitmap.hh>
 #include <ext2++/core.hh>
+#include <ctime>
+#include <fcntl.h>
+#include <limits>
 #include <optional>
+#include <sys/sendfile.h>
+#include <unistd.h>
 #include <utility>
 
-#define DEBUG_EXT2
-
-#ifdef DEBUG_EXT2
-#    define DEBUG(fmt, ...) Log(fmt, __VA_ARGS__)
-#else
-#    define DEBUG(fmt, ...)
-#endif
 namespace Ext2 {
 
 /// ===========================================================================
 ///  FS Utils.
 /// ===========================================================================
 namespace {
-/// Wrapper around read.
-isz ReadReentrant(FdType fd, void* Dest, usz Size) {
-    auto* DestPtr = reinterpret_cast<u8*>(Dest);
-    const usz Sz = Size;
-    while (Size > 0) {
-        auto BytesRead = read(fd, DestPtr, Size);
-        if (BytesRead < 0) {
-            if (errno == EINTR or errno == EAGAIN) continue;
-            return BytesRead;
-        }
-        if (BytesRead == 0) return isz(Size);
-        DestPtr += BytesRead;
-        Size -= usz(BytesRead);
-    }
-    return isz(Sz);
+/// Remove leading slashes from a path.
+void RemoveLeadingSlashes(std::string_view& Path) {
+    while (not Path.empty() and Path[0] == '/') Path.remove_prefix(1);
 }
 
-/// Wrapper around write.
-isz WriteReentrant(FdType fd, const void* Src, usz Size) {
-    auto* SrcPtr = static_cast<const u8*>(Src);
-    const usz Sz = Size;
-    while (Size > 0) {
-        auto BytesWritten = write(fd, SrcPtr, Size);
-        if (BytesWritten < 0) {
-            if (errno == EINTR or errno == EAGAIN) continue;
-            return BytesWritten;
+/// Build the path that the namespace index stores for a path relative to
+/// an absolute origin: absolute, without repeated or trailing slashes. As
+/// in Drive::InodeFromPath(), a path that ends in more than one slash must
+/// name a directory; Directory is set if that is the case. Returns nothing
+/// if the path contains . or .., which we can’t remove without knowing
+/// whether the components before them are symlinks.
+auto NormalisePath(std::string_view Path, std::string_view Origin, bool& Directory) -> std::optional<std::string> {
+    std::string Result;
+    Result.reserve(Origin.size() + Path.size() + 2);
+    auto Append = [&](std::string_view P) {
+        RemoveLeadingSlashes(P);
+        while (not P.empty()) {
+            auto Slash = P.find('/');
+            auto Component = P.substr(0, Slash);
+            P.remove_prefix(Slash == std::string_view::npos ? P.size() : Slash + 1);
+            Directory = P.starts_with('/');
+            RemoveLeadingSlashes(P);
+            if (Component == "." or Component == "..") return false;
+            Result.push_back('/');
+            Result.append(Component.data(), Component.size());
         }
-        if (BytesWritten == 0) return isz(Size);
-        SrcPtr += BytesWritten;
-        Size -= usz(BytesWritten);
-    }
-    return isz(Sz);
+        return true;
+    };
+
+    Directory = false;
+    if (not Path.starts_with('/') and not Append(Origin)) return std::nullopt;
+    if (not Append(Path)) return std::nullopt;
+    if (Result.empty()) Result.push_back('/');
+    return Result;
 }
 
-/// Read data from a file.
-bool Read(FdType Fd, usz Offs, void* Dest, usz Size) {
-    /// Seek to the offset.
-    if (lseek64(Fd, isz(Offs), SEEK_SET) < 0) {
-        Log("Failed to seek in file: {}", strerror(errno));
-        return false;
-    }
+/// ===========================================================================
+///  Constants and enums.
+/// ===========================================================================
+/// EXT2 magic number.
+constexpr inline usz SUPERBLOCK_OFFSET = 1024;
+constexpr inline u16 EXT2_SUPER_MAGIC = 0xEF53;
+constexpr inline usz DIRECT_BLOCK_COUNT = 12;
+constexpr inline usz INDIRECT_BLOCK_INDEX = 12;
+constexpr inline usz DOUBLY_INDIRECT_BLOCK_INDEX = 13;
+constexpr inline usz TRIPLY_INDIRECT_BLOCK_INDEX = 14;
+constexpr inline InodeNumberType ROOT_INODE_NUMBER = 2;
+
+/// Reads of at least this many blocks bypass the block cache.
+constexpr inline usz DIRECT_READ_BLOCKS = 16;
+
+/// Size of the chunks in which ScanGroup() reads inode tables.
+constexpr inline usz INODE_SCAN_CHUNK_SIZE = 256 * 1024;
+
+/// Maximum number of bytes moved by a single sendfile() or copy_file_range().
+constexpr inline usz MAX_TRANSFER_CHUNK = 0x7fff'f000;
+
+/// i_blocks counts 512-byte sectors, regardless of the block size.
+constexpr inline u64 SECTOR_SIZE = 512;
+
+/// The allocator prefers a run of free blocks this long (or as long as
+/// the allocation, if that is shorter) over the first free block.
+constexpr inline u64 ALLOC_RUN_BLOCKS = 16;
+
+/// Number of blocks preallocated by writes if the superblock doesn’t
+/// specify it. This is what Linux uses.
+constexpr inline u64 DEFAULT_PREALLOC_BLOCKS = 8;
+
+/// Sizes of files that don’t fit in 31 bits need the large_file feature.
+constexpr inline u64 MAX_SMALL_FILE_SIZE = u64(std::numeric_limits<i32>::max());
 
-    /// Read from the file.
-    auto BytesRead = ReadReentrant(Fd, Dest, Size);
-    if (BytesRead < 0) {
-        Log("Failed to read from file: {}", strerror(errno));
+/// Features we support. Drives with other incompatible features can’t be
+/// mounted, and drives with other read-only features only read-only.
+constexpr inline u32 SUPPORTED_INCOMPAT_FEATURES = u32(IncompatFeature::FileType);
+constexpr inline u32 SUPPORTED_RO_FEATURES = u32(RoFeature::SparseSuper) | u32(RoFeature::LargeFile);
+
+/// Inode flag of directories that have an HTree index.
+constexpr inline u32 INDEX_FL = 0x1000;
+
+/// Offsets of the HTree headers in the root and in interior nodes.
+constexpr inline usz DX_ROOT_INFO_OFFSET = 24;
+constexpr inline usz DX_NODE_ENTRIES_OFFSET = 8;
+
+/// Maximum depth of an HTree, including the root.
+constexpr inline usz DX_MAX_LEVELS = 3;
+
+/// Only the lower 24 bits of a block in an index entry are used.
+constexpr inline u32 DX_BLOCK_MASK = 0x00FF'FFFF;
+
+/// Approximate number of blocks read by a lookup in an indexed directory.
+constexpr inline u64 DX_LOOKUP_BLOCKS = 2;
+
+/// Read and validate a directory entry header in a directory block.
+bool ReadDirEntryHeader(const u8* Block, usz BlockSize, usz Offset, LinkedDirEntryHeader& H) {
+    if (Offset + sizeof H > BlockSize) {
+        SetError(ErrorCode::Corrupted);
+        Log("Corrupted directory entry at offset {} of directory block.", Offset);
         return false;
     }
-    if (usz(BytesRead) != Size) {
-        Log("Failed to read from file: Unexpected EOF");
+
+    std::memcpy(&H, Block + Offset, sizeof H);
+    if (H.rec_len < sizeof H or H.rec_len % 4 != 0 or Offset + H.rec_len > BlockSize or sizeof H + H.name_len > H.rec_len) {
+        SetError(ErrorCode::Corrupted);
+        Log("Corrupted directory entry at offset {} of directory block.", Offset);
         return false;
     }
     return true;
 }
 
-/// Write data to a file.
-bool Write(FdType Fd, isz Offs, void const* Src, usz Size) {
-    /// Seek to the offset.
-    if (lseek64(Fd, Offs, SEEK_SET) < 0) {
-        Log("Failed to seek in file: {}", strerror(errno));
-        return false;
-    }
+/// Find a name in a directory block. Returns an entry with inode 0 if
+/// the block doesn’t contain it.
+auto FindEntryInView(const u8* Block, usz BlockSize, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+    for (usz Offset = 0; Offset < BlockSize;) {
+        LinkedDirEntryHeader H;
+        if (not ReadDirEntryHeader(Block, BlockSize, Offset, H)) return {};
 
-    /// Write to the file.
-    auto BytesWritten = WriteReentrant(Fd, Src, Size);
-    if (BytesWritten < 0 or usz(BytesWritten) != Size) {
-        Log("Failed to write to file: {}", strerror(errno));
-        return false;
+        /// Check if the name matches. Entries with inode 0 are unused.
+        auto EntryName = std::string_view{reinterpret_cast<const char*>(Block + Offset + sizeof H), H.name_len};
+        if (H.inode != 0 and EntryName == Name) return H;
+        Offset += H.rec_len;
     }
-    return true;
-}
 
-/// Remove leading slashes from a path.
-void RemoveLeadingSlashes(std::string_view& Path) {
-    while (not Path.empty() and Path[0] == '/') Path.remove_prefix(1);
+    /// Not found.
+    return LinkedDirEntryHeader{};
 }
 
-/// ===========================================================================
-///  Constants and enums.
-/// ===========================================================================
-/// EXT2 magic number.
-constexpr inline usz SUPERBLOCK_OFFSET = 1024;
-constexpr inline u16 EXT2_SUPER_MAGIC = 0xEF53;
-constexpr inline usz DIRECT_BLOCK_COUNT = 12;
-constexpr inline usz INDIRECT_BLOCK_INDEX = 12;
-constexpr inline usz DOUBLY_INDIRECT_BLOCK_INDEX = 13;
-constexpr inline usz TRIPLY_INDIRECT_BLOCK_INDEX = 14;
-constexpr inline InodeNumberType ROOT_INODE_NUMBER = 2;
+/// Convert the file type of a directory entry to a file format.
+auto FileFormatFromEntryType(u8 Type) -> std::optional<Inode::FileFormat> {
+    switch (Type) {
+        case 0: return Inode::Unknown;
+        case 1: return Inode::RegularFile;
+        case 2: return Inode::Directory;
+        case 3: return Inode::CharacterDevice;
+        case 4: return Inode::BlockDevice;
+        case 5: return Inode::Fifo;
+        case 6: return Inode::Socket;
+        case 7: return Inode::SymbolicLink;
+        default: return {};
+    }
+}
 
 template <typename T>
 requires std::is_enum_v<T>
@@ -110,13 +162,808 @@ constexpr inline auto operator&(std::underlying_type_t<T> Lhs, T Rhs) {
     return Lhs & std::underlying_type_t<T>(Rhs);
 }
 
+/// Lookup of a name in an indexed directory. This walks from the root of
+/// the HTree to the leaf that covers the hash of the name, and on to the
+/// next leaves if hashes collide. The caller reads the block that Block()
+/// names and passes it to Step() until Done(), so that the blocks can be
+/// read either synchronously or asynchronously.
+class HTreeLookup {
+    /// A block on the path from the root to a leaf.
+    struct Level {
+        BlockRef Ref;
+        usz EntriesOffset;
+        u16 Count;
+        u16 At;
+
+        [[nodiscard]] auto Get(usz Index) const -> DxEntry {
+            DxEntry E;
+            std::memcpy(&E, Ref.data() + EntriesOffset + Index * sizeof E, sizeof E);
+            return E;
+        }
+
+        [[nodiscard]] auto Child() const -> u64 { return Get(At).block & DX_BLOCK_MASK; }
+    };
+
+    const InodeNumberType InodeNumber;
+    const std::string_view Name;
+    const Superblock& Sb;
+    Level Path[DX_MAX_LEVELS]{};
+
+    /// Number of levels of the index, which is 0 until we’ve read the
+    /// root, and the level that the next block belongs to. If that is
+    /// Depth, the next block is a leaf.
+    usz Depth = 0;
+    usz Next = 0;
+
+    /// Hash of the name, and the hash that the next node is searched
+    /// for, which is 0 when descending to the first leaf below an entry.
+    u32 Hash = 0;
+    u32 ProbeHash = 0;
+
+    u64 NextBlock = 0;
+    bool Finished = false;
+    std::optional<LinkedDirEntryHeader> Found;
+
+public:
+    HTreeLookup(InodeNumberType InodeNumber_, std::string_view Name_, const Superblock& Sb_)
+        : InodeNumber(InodeNumber_), Name(Name_), Sb(Sb_) {}
+
+    /// Check whether the lookup is done, and get its result: nothing on
+    /// error, and an entry with inode 0 if the name isn’t in the index.
+    [[nodiscard]] bool Done() const { return Finished; }
+    [[nodiscard]] auto Result() const -> std::optional<LinkedDirEntryHeader> { return Found; }
+
+    /// Get the block of the directory to read next.
+    [[nodiscard]] auto Block() const -> u64 { return NextBlock; }
+
+    /// Continue the lookup with the block that Block() named.
+    void Step(BlockRef Ref) {
+        if (Depth == 0) return StepRoot(std::move(Ref));
+        if (Next == Depth) return StepLeaf(Ref);
+        if (not Probe(Path[Next], std::move(Ref), DX_NODE_ENTRIES_OFFSET)) return Finish({});
+        NextBlock = Path[Next++].Child();
+    }
+
+private:
+    void Finish(std::optional<LinkedDirEntryHeader> Entry) {
+        Found = Entry;
+        Finished = true;
+    }
+
+    /// Find the entry of an index block that covers ProbeHash.
+    bool Probe(Level& L, BlockRef Ref, usz EntriesOffset) {
+        const usz BlockSize = Sb.block_size();
+        L.Ref = std::move(Ref);
+
+        DxCountLimit CL;
+        std::memcpy(&CL, L.Ref.data() + EntriesOffset, sizeof CL);
+        if (CL.count == 0 or CL.count > CL.limit or EntriesOffset + CL.limit * sizeof(DxEntry) > BlockSize) {
+            SetError(ErrorCode::Corrupted);
+            Log("Corrupted HTree node in block {} of directory {}.", NextBlock, InodeNumber);
+            return false;
+        }
+
+        /// Find the last entry whose hash is not greater than ours.
+        L.EntriesOffset = EntriesOffset;
+        L.Count = CL.count;
+        u16 Lo = 1, Hi = CL.count;
+        while (Lo < Hi) {
+            auto Mid = u16(Lo + (Hi - Lo) / 2);
+            if (L.Get(Mid).hash > ProbeHash) Hi = Mid;
+            else Lo = u16(Mid + 1);
+        }
+
+        L.At = u16(Lo - 1);
+        return true;
+    }
+
+    /// Check the root and hash the name.
+    void StepRoot(BlockRef Ref) {
+        DxRootInfo Info;
+        std::memcpy(&Info, Ref.data() + DX_ROOT_INFO_OFFSET, sizeof Info);
+        if (Info.reserved_zero != 0 or Info.info_length != sizeof Info or Info.indirect_levels >= DX_MAX_LEVELS) {
+            SetError(ErrorCode::Corrupted);
+            Log("Invalid HTree root in directory {}.", InodeNumber);
+            return Finish({});
+        }
+
+        auto Version = HashVersion(Info.hash_version);
+        if (Version <= HashVersion::Tea and Sb.s_flags & SuperblockFlag::UnsignedHash)
+            Version = HashVersion(Info.hash_version + 3);
+        auto H = DirHash(Name, Version, Sb.s_hash_seed);
+        if (not H) {
+            SetError(ErrorCode::Unsupported);
+            Log("Unsupported hash version {} in directory {}.", Info.hash_version, InodeNumber);
+            return Finish({});
+        }
+
+        Hash = ProbeHash = *H;
+        Depth = Info.indirect_levels + 1u;
+        if (not Probe(Path[0], std::move(Ref), DX_ROOT_INFO_OFFSET + Info.info_length)) return Finish({});
+        NextBlock = Path[0].Child();
+        Next = 1;
+    }
+
+    /// Search a leaf. Names whose hashes collide may continue in the next
+    /// leaf, in which case the next index entry has its hash with the
+    /// lowest bit set; find the next entry at the lowest level that has
+    /// one and descend to the first leaf below it.
+    void StepLeaf(const BlockRef& Ref) {
+        auto Entry = FindEntryInView(Ref.data(), Sb.block_size(), Name);
+        if (not Entry or Entry->inode != 0) return Finish(Entry);
+
+        usz L = Depth;
+        while (L > 0 and Path[L - 1].At + 1 >= Path[L - 1].Count) L--;
+        if (L == 0) return Finish(LinkedDirEntryHeader{});
+        auto& Up = Path[L - 1];
+        Up.At++;
+        if ((Up.Get(Up.At).hash & ~1u) != Hash) return Finish(LinkedDirEntryHeader{});
+
+        ProbeHash = 0;
+        NextBlock = Up.Child();
+        Next = L;
+    }
+};
+
 } // namespace
 
+/// ===========================================================================
+///  Block cache.
+/// ===========================================================================
+BlockRef& BlockRef::operator=(BlockRef&& Other) noexcept {
+    if (this == &Other) return *this;
+    Release();
+    Cache = std::exchange(Other.Cache, nullptr);
+    Slot = Other.Slot;
+    Ptr = std::exchange(Other.Ptr, nullptr);
+    Owned = std::move(Other.Owned);
+    return *this;
+}
+
+void BlockRef::Release() {
+    if (Cache) {
+        std::unique_lock Guard{Cache->Lock};
+        Cache->Slots[Slot].Pins--;
+    }
+    Cache = nullptr;
+    Ptr = nullptr;
+    Owned.reset();
+}
+
+BlockCache::BlockCache(BlockDevice& Device_, usz BlockSize_, usz Capacity, bool WriteBack_, IoCounters* Counters_)
+    : Device(Device_),
+      BlockSize(BlockSize_),
+      BlockShift(u32(std::countr_zero(BlockSize_))),
+      Mapped(Device_.Map(0, 0) != nullptr),
+      Arena(Capacity and not Mapped ? static_cast<u8*>(std::aligned_alloc(BlockSize_, BlockSize_ * Capacity)) : nullptr),
+      Slots(Arena ? Capacity : 0),
+      WriteBack(WriteBack_ and not Slots.empty()),
+      Counters(Counters_) {
+    if (Capacity and not Mapped and not Arena) LogAt<LogLevel::Warning>("Failed to allocate block cache. Caching is disabled.");
+    Index.reserve(Slots.size());
+}
+
+BlockCache::~BlockCache() {
+    std::unique_lock Guard{Lock};
+    while (AsyncLoads) WaitForLoad(Guard);
+}
+
+auto BlockCache::Evict() -> usz {
+    /// Sweep at most twice over all slots: the first pass may only
+    /// clear reference bits; the second is guaranteed to find an
+    /// unpinned slot if there is one.
+    for (usz i = 0; i < 2 * Slots.size(); i++) {
+        auto Current = Hand;
+        Hand = (Hand + 1) % Slots.size();
+
+        auto& S = Slots[Current];
+        if (S.Pins or S.Dirty) continue;
+        if (S.Valid and S.Referenced) {
+            S.Referenced = false;
+            continue;
+        }
+
+        if (S.Valid) Index.erase(S.Block);
+        S.Valid = false;
+        return Current;
+    }
+
+    return Slots.size();
+}
+
+auto BlockCache::Get(u64 Block) -> BlockRef {
+    BlockRef Ref;
+    if (not GetBlocks({&Block, 1}, {&Ref, 1})) return {};
+    return Ref;
+}
+
+bool BlockCache::GetBlocks(std::span<const u64> Blocks, std::span<BlockRef> Refs) {
+    assert(Blocks.size() == Refs.size());
+
+    /// Serve blocks straight from the mapping if we can.
+    if (Mapped) {
+        for (usz i = 0; i < Blocks.size(); i++) {
+            Refs[i].Ptr = Device.Map(Blocks[i] * BlockSize, BlockSize);
+            if (not Refs[i].Ptr) {
+                Log("Failed to read from file: Unexpected EOF");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    while (not Refs.empty()) {
+        Fetch F;
+        Reserve(F, Blocks, Refs);
+        if (F.RequestCount) Device.Submit({F.Requests.data(), F.RequestCount});
+
+        /// Publish the blocks we’ve loaded and wait for
+        /// any that are being loaded by other threads.
+        std::unique_lock Guard{Lock};
+        bool Failed = not Publish(F, Refs);
+        NotifyLoaded();
+        for (usz i = 0; i < F.Count; i++) {
+            if (F.States[i] != Fetch::State::Hit) continue;
+            auto& S = Slots[Refs[i].Slot];
+            while (S.Loading) WaitForLoad(Guard);
+            if (not S.Valid) Failed = true;
+        }
+
+        if (Failed) return false;
+        Blocks = Blocks.subspan(F.Count);
+        Refs = Refs.subspan(F.Count);
+    }
+
+    return true;
+}
+
+auto BlockCache::AsyncGetBlocks(std::span<const u64> Blocks, std::span<BlockRef> Refs, ResumeQueue& Queue, IoKind Kind) -> Task<bool> {
+    assert(Blocks.size() == Refs.size());
+    if (Mapped) {
+        IoScope Scope{Kind};
+        co_return GetBlocks(Blocks, Refs);
+    }
+
+    while (not Refs.empty()) {
+        Fetch F;
+        {
+            IoScope Scope{Kind};
+            Reserve(F, Blocks, Refs);
+        }
+
+        /// Publish the blocks as soon as they have been read rather than
+        /// when we are resumed, since threads that need them may be waiting.
+        bool Failed = false;
+        if (F.RequestCount) {
+            {
+                std::unique_lock Guard{Lock};
+                AsyncLoads++;
+            }
+
+            Failed = not co_await AsyncSubmit{Device, {F.Requests.data(), F.RequestCount}, Queue, Kind, [&](bool) {
+                std::unique_lock Guard{Lock};
+                bool Ok = Publish(F, Refs);
+                AsyncLoads--;
+                NotifyLoaded();
+                return Ok;
+            }};
+        }
+
+        /// Wait for blocks that someone else is loading. Waiters are woken
+        /// whenever any load completes, so check that this one has.
+        for (usz i = 0; i < F.Count; i++) {
+            if (F.States[i] != Fetch::State::Hit) continue;
+            for (bool Loading = true; Loading;) {
+                co_await LoadAwaiter{*this, Refs[i].Slot, Queue};
+                std::unique_lock Guard{Lock};
+                auto& S = Slots[Refs[i].Slot];
+                Loading = S.Loading;
+                if (not Loading and not S.Valid) Failed = true;
+            }
+        }
+
+        if (Failed) co_return false;
+        Blocks = Blocks.subspan(F.Count);
+        Refs = Refs.subspan(F.Count);
+    }
+
+    co_return true;
+}
+
+bool BlockCache::LoadAwaiter::await_suspend(std::coroutine_handle<> Handle) {
+    std::unique_lock Guard{Cache.Lock};
+    if (not Cache.Slots[Slot].Loading) return false;
+    Cache.LoadWaiters.emplace_back(Handle, &Queue);
+    return true;
+}
+
+void BlockCache::NotifyLoaded() {
+    LoadDone.notify_all();
+    for (auto [Handle, Queue] : LoadWaiters) Queue->Push(Handle);
+    LoadWaiters.clear();
+}
+
+void BlockCache::Reserve(Fetch& F, std::span<const u64> Blocks, std::span<BlockRef> Refs) {
+    const usz Count = F.Count = std::min<usz>(Refs.size(), MAX_BATCH);
+    u64 BatchHits = 0;
+    std::unique_lock Guard{Lock};
+
+    /// Pin the blocks that are already cached and reserve
+    /// slots for the ones that aren’t.
+    for (usz i = 0; i < Count; i++) {
+        auto& Ref = Refs[i];
+        if (auto It = Index.find(Blocks[i]); It != Index.end()) {
+            auto& S = Slots[It->second];
+            BatchHits++;
+            S.Referenced = true;
+            S.Pins++;
+            Ref.Cache = this;
+            Ref.Slot = It->second;
+            Ref.Ptr = Arena.get() + It->second * BlockSize;
+            F.States[i] = Fetch::State::Hit;
+            continue;
+        }
+
+        auto Free = Evict();
+
+        /// Every slot is pinned (or caching is disabled), so
+        /// hand out a private copy instead.
+        if (Free == Slots.size()) {
+            Ref.Owned = std::make_unique<u8[]>(BlockSize);
+            Ref.Ptr = Ref.Owned.get();
+            F.States[i] = Fetch::State::Owned;
+            continue;
+        }
+
+        /// Other threads that want this block will wait until
+        /// we’re done loading it.
+        auto& S = Slots[Free];
+        S.Block = Blocks[i];
+        S.Pins = 1;
+        S.Referenced = true;
+        S.Valid = false;
+        S.Loading = true;
+        Index[Blocks[i]] = Free;
+        Ref.Cache = this;
+        Ref.Slot = Free;
+        Ref.Ptr = Arena.get() + Free * BlockSize;
+        F.States[i] = Fetch::State::Reserved;
+    }
+
+    Hits += BatchHits;
+    Misses += Count - BatchHits;
+    Guard.unlock();
+    if (Counters) Counters->RecordLookups(IoScope::Current(), BatchHits, Count - BatchHits);
+
+    /// Build one request per run of consecutive missing blocks.
+    F.RequestCount = 0;
+    for (usz i = 0; i < Count; i++) {
+        if (F.States[i] == Fetch::State::Hit) continue;
+        F.Iov[i] = {const_cast<u8*>(Refs[i].Ptr), BlockSize};
+        bool Extends = F.RequestCount != 0
+                   and F.States[i - 1] != Fetch::State::Hit
+                   and Blocks[i] == Blocks[i - 1] + 1;
+
+        if (Extends) {
+            F.Requests[F.RequestCount - 1].Count++;
+        } else {
+            F.Requests[F.RequestCount++] = {
+                .Op = IoRequest::Kind::Read,
+                .Offset = Blocks[i] * BlockSize,
+                .Iov = &F.Iov[i],
+                .Count = 1,
+            };
+        }
+        F.RequestForBlock[i] = F.RequestCount - 1;
+    }
+}
+
+bool BlockCache::Publish(Fetch& F, std::span<BlockRef> Refs) {
+    bool Failed = false;
+    for (usz i = 0; i < F.Count; i++) {
+        if (F.States[i] == Fetch::State::Hit) continue;
+        bool Loaded = F.Requests[F.RequestForBlock[i]].Ok;
+        if (F.States[i] == Fetch::State::Owned) {
+            Failed = Failed or not Loaded;
+            continue;
+        }
+
+        auto& S = Slots[Refs[i].Slot];
+        S.Loading = false;
+        S.Valid = Loaded;
+        if (not Loaded) {
+            Index.erase(S.Block);
+            Failed = true;
+        }
+    }
+
+    return not Failed;
+}
+
+bool BlockCache::GetRange(u64 First, std::span<BlockRef> Refs) {
+    std::array<u64, MAX_BATCH> Blocks;
+    while (not Refs.empty()) {
+        const usz Count = std::min<usz>(Refs.size(), MAX_BATCH);
+        for (usz i = 0; i < Count; i++) Blocks[i] = First + i;
+        if (not GetBlocks({Blocks.data(), Count}, Refs.subspan(0, Count))) return false;
+        First += Count;
+        Refs = Refs.subspan(Count);
+    }
+    return true;
+}
+
+void BlockCache::Advise(u64 First, u64 Count, AccessPattern Pattern) {
+    Device.Advise(First * BlockSize, Count * BlockSize, Pattern);
+}
+
+void BlockCache::Prefetch(u64 First, usz Count) {
+    if (Count == 0) return;
+
+    /// Let the kernel do the work for mapped devices.
+    if (Mapped) {
+        Device.Advise(First * BlockSize, Count * BlockSize, AccessPattern::WillNeed);
+        return;
+    }
+
+    /// The requests must stay alive until they complete.
+    struct Batch {
+        BlockCache* Cache;
+        std::vector<usz> Slots;
+        std::vector<iovec> Iov;
+        std::vector<IoRequest> Requests;
+        std::vector<usz> RequestForSlot;
+    };
+
+    auto B = std::make_unique<Batch>();
+    B->Cache = this;
+    Count = std::min(Count, MAX_BATCH);
+    B->Slots.reserve(Count);
+    B->Iov.reserve(Count);
+
+    /// Reserve slots for the blocks that aren’t cached yet.
+    {
+        std::unique_lock Guard{Lock};
+        u64 Previous = 0;
+        for (u64 Block = First; Block < First + Count; Block++) {
+            if (Index.contains(Block)) continue;
+            auto Free = Evict();
+            if (Free == Slots.size()) break;
+
+            auto& S = Slots[Free];
+            S.Block = Block;
+            S.Pins = 1;
+            S.Referenced = true;
+            S.Valid = false;
+            S.Loading = true;
+            Index[Block] = Free;
+
+            B->Slots.push_back(Free);
+            B->Iov.push_back({Arena.get() + Free * BlockSize, BlockSize});
+            if (B->Requests.empty() or Block != Previous + 1) {
+                B->Requests.push_back({
+                    .Op = IoRequest::Kind::Read,
+                    .Offset = Block * BlockSize,
+                    .Iov = &B->Iov.back(),
+                    .Count = 0,
+                });
+            }
+
+            B->Requests.back().Count++;
+            B->RequestForSlot.push_back(B->Requests.size() - 1);
+            Previous = Block;
+        }
+
+        if (B->Slots.empty()) return;
+        AsyncLoads++;
+    }
+
+    /// The completion is always called, even if submission fails.
+    auto Raw = B.release();
+    Device.SubmitAsync(Raw->Requests, [Raw](bool) {
+        std::unique_ptr<Batch> Done{Raw};
+        auto& C = *Done->Cache;
+        std::unique_lock Guard{C.Lock};
+        for (usz i = 0; i < Done->Slots.size(); i++) {
+            auto& S = C.Slots[Done->Slots[i]];
+            S.Loading = false;
+            S.Valid = Done->Requests[Done->RequestForSlot[i]].Ok;
+            S.Pins--;
+            if (not S.Valid) C.Index.erase(S.Block);
+        }
+
+        C.AsyncLoads--;
+        C.NotifyLoaded();
+    });
+}
+
+bool BlockCache::Read(u64 Offset, void* DestRaw, usz Size) {
+    auto Dest = static_cast<u8*>(DestRaw);
+    std::array<BlockRef, MAX_BATCH> Refs;
+    while (Size > 0) {
+        /// Fetch all blocks in the range at once so that missing
+        /// blocks can be read with a single system call.
+        auto BlockOffset = usz(Offset & (BlockSize - 1));
+        auto Count = std::min<usz>((BlockOffset + Size + BlockSize - 1) >> BlockShift, MAX_BATCH);
+        if (not GetRange(Offset >> BlockShift, {Refs.data(), Count})) return false;
+
+        for (usz i = 0; i < Count; i++) {
+            auto ToCopy = std::min(Size, BlockSize - BlockOffset);
+            std::memcpy(Dest, Refs[i].data() + BlockOffset, ToCopy);
+            Refs[i] = {};
+            Offset += ToCopy;
+            Dest += ToCopy;
+            Size -= ToCopy;
+            BlockOffset = 0;
+        }
+    }
+    return true;
+}
+
+auto BlockCache::View(u64 Offset, usz Size) -> BlockRef {
+    BlockRef Ref;
+    if (Mapped) {
+        Ref.Ptr = Device.Map(Offset, Size);
+        if (not Ref.Ptr) Log("Failed to read from file: Unexpected EOF");
+        return Ref;
+    }
+
+    /// Copy the data if it spans several blocks.
+    auto BlockOffset = usz(Offset & (BlockSize - 1));
+    if (BlockOffset + Size > BlockSize) {
+        Ref.Owned = std::make_unique<u8[]>(Size);
+        if (not Read(Offset, Ref.Owned.get(), Size)) return {};
+        Ref.Ptr = Ref.Owned.get();
+        return Ref;
+    }
+
+    Ref = Get(Offset >> BlockShift);
+    if (Ref) Ref.Ptr += BlockOffset;
+    return Ref;
+}
+
+bool BlockCache::Flush(u64 First, u64 Count) {
+    /// Upper bound on the number of blocks written by a single batch.
+    static constexpr usz FLUSH_BATCH_BLOCKS = 1024;
+
+    std::unique_lock Guard{Lock};
+    std::vector<u8> Buffer;
+    std::vector<usz> Flushed;
+    std::vector<iovec> Iov;
+    std::vector<u64> RunStarts;
+    std::vector<usz> RunLengths;
+    std::vector<IoRequest> Requests;
+    bool Ok = true;
+    /// Blocks that are written again behind the cursor are left for the
+    /// next flush so that a busy writer can’t keep us here forever.
+    u64 Cursor = First;
+    for (;;) {
+        auto It = DirtyBlocks.lower_bound(Cursor);
+        if (It == DirtyBlocks.end() or *It - First >= Count) return Ok;
+
+        /// Copy a batch of dirty blocks so that they can be modified while
+        /// they are being written. Pin them so that they stay cached in
+        /// case the write fails.
+        Buffer.resize(FLUSH_BATCH_BLOCKS * BlockSize);
+        Flushed.clear();
+        Iov.clear();
+        RunStarts.clear();
+        Requests.clear();
+        u64 Previous = 0;
+        while (It != DirtyBlocks.end() and *It - First < Count and Flushed.size() < FLUSH_BATCH_BLOCKS) {
+            auto Block = *It;
+            auto SlotIndex = Index.at(Block);
+            auto& S = Slots[SlotIndex];
+            auto Data = Buffer.data() + Flushed.size() * BlockSize;
+            std::memcpy(Data, Arena.get() + SlotIndex * BlockSize, BlockSize);
+            S.Dirty = false;
+            S.Pins++;
+            It = DirtyBlocks.erase(It);
+
+            /// One request per run of consecutive blocks.
+            if (not Flushed.empty() and Block == Previous + 1) Iov.back().iov_len += BlockSize;
+            else {
+                Iov.push_back({Data, BlockSize});
+                RunStarts.push_back(Block);
+            }
+            Flushed.push_back(SlotIndex);
+            Previous = Block;
+        }
+        Cursor = Previous + 1;
+
+        RunLengths.clear();
+        for (usz i = 0; i < Iov.size(); i++) {
+            RunLengths.push_back(Iov[i].iov_len / BlockSize);
+            Requests.push_back({
+                .Op = IoRequest::Kind::Write,
+                .Offset = RunStarts[i] * BlockSize,
+                .Iov = &Iov[i],
+                .Count = 1,
+            });
+        }
+
+        Guard.unlock();
+        Device.Submit(Requests);
+        Guard.lock();
+
+        /// Blocks that couldn’t be written are dirty again.
+        usz Next = 0;
+        for (usz i = 0; i < Requests.size(); i++) {
+            for (usz j = 0; j < RunLengths[i]; j++) {
+                auto SlotIndex = Flushed[Next++];
+                Slots[SlotIndex].Pins--;
+                if (not Requests[i].Ok) MarkDirty(SlotIndex);
+            }
+            Ok = Ok and Requests[i].Ok;
+        }
+
+        if (not Ok) return false;
+    }
+}
+
+void BlockCache::MarkDirty(usz SlotIndex) {
+    auto& S = Slots[SlotIndex];
+    S.Referenced = true;
+    if (S.Dirty) return;
+    S.Dirty = true;
+    DirtyBlocks.insert(S.Block);
+}
+
+void BlockCache::WaitForLoad(std::unique_lock<std::mutex>& Guard) {
+    if (AsyncLoads == 0 or not Device.IsAsync()) {
+        LoadDone.wait(Guard);
+        return;
+    }
+
+    Guard.unlock();
+    Device.Poll(true);
+    Guard.lock();
+}
+
+bool BlockCache::Write(u64 Offset, const void* SrcRaw, usz Size) {
+    std::unique_lock Guard{Lock};
+    auto Src = static_cast<const u8*>(SrcRaw);
+    if (not WriteBack) {
+        if (not Device.Write(Offset, SrcRaw, Size)) return false;
+
+        /// Update any cached copies. If a block is being loaded, wait until
+        /// it’s done so we don’t end up with stale data in the cache.
+        while (Size > 0) {
+            auto BlockOffset = usz(Offset % BlockSize);
+            auto ToCopy = std::min(Size, BlockSize - BlockOffset);
+            for (;;) {
+                auto It = Index.find(Offset / BlockSize);
+                if (It == Index.end()) break;
+                if (Slots[It->second].Loading) {
+                    WaitForLoad(Guard);
+                    continue;
+                }
+
+                std::memcpy(Arena.get() + It->second * BlockSize + BlockOffset, Src, ToCopy);
+                break;
+            }
+
+            Offset += ToCopy;
+            Src += ToCopy;
+            Size -= ToCopy;
+        }
+        return true;
+    }
+
+    while (Size > 0) {
+        const u64 Block = Offset / BlockSize;
+        auto BlockOffset = usz(Offset % BlockSize);
+        auto ToCopy = std::min(Size, BlockSize - BlockOffset);
+        if (auto It = Index.find(Block); It != Index.end()) {
+            if (Slots[It->second].Loading) {
+                WaitForLoad(Guard);
+                continue;
+            }
+
+            std::memcpy(Arena.get() + It->second * BlockSize + BlockOffset, Src, ToCopy);
+            MarkDirty(It->second);
+        } else if (auto Free = Evict(); Free == Slots.size()) {
+            /// Everything is pinned or dirty, so write this one through.
+            if (not Device.Write(Offset, Src, ToCopy)) return false;
+        } else {
+            auto& S = Slots[Free];
+            S.Block = Block;
+            S.Referenced = true;
+            Index[Block] = Free;
+
+            /// Load the rest of the block unless we overwrite all of it.
+            if (ToCopy != BlockSize) {
+                S.Pins = 1;
+                S.Valid = false;
+                S.Loading = true;
+                Guard.unlock();
+                bool Loaded = Device.Read(Block * BlockSize, Arena.get() + Free * BlockSize, BlockSize);
+                Guard.lock();
+                S.Pins--;
+                S.Loading = false;
+                NotifyLoaded();
+                if (not Loaded) {
+                    Index.erase(Block);
+                    return false;
+                }
+            }
+
+            S.Valid = true;
+            std::memcpy(Arena.get() + Free * BlockSize + BlockOffset, Src, ToCopy);
+            MarkDirty(Free);
+        }
+
+        Offset += ToCopy;
+        Src += ToCopy;
+        Size -= ToCopy;
+    }
+    return true;
+}
+
+bool BlockCache::WriteAround(u64 Offset, const void* SrcRaw, usz Size) {
+    /// The lock is held while writing to the device, so give others
+    /// a chance to use the cache every now and then.
+    static constexpr usz MAX_CHUNK = 1024 * 1024;
+
+    auto Src = static_cast<const u8*>(SrcRaw);
+    while (Size > 0) {
+        std::unique_lock Guard{Lock};
+        auto BlockOffset = usz(Offset % BlockSize);
+        auto ToCopy = std::min(Size, BlockSize - BlockOffset);
+        if (auto It = Index.find(Offset / BlockSize); It != Index.end()) {
+            Guard.unlock();
+            if (not Write(Offset, Src, ToCopy)) return false;
+        } else {
+            /// Write everything up to the next cached block at once.
+            while (ToCopy < Size and ToCopy < MAX_CHUNK and not Index.contains((Offset + ToCopy) / BlockSize))
+                ToCopy += std::min(Size - ToCopy, BlockSize);
+            if (not Device.Write(Offset, Src, ToCopy)) return false;
+        }
+
+        Offset += ToCopy;
+        Src += ToCopy;
+        Size -= ToCopy;
+    }
+    return true;
+}
+
 /// ===========================================================================
 ///  Drive implementation.
 /// ===========================================================================
-Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_)) {
-    [[maybe_unused]] auto FormatErrorHandling = [](ErrorHandling e) {
+Drive::Drive(
+    std::unique_ptr<MonitoredBlockDevice> Device_,
+    Superblock&& Sb_,
+    std::vector<BlockGroupDescriptor>&& Descriptors_,
+    const MountOptions& Options
+) : Device(std::move(Device_)),
+    Sb(std::move(Sb_)),
+    Geometry(Sb),
+    Ops(SelectBlockOps(Geometry.Shift)),
+    Descriptors(std::move(Descriptors_)),
+    Cache(*Device, Sb.block_size(), Options.CacheBlocks, Options.DirtyLimitBlocks != 0 and not Options.ReadOnly, &Device->Statistics()),
+    BlockBitmaps(Sb.block_groups()),
+    DirtyBackgroundBlocks(Options.DirtyBackgroundBlocks),
+    DirtyLimitBlocks(Options.ReadOnly ? 0 : Options.DirtyLimitBlocks),
+    WritebackInterval(Options.WritebackIntervalMs),
+    Inodes(Options.InodeCacheEntries),
+    BlockMaps(Options.BlockMapEntries),
+    Dentries(Options.DentryCacheEntries),
+    NamespaceIndexPath(Options.NamespaceIndexPath),
+    ReadaheadBlocks(Options.ReadaheadBlocks),
+    Atime(Options.ReadOnly ? AtimeUpdate::Never : Options.Atime),
+    LazyTime(Options.LazyTime),
+    ReadOnly(Options.ReadOnly) {
+    if (LogEnabled<LogLevel::Debug>()) LogSuperblock();
+    if (ReadOnly) return;
+
+    /// Set the last mount time.
+    Sb.s_mtime = (u32) time(nullptr);
+
+    /// Increment the mount count.
+    Sb.s_mnt_count++;
+}
+
+void Drive::LogSuperblock() const {
+    auto FormatErrorHandling = [](ErrorHandling e) {
         switch (e) {
             case ErrorHandling::Ignore: return "Ignore";
             case ErrorHandling::RemountReadOnly: return "Remount read-only";
@@ -125,7 +972,7 @@ Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_))
         return "Unknown";
     };
 
-    [[maybe_unused]] auto FormatRevisionLevel = [](RevisionLevel r) {
+    auto FormatRevisionLevel = [](RevisionLevel r) {
         switch (r) {
             case RevisionLevel::GoodOldRev: return "Good old revision 0";
             case RevisionLevel::DynamicRev: return "Dynamic revision";
@@ -133,7 +980,7 @@ Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_))
         return "Unknown";
     };
 
-    [[maybe_unused]] auto FormatCreatorOS = [](CreatorOS os) {
+    auto FormatCreatorOS = [](CreatorOS os) {
         switch (os) {
             case CreatorOS::Linux: return "Linux";
             case CreatorOS::Hurd: return "GNU Hurd";
@@ -144,7 +991,7 @@ Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_))
         return "Unknown";
     };
 
-    [[maybe_unused]] auto FormatUUID = [](const u8* UUID) {
+    auto FormatUUID = [](const u8* UUID) {
         return EXT2XX_FORMAT(
             "{:02x}{:02x}{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-"
             "{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}",
@@ -154,11 +1001,11 @@ Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_))
         );
     };
 
-    [[maybe_unused]] auto FormatTime = [](time_t t) {
+    auto FormatTime = [](time_t t) {
         return EXT2XX_FORMAT("{:%Y/%m/%d %T} UTC", *gmtime(&t));
     };
 
-    DEBUG(
+    LogAt<LogLevel::Debug>(
         "Mounting Ext2 drive with\n"
         "    inodes:           {} ({} free)\n"
         "    blocks:           {} ({} free)\n"
@@ -245,80 +1092,109 @@ Drive::Drive(FdType Fd_, Superblock&& Sb_) : FileHandle(Fd_), Sb(std::move(Sb_))
         Sb.s_feature_ro_compat & RoFeature::LargeFile ? "yes" : "no",
         Sb.s_feature_ro_compat & RoFeature::BtreeDir ? "yes" : "no"
     );
-
-    /// Set the last mount time.
-    Sb.s_mtime = (u32) time(nullptr);
-
-    /// Increment the mount count.
-    Sb.s_mnt_count++;
 }
 
 Drive::~Drive() {
-    /// TODO: Unmount and sync.
-    /// Write the superblock back to disk.
-    if (FileHandle) {
-        Sb.s_state = FsState::Valid;
-        Write(FileHandle, SUPERBLOCK_OFFSET, &Sb, sizeof Sb);
-        close(FileHandle);
+    if (ReadOnly) return;
+    if (Flusher.joinable()) {
+        {
+            std::unique_lock Guard{FlusherLock};
+            FlusherStop = true;
+        }
+        FlusherWake.notify_all();
+        Flusher.join();
     }
+
+    /// Write everything back and mark the filesystem as clean.
+    std::unique_lock Guard{WriteLock};
+    WriteBackInodes();
+    Sb.s_state = FsState::Valid;
+    SuperblockDirty = true;
+    WriteBackAll();
+    Device->Flush();
 }
 
 /// ===========================================================================
 ///  Inodes and other tables.
 /// ===========================================================================
-auto Drive::ComputeInodeOffset(u32 InodeNumber) -> std::optional<usz> {
+auto Drive::ComputeInodeOffset(u32 InodeNumber) -> std::optional<u64> {
     /// Check that the inode number is valid.
     if (InodeNumber == 0 or InodeNumber > Sb.s_inodes_count) return {};
 
     /// Determine the block group containing the inode.
     /// Note that inode numbers start at 1.
     /// The computed block group is zero-based.
-    u32 BlockGroup = (InodeNumber - 1) / Sb.s_inodes_per_group;
+    u32 BlockGroup = Geometry.InodeGroup(InodeNumber - 1);
 
     /// We also need the local index into the groups inode table.
-    u32 LocalIndex = (InodeNumber - 1) % Sb.s_inodes_per_group;
+    u32 LocalIndex = Geometry.InodeInGroup(InodeNumber - 1);
 
     /// Read the block group descriptor.
     auto dt = ReadDescriptorTable(BlockGroup);
     if (not dt) return {};
 
     /// Finally, compute the offset of the inode.
-    u32 Offset = dt->bg_inode_table * Sb.block_size() + LocalIndex * Sb.s_inode_size;
-    return Offset;
+    return (u64(dt->bg_inode_table) << Geometry.Shift) + u64(LocalIndex) * Sb.s_inode_size;
 }
 
-auto Drive::FindDirectoryEntry(Inode& I, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+auto Drive::FindDirectoryEntry(InodeNumberType InodeNumber, const Inode& I, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+    IoScope Scope{IoKind::Directory};
     if (not I.Is(Inode::Directory)) return {};
-    std::vector<char> EntryName;
-    usz Offset = 0;
-
-    /// Iterate over all directory entries until we find the one we want.
-    while (Offset < I.i_size) {
-        /// Read the directory entry header.
-        LinkedDirEntryHeader H{};
-        if (not ReadInodeData(I, Offset, &H, sizeof H)) return {};
-
-        /// Check if the name matches.
-        if (H.name_len == Name.size()) {
-            EntryName.clear();
-            EntryName.resize(H.name_len);
-            if (not ReadInodeData(I, Offset + sizeof H, EntryName.data(), H.name_len)) return {};
-            if (std::string_view{EntryName.data(), EntryName.size()} == Name)
-                return H;
-        }
+    auto Map = GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+
+    /// Use the index if there is one. ‘.’ and ‘..’ are not in the index.
+    if (
+        Sb.s_feature_compat & CompatFeature::DirIndex and
+        I.i_flags & INDEX_FL and
+        Name != "." and
+        Name != ".."
+    ) {
+        if (auto Entry = FindIndexedEntry(InodeNumber, *Map, Name)) return Entry;
+    }
 
-        /// Skip to the next entry.
-        Offset += H.rec_len;
-        if (H.rec_len == 0) break;
+    /// Search the directory one block at a time.
+    const u64 Blocks = Geometry.Blocks(I.Size());
+    for (u64 Block = 0; Block < Blocks; Block++) {
+        auto Entry = FindEntryInBlock(*Map, Block, Name);
+        if (not Entry or Entry->inode != 0) return Entry;
     }
 
-    return {};
+    /// Not found.
+    return LinkedDirEntryHeader{};
 }
 
-auto Drive::InodeFromPath(std::string_view Path, std::string_view OriginPath) -> std::optional<InodeNumberType> {
+auto Drive::FindEntryInBlock(const BlockMap& Map, u64 Block, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+    const usz BlockSize = Sb.block_size();
+    auto View = InodeDataView(Map, Block << Geometry.Shift, BlockSize);
+    if (not View) return {};
+    return FindEntryInView(View.data(), BlockSize, Name);
+}
+
+auto Drive::FindIndexedEntry(InodeNumberType InodeNumber, const BlockMap& Map, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+    const usz BlockSize = Sb.block_size();
+    HTreeLookup Lookup{InodeNumber, Name, Sb};
+    while (not Lookup.Done()) {
+        auto Ref = InodeDataView(Map, Lookup.Block() << Geometry.Shift, BlockSize);
+        if (not Ref) return {};
+        Lookup.Step(std::move(Ref));
+    }
+    return Lookup.Result();
+}
+
+auto Drive::InodeFromPath(std::string_view Path, std::string_view OriginPath) -> std::optional<InodeNumberType> {
     /// Path may not be empty.
     if (Path.empty()) {
-        Log("Cannot resolve empty path.");
+        SetError(ErrorCode::InvalidPath);
+        LogAt<LogLevel::Warning>("Cannot resolve empty path.");
+        return {};
+    }
+
+    /// Use the namespace index if we have one.
+    if (auto Indexed = IndexLookup(Path, OriginPath)) {
+        if (Indexed->InodeNumber) return Indexed->InodeNumber;
+        SetError(Indexed->Error);
+        LogAt<LogLevel::Debug>("Failed to resolve {} using the namespace index.", Path);
         return {};
     }
 
@@ -333,20 +1209,22 @@ auto Drive::InodeFromPath(std::string_view Path, std::string_view OriginPath) ->
         /// Origin cannot be empty as relative paths must be
         /// relative to something.
         if (OriginPath.empty()) {
-            Log("Cannot resolve relative path without origin.");
+            SetError(ErrorCode::InvalidPath);
+            LogAt<LogLevel::Warning>("Cannot resolve relative path without origin.");
             return {};
         }
 
         /// Origin must be absolute.
         if (not OriginPath.starts_with("/")) {
-            Log("Origin must be absolute.");
+            SetError(ErrorCode::InvalidPath);
+            LogAt<LogLevel::Warning>("Origin must be absolute.");
             return {};
         }
 
         /// Get the origin inode number.
         auto OriginInode = InodeFromPath(OriginPath);
         if (not OriginInode) {
-            Log("Failed to resolve origin path.");
+            LogAt<LogLevel::Debug>("Failed to resolve origin path.");
             return {};
         }
 
@@ -365,23 +1243,12 @@ auto Drive::InodeFromPath(std::string_view Path, InodeNumberType Origin) -> std:
             auto Component = Path.substr(0, Slash);
             Path.remove_prefix(Slash == std::string_view::npos ? Path.size() : Slash + 1);
 
-            /// Get the origin inode.
-            auto OriginInode = ReadInode(Origin);
-            if (not OriginInode) {
-                Log("Failed to read inode {}.", Origin);
-                return {};
-            }
-
-            /// Inode must be a directory.
-            if (not OriginInode->Is(Inode::Directory)) {
-                Log("Inode is not a directory.");
-                return {};
-            }
-
             /// Get the directory entry.
-            auto Entry = FindDirectoryEntry(*OriginInode, Component);
-            if (not Entry) {
-                Log("Failed to find entry {} in directory {}.", Component, Origin);
+            auto Entry = LookupDentry(Origin, Component);
+            if (not Entry) return {};
+            if (Entry->inode == 0) {
+                SetError(ErrorCode::NotFound);
+                LogAt<LogLevel::Debug>("Failed to find entry {} in directory {}.", Component, Origin);
                 return {};
             }
 
@@ -392,7 +1259,8 @@ auto Drive::InodeFromPath(std::string_view Path, InodeNumberType Origin) -> std:
             /// must be a directory.
             if (Path.starts_with("/")) {
                 if (auto FF = GetFileFormat(*Entry); not FF or *FF != Inode::Directory) {
-                    Log("Inode is not a directory.");
+                    SetError(ErrorCode::NotADirectory);
+                    LogAt<LogLevel::Debug>("Inode {} is not a directory.", Origin);
                     return {};
                 }
                 RemoveLeadingSlashes(Path);
@@ -407,389 +1275,2656 @@ auto Drive::InodeFromPath(std::string_view Path, InodeNumberType Origin) -> std:
     return Origin;
 }
 
-auto Drive::GetFileFormat(LinkedDirEntryHeader Hdr) -> std::optional<Inode::FileFormat> {
-    if (Sb.s_rev_level == RevisionLevel::DynamicRev) {
-        switch (Hdr.file_type) {
-            case 0: return Inode::Unknown;
-            case 1: return Inode::RegularFile;
-            case 2: return Inode::Directory;
-            case 3: return Inode::CharacterDevice;
-            case 4: return Inode::BlockDevice;
-            case 5: return Inode::Fifo;
-            case 6: return Inode::Socket;
-            case 7: return Inode::SymbolicLink;
-
-            /// Invalid entry. Log and attempt to get the type from the inode.
-            default:
-                Log("Invalid file type {} in directory entry for {}.", Hdr.file_type, Hdr.inode);
-                break;
+auto Drive::GetNamespaceIndex() -> const NamespaceIndex* {
+    if (NamespaceIndexPath.empty()) return nullptr;
+    std::call_once(IndexOnce, [&] {
+        if (not ReadOnly) {
+            LogAt<LogLevel::Info>("Ignoring namespace index '{}' of a writable drive.", NamespaceIndexPath);
+            return;
+        }
+
+        LoadedIndex = NamespaceIndex::Open(NamespaceIndexPath, NamespaceKey());
+        if (LoadedIndex) LogAt<LogLevel::Debug>("Loaded namespace index '{}' with {} paths.", NamespaceIndexPath, LoadedIndex->Size());
+    });
+    return LoadedIndex.get();
+}
+
+auto Drive::IndexLookup(std::string_view Path, std::string_view Origin) -> std::optional<IndexedPath> {
+    auto NI = GetNamespaceIndex();
+    if (not NI) return std::nullopt;
+    if (not Path.starts_with('/') and not Origin.starts_with('/')) return std::nullopt;
+
+    bool Directory;
+    auto Normalised = NormalisePath(Path, Origin, Directory);
+    if (not Normalised) return std::nullopt;
+
+    /// The index contains every path, so a path that isn’t in it doesn’t
+    /// exist. As in InodeFromPath(), the error depends on whether the last
+    /// component that does is a directory.
+    auto E = NI->Find(*Normalised);
+    if (not E) {
+        std::string_view Prefix = *Normalised;
+        for (auto Slash = Prefix.rfind('/'); Slash != 0; Slash = Prefix.rfind('/')) {
+            Prefix = Prefix.substr(0, Slash);
+            if (auto Parent = NI->Find(Prefix))
+                return IndexedPath{0, Parent->Format == S_IFDIR ? ErrorCode::NotFound : ErrorCode::NotADirectory};
         }
+        return IndexedPath{0, ErrorCode::NotFound};
+    }
+
+    if (Directory and E->Format != S_IFDIR) return IndexedPath{0, ErrorCode::NotADirectory};
+    return IndexedPath{E->InodeNumber, ErrorCode::None};
+}
+
+auto Drive::NamespaceKey() const -> NamespaceIndexKey {
+    NamespaceIndexKey Key;
+    std::copy_n(Sb.s_uuid, Key.Uuid.size(), Key.Uuid.begin());
+    Key.WriteTime = Sb.s_wtime;
+    Key.MountCount = Sb.s_mnt_count;
+    Key.BlockSize = Sb.block_size();
+    return Key;
+}
+
+void Drive::InvalidateDentries(InodeNumberType Directory) {
+    std::unique_lock Guard{DentryLock};
+    DentryGeneration++;
+    Dentries.EraseIf([&](const DentryKey& K, const LinkedDirEntryHeader& E) {
+        return K.Parent == Directory or E.inode == Directory;
+    });
+}
+
+auto Drive::LookupDentry(InodeNumberType Parent, std::string_view Name) -> std::optional<LinkedDirEntryHeader> {
+    u64 Generation;
+    {
+        std::unique_lock Guard{DentryLock};
+        if (auto Cached = Dentries.Get(DentryView{Parent, Name})) return *Cached;
+        Generation = DentryGeneration;
+    }
+
+    /// Not cached. Scan the directory without holding the lock.
+    auto ParentInode = ReadInode(Parent);
+    if (not ParentInode) {
+        Log("Failed to read inode {}.", Parent);
+        return {};
     }
 
-    /// If the revision level is not dynamic, then we can only
-    /// determine the file format by looking at the inode.
+    /// Inode must be a directory.
+    if (not ParentInode->Is(Inode::Directory)) {
+        SetError(ErrorCode::NotADirectory);
+        LogAt<LogLevel::Debug>("Inode {} is not a directory.", Parent);
+        return {};
+    }
+
+    /// Only cache the result if no directory was modified in the meantime.
+    auto Entry = FindDirectoryEntry(Parent, *ParentInode, Name);
+    if (not Entry) return {};
+    std::unique_lock Guard{DentryLock};
+    if (Generation == DentryGeneration) Dentries.Put({Parent, std::string{Name}}, *Entry);
+    return Entry;
+}
+
+auto Drive::GetFileFormat(LinkedDirEntryHeader Hdr) -> std::optional<Inode::FileFormat> {
+    /// With the filetype feature, entries record the file format, so
+    /// we don’t need to read the inode.
+    if (Sb.s_feature_incompat & IncompatFeature::FileType) {
+        auto FF = FileFormatFromEntryType(Hdr.file_type);
+        if (FF and *FF != Inode::Unknown) return FF;
+
+        /// Invalid entry. Log and attempt to get the type from the inode.
+        if (not FF) LogAt<LogLevel::Warning>("Invalid file type {} in directory entry for {}.", Hdr.file_type, Hdr.inode);
+    }
+
+    /// Otherwise, the only way to determine the file format is to
+    /// look at the inode.
     auto Inode = ReadInode(Hdr.inode);
     if (not Inode) return {};
     return static_cast<Inode::FileFormat>(Inode->i_mode & Inode::FileFormatMask);
 }
 
+bool Drive::GroupHasSuperblock(u32 BlockGroupIndex) const {
+    if (not(Sb.s_feature_ro_compat & RoFeature::SparseSuper)) return true;
+    if (BlockGroupIndex <= 1) return true;
+
+    /// With sparse superblocks, only groups that are powers of 3, 5, or 7 have a backup.
+    for (u32 Base : {3u, 5u, 7u}) {
+        u64 N = Base;
+        while (N < BlockGroupIndex) N *= Base;
+        if (N == BlockGroupIndex) return true;
+    }
+    return false;
+}
+
 auto Drive::ReadDescriptorTable(u32 BlockGroupIndex) -> std::optional<BlockGroupDescriptor> {
-    /// The descriptor table is stored in the first block group after the superblock.
-    BlockGroupDescriptor Table;
-    auto Offset = SUPERBLOCK_OFFSET + Sb.block_size() + BlockGroupIndex * sizeof Table;
-    if (not Read(FileHandle, Offset, &Table, sizeof Table)) return {};
-    return Table;
+    std::shared_lock Guard{DescriptorLock};
+    if (BlockGroupIndex >= Descriptors.size()) return {};
+    return Descriptors[BlockGroupIndex];
 }
 
-auto Drive::ReadInode(u32 InodeNumber) -> std::optional<Inode> {
+auto Drive::InodeDataView(const BlockMap& Map, usz Offset, usz Size) -> BlockRef {
+    auto BlockIndex = Geometry.Block(Offset);
+    auto BlockOffset = Geometry.Within(Offset);
+    auto E = Map.Find(BlockIndex);
+    if (E.Physical == 0) return {};
+    if (BlockOffset + Size > Geometry.Mask + 1) return {};
+    return Cache.View(((E.Physical + BlockIndex - E.Logical) << Geometry.Shift) + BlockOffset, Size);
+}
+
+auto Drive::InodeView(InodeNumberType InodeNumber) -> BlockRef {
+    IoScope Scope{IoKind::Inode};
     auto Offset = ComputeInodeOffset(InodeNumber);
     if (not Offset) return {};
+    return Cache.View(*Offset, sizeof(Inode));
+}
 
-    /// Read the inode.
-    Inode Inode;
-    if (not Read(FileHandle, *Offset, &Inode, sizeof Inode)) return {};
-    return Inode;
-}
-
-bool Drive::ReadInodeData(Inode& I, usz Offset, void* BufferRaw, usz Size) { // clang-format off
-    /// Compute the block index and offset into the block.
-    auto Buffer = static_cast<u8*>(BufferRaw);
-    auto BlockIndex = Offset / Sb.block_size();
-    auto BlockOffset = Offset % Sb.block_size();
-
-    const usz IndirectBlockCount = Sb.block_size() / sizeof(u32);
-    const usz DoublyIndirectBlockCount = IndirectBlockCount * IndirectBlockCount;
-    const usz TriplyIndirectBlockCount = IndirectBlockCount * IndirectBlockCount * IndirectBlockCount;
-
-    /// Return value of the read loop.
-    enum struct Result {
-        Done,
-        Continue,
-        Error,
-    };
+auto Drive::PinInode(InodeNumberType InodeNumber) -> std::shared_ptr<CachedInode> {
+    {
+        std::unique_lock Guard{InodeLock};
+        if (auto Cached = Inodes.Get(InodeNumber)) return *Cached;
+    }
 
-    /// Helper to read from a list of direct, indirect, doubly indirect, or triply indirect blocks.
-    auto read_loop = [&](auto nth_block_number, usz limit) -> Result {
-        /// Read from the first direct block.
-        usz BlockNumber;
-        if (not nth_block_number(BlockIndex, BlockNumber)) return Result::Error;
-        usz ToRead = std::min(Size, Sb.block_size() - BlockOffset);
-        if (not Read(FileHandle, BlockNumber * Sb.block_size() + BlockOffset, Buffer, ToRead))
-            return Result::Error;
-
-        /// We may be done already.
-        if (ToRead == Size) return Result::Done;
-
-        /// Otherwise, read from the other direct blocks.
-        BlockIndex++;
-        Buffer += ToRead;
-        Size -= ToRead;
-        if (not nth_block_number(BlockIndex, BlockNumber)) return Result::Error;
-        while (BlockIndex < limit and Size > 0) {
-            ToRead = std::min<usz>(Size, Sb.block_size());
-            if (not Read(FileHandle, BlockNumber * Sb.block_size(), Buffer, ToRead))
-                return Result::Error;
-            BlockIndex++;
-            Buffer += ToRead;
-            Size -= ToRead;
-        }
-
-        /// If the size is zero, we're done.
-        if (Size == 0) return Result::Done;
-        BlockOffset = 0;
-        return Result::Continue;
-    };
+    /// Read the inode without holding the lock.
+    auto View = InodeView(InodeNumber);
+    if (not View) return nullptr;
+    auto Entry = std::make_shared<CachedInode>();
+    std::memcpy(&Entry->I, View.data(), sizeof Entry->I);
+
+    /// Someone else may have cached (or written) the inode in the
+    /// meantime, in which case their copy is at least as recent.
+    std::unique_lock Guard{InodeLock};
+    if (auto Cached = Inodes.Get(InodeNumber)) return *Cached;
+    Inodes.Put(InodeNumber, Entry, [](InodeNumberType, const std::shared_ptr<CachedInode>& E) {
+        return E.use_count() == 1 and not E->Dirty;
+    });
+    return Entry;
+}
 
-    /// Offset is within the first 12 direct blocks.
-    if (BlockIndex < DIRECT_BLOCK_COUNT) {
-        switch (read_loop([&](usz n, usz& out) {
-            out = I.i_block[n];
-            return true;
-        }, DIRECT_BLOCK_COUNT)) {
-            case Result::Done: return true;
-            case Result::Error: return false;
-            case Result::Continue: break;
-        }
-    }
-
-    /// Read from the indirect block.
-    if (BlockIndex < DIRECT_BLOCK_COUNT + IndirectBlockCount) {
-        /// Read the indirect block.
-        std::vector<u8> IndirectBlock(Sb.block_size());
-        if (not Read(
-            FileHandle,
-            I.i_block[INDIRECT_BLOCK_INDEX] * Sb.block_size(),
-            IndirectBlock.data(),
-            IndirectBlock.size())
-        ) return false;
-
-        /// Read from the indirect block.
-        switch (read_loop([&](usz n, usz& out) {
-            out = reinterpret_cast<u32*>(IndirectBlock.data())[n - DIRECT_BLOCK_COUNT];
-            return true;
-        }, DIRECT_BLOCK_COUNT + IndirectBlockCount)) {
-            case Result::Done: return true;
-            case Result::Error: return false;
-            case Result::Continue: break;
-        }
-    }
-
-    /// Read from the doubly indirect block.
-    if (BlockIndex < DIRECT_BLOCK_COUNT + IndirectBlockCount + DoublyIndirectBlockCount) {
-        /// Read the doubly indirect block.
-        std::vector<u8> IndirectBlock(Sb.block_size());
-        std::vector<u8> DoublyIndirectBlock(Sb.block_size());
-        if (not Read(
-            FileHandle,
-            I.i_block[DOUBLY_INDIRECT_BLOCK_INDEX] * Sb.block_size(),
-            DoublyIndirectBlock.data(),
-            DoublyIndirectBlock.size()
-        )) return false;
+auto Drive::ReadInode(u32 InodeNumber) -> std::optional<Inode> {
+    auto Pinned = PinInode(InodeNumber);
+    if (not Pinned) return {};
+    return ReadInode(*Pinned);
+}
 
-        /// Read from the triply indirect block.
-        switch (read_loop([&](usz n, usz& out) {
-            /// Read the next indirect block if necessary.
-            usz blocks_per_block = Sb.block_size() / sizeof(u32);
-            if (((n - DIRECT_BLOCK_COUNT) % blocks_per_block) == 0) {
-                if (not Read(
-                    FileHandle,
-                    reinterpret_cast<u32*>(DoublyIndirectBlock.data())[(n - DIRECT_BLOCK_COUNT) / blocks_per_block] * Sb.block_size(),
-                    IndirectBlock.data(),
-                    IndirectBlock.size()
-                )) return false;
-            }
+auto Drive::ReadInode(const CachedInode& Pinned) -> Inode {
+    if (ReadOnly) return Pinned.I;
+    std::unique_lock Guard{InodeLock};
+    return Pinned.I;
+}
 
-            /// Read the block number.
-            out = reinterpret_cast<u32*>(IndirectBlock.data())[(n - DIRECT_BLOCK_COUNT) % blocks_per_block];
-            return true;
-        }, DIRECT_BLOCK_COUNT + IndirectBlockCount + DoublyIndirectBlockCount)) {
-            case Result::Done: return true;
-            case Result::Error: return false;
-            case Result::Continue: break;
-        }
-    }
-
-    /// Read the triply indirect block.
-    std::vector<u8> IndirectBlock(Sb.block_size());
-    std::vector<u8> DoublyIndirectBlock(Sb.block_size());
-    std::vector<u8> TriplyIndirectBlock(Sb.block_size());
-    if (not Read(
-        FileHandle,
-        I.i_block[TRIPLY_INDIRECT_BLOCK_INDEX] * Sb.block_size(),
-        TriplyIndirectBlock.data(),
-        TriplyIndirectBlock.size()
-    )) return false;
-
-    switch (read_loop([&](usz n, usz& out) {
-        /// Read the next doubly indirect block if necessary.
-        const usz blocks_per_block = Sb.block_size() / sizeof(u32);
-        const usz blocks_per_doubly_indirect_block = blocks_per_block * blocks_per_block;
-        if (((n - DIRECT_BLOCK_COUNT) % blocks_per_doubly_indirect_block) == 0) {
-            if (not Read(
-                FileHandle,
-                reinterpret_cast<u32*>(TriplyIndirectBlock.data())[(n - DIRECT_BLOCK_COUNT) / blocks_per_doubly_indirect_block] * Sb.block_size(),
-                DoublyIndirectBlock.data(),
-                DoublyIndirectBlock.size()
-            )) return false;
-        }
-
-        /// Read the next indirect block if necessary.
-        if (((n - DIRECT_BLOCK_COUNT) % blocks_per_block) == 0) {
-            if (not Read(
-                FileHandle,
-                reinterpret_cast<u32*>(DoublyIndirectBlock.data())[(n - DIRECT_BLOCK_COUNT) / blocks_per_block] * Sb.block_size(),
-                IndirectBlock.data(),
-                IndirectBlock.size()
-            )) return false;
-        }
-
-        /// Read the block number.
-        out = reinterpret_cast<u32*>(IndirectBlock.data())[(n - DIRECT_BLOCK_COUNT) % blocks_per_block];
-        return true;
-    }, DIRECT_BLOCK_COUNT + IndirectBlockCount + DoublyIndirectBlockCount + TriplyIndirectBlockCount)) {
-        case Result::Done: return true;
-        case Result::Error: return false;
-        case Result::Continue: break;
+void Drive::AdviseInodeData(const BlockMap& Map, u64 FirstBlock, u64 Count, AccessPattern Pattern) {
+    while (Count > 0) {
+        auto E = Map.Find(FirstBlock);
+        auto Blocks = std::min(Count, E.Length - (FirstBlock - E.Logical));
+        if (E.Physical) Cache.Advise(E.Physical + FirstBlock - E.Logical, Blocks, Pattern);
+        FirstBlock += Blocks;
+        Count -= Blocks;
     }
+}
 
-    /// We should never get here.
-    Log("Sorry, file too large to be stored in an EXT2 filesystem.");
-    return false;
-} // clang-format on
+void Drive::PrefetchInodeData(const BlockMap& Map, u64 FirstBlock, u64 Count) {
+    while (Count > 0) {
+        auto E = Map.Find(FirstBlock);
+        auto Blocks = std::min(Count, E.Length - (FirstBlock - E.Logical));
+        for (u64 Done = 0; E.Physical and Done < Blocks; Done += BlockCache::MAX_BATCH) {
+            auto N = usz(std::min<u64>(Blocks - Done, BlockCache::MAX_BATCH));
+            Cache.Prefetch(E.Physical + FirstBlock - E.Logical + Done, N);
+        }
 
-bool Drive::WriteInode(u32 InodeNumber, const Inode& i) {
-    auto Offset = ComputeInodeOffset(InodeNumber);
-    if (not Offset) return false;
+        FirstBlock += Blocks;
+        Count -= Blocks;
+    }
+}
 
-    /// Write the inode.
-    return Write(FileHandle, isz(*Offset), &i, sizeof i);
+bool Drive::ReadInodeData(const BlockMap& Map, usz Offset, void* Buffer, usz Size) {
+    iovec Iov{Buffer, Size};
+    return ReadInodeDataV(Map, Offset, {&Iov, 1}, Size);
 }
 
-bool Drive::WriteDescriptorTable(u32 BlockGroupIndex, const BlockGroupDescriptor& Table) {
-    /// The descriptor table is stored in the first block group after the superblock.
-    auto Offset = SUPERBLOCK_OFFSET + Sb.block_size() + BlockGroupIndex * sizeof Table;
-    return Write(FileHandle, isz(Offset), &Table, sizeof Table);
+auto Drive::TransferInodeData(const BlockMap& Map, u64 Offset, FdType Out, usz Size) -> std::optional<usz> {
+    const FdType In = Device->Handle();
+
+    /// copy_file_range() can avoid copying altogether between regular
+    /// files; anything else goes through sendfile().
+    struct stat OutStat {};
+    bool UseCopyRange = fstat(Out, &OutStat) == 0 and S_ISREG(OutStat.st_mode);
+
+    /// Write zeroes for holes, and copy through a buffer if the kernel
+    /// can’t move data between these two files or if the data is in
+    /// dirty blocks that haven’t reached the device yet.
+    static constexpr usz BUFFER_SIZE = 64 * 1024;
+    std::unique_ptr<u8[]> Buffer;
+    auto WriteBuffered = [&](u64 DeviceOffset, usz Count, bool Zero, bool Dirty) -> isz {
+        if (not Buffer) Buffer = std::make_unique<u8[]>(BUFFER_SIZE);
+        auto N = std::min(Count, BUFFER_SIZE);
+        if (Zero) std::memset(Buffer.get(), 0, N);
+        else if (not(Dirty ? Cache.Read(DeviceOffset, Buffer.get(), N) : Device->Read(DeviceOffset, Buffer.get(), N))) return -1;
+        return write(Out, Buffer.get(), N);
+    };
+
+    usz Transferred = 0;
+    bool Fallback = false;
+    while (Size > 0) {
+        u64 BlockIndex = Geometry.Block(Offset);
+        usz BlockOffset = Geometry.Within(Offset);
+        auto E = Map.Find(BlockIndex);
+        auto BlocksLeft = std::min<u64>(E.Length - (BlockIndex - E.Logical), Geometry.Block(BlockOffset + Size) + 1);
+        auto Count = usz(std::min<u64>(Size, (BlocksLeft << Geometry.Shift) - BlockOffset));
+        auto DeviceOffset = ((E.Physical + BlockIndex - E.Logical) << Geometry.Shift) + BlockOffset;
+
+        /// Move at most one extent at a time.
+        isz Moved;
+        auto Chunk = std::min(Count, MAX_TRANSFER_CHUNK);
+        const bool Dirty = E.Physical and Cache.HasDirty(Geometry.Block(DeviceOffset), Geometry.Blocks(BlockOffset + Chunk));
+        if (E.Physical == 0 or Fallback or Dirty) {
+            Moved = WriteBuffered(DeviceOffset, Chunk, E.Physical == 0, Dirty);
+        } else if (UseCopyRange) {
+            auto InOffset = loff_t(DeviceOffset);
+            Device->Track(IoKind::Data, DeviceOffset, Chunk, [&] {
+                Moved = copy_file_range(In, &InOffset, Out, nullptr, Chunk, 0);
+                return Moved >= 0;
+            });
+            if (Moved < 0 and (errno == EXDEV or errno == EINVAL or errno == ENOSYS or errno == EOPNOTSUPP)) {
+                UseCopyRange = false;
+                continue;
+            }
+        } else {
+            auto InOffset = off_t(DeviceOffset);
+            Device->Track(IoKind::Data, DeviceOffset, Chunk, [&] {
+                Moved = sendfile(Out, In, &InOffset, Chunk);
+                return Moved >= 0;
+            });
+            if (Moved < 0 and (errno == EINVAL or errno == ENOSYS)) {
+                Fallback = true;
+                continue;
+            }
+        }
+
+        if (Moved < 0) {
+            if (errno == EINTR) continue;
+
+            /// The output can’t take more right now; report what we did.
+            if (errno == EAGAIN and Transferred) break;
+            SetError(ErrorCode::Io);
+            Log("Failed to transfer file data: {}", strerror(errno));
+            return {};
+        }
+
+        if (Moved == 0) break;
+        Offset += usz(Moved);
+        Size -= usz(Moved);
+        Transferred += usz(Moved);
+    }
+
+    return Transferred;
 }
 
-/// ===========================================================================
-///  Directory handle API.
-/// ===========================================================================
-Dir::Dir(Inode I_, InodeNumberType INum_, std::shared_ptr<Drive> Drv_)
-    : I(I_),
-      InodeNumber(INum_),
-      Drv(std::move(Drv_)) {}
+template <u32 Shift>
+bool Drive::ReadInodeDataVFor(const BlockMap& Map, u64 Offset, std::span<const iovec> Iov, usz Size) {
+    const u32 BlockShift = Shift ? Shift : Geometry.Shift;
+    const usz BlockSize = usz(1) << BlockShift;
+    usz IovIndex = 0, IovOffset = 0;
+    std::vector<iovec> Pieces;
+
+    /// Split the next Bytes bytes of the buffers into pieces.
+    auto TakePieces = [&](usz Bytes) {
+        Pieces.clear();
+        while (Bytes > 0) {
+            assert(IovIndex < Iov.size());
+            auto& V = Iov[IovIndex];
+            auto N = std::min(Bytes, V.iov_len - IovOffset);
+            if (N) Pieces.push_back({static_cast<u8*>(V.iov_base) + IovOffset, N});
+            IovOffset += N;
+            Bytes -= N;
+            if (IovOffset == V.iov_len) {
+                IovIndex++;
+                IovOffset = 0;
+            }
+        }
+    };
+
+    /// Read extent by extent.
+    while (Size > 0) {
+        u64 BlockIndex = Offset >> BlockShift;
+        usz BlockOffset = usz(Offset & (BlockSize - 1));
+        auto E = Map.Find(BlockIndex);
+        auto BlocksLeft = std::min<u64>(E.Length - (BlockIndex - E.Logical), ((BlockOffset + Size) >> BlockShift) + 1);
+        auto ToRead = usz(std::min<u64>(Size, (BlocksLeft << BlockShift) - BlockOffset));
+        TakePieces(ToRead);
+
+        /// Holes read as zeroes. Large reads bypass the cache and
+        /// are issued as a single read per extent, no matter how
+        /// many buffers they are spread across, unless the cache
+        /// has dirty blocks in that range; everything else goes
+        /// through the cache.
+        auto DeviceOffset = ((E.Physical + BlockIndex - E.Logical) << BlockShift) + BlockOffset;
+        if (E.Physical == 0) {
+            for (auto& P : Pieces) std::memset(P.iov_base, 0, P.iov_len);
+        } else if (ToRead >= DIRECT_READ_BLOCKS * BlockSize and not Cache.HasDirty(DeviceOffset >> BlockShift, BlocksLeft)) {
+            if (not Device->ReadV(DeviceOffset, Pieces.data(), Pieces.size())) return false;
+        } else {
+            for (auto& P : Pieces) {
+                if (not Cache.Read(DeviceOffset, P.iov_base, P.iov_len)) return false;
+                DeviceOffset += P.iov_len;
+            }
+        }
+
+        Offset += ToRead;
+        Size -= ToRead;
+    }
+
+    return true;
+}
 
 /// ===========================================================================
-///  File API.
+///  Block allocation.
 /// ===========================================================================
-File::File(InodeNumberType INum, std::shared_ptr<Drive> Drv_) : InodeNumber(INum), Drv(std::move(Drv_)) {}
+auto Drive::AllocateBlocks(u64 Goal, u64 Count) -> std::optional<std::pair<u64, u64>> {
+    const u64 Available = AvailableBlocks();
+    if (Available == 0) {
+        SetError(ErrorCode::NoSpace);
+        Log("Failed to allocate blocks: No space left on drive");
+        return {};
+    }
 
-auto File::Read(void* Buf, usz Len) -> std::optional<usz> {
-    /// Get the inode.
-    auto I = Drv->ReadInode(InodeNumber);
-    if (not I) return {};
+    Count = std::min(Count, Available);
+
+    const u32 Groups = Sb.block_groups();
+    if (Goal < Sb.s_first_data_block or Goal >= Sb.s_blocks_count) Goal = Sb.s_first_data_block;
+    const u32 GoalGroup = Geometry.BlockGroup(u32(Goal - Sb.s_first_data_block));
+
+    /// Search the goal group from the goal, then all other groups, and
+    /// finally the part of the goal group before the goal.
+    for (u32 i = 0; i <= Groups; i++) {
+        const u32 Group = (GoalGroup + i) % Groups;
+        auto Desc = ReadDescriptorTable(Group);
+        if (not Desc) return {};
+        if (Desc->bg_free_blocks_count == 0) continue;
+
+        auto Bits = LoadBlockBitmap(Group);
+        if (not Bits) return {};
+
+        const u64 GroupStart = Sb.s_first_data_block + u64(Group) * Sb.s_blocks_per_group;
+        const u64 GroupSize = std::min<u64>(Sb.s_blocks_per_group, Sb.s_blocks_count - GroupStart);
+        const u64 From = i == 0 ? Goal - GroupStart : 0;
+        const std::span<const u8> Bitmap{*Bits};
+
+        /// Continue right at the goal if we can. Otherwise, prefer a run
+        /// that is long enough over the first free block so that small
+        /// holes left by other files don’t fragment this one.
+        u64 Start = BitmapFindClear(Bitmap, From, GroupSize);
+        if (Start != From and Start != GroupSize) {
+            const u64 Want = std::min<u64>(Count, ALLOC_RUN_BLOCKS);
+            if (auto Run = BitmapFindClearRun(Bitmap, Start, GroupSize, Want); Run != GroupSize) Start = Run;
+        }
 
-    /// Read the data.
-    auto ToRead = std::min<usz>(Len, I->i_size - Offset);
-    if (not Drv->ReadInodeData(*I, Offset, Buf, ToRead)) return {};
+        if (Start == GroupSize) continue;
+        u64 Len = BitmapFindSet(Bitmap, Start, Start + std::min(Count, GroupSize - Start)) - Start;
+        if (not UpdateBlockBitmap(Group, Start, Len, true)) return {};
+        return std::pair{GroupStart + Start, Len};
+    }
 
-    /// Update the offset.
-    Offset += ToRead;
-    return ToRead;
+    SetError(ErrorCode::NoSpace);
+    Log("Failed to allocate blocks: No space left on drive");
+    return {};
 }
 
-/// ===========================================================================
-///  Drive API.
-/// ===========================================================================
-/// Open a directory.
-auto Drive::OpenDir(std::string_view FilePath, std::string_view Origin) -> std::unique_ptr<Dir> {
-    auto INum = InodeFromPath(FilePath, Origin);
-    if (not INum) return {};
+auto Drive::AvailableBlocks() const -> u64 {
+    if (Sb.s_free_blocks_count <= Sb.s_r_blocks_count) return 0;
+    return Sb.s_free_blocks_count - Sb.s_r_blocks_count;
+}
 
-    auto I = ReadInode(*INum);
-    if (not I) return {};
+auto Drive::AllocateIndirectBlock(Inode& I, u64 Goal) -> u32 {
+    auto Run = AllocateBlocks(Goal, 1);
+    if (not Run) return 0;
+
+    std::vector<u8> Zeroes(Sb.block_size());
+    if (not Cache.Write(Run->first * Sb.block_size(), Zeroes.data(), Zeroes.size())) {
+        FreeBlocks(Run->first, 1);
+        return 0;
+    }
 
-    return std::unique_ptr<Dir>{::new Dir{*I, *INum, This.lock()}};
+    I.i_blocks += u32(Sb.block_size() / SECTOR_SIZE);
+    return u32(Run->first);
 }
 
-/// Open a file.
-auto Drive::OpenFile(std::string_view FilePath, std::string_view Origin) -> std::unique_ptr<File> {
-    auto INum = InodeFromPath(FilePath, Origin);
-    if (not INum) return {};
-    return std::unique_ptr<File>{::new File{*INum, This.lock()}};
+auto Drive::AllocateRun(WriteState& S, u64 Goal, u64 Count) -> std::optional<std::pair<u64, u64>> {
+    if (S.PreallocCount and S.PreallocFirst == Goal) {
+        auto N = std::min(Count, S.PreallocCount);
+        S.PreallocFirst += N;
+        S.PreallocCount -= N;
+        return std::pair{Goal, N};
+    }
+
+    if (not ReleasePrealloc(S)) return {};
+    const u64 Extra = Sb.s_prealloc_blocks ? Sb.s_prealloc_blocks : DEFAULT_PREALLOC_BLOCKS;
+    auto Run = AllocateBlocks(Goal, Count + Extra);
+    if (Run and Run->second > Count) {
+        S.PreallocFirst = Run->first + Count;
+        S.PreallocCount = Run->second - Count;
+        Run->second = Count;
+    }
+    return Run;
 }
 
-/// Initialise a directory iterator.
-Dir::Iterator::Iterator(Dir* D_) : D(D_) {
-    if (not D) return;
-    Done = false;
-    ++*this;
+void Drive::AllowFileSize(u64 Size) {
+    if (Size <= MAX_SMALL_FILE_SIZE or Sb.s_feature_ro_compat & RoFeature::LargeFile) return;
+    Sb.s_feature_ro_compat |= u32(RoFeature::LargeFile);
+    SuperblockDirty = true;
 }
 
-/// Advance a directory iterator.
-Dir::Iterator Dir::Iterator::operator++() {
-    /// If the offset is past the end of the file, we're done.
-    if (NextOffset >= D->I.i_size) {
-        Done = true;
-        return *this;
+bool Drive::FreeBlocks(u64 First, u64 Count) {
+    if (First < Sb.s_first_data_block or First + Count > Sb.s_blocks_count) {
+        SetError(ErrorCode::Corrupted);
+        Log("Refusing to free blocks {} to {}: Out of range", First, First + Count);
+        return false;
     }
 
-    /// Read the next header.
-    if (not D->Drv->ReadInodeData(D->I, NextOffset, &Hdr, sizeof Hdr)) {
-        std::exchange(*this, {});
-        return *this;
+    while (Count) {
+        const u32 Group = Geometry.BlockGroup(u32(First - Sb.s_first_data_block));
+        const u64 FirstBit = Geometry.BlockInGroup(u32(First - Sb.s_first_data_block));
+        const u64 N = std::min<u64>(Count, Sb.s_blocks_per_group - FirstBit);
+        if (not UpdateBlockBitmap(Group, FirstBit, N, false)) return false;
+        First += N;
+        Count -= N;
     }
 
-    /// Nothing more to read.
-    if (Hdr.rec_len == 0) {
-        Done = true;
-        return *this;
+    return true;
+}
+
+auto Drive::LoadBlockBitmap(u32 BlockGroupIndex) -> std::vector<u8>* {
+    IoScope Scope{IoKind::Metadata};
+    if (BlockGroupIndex >= BlockBitmaps.size()) return nullptr;
+    auto& Bits = BlockBitmaps[BlockGroupIndex];
+    if (not Bits.empty()) return &Bits;
+
+    auto Desc = ReadDescriptorTable(BlockGroupIndex);
+    if (not Desc) return nullptr;
+    Bits.resize(Sb.block_size());
+    if (not Cache.Read(u64(Desc->bg_block_bitmap) * Sb.block_size(), Bits.data(), Bits.size())) {
+        Bits.clear();
+        return nullptr;
     }
 
-    /// Skip entries with an inode number of zero.
-    if (Hdr.inode == 0) {
-        NextOffset += Hdr.rec_len;
-        return ++*this;
+    return &Bits;
+}
+
+auto Drive::MaxFileSize() const -> u64 {
+    /// Revision 0 has no feature flags, so it can’t have large files.
+    if (Sb.s_rev_level == RevisionLevel::GoodOldRev) return MAX_SMALL_FILE_SIZE;
+
+    /// The limit is either what the block pointers can address or what
+    /// i_blocks can count in 512-byte sectors, including the indirect
+    /// blocks, which take up about one in every PerBlock blocks.
+    const u64 BlockSize = Sb.block_size();
+    const u64 PerBlock = BlockSize / sizeof(u32);
+    const u64 Addressable = DIRECT_BLOCK_COUNT + PerBlock + PerBlock * PerBlock + PerBlock * PerBlock * PerBlock;
+    const u64 Countable = u64(std::numeric_limits<u32>::max()) * SECTOR_SIZE / BlockSize * PerBlock / (PerBlock + 1) - 3;
+    return std::min(Addressable, Countable) * BlockSize;
+}
+
+auto Drive::MapNewBlocks(WriteState& S, Inode& I, u64 Logical, u64 Count, u64 Goal) -> std::optional<std::pair<u64, u64>> {
+    for (;;) {
+        auto Run = AllocateRun(S, Goal, Count);
+        if (not Run) return {};
+
+        /// If the drive is almost full, the run may have taken the blocks
+        /// we need for indirect blocks. Give back what we couldn’t map and
+        /// try again with a shorter run.
+        auto Mapped = SetBlockPointers(I, Logical, Run->first, Run->second);
+        if (Mapped < Run->second) {
+            if (not ReleasePrealloc(S) or not FreeBlocks(Run->first + Mapped, Run->second - Mapped)) return {};
+            if (Mapped == 0) {
+                Count = Run->second / 2;
+                if (Count == 0) return {};
+                continue;
+            }
+        }
+
+        I.i_blocks += u32(Mapped * (Sb.block_size() / SECTOR_SIZE));
+        return std::pair{Run->first, Mapped};
     }
+}
 
-    /// Read the name.
-    if (not D->Drv->ReadInodeData(D->I, NextOffset + sizeof Hdr, Name.data(), Hdr.name_len)) {
-        std::exchange(*this, {});
-        return *this;
+bool Drive::QueueFree(std::pair<u64, u64>& Pending, u64 Block) {
+    if (Pending.second and Pending.first + Pending.second == Block) {
+        Pending.second++;
+        return true;
     }
 
-    /// Update the iterator.
-    NextOffset += Hdr.rec_len;
-    return *this;
+    if (Pending.second and not FreeBlocks(Pending.first, Pending.second)) return false;
+    Pending = {Block, 1};
+    return true;
 }
 
-/// Stat a file.
-auto Drive::Stat(std::string_view FilePath, std::string_view Origin) -> std::optional<struct stat> {
-    /// Get the inode number.
-    auto INum = InodeFromPath(FilePath, Origin);
-    if (not INum) return {};
+bool Drive::ReleasePrealloc(WriteState& S) {
+    if (not S.PreallocCount) return true;
+    return FreeBlocks(S.PreallocFirst, std::exchange(S.PreallocCount, 0));
+}
 
-    /// Read the inode.
-    auto I = ReadInode(*INum);
-    if (not I) {
-        Log("Failed to read inode {} for file '{}'", *INum, FilePath);
-        return {};
+bool Drive::UpdateBlockBitmap(u32 BlockGroupIndex, u64 FirstBit, u64 Count, bool Used) {
+    if (Count == 0) return true;
+    auto Bits = LoadBlockBitmap(BlockGroupIndex);
+    auto Desc = ReadDescriptorTable(BlockGroupIndex);
+    if (not Bits or not Desc) return false;
+
+    /// Blocks that are already in the desired state indicate corruption
+    /// or a bug; don’t count them twice.
+    const u64 InUse = BitmapCount(*Bits, FirstBit, FirstBit + Count);
+    const u64 Changed = Used ? Count - InUse : InUse;
+    if (Changed != Count) {
+        LogAt<LogLevel::Warning>(
+            "{} of blocks {} to {} are already {}",
+            Count - Changed,
+            Sb.s_first_data_block + u64(BlockGroupIndex) * Sb.s_blocks_per_group + FirstBit,
+            Sb.s_first_data_block + u64(BlockGroupIndex) * Sb.s_blocks_per_group + FirstBit + Count,
+            Used ? "in use" : "free"
+        );
     }
 
-    /// Update the access time.
-    I->i_atime = (u32) time(nullptr);
-    if (not WriteInode(*INum, *I)) return {};
+    BitmapFill(*Bits, FirstBit, FirstBit + Count, Used);
 
-    /// Extract properties.
-    struct stat st {};
-    st.st_ino = *INum;
-    st.st_mode = I->i_mode;
-    st.st_nlink = I->i_links_count;
-    st.st_uid = I->i_uid;
-    st.st_gid = I->i_gid;
-    st.st_size = I->i_size;
-    st.st_blksize = Sb.block_size();
-    st.st_blocks = I->i_blocks;
-    st.st_atime = I->i_atime;
-    st.st_mtime = I->i_mtime;
-    st.st_ctime = I->i_ctime;
-    return st;
+    /// Write back only the bytes that changed.
+    const u64 FirstByte = FirstBit / 8;
+    const u64 EndByte = (FirstBit + Count + 7) / 8;
+    if (not Cache.Write(
+            u64(Desc->bg_block_bitmap) * Sb.block_size() + FirstByte,
+            Bits->data() + FirstByte,
+            EndByte - FirstByte
+        )) return false;
+
+    if (Used) {
+        Desc->bg_free_blocks_count = u16(Desc->bg_free_blocks_count - Changed);
+        Sb.s_free_blocks_count -= u32(Changed);
+    } else {
+        Desc->bg_free_blocks_count = u16(Desc->bg_free_blocks_count + Changed);
+        Sb.s_free_blocks_count += u32(Changed);
+    }
+
+    SuperblockDirty = true;
+    return WriteDescriptorTable(BlockGroupIndex, *Desc);
 }
 
-/// Attempt to mount a drive.
-auto Drive::TryMount(FdType Fd) -> std::shared_ptr<Drive> {
-    /// Read the superblock.
-    Superblock sb;
-    if (not Read(Fd, SUPERBLOCK_OFFSET, &sb, sizeof sb)) {
-        Log("Drive is too small to contain a valid ext2 filesystem.");
-        return nullptr;
+auto Drive::SetBlockPointers(Inode& I, u64 Logical, u64 Physical, u64 Count) -> u64 {
+    IoScope Scope{IoKind::Metadata};
+    const u64 BlockSize = Sb.block_size();
+    const u64 PerBlock = BlockSize / sizeof(u32);
+    std::vector<u32> Entries;
+    u64 Mapped = 0;
+    while (Mapped < Count) {
+        /// Direct blocks.
+        if (Logical < DIRECT_BLOCK_COUNT) {
+            I.i_block[Logical++] = u32(Physical++);
+            Mapped++;
+            continue;
+        }
+
+        /// Find out which indirect tree this block is in and the index at
+        /// each level of that tree.
+        u64 Rest = Logical - DIRECT_BLOCK_COUNT;
+        u32 Depth = 1;
+        u64 Span = PerBlock;
+        while (Rest >= Span) {
+            Rest -= Span;
+            if (++Depth > 3) {
+                SetError(ErrorCode::FileTooLarge);
+                Log("Sorry, file too large to be stored in an EXT2 filesystem.");
+                return Mapped;
+            }
+            Span *= PerBlock;
+        }
+
+        /// Walk down to the last level, allocating indirect blocks as we go.
+        u32& Root = I.i_block[INDIRECT_BLOCK_INDEX + Depth - 1];
+        if (not Root and not (Root = AllocateIndirectBlock(I, Physical))) return Mapped;
+        u64 Current = Root;
+        for (u32 Level = Depth; Level > 1; Level--) {
+            Span /= PerBlock;
+            const u64 EntryOffset = Current * BlockSize + (Rest / Span) * sizeof(u32);
+            Rest %= Span;
+
+            u32 Next;
+            if (not Cache.Read(EntryOffset, &Next, sizeof Next)) return Mapped;
+            if (not Next) {
+                if (not (Next = AllocateIndirectBlock(I, Physical))) return Mapped;
+                if (not Cache.Write(EntryOffset, &Next, sizeof Next)) return Mapped;
+            }
+            Current = Next;
+        }
+
+        /// Fill in as many entries of that block as we can at once.
+        const u64 N = std::min(Count - Mapped, PerBlock - Rest);
+        Entries.resize(N);
+        for (u64 j = 0; j < N; j++) Entries[j] = u32(Physical + j);
+        if (not Cache.Write(Current * BlockSize + Rest * sizeof(u32), Entries.data(), N * sizeof(u32))) return Mapped;
+        Logical += N;
+        Physical += N;
+        Mapped += N;
     }
 
-    /// Validate the superblock.
-    if (sb.s_magic != EXT2_SUPER_MAGIC) {
-        Log("Invalid magic number: 0x{:04x}", sb.s_magic);
-        return nullptr;
+    return Mapped;
+}
+
+bool Drive::TruncateBranch(Inode& I, u32& Block, u32 Level, u64 First, u64 Keep, std::pair<u64, u64>& Pending) {
+    IoScope Scope{IoKind::Metadata};
+    const u64 PerBlock = Sb.block_size() / sizeof(u32);
+    u64 Span = 1;
+    for (u32 i = 0; i < Level; i++) Span *= PerBlock;
+    if (Block == 0 or First + Span <= Keep) return true;
+
+    /// Free the children if this is an indirect block.
+    if (Level) {
+        std::vector<u32> Entries(PerBlock);
+        if (not Cache.Read(u64(Block) * Sb.block_size(), Entries.data(), Sb.block_size())) return false;
+
+        bool Changed = false;
+        for (u64 i = 0; i < PerBlock; i++) {
+            const u32 Old = Entries[i];
+            if (not TruncateBranch(I, Entries[i], Level - 1, First + i * (Span / PerBlock), Keep, Pending)) return false;
+            Changed |= Entries[i] != Old;
+        }
+
+        /// Keep this block if it still maps something.
+        if (std::any_of(Entries.begin(), Entries.end(), [](u32 E) { return E != 0; })) {
+            return not Changed or Cache.Write(u64(Block) * Sb.block_size(), Entries.data(), Sb.block_size());
+        }
     }
 
-    /// Check for incompatible or read-only features.
-    if (sb.s_feature_incompat or sb.s_feature_ro_compat) {
-        Log("Incompatible or read-only features are enabled. Refusing to mount.");
-        return nullptr;
+    if (not QueueFree(Pending, Block)) return false;
+    I.i_blocks -= u32(Sb.block_size() / SECTOR_SIZE);
+    Block = 0;
+    return true;
+}
+
+/// ===========================================================================
+///  Write-back.
+/// ===========================================================================
+auto Drive::DelayedRange(WriteState& S, u64 First, u64 Count) -> u8* {
+    const u64 BlockSize = Sb.block_size();
+    const u64 End = First + Count;
+    auto Blocks = [&](auto It) { return It->second.size() / BlockSize; };
+
+    /// Find the first run that overlaps or touches the range.
+    auto It = S.Delayed.upper_bound(First);
+    if (It != S.Delayed.begin()) {
+        if (auto Prev = std::prev(It); Prev->first + Blocks(Prev) >= First) It = Prev;
     }
 
-    /// Check for errors.
-    if (sb.s_state == FsState::HasErrors) {
-        Log("Filesystem has errors. Refusing to mount.");
-        return nullptr;
+    /// Overwriting delayed data is the common case.
+    if (It != S.Delayed.end() and It->first <= First and It->first + Blocks(It) >= End)
+        return It->second.data() + (First - It->first) * BlockSize;
+
+    /// Otherwise, merge everything that overlaps or touches the range.
+    u64 NewFirst = First, NewEnd = End, Existing = 0;
+    auto Last = It;
+    for (; Last != S.Delayed.end() and Last->first <= End; ++Last) {
+        NewFirst = std::min(NewFirst, Last->first);
+        NewEnd = std::max(NewEnd, Last->first + Blocks(Last));
+        Existing += Blocks(Last);
     }
 
-    /// Set the error flag. We'll clear it when we unmount the drive.
-    sb.s_state = FsState::HasErrors;
+    const u64 Added = NewEnd - NewFirst - Existing;
+    if (not HasDelayedSpace(Added)) return nullptr;
+
+    /// Appending to a run is by far the most common way to get here, so
+    /// reuse its buffer if it starts the range.
+    std::vector<u8> Data;
+    if (It != Last and It->first == NewFirst) Data = std::move(It->second);
+    Data.resize((NewEnd - NewFirst) * BlockSize);
+    for (auto R = It; R != Last; ++R)
+        if (not R->second.empty()) std::memcpy(Data.data() + (R->first - NewFirst) * BlockSize, R->second.data(), R->second.size());
+
+    S.Delayed.erase(It, Last);
+    auto Run = S.Delayed.emplace(NewFirst, std::move(Data)).first;
+    DelayedBlocks.fetch_add(Added, std::memory_order_release);
+    return Run->second.data() + (First - NewFirst) * BlockSize;
+}
 
-    /// Create the drive.
-    auto ptr = std::shared_ptr<Drive>{::new Drive(Fd, std::move(sb))};
-    ptr->This = ptr;
-    return ptr;
+bool Drive::FlushAllDelayed() {
+    bool Ok = true;
+    for (auto It = WriteStates.begin(); It != WriteStates.end();) {
+        /// This may drop the entry.
+        const auto InodeNumber = It++->first;
+        Ok = FlushDelayed(InodeNumber) and Ok;
+    }
+    return Ok;
+}
+
+bool Drive::FlushDelayed(InodeNumberType InodeNumber) {
+    auto State = WriteStates.find(InodeNumber);
+    if (State == WriteStates.end()) return true;
+    auto& S = State->second;
+
+    bool Ok = true;
+    if (not S.Delayed.empty()) {
+        auto I = ReadInode(*S.Pin);
+        auto Map = GetBlockMap(InodeNumber, I);
+        if (not Map) return false;
+
+        /// Runs are written in order, and each one continues right after
+        /// the block before it if that is mapped, so a file written from
+        /// start to end ends up contiguous if there is room for it.
+        const u64 BlockSize = Sb.block_size();
+        u64 Goal = Sb.s_first_data_block + u64(Geometry.InodeGroup(InodeNumber - 1)) * Sb.s_blocks_per_group;
+        u64 LastLogical = 0, LastPhysical = 0;
+        auto Run = S.Delayed.begin();
+        u64 Done = 0;
+        for (; Run != S.Delayed.end() and Ok; ++Run) {
+            const u64 Count = Run->second.size() / BlockSize;
+            for (Done = 0; Done < Count;) {
+                const u64 Logical = Run->first + Done;
+                if (LastPhysical and LastLogical + 1 == Logical) Goal = LastPhysical + 1;
+                else if (Logical) {
+                    if (auto Prev = Map->Find(Logical - 1); Prev.Physical) Goal = Prev.Physical + (Logical - Prev.Logical);
+                }
+
+                auto Mapped = MapNewBlocks(S, I, Logical, Count - Done, Goal);
+                if (not Mapped) {
+                    Ok = false;
+                    break;
+                }
+
+                /// The blocks are mapped now, so never give them out twice,
+                /// even if writing them fails.
+                const auto Data = Run->second.data() + Done * BlockSize;
+                Ok = Cache.WriteAround(Mapped->first * BlockSize, Data, Mapped->second * BlockSize);
+                Done += Mapped->second;
+                LastLogical = Logical + Mapped->second - 1;
+                LastPhysical = Mapped->first + Mapped->second - 1;
+                if (not Ok) break;
+            }
+
+            if (Done < Count) break;
+        }
+
+        /// Point the inode to the data before we drop it so that readers
+        /// always find it in one place or the other.
+        Ok = WriteInode(InodeNumber, I) and Ok;
+        {
+            std::unique_lock MapGuard{BlockMapLock};
+            BlockMaps.Erase(InodeNumber);
+        }
+
+        std::unique_lock Guard{DelayedLock};
+        u64 Flushed = 0;
+        for (auto R = S.Delayed.begin(); R != Run;) {
+            Flushed += R->second.size() / BlockSize;
+            R = S.Delayed.erase(R);
+        }
+
+        /// Keep the part of the run we stopped in that we haven’t written.
+        if (Run != S.Delayed.end() and Done) {
+            std::vector<u8> Rest{Run->second.begin() + isz(Done * BlockSize), Run->second.end()};
+            const u64 RestFirst = Run->first + Done;
+            S.Delayed.erase(Run);
+            S.Delayed.emplace(RestFirst, std::move(Rest));
+            Flushed += Done;
+        }
+
+        DelayedBlocks.fetch_sub(Flushed, std::memory_order_release);
+    }
+
+    /// Drop the state if nothing needs it anymore.
+    if (S.Writers == 0 and S.Delayed.empty()) {
+        Ok = ReleasePrealloc(S) and Ok;
+        std::unique_lock Guard{DelayedLock};
+        WriteStates.erase(State);
+    }
+
+    return Ok;
+}
+
+void Drive::FlusherMain() {
+    std::unique_lock Guard{FlusherLock};
+    while (not FlusherStop) {
+        FlusherWake.wait_for(Guard, WritebackInterval, [&] { return FlusherStop or FlusherKick; });
+        if (FlusherStop) return;
+        FlusherKick = false;
+        Guard.unlock();
+
+        /// Don’t touch the superblock if there is nothing to do.
+        {
+            std::unique_lock Write{WriteLock};
+            if (DelayedBlocks.load(std::memory_order_relaxed) or Cache.DirtyCount() or SuperblockDirty) WriteBackAll();
+        }
+
+        Guard.lock();
+    }
+}
+
+auto Drive::GetWriteState(InodeNumberType InodeNumber, const std::shared_ptr<CachedInode>& Pin) -> WriteState& {
+    if (auto It = WriteStates.find(InodeNumber); It != WriteStates.end()) return It->second;
+
+    /// Start writing back in the background once anything is written.
+    if (DirtyLimitBlocks and not Flusher.joinable()) Flusher = std::thread{[this] { FlusherMain(); }};
+
+    std::unique_lock Guard{DelayedLock};
+    auto& S = WriteStates[InodeNumber];
+    S.Pin = Pin;
+    return S;
+}
+
+bool Drive::HasDelayed(InodeNumberType InodeNumber) {
+    std::shared_lock Guard{DelayedLock};
+    auto State = WriteStates.find(InodeNumber);
+    return State != WriteStates.end() and not State->second.Delayed.empty();
+}
+
+bool Drive::HasDelayedSpace(u64 Added) const {
+    /// Leave room for the indirect blocks of every run, and for a few
+    /// more per inode since a run may straddle several of them.
+    const u64 PerBlock = Sb.block_size() / sizeof(u32);
+    u64 Needed = DelayedBlocks.load(std::memory_order_relaxed) + Added;
+    Needed += Needed / PerBlock + 3 * (WriteStates.size() + 1);
+    return Needed <= AvailableBlocks();
+}
+
+void Drive::OverlayDelayed(InodeNumberType InodeNumber, u64 Offset, std::span<const iovec> Iov, usz Size) {
+    auto State = WriteStates.find(InodeNumber);
+    if (State == WriteStates.end()) return;
+
+    const u64 BlockSize = Sb.block_size();
+    const u64 End = Offset + Size;
+    auto& Runs = State->second.Delayed;
+    auto Run = Runs.upper_bound(Offset / BlockSize);
+    if (Run != Runs.begin()) --Run;
+    for (; Run != Runs.end() and Run->first * BlockSize < End; ++Run) {
+        const u64 RunStart = Run->first * BlockSize;
+        const u64 From = std::max(Offset, RunStart);
+        const u64 To = std::min(End, RunStart + Run->second.size());
+        if (From >= To) continue;
+
+        /// Find the buffer the data starts in and copy it.
+        u64 Pos = From - Offset;
+        auto Src = Run->second.data() + (From - RunStart);
+        usz Left = To - From;
+        for (auto& V : Iov) {
+            if (Left == 0) break;
+            if (Pos >= V.iov_len) {
+                Pos -= V.iov_len;
+                continue;
+            }
+
+            const usz N = std::min<usz>(Left, V.iov_len - Pos);
+            std::memcpy(static_cast<u8*>(V.iov_base) + Pos, Src, N);
+            Src += N;
+            Left -= N;
+            Pos = 0;
+        }
+    }
+}
+
+bool Drive::Sync() {
+    if (ReadOnly) return true;
+    std::unique_lock Guard{WriteLock};
+    bool Ok = WriteBackInodes();
+    Ok = WriteBackAll() and Ok;
+    return Device->Flush() and Ok;
+}
+
+void Drive::ThrottleWrites() {
+    if (not DirtyLimitBlocks) return;
+    const usz CacheDirty = Cache.DirtyCount();
+    const usz Dirty = DelayedBlocks.load(std::memory_order_relaxed) + CacheDirty;
+    if (Dirty >= DirtyLimitBlocks) {
+        WriteBackAll();
+        return;
+    }
+
+    /// Dirty blocks can’t be evicted, so don’t let them fill the cache
+    /// either; once they do, every write goes straight to the device.
+    const usz Capacity = Cache.Stats().Capacity;
+    if (CacheDirty >= Capacity / 4 * 3) {
+        WriteBackBlocks();
+        return;
+    }
+
+    if (Dirty >= DirtyBackgroundBlocks or CacheDirty >= Capacity / 2) {
+        {
+            std::unique_lock Guard{FlusherLock};
+            FlusherKick = true;
+        }
+        FlusherWake.notify_one();
+    }
+}
+
+bool Drive::WriteBackAll() {
+    bool Ok = FlushAllDelayed();
+    return WriteBackBlocks() and Ok;
+}
+
+bool Drive::WriteBackBlocks() {
+    bool Ok = true;
+    if (SuperblockDirty) {
+        SuperblockDirty = false;
+        Ok = Cache.Write(SUPERBLOCK_OFFSET, &Sb, sizeof Sb);
+    }
+    return Cache.Flush() and Ok;
+}
+
+/// ===========================================================================
+///  Block maps.
+/// ===========================================================================
+void BlockMap::Append(u64 Physical, u64 Count) {
+    if (not Extents.empty()) {
+        auto& Last = Extents.back();
+        bool BothHoles = Last.Physical == 0 and Physical == 0;
+        if (BothHoles or (Last.Physical != 0 and Last.Physical + Last.Length == Physical)) {
+            Last.Length += Count;
+            return;
+        }
+    }
+
+    u64 Logical = Extents.empty() ? 0 : Extents.back().Logical + Extents.back().Length;
+    Extents.push_back({Logical, Physical, Count});
+}
+
+auto BlockMap::Find(u64 Logical) const -> Extent {
+    auto It = std::upper_bound(Extents.begin(), Extents.end(), Logical, [](u64 L, const Extent& E) {
+        return L < E.Logical;
+    });
+
+    if (It != Extents.begin()) {
+        auto& E = *std::prev(It);
+        if (Logical < E.Logical + E.Length) return E;
+    }
+
+    /// Past the end of the map.
+    return {Logical, 0, std::numeric_limits<u64>::max() / 2};
+}
+
+auto BlockMap::DriveBlocks(u64 First, u64 Count) const -> std::vector<u64> {
+    std::vector<u64> Result;
+    for (u64 Logical = First; Logical < First + Count;) {
+        auto E = Find(Logical);
+        auto N = std::min(First + Count - Logical, E.Length - (Logical - E.Logical));
+        if (E.Physical)
+            for (u64 i = 0; i < N; i++) Result.push_back(E.Physical + Logical - E.Logical + i);
+        Logical += N;
+    }
+    return Result;
+}
+
+bool BlockMap::Matches(const Inode& I) const {
+    return Size == I.Size() and Sectors == I.i_blocks and std::equal(Blocks.begin(), Blocks.end(), I.i_block);
+}
+
+auto Drive::BuildBlockMap(const Inode& I) -> std::shared_ptr<const BlockMap> {
+    IoScope Scope{IoKind::Metadata};
+    auto Map = std::make_shared<BlockMap>();
+    std::copy_n(I.i_block, Map->Blocks.size(), Map->Blocks.begin());
+    Map->Size = I.Size();
+    Map->Sectors = I.i_blocks;
+
+    /// Direct blocks.
+    u64 Remaining = Geometry.Blocks(I.Size());
+    for (usz i = 0; i < DIRECT_BLOCK_COUNT and Remaining; i++, Remaining--) Map->Append(I.i_block[i]);
+
+    /// Indirect blocks.
+    for (u32 Level = 1; Level <= 3 and Remaining; Level++)
+        if (not MapIndirectBlock(*Map, I.i_block[INDIRECT_BLOCK_INDEX + Level - 1], Level, Remaining))
+            return nullptr;
+
+    if (Remaining) {
+        SetError(ErrorCode::FileTooLarge);
+        Log("Sorry, file too large to be stored in an EXT2 filesystem.");
+        return nullptr;
+    }
+
+    return Map;
+}
+
+auto Drive::GetBlockMap(InodeNumberType InodeNumber, const Inode& I) -> std::shared_ptr<const BlockMap> {
+    {
+        std::unique_lock Guard{BlockMapLock};
+        if (auto Map = BlockMaps.Get(InodeNumber); Map and (*Map)->Matches(I)) return *Map;
+    }
+
+    /// Build the map without holding the lock.
+    auto Map = IndexedBlockMap(InodeNumber, I);
+    if (not Map) Map = BuildBlockMap(I);
+    if (not Map) return nullptr;
+
+    std::unique_lock Guard{BlockMapLock};
+    BlockMaps.Put(InodeNumber, Map);
+    return Map;
+}
+
+auto Drive::IndexedBlockMap(InodeNumberType InodeNumber, const Inode& I) -> std::shared_ptr<const BlockMap> {
+    auto NI = GetNamespaceIndex();
+    if (not NI) return nullptr;
+    auto Record = NI->FindInode(InodeNumber);
+    if (not Record) return nullptr;
+
+    auto Map = std::make_shared<BlockMap>();
+    Map->Blocks = Record->Blocks;
+    Map->Size = Record->Size;
+    Map->Sectors = Record->Sectors;
+    if (not Map->Matches(I)) return nullptr;
+
+    /// The index matched the superblock, but don’t trust it with blocks
+    /// that aren’t on the drive.
+    for (auto& E : NI->Extents(*Record)) {
+        auto Logical = Map->Extents.empty() ? 0 : Map->Extents.back().Logical + Map->Extents.back().Length;
+        if (E.Logical != Logical or E.Length == 0 or E.Physical >= Sb.s_blocks_count or Sb.s_blocks_count - E.Physical < E.Length) {
+            LogAt<LogLevel::Warning>("Namespace index has an invalid block map for inode {}.", InodeNumber);
+            return nullptr;
+        }
+        Map->Extents.push_back({E.Logical, E.Physical, E.Length});
+    }
+
+    auto Metadata = NI->Metadata(*Record);
+    if (std::ranges::any_of(Metadata, [&](u64 B) { return B >= Sb.s_blocks_count; })) {
+        LogAt<LogLevel::Warning>("Namespace index has an invalid block map for inode {}.", InodeNumber);
+        return nullptr;
+    }
+
+    Map->MetadataBlocks.assign(Metadata.begin(), Metadata.end());
+    return Map;
+}
+
+void Drive::ResizeBlockMap(InodeNumberType InodeNumber, const BlockMap& Map, u64 Size) {
+    if (Map.Size == Size) return;
+    auto Resized = std::make_shared<BlockMap>(Map);
+    Resized->Size = Size;
+    std::unique_lock Guard{BlockMapLock};
+    BlockMaps.Put(InodeNumber, std::move(Resized));
+}
+
+template <u32 Shift>
+bool Drive::MapIndirectBlockFor(BlockMap& Map, u64 Block, u32 Level, u64& Remaining) {
+    const u32 PointerShift = Shift ? Shift - 2 : Geometry.PointerShift;
+    const u64 BlocksPerBlock = u64(1) << PointerShift;
+    const u64 Span = u64(1) << (PointerShift * (Level - 1));
+
+    /// A missing indirect block means that everything it would map is a hole.
+    if (Block == 0) {
+        auto Holes = std::min(Remaining, Span * BlocksPerBlock);
+        Map.Append(0, Holes);
+        Remaining -= Holes;
+        return true;
+    }
+
+    auto Ref = Cache.Get(Block);
+    if (not Ref) return false;
+    Map.MetadataBlocks.push_back(Block);
+
+    auto Entries = reinterpret_cast<const u32*>(Ref.data());
+    for (u64 i = 0; i < BlocksPerBlock and Remaining; i++) {
+        if (Level == 1) {
+            Map.Append(Entries[i]);
+            Remaining--;
+        } else if (not MapIndirectBlockFor<Shift>(Map, Entries[i], Level - 1, Remaining)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+auto Drive::SelectBlockOps(u32 Shift) -> BlockOps {
+    /// These are the block sizes mke2fs creates; anything else uses the
+    /// generic versions, which read the block size from the geometry.
+    switch (Shift) {
+        case 10: return {&Drive::MapIndirectBlockFor<10>, &Drive::ReadInodeDataVFor<10>};
+        case 11: return {&Drive::MapIndirectBlockFor<11>, &Drive::ReadInodeDataVFor<11>};
+        case 12: return {&Drive::MapIndirectBlockFor<12>, &Drive::ReadInodeDataVFor<12>};
+        default: return {&Drive::MapIndirectBlockFor<0>, &Drive::ReadInodeDataVFor<0>};
+    }
+}
+
+bool Drive::WriteInode(u32 InodeNumber, const Inode& i_) {
+    IoScope Scope{IoKind::Inode};
+    auto Offset = ComputeInodeOffset(InodeNumber);
+    if (not Offset) return false;
+
+    /// Write the inode and update the cached copy while holding the
+    /// lock so that readers never see a copy older than the drive. Keep
+    /// an access time that was updated lazily after the caller got its
+    /// copy of the inode.
+    std::unique_lock Guard{InodeLock};
+    auto Entry = Inodes.Get(InodeNumber);
+    auto i = i_;
+    if (Entry and (*Entry)->Dirty) i.i_atime = std::max(i.i_atime, (*Entry)->I.i_atime);
+    if (not Cache.Write(*Offset, &i, sizeof i)) return false;
+
+    /// Cached lookups in a directory are stale if its contents changed
+    /// or if it was deleted. If we don’t know the old version of the
+    /// inode, assume that it did.
+    if (i.Is(Inode::Directory) or (Entry and (*Entry)->I.Is(Inode::Directory))) {
+        auto Changed = [&](const Inode& Old) {
+            return Old.i_mtime != i.i_mtime or
+                   Old.i_size != i.i_size or
+                   Old.i_links_count != i.i_links_count or
+                   std::memcmp(Old.i_block, i.i_block, sizeof i.i_block) != 0;
+        };
+
+        if (not Entry or Changed((*Entry)->I)) InvalidateDentries(InodeNumber);
+    }
+    if (not Entry) Entry = Inodes.Put(InodeNumber, std::make_shared<CachedInode>(), [](InodeNumberType, const std::shared_ptr<CachedInode>& E) {
+        return E.use_count() == 1 and not E->Dirty;
+    });
+
+    if (Entry) {
+        (*Entry)->I = i;
+        (*Entry)->Version++;
+        (*Entry)->Dirty = false;
+    }
+
+    LazyInodes.erase(InodeNumber);
+    return true;
+}
+
+bool Drive::WriteBackInodes() {
+    IoScope Scope{IoKind::Inode};
+    std::vector<InodeNumberType> Pending;
+    {
+        std::unique_lock Guard{InodeLock};
+        Pending.assign(LazyInodes.begin(), LazyInodes.end());
+    }
+
+    /// Write them in order so that inodes in the same block end up
+    /// next to each other.
+    std::ranges::sort(Pending);
+    bool Ok = true;
+    for (auto InodeNumber : Pending) {
+        auto Offset = ComputeInodeOffset(InodeNumber);
+        if (not Offset) {
+            Ok = false;
+            continue;
+        }
+
+        std::unique_lock Guard{InodeLock};
+        auto Entry = Inodes.Get(InodeNumber);
+        if (not Entry or not(*Entry)->Dirty) continue;
+        if (not Cache.Write(*Offset, &(*Entry)->I, sizeof(Inode))) {
+            Ok = false;
+            continue;
+        }
+
+        (*Entry)->Version++;
+        (*Entry)->Dirty = false;
+        LazyInodes.erase(InodeNumber);
+    }
+
+    return Ok;
+}
+
+bool Drive::WriteDescriptorTable(u32 BlockGroupIndex, const BlockGroupDescriptor& Table) {
+    IoScope Scope{IoKind::Descriptor};
+    std::unique_lock Guard{DescriptorLock};
+    if (BlockGroupIndex >= Descriptors.size()) return false;
+    Descriptors[BlockGroupIndex] = Table;
+
+    /// Write the descriptor through to the primary table and
+    /// to every backup copy. Each copy is stored in the block
+    /// right after the superblock of its block group.
+    const auto EntryOffset = BlockGroupIndex * sizeof Table;
+    for (u32 Group = 0; Group < Descriptors.size(); Group++) {
+        if (not GroupHasSuperblock(Group)) continue;
+        u64 TableBlock = Sb.s_first_data_block + u64(Group) * Sb.s_blocks_per_group + 1;
+        if (not Cache.Write(TableBlock * Sb.block_size() + EntryOffset, &Table, sizeof Table)) return false;
+    }
+
+    return true;
+}
+
+/// ===========================================================================
+///  Asynchronous API.
+/// ===========================================================================
+auto Drive::AsyncFetchData(const BlockMap& Map, u64 First, u64 Count, std::vector<BlockRef>& Held, IoKind Kind) -> Task<bool> {
+    auto Blocks = Map.DriveBlocks(First, Count);
+    auto Start = Held.size();
+    Held.resize(Start + Blocks.size());
+    co_return co_await Cache.AsyncGetBlocks(Blocks, std::span{Held}.subspan(Start), Ready, Kind);
+}
+
+auto Drive::AsyncFetchIndirect(const u8* Data, u32 Level, u64 Remaining, std::vector<BlockRef>& Held) -> Task<bool> {
+    if (Level == 1) co_return true;
+    const u64 BlocksPerBlock = Sb.block_size() / sizeof(u32);
+    u64 ChildSpan = 1;
+    for (u32 i = 1; i < Level; i++) ChildSpan *= BlocksPerBlock;
+
+    /// Fetch all children that map anything in one go.
+    auto Entries = reinterpret_cast<const u32*>(Data);
+    const u64 Children = std::min(BlocksPerBlock, (Remaining + ChildSpan - 1) / ChildSpan);
+    std::vector<u64> Blocks;
+    std::vector<u64> Covered;
+    for (u64 i = 0; i < Children; i++) {
+        if (Entries[i] == 0) continue;
+        Blocks.push_back(Entries[i]);
+        Covered.push_back(std::min(ChildSpan, Remaining - i * ChildSpan));
+    }
+
+    std::vector<BlockRef> Refs(Blocks.size());
+    if (not co_await Cache.AsyncGetBlocks(Blocks, Refs, Ready, IoKind::Metadata)) co_return false;
+    for (usz i = 0; i < Refs.size(); i++)
+        if (not co_await AsyncFetchIndirect(Refs[i].data(), Level - 1, Covered[i], Held)) co_return false;
+
+    for (auto& Ref : Refs) Held.push_back(std::move(Ref));
+    co_return true;
+}
+
+auto Drive::AsyncGetBlockMap(InodeNumberType InodeNumber, Inode I) -> Task<std::shared_ptr<const BlockMap>> {
+    {
+        std::unique_lock Guard{BlockMapLock};
+        if (auto Map = BlockMaps.Get(InodeNumber); Map and (*Map)->Matches(I)) co_return *Map;
+    }
+
+    /// Fetch the indirect blocks one level at a time and keep them
+    /// pinned so that building the map only has to look at the cache.
+    const u64 BlocksPerBlock = Sb.block_size() / sizeof(u32);
+    u64 Remaining = Geometry.Blocks(I.Size());
+    Remaining -= std::min<u64>(Remaining, DIRECT_BLOCK_COUNT);
+    std::vector<BlockRef> Held;
+    u64 Span = 1;
+    for (u32 Level = 1; Level <= 3 and Remaining; Level++) {
+        Span *= BlocksPerBlock;
+        const u64 Covered = std::min(Remaining, Span);
+        Remaining -= Covered;
+
+        u64 Block = I.i_block[INDIRECT_BLOCK_INDEX + Level - 1];
+        if (Block == 0) continue;
+        BlockRef Ref;
+        if (not co_await Cache.AsyncGetBlocks({&Block, 1}, {&Ref, 1}, Ready, IoKind::Metadata)) co_return nullptr;
+        auto Data = Ref.data();
+        Held.push_back(std::move(Ref));
+        if (not co_await AsyncFetchIndirect(Data, Level, Covered, Held)) co_return nullptr;
+    }
+
+    co_return GetBlockMap(InodeNumber, I);
+}
+
+auto Drive::AsyncLookupDentry(InodeNumberType Parent, std::string_view Name) -> Task<std::optional<LinkedDirEntryHeader>> {
+    u64 Generation;
+    {
+        std::unique_lock Guard{DentryLock};
+        if (auto Cached = Dentries.Get(DentryView{Parent, Name})) co_return *Cached;
+        Generation = DentryGeneration;
+    }
+
+    auto Pinned = co_await AsyncPinInode(Parent);
+    if (not Pinned) {
+        Log("Failed to read inode {}.", Parent);
+        co_return std::nullopt;
+    }
+
+    auto I = ReadInode(*Pinned);
+    if (not I.Is(Inode::Directory)) {
+        SetError(ErrorCode::NotADirectory);
+        LogAt<LogLevel::Debug>("Inode {} is not a directory.", Parent);
+        co_return std::nullopt;
+    }
+
+    auto Map = co_await AsyncGetBlockMap(Parent, I);
+    if (not Map) co_return std::nullopt;
+
+    /// Indexed directories can be large, so walk the index and fetch one
+    /// block of the path at a time. As in FindDirectoryEntry(), scan the
+    /// directory if the index can’t be used.
+    const u64 Blocks = Geometry.Blocks(I.Size());
+    std::optional<LinkedDirEntryHeader> Entry;
+    if (
+        Sb.s_feature_compat & CompatFeature::DirIndex and
+        I.i_flags & INDEX_FL and
+        Name != "." and
+        Name != ".."
+    ) {
+        HTreeLookup Lookup{Parent, Name, Sb};
+        while (not Lookup.Done()) {
+            std::vector<BlockRef> Held;
+            if (not co_await AsyncFetchData(*Map, Lookup.Block(), 1, Held, IoKind::Directory)) break;
+            IoScope Scope{IoKind::Directory};
+            auto Ref = InodeDataView(*Map, Lookup.Block() << Geometry.Shift, Sb.block_size());
+            if (not Ref) break;
+            Lookup.Step(std::move(Ref));
+        }
+        if (Lookup.Done()) Entry = Lookup.Result();
+    }
+
+    /// Otherwise, fetch the directory in batches and search each batch.
+    if (not Entry) {
+        Entry = LinkedDirEntryHeader{};
+        for (u64 First = 0; First < Blocks and Entry and Entry->inode == 0; First += BlockCache::MAX_BATCH) {
+            auto Count = std::min<u64>(BlockCache::MAX_BATCH, Blocks - First);
+            std::vector<BlockRef> Held;
+            if (not co_await AsyncFetchData(*Map, First, Count, Held, IoKind::Directory)) co_return std::nullopt;
+
+            IoScope Scope{IoKind::Directory};
+            for (u64 Block = First; Block < First + Count; Block++) {
+                Entry = FindEntryInBlock(*Map, Block, Name);
+                if (not Entry or Entry->inode != 0) break;
+            }
+        }
+    }
+
+    /// Only cache the result if no directory was modified in the meantime.
+    if (not Entry) co_return std::nullopt;
+    std::unique_lock Guard{DentryLock};
+    if (Generation == DentryGeneration) Dentries.Put({Parent, std::string{Name}}, *Entry);
+    co_return Entry;
+}
+
+auto Drive::AsyncPinInode(InodeNumberType InodeNumber) -> Task<std::shared_ptr<CachedInode>> {
+    {
+        std::unique_lock Guard{InodeLock};
+        if (auto Cached = Inodes.Get(InodeNumber)) co_return *Cached;
+    }
+
+    /// Fetch the block that contains the inode, after which PinInode()
+    /// finds it in the cache.
+    auto Offset = ComputeInodeOffset(InodeNumber);
+    if (not Offset) co_return nullptr;
+    u64 Block = Geometry.Block(*Offset);
+    BlockRef Ref;
+    if (not co_await Cache.AsyncGetBlocks({&Block, 1}, {&Ref, 1}, Ready, IoKind::Inode)) co_return nullptr;
+    co_return PinInode(InodeNumber);
+}
+
+auto Drive::AsyncReadInodeData(const BlockMap& Map, u64 Offset, std::span<u8> Buffer) -> Task<bool> {
+    const usz BlockSize = Sb.block_size();
+
+    /// A part of the buffer that is read through the cache.
+    struct Copy {
+        u64 DeviceOffset;
+        u8* Dest;
+        usz Size;
+    };
+
+    /// Sort the buffer into holes, large extents that are read directly,
+    /// and blocks that are read through the cache, as ReadInodeDataV()
+    /// does, so that everything can be read with at most two batches.
+    std::vector<iovec> Iov;
+    std::vector<IoRequest> Requests;
+    std::vector<Copy> Copies;
+    std::vector<u64> Blocks;
+    for (usz Done = 0; Done < Buffer.size();) {
+        u64 BlockIndex = Geometry.Block(Offset);
+        usz BlockOffset = Geometry.Within(Offset);
+        auto Size = Buffer.size() - Done;
+        auto E = Map.Find(BlockIndex);
+        auto BlocksLeft = std::min<u64>(E.Length - (BlockIndex - E.Logical), Geometry.Block(BlockOffset + Size) + 1);
+        auto ToRead = usz(std::min<u64>(Size, (BlocksLeft << Geometry.Shift) - BlockOffset));
+        auto Dest = Buffer.data() + Done;
+
+        auto DeviceOffset = ((E.Physical + BlockIndex - E.Logical) << Geometry.Shift) + BlockOffset;
+        if (E.Physical == 0) {
+            std::memset(Dest, 0, ToRead);
+        } else if (ToRead >= DIRECT_READ_BLOCKS * BlockSize and not Cache.HasDirty(Geometry.Block(DeviceOffset), BlocksLeft)) {
+            Iov.push_back({Dest, ToRead});
+            Requests.push_back({.Op = IoRequest::Kind::Read, .Offset = DeviceOffset, .Iov = nullptr, .Count = 1});
+        } else {
+            Copies.push_back({DeviceOffset, Dest, ToRead});
+            for (u64 B = Geometry.Block(DeviceOffset); (B << Geometry.Shift) < DeviceOffset + ToRead; B++) Blocks.push_back(B);
+        }
+
+        Offset += ToRead;
+        Done += ToRead;
+    }
+
+    /// Iov doesn’t move anymore.
+    for (usz i = 0; i < Requests.size(); i++) Requests[i].Iov = &Iov[i];
+
+    std::vector<BlockRef> Refs(Blocks.size());
+    if (not co_await Cache.AsyncGetBlocks(Blocks, Refs, Ready, IoKind::Data)) co_return false;
+    if (not co_await AsyncSubmit{*Device, Requests, Ready, IoKind::Data}) co_return false;
+
+    /// Copy from the blocks we’ve fetched, in the order we’ve fetched them.
+    usz Ref = 0;
+    for (auto& C : Copies) {
+        for (u64 Pos = C.DeviceOffset; Pos < C.DeviceOffset + C.Size; Ref++) {
+            auto InBlock = Geometry.Within(Pos);
+            auto N = std::min<usz>(BlockSize - InBlock, usz(C.DeviceOffset + C.Size - Pos));
+            std::memcpy(C.Dest + (Pos - C.DeviceOffset), Refs[Ref].data() + InBlock, N);
+            Pos += N;
+        }
+    }
+
+    co_return true;
+}
+
+auto Drive::AsyncInodeFromPath(std::string FilePath, std::string OriginPath) -> Task<std::optional<InodeNumberType>> {
+    std::string_view Path = FilePath;
+    if (Path.empty()) {
+        SetError(ErrorCode::InvalidPath);
+        LogAt<LogLevel::Warning>("Cannot resolve empty path.");
+        co_return std::nullopt;
+    }
+
+    if (auto Indexed = IndexLookup(Path, OriginPath)) {
+        if (Indexed->InodeNumber) co_return Indexed->InodeNumber;
+        SetError(Indexed->Error);
+        LogAt<LogLevel::Debug>("Failed to resolve {} using the namespace index.", Path);
+        co_return std::nullopt;
+    }
+
+    /// Resolve the origin of relative paths first.
+    InodeNumberType Origin = ROOT_INODE_NUMBER;
+    if (Path.starts_with("/")) {
+        RemoveLeadingSlashes(Path);
+    } else {
+        if (OriginPath.empty()) {
+            SetError(ErrorCode::InvalidPath);
+            LogAt<LogLevel::Warning>("Cannot resolve relative path without origin.");
+            co_return std::nullopt;
+        }
+
+        if (not OriginPath.starts_with("/")) {
+            SetError(ErrorCode::InvalidPath);
+            LogAt<LogLevel::Warning>("Origin must be absolute.");
+            co_return std::nullopt;
+        }
+
+        auto OriginInode = co_await AsyncInodeFromPath(std::move(OriginPath));
+        if (not OriginInode) {
+            LogAt<LogLevel::Debug>("Failed to resolve origin path.");
+            co_return std::nullopt;
+        }
+        Origin = *OriginInode;
+    }
+
+    /// Walk the path as InodeFromPath() does.
+    while (not Path.empty()) {
+        auto Slash = Path.find('/');
+        auto Component = Path.substr(0, Slash);
+        Path.remove_prefix(Slash == std::string_view::npos ? Path.size() : Slash + 1);
+
+        auto Entry = co_await AsyncLookupDentry(Origin, Component);
+        if (not Entry) co_return std::nullopt;
+        if (Entry->inode == 0) {
+            SetError(ErrorCode::NotFound);
+            LogAt<LogLevel::Debug>("Failed to find entry {} in directory {}.", Component, Origin);
+            co_return std::nullopt;
+        }
+
+        Origin = Entry->inode;
+        if (Path.starts_with("/")) {
+            /// Without the filetype feature, the type is in the inode.
+            std::shared_ptr<CachedInode> Pinned;
+            if (not(Sb.s_feature_incompat & IncompatFeature::FileType)) {
+                Pinned = co_await AsyncPinInode(Origin);
+                if (not Pinned) co_return std::nullopt;
+            }
+
+            if (auto FF = GetFileFormat(*Entry); not FF or *FF != Inode::Directory) {
+                SetError(ErrorCode::NotADirectory);
+                LogAt<LogLevel::Debug>("Inode {} is not a directory.", Origin);
+                co_return std::nullopt;
+            }
+            RemoveLeadingSlashes(Path);
+        }
+    }
+
+    co_return Origin;
+}
+
+auto Drive::AsyncOpenDir(std::string FilePath, std::string Origin) -> Task<std::unique_ptr<Dir>> {
+    auto INum = co_await AsyncInodeFromPath(std::move(FilePath), std::move(Origin));
+    if (not INum) co_return nullptr;
+
+    auto Pinned = co_await AsyncPinInode(*INum);
+    if (not Pinned) co_return nullptr;
+
+    auto I = ReadInode(*Pinned);
+    auto Map = co_await AsyncGetBlockMap(*INum, I);
+    if (not Map) co_return nullptr;
+    co_return std::unique_ptr<Dir>{::new Dir{I, *INum, std::move(Pinned), std::move(Map), This.lock()}};
+}
+
+auto Drive::AsyncOpenFile(std::string FilePath, std::string Origin) -> Task<std::unique_ptr<File>> {
+    auto INum = co_await AsyncInodeFromPath(std::move(FilePath), std::move(Origin));
+    if (not INum) co_return nullptr;
+
+    auto Pinned = co_await AsyncPinInode(*INum);
+    if (not Pinned) co_return nullptr;
+    co_return std::unique_ptr<File>{::new File{*INum, std::move(Pinned), This.lock(), ReadaheadBlocks}};
+}
+
+auto Drive::AsyncStat(std::string FilePath, std::string Origin) -> Task<std::optional<struct stat>> {
+    auto INum = co_await AsyncInodeFromPath(FilePath, std::move(Origin));
+    if (not INum) co_return std::nullopt;
+
+    auto Pinned = co_await AsyncPinInode(*INum);
+    if (not Pinned) {
+        Log("Failed to read inode {} for file '{}'", *INum, FilePath);
+        co_return std::nullopt;
+    }
+
+    UpdateAtime(*INum, *Pinned, true);
+    co_return MakeStat(*INum, ReadInode(*Pinned));
+}
+
+auto Drive::Poll(bool Wait) -> usz {
+    /// Don’t wait for the device if there was something to do.
+    auto Resumed = Ready.Drain();
+    Device->Poll(Wait and Resumed == 0);
+    return Resumed + Ready.Drain();
+}
+
+auto File::AsyncReadAt(u64 ReadOffset, std::span<u8> Buffer, bool Sequential) -> Task<std::optional<usz>> {
+    /// Delayed data can only be read around with DelayedLock held,
+    /// which we can’t hold while suspended. Delayed data of other files
+    /// doesn’t matter.
+    if (Drv->DelayedBlocks.load(std::memory_order_acquire) and Drv->HasDelayed(InodeNumber))
+        co_return PRead(ReadOffset, Buffer);
+
+    auto I = Drv->ReadInode(*Pin);
+    auto Map = co_await Drv->AsyncGetBlockMap(InodeNumber, I);
+    if (not Map) co_return std::nullopt;
+
+    /// Don’t read past the end of the file.
+    const u64 Size = I.Size();
+    auto ToRead = usz(std::min<u64>(Buffer.size(), Size - std::min(ReadOffset, Size)));
+    if (Sequential) Readahead(*Map, Size, ReadOffset, ToRead);
+    if (not co_await Drv->AsyncReadInodeData(*Map, ReadOffset, Buffer.first(ToRead))) co_return std::nullopt;
+    co_return ToRead;
+}
+
+auto File::AsyncPRead(u64 ReadOffset, std::span<u8> Buffer) -> Task<std::optional<usz>> {
+    return AsyncReadAt(ReadOffset, Buffer, false);
+}
+
+auto File::AsyncRead(std::span<u8> Buffer) -> Task<std::optional<usz>> {
+    auto Read = co_await AsyncReadAt(Offset, Buffer, true);
+    if (Read) Offset += *Read;
+    co_return Read;
+}
+
+auto Dir::AsyncEntries() -> AsyncGenerator<DirEntryView> {
+    const u64 Blocks = Drv->Geometry.Blocks(I.Size());
+    Iterator It;
+    It.D = this;
+    It.Done = false;
+
+    /// Fetch a batch of blocks, then parse the entries that start in it
+    /// without suspending. The iterator keeps the block it points into
+    /// pinned, so the batch can be released as soon as we move on.
+    for (u64 First = 0; First < Blocks; First += BlockCache::MAX_BATCH) {
+        auto Count = std::min<u64>(BlockCache::MAX_BATCH, Blocks - First);
+        std::vector<BlockRef> Held;
+        if (not co_await Drv->AsyncFetchData(*Map, First, Count, Held, IoKind::Directory)) co_return false;
+        while (It.NextOffset < ((First + Count) << Drv->Geometry.Shift)) {
+            ++It;
+            if (It.Done) co_return not It.Failed();
+            co_yield *It;
+        }
+    }
+
+    co_return true;
+}
+
+/// ===========================================================================
+///  Directory handle API.
+/// ===========================================================================
+Dir::Dir(
+    Inode I_,
+    InodeNumberType INum_,
+    std::shared_ptr<CachedInode> Pin_,
+    std::shared_ptr<const BlockMap> Map_,
+    std::shared_ptr<Drive> Drv_
+) : I(I_),
+    InodeNumber(INum_),
+    Pin(std::move(Pin_)),
+    Map(std::move(Map_)),
+      Drv(std::move(Drv_)) {}
+
+/// ===========================================================================
+///  File API.
+/// ===========================================================================
+File::File(InodeNumberType INum, std::shared_ptr<CachedInode> Pin_, std::shared_ptr<Drive> Drv_, usz ReadaheadBlocks)
+    : InodeNumber(INum),
+      Pin(std::move(Pin_)),
+      ReadaheadMax(ReadaheadBlocks),
+      Drv(std::move(Drv_)) {}
+
+void File::Readahead(const BlockMap& Map, u64 Size, u64 ReadOffset, usz Len) {
+    IoScope Scope{IoKind::Data};
+    if (Len == 0) return;
+
+    /// Any read that doesn’t continue the previous one resets the window,
+    /// and the rest of the file is no longer advised as sequential.
+    const auto& Geometry = Drv->Geometry;
+    const u64 First = Geometry.Block(ReadOffset);
+    const u64 FileBlocks = Geometry.Blocks(Size);
+    bool Sequential = ReadOffset == ReadaheadNext;
+    ReadaheadNext = ReadOffset + Len;
+    if (not Sequential or ReadaheadMax == 0) {
+        ReadaheadWindow = 0;
+        if (AdvisedSequential) Drv->AdviseInodeData(Map, 0, FileBlocks, AccessPattern::Normal);
+        AdvisedSequential = false;
+        return;
+    }
+
+    /// The advice lets the device read ahead for reads of any size. Large
+    /// reads bypass the cache, so prefetching for them is pointless.
+    if (not AdvisedSequential and First < FileBlocks) Drv->AdviseInodeData(Map, First, FileBlocks - First, AccessPattern::Sequential);
+    AdvisedSequential = true;
+    const u64 End = Geometry.Blocks(ReadOffset + Len);
+    if (End - First >= DIRECT_READ_BLOCKS) return;
+
+    /// Start with a small window that is larger than the reads.
+    if (ReadaheadWindow == 0) {
+        ReadaheadWindow = usz(std::min<u64>(ReadaheadMax, std::max<u64>(4, 2 * (End - First))));
+        ReadaheadUntil = End;
+    }
+
+    /// Don’t issue more until the reader has consumed half of what is in
+    /// flight. If the reader has overtaken the readahead, catch up.
+    ReadaheadUntil = std::max(ReadaheadUntil, End);
+    if (ReadaheadUntil - End > ReadaheadWindow / 2) return;
+
+    /// Prefetch the next window and grow it.
+    if (ReadaheadUntil >= FileBlocks) return;
+    auto Count = std::min<u64>(ReadaheadWindow, FileBlocks - ReadaheadUntil);
+    Drv->PrefetchInodeData(Map, ReadaheadUntil, Count);
+    ReadaheadUntil += Count;
+    ReadaheadWindow = std::min(ReadaheadWindow * 2, ReadaheadMax);
+}
+
+auto File::PRead(u64 ReadOffset, std::span<u8> Buffer) -> std::optional<usz> {
+    iovec Iov{Buffer.data(), Buffer.size()};
+    return ReadV(ReadOffset, {&Iov, 1});
+}
+
+auto File::Read(void* Buf, usz Len) -> std::optional<usz> {
+    IoScope Scope{IoKind::Data};
+    /// Don’t let delayed data be written back while we read around it.
+    std::shared_lock Delayed{Drv->DelayedLock, std::defer_lock};
+    if (Drv->DelayedBlocks.load(std::memory_order_acquire)) Delayed.lock();
+
+    /// Get the current version of the inode.
+    auto I = Drv->ReadInode(*Pin);
+
+    /// Read the data.
+    auto Map = Drv->GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+    const u64 Size = I.Size();
+    auto ToRead = usz(std::min<u64>(Len, Size - std::min(Offset, Size)));
+    Readahead(*Map, Size, Offset, ToRead);
+    if (not Drv->ReadInodeData(*Map, Offset, Buf, ToRead)) return {};
+    if (Delayed.owns_lock()) {
+        iovec Iov{Buf, ToRead};
+        Drv->OverlayDelayed(InodeNumber, Offset, {&Iov, 1}, ToRead);
+    }
+
+    /// Update the offset.
+    Offset += ToRead;
+    return ToRead;
+}
+
+auto File::ReadV(u64 ReadOffset, std::span<const iovec> Iov) -> std::optional<usz> {
+    IoScope Scope{IoKind::Data};
+    std::shared_lock Delayed{Drv->DelayedLock, std::defer_lock};
+    if (Drv->DelayedBlocks.load(std::memory_order_acquire)) Delayed.lock();
+
+    /// Get the current version of the inode.
+    auto I = Drv->ReadInode(*Pin);
+    auto Map = Drv->GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+
+    /// Don’t read past the end of the file.
+    usz Total = 0;
+    for (auto& V : Iov) Total += V.iov_len;
+    const u64 Size = I.Size();
+    auto ToRead = usz(std::min<u64>(Total, Size - std::min(ReadOffset, Size)));
+    if (not Drv->ReadInodeDataV(*Map, ReadOffset, Iov, ToRead)) return {};
+    if (Delayed.owns_lock()) Drv->OverlayDelayed(InodeNumber, ReadOffset, Iov, ToRead);
+    return ToRead;
+}
+
+auto File::TransferTo(FdType Out, u64 TransferOffset, usz Len) -> std::optional<usz> {
+    IoScope Scope{IoKind::Data};
+    /// Delayed data has no blocks to transfer from yet.
+    if (Drv->DelayedBlocks.load(std::memory_order_acquire)) {
+        std::unique_lock Guard{Drv->WriteLock};
+        if (not Drv->FlushDelayed(InodeNumber)) return {};
+    }
+
+    /// Get the current version of the inode.
+    auto I = Drv->ReadInode(*Pin);
+    auto Map = Drv->GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+
+    /// Don’t transfer past the end of the file.
+    const u64 Size = I.Size();
+    auto ToTransfer = usz(std::min<u64>(Len, Size - std::min(TransferOffset, Size)));
+    return Drv->TransferInodeData(*Map, TransferOffset, Out, ToTransfer);
+}
+
+auto File::ExtentMap() -> std::optional<FileExtents> {
+    /// Delayed data has no blocks yet.
+    if (Drv->DelayedBlocks.load(std::memory_order_acquire)) {
+        std::unique_lock Guard{Drv->WriteLock};
+        if (not Drv->FlushDelayed(InodeNumber)) return {};
+    }
+
+    auto I = Drv->ReadInode(*Pin);
+    auto Map = Drv->GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+    return FileExtents{
+        .BlockSize = Drv->Sb.block_size(),
+        .Size = I.Size(),
+        .Data = Map->Extents,
+        .Metadata = Map->MetadataBlocks,
+    };
+}
+
+File::~File() {
+    if (not Writer) return;
+    std::unique_lock Guard{Drv->WriteLock};
+    auto State = Drv->WriteStates.find(InodeNumber);
+    if (State == Drv->WriteStates.end()) return;
+
+    /// Delayed data is left to the flusher. With nothing to flush, this
+    /// just drops the state if we were the last writer.
+    State->second.Writers--;
+    if (State->second.Delayed.empty()) Drv->FlushDelayed(InodeNumber);
+}
+
+auto File::PWrite(u64 WriteOffset, std::span<const u8> Data) -> std::optional<usz> {
+    IoScope Scope{IoKind::Data};
+    if (Data.empty()) return 0;
+    if (WriteOffset > Drv->MaxFileSize() or Data.size() > Drv->MaxFileSize() - WriteOffset) {
+        SetError(ErrorCode::FileTooLarge);
+        LogAt<LogLevel::Warning>("Cannot write to inode {}: File would be too large", InodeNumber);
+        return {};
+    }
+
+    if (Drv->ReadOnly) {
+        SetError(ErrorCode::ReadOnly);
+        LogAt<LogLevel::Warning>("Cannot write to inode {}: Drive is mounted read-only", InodeNumber);
+        return {};
+    }
+
+    std::unique_lock Guard{Drv->WriteLock};
+    auto I = Drv->ReadInode(*Pin);
+    if (not I.Is(Inode::RegularFile)) {
+        SetError(ErrorCode::NotARegularFile);
+        LogAt<LogLevel::Warning>("Cannot write to inode {}: Not a regular file", InodeNumber);
+        return {};
+    }
+
+    auto& S = Drv->GetWriteState(InodeNumber, Pin);
+    if (not std::exchange(Writer, true)) S.Writers++;
+
+    const u64 BlockSize = Drv->Sb.block_size();
+    const u64 End = WriteOffset + Data.size();
+    const u64 EndBlock = (End + BlockSize - 1) / BlockSize;
+    u64 Logical = WriteOffset / BlockSize;
+
+    /// Data written to holes is kept in memory until it is written back,
+    /// unless write-back is disabled. If it may not fit, write back what
+    /// we have so that the free block count is exact again.
+    const bool Delay = Drv->DirtyLimitBlocks != 0;
+    if (Delay and not Drv->HasDelayedSpace(EndBlock - Logical)) {
+        Drv->FlushAllDelayed();
+        I = Drv->ReadInode(*Pin);
+    }
+
+    auto Map = Drv->GetBlockMap(InodeNumber, I);
+    if (not Map) return {};
+
+    /// New blocks go right after the block before them if it is mapped,
+    /// and into the block group of the inode otherwise.
+    u64 Goal = Drv->Sb.s_first_data_block + u64(Drv->Geometry.InodeGroup(InodeNumber - 1)) * Drv->Sb.s_blocks_per_group;
+    if (Logical) {
+        if (auto Prev = Map->Find(Logical - 1); Prev.Physical) Goal = Prev.Physical + (Logical - Prev.Logical);
+    }
+
+    std::vector<u8> Zeroes;
+    auto Zero = [&](u64 At, u64 Size) {
+        Zeroes.resize(BlockSize);
+        return Drv->Cache.Write(At, Zeroes.data(), Size);
+    };
+
+    bool Allocated = false;
+    u64 MaxDelayed = EndBlock;
+    while (Logical < EndBlock) {
+        auto E = Map->Find(Logical);
+        u64 Count = std::min(E.Logical + E.Length - Logical, EndBlock - Logical);
+        u64 Physical = E.Physical + (Logical - E.Logical);
+
+        /// Delayed blocks start out zeroed, so we only need to copy the
+        /// data. If the drive is almost full, write as much as still fits.
+        if (not E.Physical and Delay) {
+            Count = std::min(Count, MaxDelayed);
+            std::unique_lock DelayedGuard{Drv->DelayedLock};
+            auto Buf = Drv->DelayedRange(S, Logical, Count);
+            if (not Buf) {
+                MaxDelayed = Count / 2;
+                if (MaxDelayed) continue;
+                SetError(ErrorCode::NoSpace);
+                Log("Failed to allocate blocks: No space left on drive");
+                break;
+            }
+
+            const u64 From = std::max(WriteOffset, Logical * BlockSize);
+            const u64 To = std::min(End, (Logical + Count) * BlockSize);
+            std::memcpy(Buf + (From - Logical * BlockSize), Data.data() + (From - WriteOffset), To - From);
+            Logical += Count;
+            continue;
+        }
+
+        /// Fill holes and extend the file.
+        if (not E.Physical) {
+            auto Mapped = Drv->MapNewBlocks(S, I, Logical, Count, Goal);
+            if (not Mapped) break;
+            Physical = Mapped->first;
+            Count = Mapped->second;
+            Allocated = true;
+
+            /// New blocks may contain anything, so zero the parts of
+            /// them that this write doesn’t cover.
+            const u64 RunStart = Logical * BlockSize;
+            const u64 RunEnd = (Logical + Count) * BlockSize;
+            if (RunStart < WriteOffset and not Zero(Physical * BlockSize, WriteOffset - RunStart)) break;
+            if (RunEnd > End and not Zero((Physical + Count) * BlockSize - (RunEnd - End), RunEnd - End)) break;
+        }
+
+        /// Write the part of the data that goes into these blocks. Large
+        /// writes go around the cache, just like large reads.
+        const u64 From = std::max(WriteOffset, Logical * BlockSize);
+        const u64 To = std::min(End, (Logical + Count) * BlockSize);
+        const u64 At = Physical * BlockSize + (From - Logical * BlockSize);
+        const auto Src = Data.data() + (From - WriteOffset);
+        if (To - From >= DIRECT_READ_BLOCKS * BlockSize) {
+            if (not Drv->Cache.WriteAround(At, Src, To - From)) break;
+        } else {
+            if (not Drv->Cache.Write(At, Src, To - From)) break;
+        }
+
+        Logical += Count;
+        Goal = Physical + Count;
+    }
+
+    /// If we stopped early, everything before the block we stopped at
+    /// has been written.
+    const u64 Written = std::clamp(Logical * BlockSize, WriteOffset, End);
+    if (Written > I.Size()) {
+        I.SetSize(Written);
+        Drv->AllowFileSize(Written);
+    }
+    if (Written > WriteOffset or Allocated) {
+        I.i_mtime = I.i_ctime = u32(std::time(nullptr));
+        if (not Drv->WriteInode(InodeNumber, I)) return {};
+    }
+
+    /// Indirect blocks may have changed even if the inode didn’t. If only
+    /// the size changed, the map is still correct.
+    if (Allocated) {
+        std::unique_lock MapGuard{Drv->BlockMapLock};
+        Drv->BlockMaps.Erase(InodeNumber);
+    } else if (Written > WriteOffset) {
+        Drv->ResizeBlockMap(InodeNumber, *Map, I.Size());
+    }
+
+    Drv->ThrottleWrites();
+    if (Written == WriteOffset) return {};
+    return Written - WriteOffset;
+}
+
+bool File::Sync() {
+    if (Drv->ReadOnly) return true;
+    std::unique_lock Guard{Drv->WriteLock};
+    bool Ok = Drv->FlushDelayed(InodeNumber);
+    Ok = Drv->WriteBackInodes() and Ok;
+    Ok = Drv->WriteBackBlocks() and Ok;
+    return Drv->Device->Flush() and Ok;
+}
+
+bool File::Truncate(u64 NewSize) {
+    IoScope Scope{IoKind::Data};
+    if (NewSize > Drv->MaxFileSize()) {
+        SetError(ErrorCode::FileTooLarge);
+        LogAt<LogLevel::Warning>("Cannot truncate inode {}: File would be too large", InodeNumber);
+        return false;
+    }
+
+    if (Drv->ReadOnly) {
+        SetError(ErrorCode::ReadOnly);
+        LogAt<LogLevel::Warning>("Cannot truncate inode {}: Drive is mounted read-only", InodeNumber);
+        return false;
+    }
+
+    std::unique_lock Guard{Drv->WriteLock};
+    auto I = Drv->ReadInode(*Pin);
+    if (not I.Is(Inode::RegularFile)) {
+        SetError(ErrorCode::NotARegularFile);
+        LogAt<LogLevel::Warning>("Cannot truncate inode {}: Not a regular file", InodeNumber);
+        return false;
+    }
+
+    auto State = Drv->WriteStates.find(InodeNumber);
+    if (State != Drv->WriteStates.end() and not Drv->ReleasePrealloc(State->second)) return false;
+    if (NewSize == I.Size()) return true;
+
+    bool Ok = true;
+    if (NewSize < I.Size()) {
+        auto Map = Drv->GetBlockMap(InodeNumber, I);
+        if (not Map) return false;
+        const u64 BlockSize = Drv->Sb.block_size();
+        const u64 Keep = (NewSize + BlockSize - 1) / BlockSize;
+
+        /// Drop delayed data past the new end.
+        if (State != Drv->WriteStates.end()) {
+            std::unique_lock DelayedGuard{Drv->DelayedLock};
+            auto& Runs = State->second.Delayed;
+            u64 Dropped = 0;
+            for (auto Run = Runs.begin(); Run != Runs.end();) {
+                const u64 Blocks = Run->second.size() / BlockSize;
+                if (Run->first >= Keep) {
+                    Dropped += Blocks;
+                    Run = Runs.erase(Run);
+                    continue;
+                }
+
+                if (Run->first + Blocks > Keep) {
+                    Dropped += Run->first + Blocks - Keep;
+                    Run->second.resize((Keep - Run->first) * BlockSize);
+                }
+
+                /// Zero the rest of the new last block if it is delayed.
+                const u64 RunStart = Run->first * BlockSize;
+                if (NewSize > RunStart and NewSize < RunStart + Run->second.size())
+                    std::memset(Run->second.data() + (NewSize - RunStart), 0, Run->second.size() - (NewSize - RunStart));
+
+                ++Run;
+            }
+            Drv->DelayedBlocks.fetch_sub(Dropped, std::memory_order_release);
+        }
+
+        /// Zero the rest of the new last block so that the old data
+        /// doesn’t reappear if the file grows again.
+        if (NewSize % BlockSize) {
+            auto E = Map->Find(NewSize / BlockSize);
+            if (E.Physical) {
+                std::vector<u8> Zeroes(BlockSize - NewSize % BlockSize);
+                const u64 At = (E.Physical + (NewSize / BlockSize - E.Logical)) * BlockSize + NewSize % BlockSize;
+                if (not Drv->Cache.Write(At, Zeroes.data(), Zeroes.size())) return false;
+            }
+        }
+
+        /// Free everything past the new end. If this fails halfway, still
+        /// write the inode so that it doesn’t point to freed blocks.
+        const u64 PerBlock = BlockSize / sizeof(u32);
+        std::pair<u64, u64> Pending{};
+        for (u32 i = 0; i < DIRECT_BLOCK_COUNT and Ok; i++) Ok = Drv->TruncateBranch(I, I.i_block[i], 0, i, Keep, Pending);
+        u64 First = DIRECT_BLOCK_COUNT, Span = PerBlock;
+        for (u32 Level = 1; Level <= 3 and Ok; Level++, First += Span, Span *= PerBlock)
+            Ok = Drv->TruncateBranch(I, I.i_block[INDIRECT_BLOCK_INDEX + Level - 1], Level, First, Keep, Pending);
+        if (Pending.second) Ok = Drv->FreeBlocks(Pending.first, Pending.second) and Ok;
+    }
+
+    I.SetSize(NewSize);
+    Drv->AllowFileSize(NewSize);
+    I.i_mtime = I.i_ctime = u32(std::time(nullptr));
+    Ok = Drv->WriteInode(InodeNumber, I) and Ok;
+
+    std::unique_lock MapGuard{Drv->BlockMapLock};
+    Drv->BlockMaps.Erase(InodeNumber);
+    return Ok;
+}
+
+auto File::Write(const void* Buf, usz Len) -> std::optional<usz> {
+    auto Written = PWrite(Offset, {static_cast<const u8*>(Buf), Len});
+    if (Written) Offset += *Written;
+    return Written;
+}
+
+/// ===========================================================================
+///  Drive API.
+/// ===========================================================================
+/// Open a directory.
+auto Drive::OpenDir(std::string_view FilePath, std::string_view Origin) -> std::unique_ptr<Dir> {
+    auto INum = InodeFromPath(FilePath, Origin);
+    if (not INum) return {};
+
+    auto Pinned = PinInode(*INum);
+    if (not Pinned) return {};
+
+    auto I = ReadInode(*Pinned);
+    auto Map = GetBlockMap(*INum, I);
+    if (not Map) return {};
+    return std::unique_ptr<Dir>{::new Dir{I, *INum, std::move(Pinned), std::move(Map), This.lock()}};
+}
+
+/// Open a file.
+auto Drive::OpenFile(std::string_view FilePath, std::string_view Origin) -> std::unique_ptr<File> {
+    auto INum = InodeFromPath(FilePath, Origin);
+    if (not INum) return {};
+
+    auto Pinned = PinInode(*INum);
+    if (not Pinned) return {};
+    return std::unique_ptr<File>{::new File{*INum, std::move(Pinned), This.lock(), ReadaheadBlocks}};
+}
+
+/// Initialise a directory iterator.
+Dir::Iterator::Iterator(Dir* D_) : D(D_) {
+    if (not D) return;
+    Done = false;
+    ++*this;
+}
+
+/// Advance a directory iterator.
+auto Dir::Iterator::operator++() -> Iterator& {
+    IoScope Scope{IoKind::Directory};
+    const usz BlockSize = D->Drv->Sb.block_size();
+    for (;;) {
+        /// If the offset is past the end of the file, we're done.
+        if (NextOffset >= D->I.i_size) {
+            Done = true;
+            return *this;
+        }
+
+        /// Load the block containing the next entry if we don’t have it yet.
+        auto BlockIndex = D->Drv->Geometry.Block(NextOffset);
+        if (not Block or BlockIndex != CurrentBlock) {
+            auto Ref = D->Drv->InodeDataView(*D->Map, BlockIndex << D->Drv->Geometry.Shift, BlockSize);
+            if (not Ref) {
+                Fail();
+                return *this;
+            }
+
+            Block = std::make_shared<BlockRef>(std::move(Ref));
+            CurrentBlock = BlockIndex;
+        }
+
+        /// Parse the next header.
+        auto Offset = D->Drv->Geometry.Within(NextOffset);
+        LinkedDirEntryHeader Hdr;
+        if (not ReadDirEntryHeader(Block->data(), BlockSize, Offset, Hdr)) {
+            Fail();
+            return *this;
+        }
+
+        /// Skip entries with an inode number of zero.
+        NextOffset += Hdr.rec_len;
+        if (Hdr.inode == 0) continue;
+
+        /// Point to the name in the block.
+        Current.Inode = Hdr.inode;
+        Current.Name = {reinterpret_cast<const char*>(Block->data() + Offset + sizeof Hdr), Hdr.name_len};
+        Current.Type = Inode::Unknown;
+        if (D->Drv->Sb.s_feature_incompat & IncompatFeature::FileType)
+            Current.Type = FileFormatFromEntryType(Hdr.file_type).value_or(Inode::Unknown);
+        return *this;
+    }
+}
+
+/// Stat a file.
+auto Drive::Stat(std::string_view FilePath, std::string_view Origin) -> std::optional<struct stat> {
+    /// Get the inode number.
+    auto INum = InodeFromPath(FilePath, Origin);
+    if (not INum) return {};
+
+    /// Read the inode.
+    auto Pinned = PinInode(*INum);
+    if (not Pinned) {
+        Log("Failed to read inode {} for file '{}'", *INum, FilePath);
+        return {};
+    }
+
+    UpdateAtime(*INum, *Pinned);
+    return MakeStat(*INum, ReadInode(*Pinned));
+}
+
+auto Drive::StatFs() -> std::optional<FsStatistics> {
+    IoScope Scope{IoKind::Metadata};
+    std::unique_lock Guard{WriteLock, std::defer_lock};
+    if (not ReadOnly) Guard.lock();
+
+    FsStatistics St;
+    St.BlockSize = Sb.block_size();
+    St.Blocks = Sb.s_blocks_count;
+    St.ReservedBlocks = Sb.s_r_blocks_count;
+    St.Inodes = Sb.s_inodes_count;
+
+    /// Bits past the end of a bitmap are padding and set; don’t count them.
+    const u32 Groups = Sb.block_groups();
+    for (u32 Group = 0; Group < Groups; Group++) {
+        auto Desc = ReadDescriptorTable(Group);
+        if (not Desc) return {};
+        auto BlockBits = Cache.Get(Desc->bg_block_bitmap);
+        auto InodeBits = Cache.Get(Desc->bg_inode_bitmap);
+        if (not BlockBits or not InodeBits) return {};
+
+        const u64 GroupStart = Sb.s_first_data_block + u64(Group) * Sb.s_blocks_per_group;
+        const u64 GroupBlocks = std::min<u64>(Sb.s_blocks_per_group, Sb.s_blocks_count - GroupStart);
+        const u64 FreeBlocks = GroupBlocks - BitmapCount({BlockBits.data(), Sb.block_size()}, 0, GroupBlocks);
+        const u64 FreeInodes = Sb.s_inodes_per_group - BitmapCount({InodeBits.data(), Sb.block_size()}, 0, Sb.s_inodes_per_group);
+        St.FreeBlocks += FreeBlocks;
+        St.FreeInodes += FreeInodes;
+
+        if (FreeBlocks != Desc->bg_free_blocks_count or FreeInodes != Desc->bg_free_inodes_count) {
+            LogAt<LogLevel::Warning>(
+                "Block group {} has {} free blocks and {} free inodes, but its descriptor says {} and {}",
+                Group,
+                FreeBlocks,
+                FreeInodes,
+                Desc->bg_free_blocks_count,
+                Desc->bg_free_inodes_count
+            );
+            St.MismatchedGroups++;
+        }
+    }
+
+    St.FreeBlocks -= std::min<u64>(St.FreeBlocks, DelayedBlocks.load(std::memory_order_relaxed));
+    return St;
+}
+
+void Drive::UpdateAtime(InodeNumberType InodeNumber, CachedInode& Pinned, bool Lazy) {
+    /// Flush lazy updates in batches so that they don’t pile up in the
+    /// inode cache, which can’t evict them.
+    static constexpr usz LAZY_INODE_BATCH = 1024;
+
+    /// relatime only updates the access time once a day unless the
+    /// inode has been modified since it was last accessed.
+    static constexpr u32 RELATIME_INTERVAL = 24 * 60 * 60;
+
+    if (Atime == AtimeUpdate::Never) return;
+    auto Offset = ComputeInodeOffset(InodeNumber);
+    if (not Offset) return;
+
+    const auto Now = u32(std::time(nullptr));
+    std::unique_lock Guard{InodeLock};
+    auto& I = Pinned.I;
+    if (I.i_atime == Now) return;
+    if (
+        Atime == AtimeUpdate::Relative and
+        I.i_atime > I.i_mtime and
+        I.i_atime > I.i_ctime and
+        Now - I.i_atime < RELATIME_INTERVAL
+    ) return;
+
+    /// Write the cached copy while holding the lock so that we don’t
+    /// undo a concurrent write of the rest of the inode. With write-back,
+    /// this only copies it into the block cache. If the write fails, keep
+    /// the update for WriteBackInodes() to retry.
+    I.i_atime = Now;
+    if (not LazyTime and not Lazy and Cache.Write(*Offset, &I, sizeof I)) {
+        Pinned.Version++;
+        return;
+    }
+
+    Pinned.Dirty = true;
+    LazyInodes.insert(InodeNumber);
+    if (LazyInodes.size() < LAZY_INODE_BATCH) return;
+    Guard.unlock();
+    WriteBackInodes();
+}
+
+auto Drive::MakeStat(InodeNumberType InodeNumber, const Inode& I) -> struct stat {
+    struct stat st {};
+    st.st_ino = InodeNumber;
+    st.st_mode = I.i_mode;
+    st.st_nlink = I.i_links_count;
+    st.st_uid = I.i_uid;
+    st.st_gid = I.i_gid;
+    st.st_size = off_t(I.Size());
+    st.st_blksize = Sb.block_size();
+    st.st_blocks = I.i_blocks;
+    st.st_atime = I.i_atime;
+    st.st_mtime = I.i_mtime;
+    st.st_ctime = I.i_ctime;
+    return st;
+}
+
+/// ===========================================================================
+///  Scanning inode tables.
+/// ===========================================================================
+bool Drive::ScanGroup(u32 BlockGroupIndex, const InodeCallback& Callback) {
+    auto Descriptor = ReadDescriptorTable(BlockGroupIndex);
+    if (not Descriptor) return false;
+
+    /// Nothing to do if the group has no used inodes.
+    const u32 InodesPerGroup = Sb.s_inodes_per_group;
+    if (Descriptor->bg_free_inodes_count >= InodesPerGroup) return true;
+
+    /// Read the inode bitmap and find the last used inode so we don’t
+    /// read the unused tail of the table.
+    auto Bitmap = Cache.Get(Descriptor->bg_inode_bitmap);
+    if (not Bitmap) return false;
+    const std::span<const u8> Bits{Bitmap.data(), usz((InodesPerGroup + 7) / 8)};
+    auto Used = [&](u32 Index) { return (Bits[Index / 8] >> (Index % 8)) & 1; };
+    u32 End = InodesPerGroup;
+    while (End > 0 and not Used(End - 1)) End--;
+
+    /// Read the table in chunks.
+    const usz InodeSize = Sb.s_inode_size;
+    const u64 TableOffset = u64(Descriptor->bg_inode_table) * Sb.block_size();
+    const u32 InodesPerChunk = u32(std::max<usz>(1, INODE_SCAN_CHUNK_SIZE / InodeSize));
+    std::unique_ptr<u8[]> Buffer;
+    for (u32 First = 0;; First += InodesPerChunk) {
+        /// Start each chunk at a used inode so we skip unused ranges.
+        First = u32(BitmapFindSet(Bits, First, End));
+        if (First >= End) break;
+        auto Count = std::min(InodesPerChunk, End - First);
+
+        /// Map the chunk if we can, and read it otherwise. Inodes that
+        /// have been written but not written back are only in the cache.
+        auto Offset = TableOffset + First * InodeSize;
+        auto Size = Count * InodeSize;
+        auto Data = Device->Map(Offset, Size);
+        if (not Data) {
+            IoScope Scope{IoKind::Inode};
+            if (not Buffer) Buffer = std::make_unique<u8[]>(InodesPerChunk * InodeSize);
+            const bool Dirty = Cache.HasDirty(Geometry.Block(Offset), Geometry.Blocks(Offset + Size) - Geometry.Block(Offset));
+            if (not(Dirty ? Cache.Read(Offset, Buffer.get(), Size) : Device->Read(Offset, Buffer.get(), Size))) return false;
+            Data = Buffer.get();
+        }
+
+        for (u32 i = 0; i < Count; i++) {
+            if (not Used(First + i)) continue;
+            Inode I;
+            std::memcpy(&I, Data + i * InodeSize, sizeof I);
+            Callback(BlockGroupIndex * InodesPerGroup + First + i + 1, I);
+        }
+    }
+
+    return true;
+}
+
+bool Drive::ScanInodes(const InodeCallback& Callback, const ScanOptions& Options) {
+    auto Threads = Options.Threads ? Options.Threads : std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingPool<u32> Pool{std::min<usz>(Threads, Sb.block_groups())};
+    std::atomic<bool> Ok = true;
+    for (u32 G = 0; G < Sb.block_groups(); G++) Pool.Push(G, G);
+    Pool.Run([&](usz, u32 G) {
+        if (not ScanGroup(G, Callback)) Ok.store(false, std::memory_order_relaxed);
+    });
+    return Ok.load(std::memory_order_relaxed);
+}
+
+/// ===========================================================================
+///  Walking the filesystem.
+/// ===========================================================================
+bool Drive::Walk(std::string_view Root, const WalkCallback& Callback, const WalkOptions& Options) {
+    auto RootInode = InodeFromPath(Root);
+    if (not RootInode) return false;
+
+    /// A directory that still needs to be scanned.
+    struct Task {
+        std::string Path;
+        InodeNumberType InodeNumber{};
+    };
+
+    /// A directory entry whose inode we still need to read.
+    struct Child {
+        InodeNumberType InodeNumber;
+        u64 Block;
+        std::string Name;
+    };
+
+    auto Threads = Options.Threads ? Options.Threads : std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingPool<Task> Pool{Threads};
+    std::atomic<bool> Ok = true;
+
+    auto ScanDirectory = [&](usz Worker, Task T) {
+        auto Pinned = PinInode(T.InodeNumber);
+        if (not Pinned) {
+            Ok.store(false, std::memory_order_relaxed);
+            return;
+        }
+
+        auto I = ReadInode(*Pinned);
+        auto Map = GetBlockMap(T.InodeNumber, I);
+        if (not Map) {
+            Ok.store(false, std::memory_order_relaxed);
+            return;
+        }
+
+        /// Collect the entries and the inode table blocks they are in.
+        Dir D{I, T.InodeNumber, std::move(Pinned), std::move(Map), This.lock()};
+        std::vector<Child> Children;
+        auto Read = D.ForEachEntry([&](const DirEntryView& E) {
+            if (E.Name == "." or E.Name == "..") return;
+            auto Offset = ComputeInodeOffset(E.Inode);
+            Children.push_back({E.Inode, Offset ? Geometry.Block(*Offset) : 0, std::string{E.Name}});
+        });
+
+        if (not Read) Ok.store(false, std::memory_order_relaxed);
+
+        /// Read the inodes in disk order, loading all inode table blocks
+        /// of this directory in one batch first.
+        std::ranges::sort(Children, {}, &Child::InodeNumber);
+        std::vector<u64> Blocks;
+        for (auto& C : Children)
+            if (C.Block and (Blocks.empty() or Blocks.back() != C.Block))
+                Blocks.push_back(C.Block);
+
+        std::vector<BlockRef> Refs(Blocks.size());
+        IoScope Scope{IoKind::Inode};
+        if (not Cache.GetBlocks(Blocks, Refs)) Refs.clear();
+
+        std::string Path = T.Path;
+        if (not Path.ends_with('/')) Path += '/';
+        const usz PrefixSize = Path.size();
+        for (auto& C : Children) {
+            auto ChildInode = ReadInode(C.InodeNumber);
+            if (not ChildInode) {
+                Ok.store(false, std::memory_order_relaxed);
+                continue;
+            }
+
+            Path.resize(PrefixSize);
+            Path += C.Name;
+            Callback(Path, C.InodeNumber, MakeStat(C.InodeNumber, *ChildInode));
+            if (ChildInode->Is(Inode::Directory)) Pool.Push(Worker, {Path, C.InodeNumber});
+        }
+    };
+
+    std::string RootPath{Root};
+    if (not RootPath.starts_with('/')) RootPath.insert(0, 1, '/');
+    Pool.Push(0, {std::move(RootPath), *RootInode});
+    Pool.Run(ScanDirectory);
+    return Ok.load(std::memory_order_relaxed);
+}
+
+auto Drive::ResolveMany(
+    std::span<const std::string_view> Paths,
+    std::string_view Origin,
+    const ResolveOptions& Options
+) -> std::vector<std::optional<InodeNumberType>> {
+    /// A path component shared by some of the paths. The inode number is
+    /// set by whoever finds the entry before the node is visited.
+    struct Node {
+        InodeNumberType InodeNumber{};
+        std::unordered_map<std::string_view, usz> Children;
+
+        /// Paths that end here, and whether they end in more slashes than
+        /// the separator, in which case this must be a directory, as with
+        /// InodeFromPath().
+        std::vector<std::pair<usz, bool>> Ends;
+    };
+
+    std::vector<std::optional<InodeNumberType>> Results(Paths.size());
+    std::vector<Node> Nodes(1);
+    Nodes[0].InodeNumber = ROOT_INODE_NUMBER;
+    std::optional<usz> OriginNode;
+
+    /// Build the tree. Relative paths start at a second root.
+    for (usz i = 0; i < Paths.size(); i++) {
+        auto Path = Paths[i];
+        if (Path.empty()) continue;
+        if (auto Indexed = IndexLookup(Path, Origin)) {
+            if (Indexed->InodeNumber) Results[i] = Indexed->InodeNumber;
+            continue;
+        }
+
+        usz N = 0;
+        if (Path.starts_with("/")) {
+            RemoveLeadingSlashes(Path);
+        } else {
+            if (not OriginNode) {
+                OriginNode = Nodes.size();
+                Nodes.emplace_back();
+                if (not Origin.starts_with("/")) LogAt<LogLevel::Warning>("Origin must be absolute.");
+                else if (auto O = InodeFromPath(Origin)) Nodes.back().InodeNumber = *O;
+            }
+
+            if (Nodes[*OriginNode].InodeNumber == 0) continue;
+            N = *OriginNode;
+        }
+
+        bool TrailingSlash = false;
+        while (not Path.empty()) {
+            auto Slash = Path.find('/');
+            auto Component = Path.substr(0, Slash);
+            Path.remove_prefix(Slash == std::string_view::npos ? Path.size() : Slash + 1);
+            TrailingSlash = Path.starts_with("/");
+            RemoveLeadingSlashes(Path);
+
+            auto [It, Inserted] = Nodes[N].Children.try_emplace(Component, Nodes.size());
+            auto Child = It->second;
+            if (Inserted) Nodes.emplace_back();
+            N = Child;
+        }
+
+        Nodes[N].Ends.emplace_back(i, TrailingSlash);
+    }
+
+    auto Threads = Options.Threads ? Options.Threads : std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingPool<usz> Pool{Threads};
+    const usz BlockSize = Sb.block_size();
+
+    /// Record the entry of a node. We only need to visit it if it has
+    /// children or must be a directory and we don’t know its type yet.
+    auto Found = [&](usz Worker, usz Child, InodeNumberType InodeNumber, Inode::FileFormat Type) {
+        auto& C = Nodes[Child];
+        C.InodeNumber = InodeNumber;
+        bool NeedsDirectory = not C.Children.empty() or std::ranges::any_of(C.Ends, [](auto& E) { return E.second; });
+        if (NeedsDirectory and (Type == Inode::Unknown or Type == Inode::Directory)) {
+            Pool.Push(Worker, Child);
+            return;
+        }
+
+        for (auto [Index, MustBeDirectory] : C.Ends)
+            if (not MustBeDirectory) Results[Index] = InodeNumber;
+    };
+
+    auto EntryType = [&](const LinkedDirEntryHeader& H) {
+        if (not(Sb.s_feature_incompat & IncompatFeature::FileType)) return Inode::Unknown;
+        return FileFormatFromEntryType(H.file_type).value_or(Inode::Unknown);
+    };
+
+    auto Visit = [&](usz Worker, usz N) {
+        auto& Nd = Nodes[N];
+        auto Pinned = PinInode(Nd.InodeNumber);
+        if (not Pinned) return;
+
+        auto I = ReadInode(*Pinned);
+        const bool IsDirectory = I.Is(Inode::Directory);
+        for (auto [Index, MustBeDirectory] : Nd.Ends)
+            if (IsDirectory or not MustBeDirectory) Results[Index] = Nd.InodeNumber;
+        if (not IsDirectory or Nd.Children.empty()) return;
+
+        auto Map = GetBlockMap(Nd.InodeNumber, I);
+        if (not Map) return;
+
+        /// Use the index if that reads fewer blocks than a scan.
+        const u64 Blocks = Geometry.Blocks(I.Size());
+        if (
+            Sb.s_feature_compat & CompatFeature::DirIndex and
+            I.i_flags & INDEX_FL and
+            Nd.Children.size() * DX_LOOKUP_BLOCKS < Blocks
+        ) {
+            for (auto& [Name, Child] : Nd.Children) {
+                auto Entry = FindDirectoryEntry(Nd.InodeNumber, I, Name);
+                if (Entry and Entry->inode) Found(Worker, Child, Entry->inode, EntryType(*Entry));
+            }
+            return;
+        }
+
+        /// Otherwise, read the directory in batches and match every
+        /// entry against the names we’re looking for.
+        IoScope Scope{IoKind::Directory};
+        usz Left = Nd.Children.size();
+        for (u64 First = 0; First < Blocks and Left; First += BlockCache::MAX_BATCH) {
+            auto Count = std::min<u64>(BlockCache::MAX_BATCH, Blocks - First);
+            auto DriveBlocks = Map->DriveBlocks(First, Count);
+            std::vector<BlockRef> Refs(DriveBlocks.size());
+            if (not Cache.GetBlocks(DriveBlocks, Refs)) return;
+
+            for (auto& Ref : Refs) {
+                for (usz Offset = 0; Offset < BlockSize and Left;) {
+                    LinkedDirEntryHeader H;
+                    if (not ReadDirEntryHeader(Ref.data(), BlockSize, Offset, H)) return;
+                    Offset += H.rec_len;
+                    if (H.inode == 0) continue;
+
+                    auto Name = std::string_view{reinterpret_cast<const char*>(Ref.data() + Offset - H.rec_len + sizeof H), H.name_len};
+                    if (auto It = Nd.Children.find(Name); It != Nd.Children.end()) {
+                        Found(Worker, It->second, H.inode, EntryType(H));
+                        Left--;
+                    }
+                }
+            }
+        }
+    };
+
+    if (not Nodes[0].Children.empty() or not Nodes[0].Ends.empty()) Pool.Push(0, 0);
+    if (OriginNode and Nodes[*OriginNode].InodeNumber) Pool.Push(0, *OriginNode);
+    Pool.Run(Visit);
+    return Results;
+}
+
+bool Drive::WriteNamespaceIndex(std::string_view Path, const WalkOptions& Options) {
+    if (not ReadOnly) {
+        SetError(ErrorCode::Unsupported);
+        Log("Namespace indices can only be written for drives mounted read-only.");
+        return false;
+    }
+
+    NamespaceIndex::Builder Builder;
+    std::vector<InodeNumberType> Mapped{ROOT_INODE_NUMBER};
+    std::mutex Lock;
+    Builder.AddPath("/", ROOT_INODE_NUMBER, S_IFDIR);
+    auto Collect = [&](std::string_view P, InodeNumberType InodeNumber, const struct stat& St) {
+        std::unique_lock Guard{Lock};
+        Builder.AddPath(P, InodeNumber, u16(St.st_mode & S_IFMT));
+        if (S_ISREG(St.st_mode) or S_ISDIR(St.st_mode)) Mapped.push_back(InodeNumber);
+    };
+
+    /// An index that misses paths would make lookups of them fail.
+    if (not Walk("/", Collect, Options)) {
+        Log("Failed to read every directory; not writing namespace index '{}'.", Path);
+        return false;
+    }
+
+    /// Hard links share a block map.
+    std::ranges::sort(Mapped);
+    auto Duplicates = std::ranges::unique(Mapped);
+    Mapped.erase(Duplicates.begin(), Duplicates.end());
+
+    std::vector<NamespaceIndexExtent> Extents;
+    for (auto InodeNumber : Mapped) {
+        auto Pinned = PinInode(InodeNumber);
+        if (not Pinned) return false;
+        auto I = ReadInode(*Pinned);
+        auto Map = GetBlockMap(InodeNumber, I);
+        if (not Map) return false;
+
+        Extents.clear();
+        for (auto& E : Map->Extents) Extents.push_back({E.Logical, E.Physical, E.Length});
+        Builder.AddInode(InodeNumber, I.i_blocks, I.Size(), Map->Blocks, Extents, Map->MetadataBlocks);
+    }
+
+    return Builder.Write(Path, NamespaceKey());
+}
+
+/// Attempt to mount a drive.
+auto Drive::TryMount(FdType Fd, const MountOptions& Options) -> std::shared_ptr<Drive> {
+    /// Reads from a mapping skip the block cache altogether, but a mapped
+    /// drive can’t hold writes back, so only map it if we never write.
+    if (Options.ReadOnly) {
+        if (auto Mapped = MappedBlockDevice::Open(Fd)) return TryMount(std::move(Mapped), Options);
+    }
+
+    return TryMount(std::make_unique<FdBlockDevice>(Fd), Options);
+}
+
+auto Drive::TryMount(std::unique_ptr<BlockDevice> Inner, const MountOptions& Options) -> std::shared_ptr<Drive> {
+    auto Device = std::make_unique<MonitoredBlockDevice>(std::move(Inner), Options.Trace);
+
+    /// Read the superblock.
+    Superblock sb;
+    if (not Device->Read(SUPERBLOCK_OFFSET, &sb, sizeof sb)) {
+        SetError(ErrorCode::Corrupted);
+        Log("Drive is too small to contain a valid ext2 filesystem.");
+        return nullptr;
+    }
+
+    /// Validate the superblock.
+    if (sb.s_magic != EXT2_SUPER_MAGIC) {
+        SetError(ErrorCode::Corrupted);
+        Log("Invalid magic number: 0x{:04x}", sb.s_magic);
+        return nullptr;
+    }
+
+    /// Everything we compute from the geometry depends on these. Blocks
+    /// can be at most 64 KiB, and the bitmap of a group must fit in one.
+    if (
+        sb.s_log_block_size > 6 or
+        sb.s_blocks_per_group == 0 or
+        sb.s_blocks_per_group > sb.block_size() * 8 or
+        sb.s_inodes_per_group == 0 or
+        sb.s_inodes_per_group > sb.block_size() * 8
+    ) {
+        SetError(ErrorCode::Corrupted);
+        Log("Invalid geometry: log block size {}, {} blocks and {} inodes per group.", sb.s_log_block_size, sb.s_blocks_per_group, sb.s_inodes_per_group);
+        return nullptr;
+    }
+
+    /// Check for incompatible or read-only features. The latter only
+    /// matter if we write to the drive.
+    if (auto Unsupported = sb.s_feature_incompat & ~SUPPORTED_INCOMPAT_FEATURES) {
+        SetError(ErrorCode::Unsupported);
+        Log("Unsupported incompatible features 0x{:x} are enabled. Refusing to mount.", Unsupported);
+        return nullptr;
+    }
+
+    if (auto Unsupported = sb.s_feature_ro_compat & ~SUPPORTED_RO_FEATURES; Unsupported and not Options.ReadOnly) {
+        SetError(ErrorCode::Unsupported);
+        Log("Unsupported read-only features 0x{:x} are enabled. Refusing to mount read-write.", Unsupported);
+        return nullptr;
+    }
+
+    /// Check for errors. Reading a damaged filesystem is fine.
+    if (sb.s_state == FsState::HasErrors and not Options.ReadOnly) {
+        SetError(ErrorCode::Corrupted);
+        Log("Filesystem has errors. Refusing to mount read-write.");
+        return nullptr;
+    }
+
+    /// Load the block group descriptor table. It is stored in
+    /// the block after the one that contains the superblock.
+    std::vector<BlockGroupDescriptor> Descriptors(sb.block_groups());
+    u64 TableOffset = u64(sb.s_first_data_block + 1) * sb.block_size();
+    IoScope Scope{IoKind::Descriptor};
+    if (not Device->Read(TableOffset, Descriptors.data(), Descriptors.size() * sizeof(BlockGroupDescriptor))) {
+        Log("Failed to read block group descriptor table.");
+        return nullptr;
+    }
+
+    /// Inode tables are read at random. Those of consecutive groups are
+    /// adjacent in some layouts, so advise each run of them at once. Files
+    /// that are read sequentially are advised as such by Readahead().
+    const BlockGeometry Geometry{sb};
+    const u64 TableBlocks = Geometry.Blocks(u64(sb.s_inodes_per_group) * sb.s_inode_size);
+    std::vector<u64> Tables;
+    Tables.reserve(Descriptors.size());
+    for (const auto& D : Descriptors) Tables.push_back(D.bg_inode_table);
+    std::ranges::sort(Tables);
+    for (usz I = 0; I < Tables.size();) {
+        const u64 First = Tables[I];
+        u64 End = First + TableBlocks;
+        for (I++; I < Tables.size() and Tables[I] <= End; I++) End = std::max(End, Tables[I] + TableBlocks);
+        Device->Advise(First << Geometry.Shift, (End - First) << Geometry.Shift, AccessPattern::Random);
+    }
+
+    /// Set the error flag. We'll clear it when we unmount the drive.
+    if (not Options.ReadOnly) sb.s_state = FsState::HasErrors;
+
+    /// Create the drive.
+    auto ptr = std::shared_ptr<Drive>{::new Drive(std::move(Device), std::move(sb), std::move(Descriptors), Options)};
+    ptr->This = ptr;
+    return ptr;
+}
+
+auto Drive::TryMountMapped(std::string_view Path, const MountOptions& Options) -> std::shared_ptr<Drive> {
+    auto Fd = open(std::string{Path}.c_str(), Options.ReadOnly ? O_RDONLY : O_RDWR);
+    if (Fd < 0) {
+        SetError(ErrorCode::Io);
+        Log("Failed to open '{}': {}", Path, strerror(errno));
+        return nullptr;
+    }
+
+    /// Open() only takes ownership of the descriptor if it succeeds.
+    auto Device = MappedBlockDevice::Open(Fd);
+    if (not Device) {
+        close(Fd);
+        return nullptr;
+    }
+
+    return TryMount(std::move(Device), Options);
 }
 
-} // namespace Ext2
\ No newline at end of file
+} // namespace Ext2
@@ -0,0 +1,160 @@
+#include <bit>
+#include <ext2++/bits/hash.hh>
+
+namespace Ext2 {
+
+/// ===========================================================================
+///  Directory hashes.
+/// ===========================================================================
+namespace {
+/// Hash with the least significant bit set has a special meaning in the
+/// index, so this is the largest value a name can hash to.
+constexpr u32 MAX_HASH = 0xFFFF'FFFC;
+
+/// Default seed if the superblock doesn’t specify one.
+constexpr u32 DEFAULT_SEED[4]{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+/// The original hash used by HTree directories. Whether characters are
+/// sign-extended depends on the platform that created the filesystem.
+template <typename Char>
+u32 LegacyHash(std::string_view Name) {
+    u32 Hash0 = 0x12a3fe2d, Hash1 = 0x37abe8f9;
+    for (char C : Name) {
+        u32 Hash = Hash1 + (Hash0 ^ (u32(i32(Char(C))) * 7152373));
+        if (Hash & 0x8000'0000) Hash -= 0x7fff'ffff;
+        Hash1 = Hash0;
+        Hash0 = Hash;
+    }
+    return Hash0 << 1;
+}
+
+/// Pack (part of) a name into the input of a hash round.
+template <typename Char>
+void NameToHashBuffer(std::string_view Name, std::span<u32> Buf) {
+    u32 Pad = u32(Name.size()) | (u32(Name.size()) << 8);
+    Pad |= Pad << 16;
+
+    auto Len = std::min(Name.size(), Buf.size() * 4);
+    u32 Val = Pad;
+    usz Out = 0;
+    for (usz I = 0; I < Len; I++) {
+        Val = u32(i32(Char(Name[I]))) + (Val << 8);
+        if (I % 4 == 3) {
+            Buf[Out++] = Val;
+            Val = Pad;
+        }
+    }
+
+    if (Out < Buf.size()) Buf[Out++] = Val;
+    while (Out < Buf.size()) Buf[Out++] = Pad;
+}
+
+/// One round of TEA.
+void TeaTransform(u32 (&Buf)[4], const u32 (&In)[4]) {
+    static constexpr u32 DELTA = 0x9E3779B9;
+    u32 Sum = 0;
+    u32 B0 = Buf[0], B1 = Buf[1];
+    for (int N = 0; N < 16; N++) {
+        Sum += DELTA;
+        B0 += ((B1 << 4) + In[0]) ^ (B1 + Sum) ^ ((B1 >> 5) + In[1]);
+        B1 += ((B0 << 4) + In[2]) ^ (B0 + Sum) ^ ((B0 >> 5) + In[3]);
+    }
+    Buf[0] += B0;
+    Buf[1] += B1;
+}
+
+/// Cut-down version of the MD4 transform.
+void HalfMD4Transform(u32 (&Buf)[4], const u32 (&In)[8]) {
+    static constexpr u32 K2 = 013240474631;
+    static constexpr u32 K3 = 015666365641;
+    auto F = [](u32 X, u32 Y, u32 Z) { return Z ^ (X & (Y ^ Z)); };
+    auto G = [](u32 X, u32 Y, u32 Z) { return (X & Y) + ((X ^ Y) & Z); };
+    auto H = [](u32 X, u32 Y, u32 Z) { return X ^ Y ^ Z; };
+    auto Round = [](auto Fn, u32& A, u32 B, u32 C, u32 D, u32 X, int S) {
+        A = std::rotl(A + Fn(B, C, D) + X, S);
+    };
+
+    u32 A = Buf[0], B = Buf[1], C = Buf[2], D = Buf[3];
+
+    Round(F, A, B, C, D, In[0], 3);
+    Round(F, D, A, B, C, In[1], 7);
+    Round(F, C, D, A, B, In[2], 11);
+    Round(F, B, C, D, A, In[3], 19);
+    Round(F, A, B, C, D, In[4], 3);
+    Round(F, D, A, B, C, In[5], 7);
+    Round(F, C, D, A, B, In[6], 11);
+    Round(F, B, C, D, A, In[7], 19);
+
+    Round(G, A, B, C, D, In[1] + K2, 3);
+    Round(G, D, A, B, C, In[3] + K2, 5);
+    Round(G, C, D, A, B, In[5] + K2, 9);
+    Round(G, B, C, D, A, In[7] + K2, 13);
+    Round(G, A, B, C, D, In[0] + K2, 3);
+    Round(G, D, A, B, C, In[2] + K2, 5);
+    Round(G, C, D, A, B, In[4] + K2, 9);
+    Round(G, B, C, D, A, In[6] + K2, 13);
+
+    Round(H, A, B, C, D, In[3] + K3, 3);
+    Round(H, D, A, B, C, In[7] + K3, 9);
+    Round(H, C, D, A, B, In[2] + K3, 11);
+    Round(H, B, C, D, A, In[6] + K3, 15);
+    Round(H, A, B, C, D, In[1] + K3, 3);
+    Round(H, D, A, B, C, In[5] + K3, 9);
+    Round(H, C, D, A, B, In[0] + K3, 11);
+    Round(H, B, C, D, A, In[4] + K3, 15);
+
+    Buf[0] += A;
+    Buf[1] += B;
+    Buf[2] += C;
+    Buf[3] += D;
+}
+
+/// Hash a name in chunks using TEA or half-MD4.
+template <typename Char, usz Words, typename Transform>
+void HashChunks(std::string_view Name, u32 (&Buf)[4], Transform Fn) {
+    u32 In[Words];
+    while (not Name.empty()) {
+        NameToHashBuffer<Char>(Name, In);
+        Fn(Buf, In);
+        Name.remove_prefix(std::min(Name.size(), Words * 4));
+    }
+}
+} // namespace
+
+auto DirHash(std::string_view Name, HashVersion Version, const u32 (&Seed)[4]) -> std::optional<u32> {
+    u32 Buf[4];
+    bool HasSeed = Seed[0] or Seed[1] or Seed[2] or Seed[3];
+    std::memcpy(Buf, HasSeed ? Seed : DEFAULT_SEED, sizeof Buf);
+
+    u32 Hash;
+    switch (Version) {
+        case HashVersion::Legacy: Hash = LegacyHash<signed char>(Name); break;
+        case HashVersion::LegacyUnsigned: Hash = LegacyHash<unsigned char>(Name); break;
+
+        case HashVersion::HalfMD4:
+            HashChunks<signed char, 8>(Name, Buf, HalfMD4Transform);
+            Hash = Buf[1];
+            break;
+
+        case HashVersion::HalfMD4Unsigned:
+            HashChunks<unsigned char, 8>(Name, Buf, HalfMD4Transform);
+            Hash = Buf[1];
+            break;
+
+        case HashVersion::Tea:
+            HashChunks<signed char, 4>(Name, Buf, TeaTransform);
+            Hash = Buf[0];
+            break;
+
+        case HashVersion::TeaUnsigned:
+            HashChunks<unsigned char, 4>(Name, Buf, TeaTransform);
+            Hash = Buf[0];
+            break;
+
+        default: return {};
+    }
+
+    Hash &= ~1u;
+    return std::min(Hash, MAX_HASH);
+}
+} // namespace Ext2
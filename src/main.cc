@@ -14,14 +14,14 @@ int main(int argc, char** argv) {
 
     /// Open the file.
     auto Path = *options::get<"drive">();
-    auto Fd = open(Path.c_str(), O_RDWR);
+    auto Fd = open(Path.c_str(), O_RDONLY);
     if (Fd < 0) {
         fmt::print(stderr, "Failed to open drive: {}\n", strerror(errno));
         return 1;
     }
 
-    /// Try to mount the drive.
-    auto Drive = Ext2::Drive::TryMount(Fd);
+    /// Try to mount the drive. We only read from it.
+    auto Drive = Ext2::Drive::TryMount(Fd, {.ReadOnly = true});
     if (not Drive) {
         fmt::print(stderr, "Failed to mount drive\n");
         return 1;
@@ -59,7 +59,7 @@ int main(int argc, char** argv) {
 
     fmt::print("Directory:\n");
     for (const auto& Entry : *Dir) {
-        fmt::print("    {}\n", Entry->name);
+        fmt::print("    {}\n", Entry.Name);
     }
 
     /// Read from a file.
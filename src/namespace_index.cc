@@ -0,0 +1,227 @@
+#include <ext2++/bits/namespace_index.hh>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Ext2 {
+/// ===========================================================================
+///  Namespace index.
+/// ===========================================================================
+namespace {
+constexpr std::array<char, 8> NAMESPACE_INDEX_MAGIC{'E', 'X', 'T', '2', 'N', 'S', 'I', 'X'};
+constexpr u32 NAMESPACE_INDEX_VERSION = 1;
+
+/// Check that Count records of a given size starting at Offset lie
+/// within Length bytes and are suitably aligned.
+bool InBounds(u64 Offset, u64 Count, u64 Size, u64 Align, u64 Length) {
+    if (Offset % Align or Offset > Length) return false;
+    return Count <= (Length - Offset) / Size;
+}
+
+/// Round up to a multiple of 8.
+auto Align8(u64 Offset) -> u64 {
+    return (Offset + 7) & ~u64(7);
+}
+} // namespace
+
+void NamespaceIndex::Builder::AddPath(std::string_view Path, u32 InodeNumber, u16 Format) {
+    Entries.push_back({
+        .PathOffset = Strings.size(),
+        .PathSize = u32(Path.size()),
+        .InodeNumber = InodeNumber,
+        .Format = Format,
+        .Pad = {},
+    });
+    Strings += Path;
+}
+
+void NamespaceIndex::Builder::AddInode(
+    u32 InodeNumber,
+    u32 Sectors,
+    u64 Size,
+    const std::array<u32, 15>& Blocks,
+    std::span<const NamespaceIndexExtent> InodeExtents,
+    std::span<const u64> InodeMetadata
+) {
+    Inodes.push_back({
+        .InodeNumber = InodeNumber,
+        .Sectors = Sectors,
+        .Size = Size,
+        .Blocks = Blocks,
+        .Pad = 0,
+        .FirstExtent = Extents.size(),
+        .ExtentCount = InodeExtents.size(),
+        .FirstMetadata = Metadata.size(),
+        .MetadataCount = InodeMetadata.size(),
+    });
+    Extents.insert(Extents.end(), InodeExtents.begin(), InodeExtents.end());
+    Metadata.insert(Metadata.end(), InodeMetadata.begin(), InodeMetadata.end());
+}
+
+bool NamespaceIndex::Builder::Write(std::string_view Path, const NamespaceIndexKey& Key) {
+    auto PathOf = [&](const NamespaceIndexEntry& E) {
+        return std::string_view{Strings}.substr(usz(E.PathOffset), E.PathSize);
+    };
+
+    std::ranges::sort(Entries, {}, PathOf);
+    std::ranges::sort(Inodes, {}, &NamespaceIndexInode::InodeNumber);
+
+    /// Lay out the file: the header, then every section, 8-byte aligned.
+    NamespaceIndexHeader H{
+        .Magic = NAMESPACE_INDEX_MAGIC,
+        .Version = NAMESPACE_INDEX_VERSION,
+        .Reserved = 0,
+        .Key = Key,
+        .KeyPad = 0,
+        .EntryCount = Entries.size(),
+        .EntriesOffset = Align8(sizeof H),
+        .InodeCount = Inodes.size(),
+        .InodesOffset = 0,
+        .ExtentCount = Extents.size(),
+        .ExtentsOffset = 0,
+        .MetadataCount = Metadata.size(),
+        .MetadataOffset = 0,
+        .StringsSize = Strings.size(),
+        .StringsOffset = 0,
+    };
+
+    H.InodesOffset = Align8(H.EntriesOffset + Entries.size() * sizeof(NamespaceIndexEntry));
+    H.ExtentsOffset = Align8(H.InodesOffset + Inodes.size() * sizeof(NamespaceIndexInode));
+    H.MetadataOffset = Align8(H.ExtentsOffset + Extents.size() * sizeof(NamespaceIndexExtent));
+    H.StringsOffset = Align8(H.MetadataOffset + Metadata.size() * sizeof(u64));
+
+    std::vector<u8> File(usz(H.StringsOffset + Strings.size()));
+    auto Put = [&](u64 Offset, const void* Data, usz Size) {
+        if (Size) std::memcpy(File.data() + Offset, Data, Size);
+    };
+
+    Put(0, &H, sizeof H);
+    Put(H.EntriesOffset, Entries.data(), Entries.size() * sizeof(NamespaceIndexEntry));
+    Put(H.InodesOffset, Inodes.data(), Inodes.size() * sizeof(NamespaceIndexInode));
+    Put(H.ExtentsOffset, Extents.data(), Extents.size() * sizeof(NamespaceIndexExtent));
+    Put(H.MetadataOffset, Metadata.data(), Metadata.size() * sizeof(u64));
+    Put(H.StringsOffset, Strings.data(), Strings.size());
+
+    /// Write a temporary file and rename it so that readers never
+    /// see a partially written index.
+    auto Temp = std::string{Path} + ".tmp";
+    auto Fd = open(Temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (Fd < 0) {
+        Log("Failed to create '{}': {}", Temp, strerror(errno));
+        return false;
+    }
+
+    for (usz Done = 0; Done < File.size();) {
+        auto Written = write(Fd, File.data() + Done, File.size() - Done);
+        if (Written < 0 and errno == EINTR) continue;
+        if (Written <= 0) {
+            Log("Failed to write '{}': {}", Temp, strerror(errno));
+            close(Fd);
+            unlink(Temp.c_str());
+            return false;
+        }
+        Done += usz(Written);
+    }
+
+    if (fsync(Fd) != 0 or close(Fd) != 0 or rename(Temp.c_str(), std::string{Path}.c_str()) != 0) {
+        Log("Failed to write '{}': {}", Path, strerror(errno));
+        unlink(Temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+NamespaceIndex::~NamespaceIndex() {
+    munmap(const_cast<u8*>(Base), Length);
+}
+
+auto NamespaceIndex::Open(std::string_view Path, const NamespaceIndexKey& Key) -> std::unique_ptr<NamespaceIndex> {
+    auto Fd = open(std::string{Path}.c_str(), O_RDONLY | O_CLOEXEC);
+    if (Fd < 0) {
+        LogAt<LogLevel::Info>("Failed to open namespace index '{}': {}", Path, strerror(errno));
+        return nullptr;
+    }
+
+    struct stat St;
+    if (fstat(Fd, &St) != 0 or usz(St.st_size) < sizeof(NamespaceIndexHeader)) {
+        LogAt<LogLevel::Warning>("Namespace index '{}' is truncated.", Path);
+        close(Fd);
+        return nullptr;
+    }
+
+    auto Length = usz(St.st_size);
+    auto Base = mmap(nullptr, Length, PROT_READ, MAP_SHARED, Fd, 0);
+    close(Fd);
+    if (Base == MAP_FAILED) {
+        Log("Failed to map namespace index '{}': {}", Path, strerror(errno));
+        return nullptr;
+    }
+
+    auto Index = std::unique_ptr<NamespaceIndex>{::new NamespaceIndex(static_cast<const u8*>(Base), Length)};
+    if (Index->Header->Magic != NAMESPACE_INDEX_MAGIC or Index->Header->Version != NAMESPACE_INDEX_VERSION or not Index->Validate()) {
+        LogAt<LogLevel::Warning>("Namespace index '{}' is malformed.", Path);
+        return nullptr;
+    }
+
+    if (Index->Header->Key != Key) {
+        LogAt<LogLevel::Info>("Namespace index '{}' is stale.", Path);
+        return nullptr;
+    }
+
+    return Index;
+}
+
+bool NamespaceIndex::Validate() const {
+    auto& H = *Header;
+    if (
+        not InBounds(H.EntriesOffset, H.EntryCount, sizeof(NamespaceIndexEntry), 8, Length) or
+        not InBounds(H.InodesOffset, H.InodeCount, sizeof(NamespaceIndexInode), 8, Length) or
+        not InBounds(H.ExtentsOffset, H.ExtentCount, sizeof(NamespaceIndexExtent), 8, Length) or
+        not InBounds(H.MetadataOffset, H.MetadataCount, sizeof(u64), 8, Length) or
+        not InBounds(H.StringsOffset, H.StringsSize, 1, 1, Length)
+    ) return false;
+
+    /// Lookups use binary search, so the order matters as much as the bounds.
+    auto Entries = Section<NamespaceIndexEntry>(H.EntriesOffset, H.EntryCount);
+    for (usz i = 0; i < Entries.size(); i++) {
+        auto& E = Entries[i];
+        if (E.PathOffset > H.StringsSize or E.PathSize > H.StringsSize - E.PathOffset) return false;
+        if (i and PathOf(Entries[i - 1]) >= PathOf(E)) return false;
+    }
+
+    auto Inodes = Section<NamespaceIndexInode>(H.InodesOffset, H.InodeCount);
+    for (usz i = 0; i < Inodes.size(); i++) {
+        auto& I = Inodes[i];
+        if (I.FirstExtent > H.ExtentCount or I.ExtentCount > H.ExtentCount - I.FirstExtent) return false;
+        if (I.FirstMetadata > H.MetadataCount or I.MetadataCount > H.MetadataCount - I.FirstMetadata) return false;
+        if (i and Inodes[i - 1].InodeNumber >= I.InodeNumber) return false;
+    }
+
+    return true;
+}
+
+auto NamespaceIndex::Find(std::string_view Path) const -> const NamespaceIndexEntry* {
+    auto Entries = Section<NamespaceIndexEntry>(Header->EntriesOffset, Header->EntryCount);
+    auto It = std::ranges::lower_bound(Entries, Path, {}, [&](const NamespaceIndexEntry& E) { return PathOf(E); });
+    if (It == Entries.end() or PathOf(*It) != Path) return nullptr;
+    return &*It;
+}
+
+auto NamespaceIndex::FindInode(u32 InodeNumber) const -> const NamespaceIndexInode* {
+    auto Inodes = Section<NamespaceIndexInode>(Header->InodesOffset, Header->InodeCount);
+    auto It = std::ranges::lower_bound(Inodes, InodeNumber, {}, &NamespaceIndexInode::InodeNumber);
+    if (It == Inodes.end() or It->InodeNumber != InodeNumber) return nullptr;
+    return &*It;
+}
+
+auto NamespaceIndex::Extents(const NamespaceIndexInode& I) const -> std::span<const NamespaceIndexExtent> {
+    return Section<NamespaceIndexExtent>(Header->ExtentsOffset, Header->ExtentCount).subspan(usz(I.FirstExtent), usz(I.ExtentCount));
+}
+
+auto NamespaceIndex::Metadata(const NamespaceIndexInode& I) const -> std::span<const u64> {
+    return Section<u64>(Header->MetadataOffset, Header->MetadataCount).subspan(usz(I.FirstMetadata), usz(I.MetadataCount));
+}
+} // namespace Ext2
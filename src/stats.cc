@@ -0,0 +1,61 @@
+#include <bit>
+#include <cmath>
+#include <ext2++/bits/stats.hh>
+
+namespace Ext2 {
+/// ===========================================================================
+///  I/O statistics.
+/// ===========================================================================
+auto IoKindName(IoKind K) -> std::string_view {
+    switch (K) {
+        case IoKind::Inode: return "inode";
+        case IoKind::Descriptor: return "descriptor";
+        case IoKind::Directory: return "directory";
+        case IoKind::Data: return "data";
+        case IoKind::Metadata: return "metadata";
+        case IoKind::Write: return "write";
+    }
+    return "unknown";
+}
+
+auto LatencyHistogram::Bucket(std::chrono::nanoseconds Latency) -> usz {
+    auto Ns = u64(std::max<i64>(Latency.count(), 1));
+    return std::min<usz>(usz(std::bit_width(Ns)) - 1, BUCKETS - 1);
+}
+
+auto LatencyHistogram::Count() const -> u64 {
+    u64 Total = 0;
+    for (auto B : Buckets) Total += B;
+    return Total;
+}
+
+auto LatencyHistogram::Percentile(f64 P) const -> std::chrono::nanoseconds {
+    auto Total = Count();
+    if (Total == 0) return {};
+
+    /// Find the bucket that contains the sample with this rank.
+    auto Rank = std::max<u64>(u64(std::ceil(std::clamp(P, 0.0, 1.0) * f64(Total))), 1);
+    u64 Seen = 0;
+    for (usz I = 0; I < BUCKETS; I++) {
+        Seen += Buckets[I];
+        if (Seen >= Rank) return std::chrono::nanoseconds{i64(u64(2) << I)};
+    }
+    return std::chrono::nanoseconds{i64(u64(2) << (BUCKETS - 1))};
+}
+
+auto IoCounters::Snapshot() const -> IoStatistics {
+    IoStatistics S;
+    for (usz K = 0; K < IO_KIND_COUNT; K++) {
+        auto& From = Kinds[K];
+        auto& To = S.Kinds[K];
+        To.Requests = From.Requests.load(std::memory_order_relaxed);
+        To.Bytes = From.Bytes.load(std::memory_order_relaxed);
+        To.Errors = From.Errors.load(std::memory_order_relaxed);
+        To.CacheHits = From.CacheHits.load(std::memory_order_relaxed);
+        To.CacheMisses = From.CacheMisses.load(std::memory_order_relaxed);
+        for (usz I = 0; I < LatencyHistogram::BUCKETS; I++)
+            To.Latency.Buckets[I] = From.Latency[I].load(std::memory_order_relaxed);
+    }
+    return S;
+}
+} // namespace Ext2
@@ -0,0 +1,102 @@
+#include "test.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+constexpr Bench::ImageOptions ADVICE_IMAGE{
+    .BlockSize = 1024,
+    .Depth = 1,
+    .FanOut = 2,
+    .FilesPerDir = 16,
+    .MinFileSize = 512 * 1024,
+    .MaxFileSize = 1024 * 1024,
+    .Fragmentation = 0,
+    .Seed = 37,
+};
+
+struct Advice {
+    u64 Offset;
+    u64 Size;
+    AccessPattern Pattern;
+};
+
+/// Device that records the advice it is given.
+class AdvisedBlockDevice final : public FdBlockDevice {
+public:
+    std::vector<Advice>& Recorded;
+
+    AdvisedBlockDevice(FdType Fd_, std::vector<Advice>& Recorded_) : FdBlockDevice(Fd_), Recorded(Recorded_) {}
+    void Advise(u64 Offset, u64 Size, AccessPattern Pattern) override { Recorded.push_back({Offset, Size, Pattern}); }
+};
+
+auto Count(std::span<const Advice> Recorded, AccessPattern Pattern) -> usz {
+    return usz(std::ranges::count(Recorded, Pattern, &Advice::Pattern));
+}
+
+auto Mount(const TempImage& Img, std::vector<Advice>& Recorded) -> std::shared_ptr<Drive> {
+    MountOptions Options;
+    Options.ReadOnly = true;
+    return Drive::TryMount(std::make_unique<AdvisedBlockDevice>(open(Img.Path().c_str(), O_RDONLY), Recorded), Options);
+}
+
+/// Move the inode tables of all groups next to each other, as mke2fs
+/// does with flex_bg. Returns the number of groups.
+auto PackInodeTables(const TempImage& Img) -> u32 {
+    const int Fd = open(Img.Path().c_str(), O_RDWR);
+    if (Fd < 0) return 0;
+    Superblock Sb;
+    std::vector<BlockGroupDescriptor> Descriptors;
+    u32 Groups = 0;
+    if (pread(Fd, &Sb, sizeof Sb, 1024) == ssize_t(sizeof Sb)) {
+        Descriptors.resize(Sb.block_groups());
+        const auto Size = Descriptors.size() * sizeof(BlockGroupDescriptor);
+        const auto At = off_t(u64(Sb.s_first_data_block + 1) * Sb.block_size());
+        const u32 TableBlocks = u32(BlockGeometry{Sb}.Blocks(u64(Sb.s_inodes_per_group) * Sb.s_inode_size));
+        if (pread(Fd, Descriptors.data(), Size, At) == ssize_t(Size)) {
+            for (u32 G = 1; G < Descriptors.size(); G++) Descriptors[G].bg_inode_table = Descriptors[0].bg_inode_table + G * TableBlocks;
+            if (pwrite(Fd, Descriptors.data(), Size, At) == ssize_t(Size)) Groups = u32(Descriptors.size());
+        }
+    }
+
+    close(Fd);
+    return Groups;
+}
+} // namespace
+
+/// Only files that are read sequentially are advised as such, and
+/// adjacent inode tables are advised as one range.
+TEST(AccessAdvice) {
+    TempImage Img{ADVICE_IMAGE};
+    REQUIRE(Img.Ok());
+
+    /// The generator places each inode table in its own group.
+    std::vector<Advice> Recorded;
+    {
+        auto D = Mount(Img, Recorded);
+        REQUIRE(D);
+        CHECK(Count(Recorded, AccessPattern::Random) > 1);
+        CHECK(Count(Recorded, AccessPattern::Sequential) == 0);
+
+        /// Reading a file from the start advises all of it at once.
+        auto Path = Img.Files().front();
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        Recorded.clear();
+        std::vector<u8> Buffer(4096);
+        CHECK(F->Read(Buffer.data(), Buffer.size()) == Buffer.size());
+        const auto Sequential = Count(Recorded, AccessPattern::Sequential);
+        CHECK(Sequential >= 1);
+        while (F->Read(Buffer.data(), Buffer.size()).value_or(0) != 0) {}
+        CHECK(Count(Recorded, AccessPattern::Sequential) == Sequential);
+        CHECK(Count(Recorded, AccessPattern::Normal) == 0);
+    }
+
+    REQUIRE(PackInodeTables(Img) > 1);
+    Recorded.clear();
+    REQUIRE(Mount(Img, Recorded));
+    CHECK(Count(Recorded, AccessPattern::Random) == 1);
+}
@@ -0,0 +1,148 @@
+#include "test.hh"
+
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+/// The superblock is at a fixed offset from the start of the drive.
+constexpr usz SUPERBLOCK_OFFSET = 1024;
+
+constexpr Bench::ImageOptions WRITE_IMAGE{
+    .BlockSize = 4096,
+    .Depth = 1,
+    .FanOut = 2,
+    .FilesPerDir = 8,
+    .MinFileSize = 1024,
+    .MaxFileSize = 64 * 1024,
+    .Fragmentation = 0.2,
+    .Seed = 17,
+};
+
+/// Set the number of reserved blocks in the superblock of an image.
+bool SetReservedBlocks(const TempImage& Img, u32 Count) {
+    const int Fd = open(Img.Path().c_str(), O_WRONLY);
+    if (Fd < 0) return false;
+    const off_t At = off_t(SUPERBLOCK_OFFSET + offsetof(Superblock, s_r_blocks_count));
+    const bool Ok = pwrite(Fd, &Count, sizeof Count, At) == ssize_t(sizeof Count);
+    close(Fd);
+    return Ok;
+}
+
+/// Overwrite part of every file and extend it into indirect blocks,
+/// then check that all of it is still there after a remount.
+void WriteRoundTrip(const MountOptions& Options) {
+    TempImage Img{WRITE_IMAGE};
+    REQUIRE(Img.Ok());
+
+    std::vector<std::vector<u8>> Expected;
+    {
+        auto D = Img.Mount(Options);
+        REQUIRE(D);
+        for (usz Index = 0; auto& Path : Img.Files()) {
+            auto F = D->OpenFile(Path);
+            REQUIRE(F);
+            auto Size = usz(D->Stat(Path)->st_size);
+            auto Contents = ReadAll(*F, 0, Size);
+            REQUIRE(Contents);
+
+            auto Middle = Pattern(Size / 2, 2 * Index);
+            auto Tail = Pattern(300'000 + 4096 * Index, 2 * Index + 1);
+            CHECK(F->PWrite(Size / 4, Middle) == Middle.size());
+            CHECK(F->PWrite(Size, Tail) == Tail.size());
+            std::ranges::copy(Middle, Contents->begin() + isz(Size / 4));
+            Contents->insert(Contents->end(), Tail.begin(), Tail.end());
+            CHECK(ReadAll(*F, 0, Contents->size()) == *Contents);
+            Expected.push_back(std::move(*Contents));
+            Index++;
+        }
+    }
+
+    CHECK(Img.Fsck());
+
+    auto D = Img.Mount(Options);
+    REQUIRE(D);
+    for (usz Index = 0; auto& Path : Img.Files()) {
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        CHECK(D->Stat(Path)->st_size == off_t(Expected[Index].size()));
+        CHECK(ReadAll(*F, 0, Expected[Index].size()) == Expected[Index]);
+        Index++;
+    }
+}
+
+/// Reserve all free blocks, or all but a few, and append to a file.
+void WriteWithReserved(const MountOptions& Options) {
+    TempImage Img{WRITE_IMAGE};
+    REQUIRE(Img.Ok());
+
+    MountOptions ReadOnly;
+    ReadOnly.ReadOnly = true;
+    auto Free = Img.Mount(ReadOnly)->StatFs()->FreeBlocks;
+    auto Path = Img.Files().front();
+
+    /// With everything reserved, nothing can be allocated, but data can
+    /// still be overwritten in place.
+    REQUIRE(SetReservedBlocks(Img, u32(Free)));
+    {
+        auto D = Img.Mount(Options);
+        REQUIRE(D);
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        auto Size = u64(D->Stat(Path)->st_size);
+        auto Slack = (Size + WRITE_IMAGE.BlockSize - 1) / WRITE_IMAGE.BlockSize * WRITE_IMAGE.BlockSize - Size;
+        auto Data = Pattern(64 * 1024, 3);
+        CHECK(F->PWrite(Size, Data).value_or(0) == Slack);
+        CHECK(LastError() == ErrorCode::NoSpace);
+        CHECK(F->PWrite(0, std::span{Data}.first(512)) == 512);
+        CHECK(D->Sync());
+        CHECK(D->StatFs()->FreeBlocks == Free);
+        CHECK(u64(D->Stat(Path)->st_size) == Size + Slack);
+    }
+
+    /// e2fsck rejects reserving more than half of the drive.
+    REQUIRE(SetReservedBlocks(Img, 0));
+    CHECK(Img.Fsck());
+
+    /// Leave a few blocks; a write that needs fewer succeeds.
+    REQUIRE(SetReservedBlocks(Img, u32(Free - 64)));
+    {
+        auto D = Img.Mount(Options);
+        REQUIRE(D);
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        auto Size = u64(D->Stat(Path)->st_size);
+        auto Data = Pattern(32 * 4096, 4);
+        CHECK(F->PWrite(Size, Data) == Data.size());
+        CHECK(D->Sync());
+        CHECK(ReadAll(*F, Size, Data.size()) == Data);
+        CHECK(D->StatFs()->FreeBlocks >= Free - 64);
+    }
+
+    REQUIRE(SetReservedBlocks(Img, 0));
+    CHECK(Img.Fsck());
+}
+} // namespace
+
+TEST(WriteRoundTripDelayed) {
+    WriteRoundTrip({});
+}
+
+TEST(WriteRoundTripImmediate) {
+    MountOptions Options;
+    Options.DirtyLimitBlocks = 0;
+    WriteRoundTrip(Options);
+}
+
+TEST(ReservedBlocksDelayed) {
+    WriteWithReserved({});
+}
+
+TEST(ReservedBlocksImmediate) {
+    MountOptions Options;
+    Options.DirtyLimitBlocks = 0;
+    WriteWithReserved(Options);
+}
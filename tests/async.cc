@@ -0,0 +1,76 @@
+#include "test.hh"
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+constexpr Bench::ImageOptions ASYNC_IMAGE{
+    .BlockSize = 1024,
+    .Depth = 1,
+    .FanOut = 1,
+    .FilesPerDir = 4,
+    .MinFileSize = 20 * 1024,
+    .MaxFileSize = 40 * 1024,
+    .Fragmentation = 0,
+    .Seed = 29,
+};
+} // namespace
+
+/// Delayed data of one file doesn’t keep others from being read
+/// asynchronously, and is seen by reads of its own file.
+TEST(AsyncReadWithDelayedData) {
+    TempImage Img{ASYNC_IMAGE};
+    REQUIRE(Img.Ok());
+
+    auto D = Img.Mount();
+    REQUIRE(D);
+    auto& Files = Img.Files();
+    REQUIRE(Files.size() >= 2);
+
+    auto Written = D->OpenFile(Files[0]);
+    auto Other = D->OpenFile(Files[1]);
+    REQUIRE(Written and Other);
+
+    auto WrittenSize = usz(D->Stat(Files[0])->st_size);
+    auto OtherSize = usz(D->Stat(Files[1])->st_size);
+    auto Expected = ReadAll(*Written, 0, WrittenSize);
+    auto OtherExpected = ReadAll(*Other, 0, OtherSize);
+    REQUIRE(Expected and OtherExpected);
+
+    auto Tail = Pattern(10'000, 5);
+    CHECK(Written->PWrite(WrittenSize, Tail) == Tail.size());
+    Expected->insert(Expected->end(), Tail.begin(), Tail.end());
+
+    std::vector<u8> Buffer(Expected->size());
+    CHECK(RunTask(*D, Written->AsyncPRead(0, Buffer)) == Buffer.size());
+    CHECK(Buffer == *Expected);
+
+    Buffer.assign(OtherSize, 0);
+    CHECK(RunTask(*D, Other->AsyncPRead(0, Buffer)) == OtherSize);
+    CHECK(Buffer == *OtherExpected);
+}
+
+/// Access times updated by AsyncStat() are written back on Sync().
+TEST(AsyncStatAtime) {
+    TempImage Img{ASYNC_IMAGE};
+    REQUIRE(Img.Ok());
+
+    MountOptions ReadOnly;
+    ReadOnly.ReadOnly = true;
+    auto Path = Img.Files().front();
+    auto Before = Img.Mount(ReadOnly)->Stat(Path)->st_atime;
+
+    {
+        MountOptions Options;
+        Options.Atime = AtimeUpdate::Strict;
+        auto D = Img.Mount(Options);
+        REQUIRE(D);
+        auto St = RunTask(*D, D->AsyncStat(Path));
+        REQUIRE(St);
+        CHECK(St->st_atime > Before);
+        CHECK(D->Sync());
+    }
+
+    CHECK(Img.Mount(ReadOnly)->Stat(Path)->st_atime > Before);
+    CHECK(Img.Fsck());
+}
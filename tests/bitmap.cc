@@ -0,0 +1,127 @@
+#include "test.hh"
+
+#include <ext2++/bits/bitmap.hh>
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+/// Longer than a few vectors, so that every kernel has a tail as well.
+constexpr usz BITMAP_BYTES = 200;
+
+bool Bit(std::span<const u8> Bits, u64 Index) {
+    return (Bits[usz(Index / 8)] >> (Index % 8)) & 1;
+}
+
+/// Random bitmaps that are mostly clear, mostly set, or anything in
+/// between, so that searches stop both early and late.
+auto RandomBitmap(Bench::Random& Rng) -> std::vector<u8> {
+    std::vector<u8> Bits(BITMAP_BYTES);
+    const auto Density = Rng() % 5;
+    for (auto& B : Bits) {
+        switch (Density) {
+            case 0: B = Rng() % 64 ? 0x00 : u8(1u << (Rng() % 8)); break;
+            case 1: B = Rng() % 64 ? 0xFF : u8(~(1u << (Rng() % 8))); break;
+            default: B = u8(Rng()); break;
+        }
+    }
+
+    return Bits;
+}
+
+/// A range of bits in the bitmap. Many start or end inside a byte, and
+/// many are shorter than a byte.
+auto RandomRange(Bench::Random& Rng) -> std::pair<u64, u64> {
+    const u64 Total = BITMAP_BYTES * 8;
+    const u64 First = Rng() % Total;
+    const u64 Length = Rng() % 4 ? Rng() % (Total - First + 1) : Rng() % std::min<u64>(9, Total - First + 1);
+    return {First, First + Length};
+}
+
+auto Count(std::span<const u8> Bits, u64 First, u64 End) -> u64 {
+    u64 Total = 0;
+    for (; First < End; First++) Total += Bit(Bits, First);
+    return Total;
+}
+
+auto Find(std::span<const u8> Bits, u64 First, u64 End, bool Value) -> u64 {
+    for (; First < End; First++)
+        if (Bit(Bits, First) == Value) return First;
+    return End;
+}
+
+auto FindClearRun(std::span<const u8> Bits, u64 First, u64 End, u64 Length) -> u64 {
+    for (u64 Run = 0; First < End; First++) {
+        Run = Bit(Bits, First) ? 0 : Run + 1;
+        if (Run == Length) return First + 1 - Length;
+    }
+
+    return End;
+}
+} // namespace
+
+/// Every kernel that the CPU supports agrees with the scalar one, for
+/// all offsets and lengths, including those shorter than a vector.
+TEST(BitmapKernels) {
+    fmt::print(stderr, "bitmap implementation: {}\n", BitmapImplementation());
+    auto Available = detail::AvailableBitmapKernels();
+    REQUIRE(not Available.empty());
+    const auto& Scalar = *Available.front();
+    CHECK(Available.back()->Name == BitmapImplementation());
+
+    Bench::Random Rng{41};
+    for (int Round = 0; Round < 50; Round++) {
+        auto Bits = RandomBitmap(Rng);
+        for (const auto* K : Available) {
+            for (usz Offset = 0; Offset < 40; Offset++) {
+                for (usz N = 0; Offset + N <= Bits.size(); N++) {
+                    const u8* Data = Bits.data() + Offset;
+                    CHECK(K->Popcount(Data, N) == Scalar.Popcount(Data, N));
+                    CHECK(K->FindNotByte(Data, N, 0x00) == Scalar.FindNotByte(Data, N, 0x00));
+                    CHECK(K->FindNotByte(Data, N, 0xFF) == Scalar.FindNotByte(Data, N, 0xFF));
+                }
+            }
+        }
+    }
+
+    /// A single differing byte is found in every position of a vector.
+    for (const auto* K : Available) {
+        for (u8 Byte : {u8(0x00), u8(0xFF), u8(0x5A)}) {
+            std::vector<u8> Bits(BITMAP_BYTES, Byte);
+            CHECK(K->FindNotByte(Bits.data(), Bits.size(), Byte) == Bits.size());
+            for (usz At = 0; At < Bits.size(); At++) {
+                Bits[At] = u8(~Byte);
+                CHECK(K->FindNotByte(Bits.data(), Bits.size(), Byte) == At);
+                CHECK(K->FindNotByte(Bits.data() + 1, Bits.size() - 1, Byte) == (At ? At - 1 : Bits.size() - 1));
+                Bits[At] = Byte;
+            }
+        }
+    }
+}
+
+/// The bit operations agree with testing one bit at a time.
+TEST(BitmapOperations) {
+    Bench::Random Rng{43};
+    for (int Round = 0; Round < 20'000; Round++) {
+        auto Bits = RandomBitmap(Rng);
+        auto [First, End] = RandomRange(Rng);
+        CHECK(BitmapCount(Bits, First, End) == Count(Bits, First, End));
+        CHECK(BitmapFindClear(Bits, First, End) == Find(Bits, First, End, false));
+        CHECK(BitmapFindSet(Bits, First, End) == Find(Bits, First, End, true));
+
+        const u64 Length = 1 + Rng() % 70;
+        CHECK(BitmapFindClearRun(Bits, First, End, Length) == FindClearRun(Bits, First, End, Length));
+
+        /// Filling leaves the bits outside the range alone.
+        const bool Value = Rng() % 2;
+        auto Expected = Bits;
+        for (u64 I = First; I < End; I++) {
+            const u8 Mask = u8(1u << (I % 8));
+            auto& Byte = Expected[usz(I / 8)];
+            Byte = u8(Value ? Byte | Mask : Byte & ~Mask);
+        }
+
+        BitmapFill(Bits, First, End, Value);
+        CHECK(Bits == Expected);
+    }
+}
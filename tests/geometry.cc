@@ -0,0 +1,25 @@
+#include "test.hh"
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+/// Group arithmetic with the precomputed inverses matches division,
+/// including for group sizes that aren’t powers of two.
+TEST(GeometryGroupDivision) {
+    for (u32 PerGroup : {1u, 2u, 3u, 7u, 1928u, 8192u, 32767u, 32768u, 65528u, 524288u}) {
+        Superblock Sb{};
+        Sb.s_log_block_size = 2;
+        Sb.s_inodes_per_group = PerGroup;
+        Sb.s_blocks_per_group = PerGroup;
+        const BlockGeometry Geometry{Sb};
+
+        Bench::Random Rng{PerGroup};
+        for (int I = 0; I < 10'000; I++) {
+            const auto Index = I < 100 ? u32(I) : I < 200 ? ~u32(0) - u32(I - 100) : u32(Rng());
+            CHECK(Geometry.InodeGroup(Index) == Index / PerGroup);
+            CHECK(Geometry.InodeInGroup(Index) == Index % PerGroup);
+            CHECK(Geometry.BlockGroup(Index) == Index / PerGroup);
+            CHECK(Geometry.BlockInGroup(Index) == Index % PerGroup);
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#include "test.hh"
+
+#include <ext2++/bits/hash.hh>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/wait.h>
+#include <unordered_map>
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+constexpr u32 DEFAULT[4]{};
+constexpr u32 CUSTOM[4]{0x3322'1100, 0x7766'5544, 0xBBAA'9988, 0xFFEE'DDCC};
+
+/// Expected hashes, in the order of HashVersion. These were computed
+/// with ext2fs_dirhash() from e2fsprogs 1.47.0. The signed and unsigned
+/// variants only differ for names with bytes above 0x7F.
+struct KnownHash {
+    std::string_view Name;
+    const u32 (&Seed)[4];
+    u32 Hashes[6];
+};
+
+const KnownHash KNOWN_HASHES[]{
+    {"", DEFAULT, {0x2547fc5a, 0xefcdab88, 0x67452300, 0x2547fc5a, 0xefcdab88, 0x67452300}},
+    {"a", DEFAULT, {0xe74b53e2, 0xd5fa7d7a, 0x6d0ea4c0, 0xe74b53e2, 0xd5fa7d7a, 0x6d0ea4c0}},
+    {"hello", DEFAULT, {0x32252546, 0x1746da32, 0x6f5bb1a8, 0x32252546, 0x1746da32, 0x6f5bb1a8}},
+    {"lost+found", DEFAULT, {0x5e2aba24, 0x591de422, 0x2dbf9e80, 0x5e2aba24, 0x591de422, 0x2dbf9e80}},
+    {"file-1234", DEFAULT, {0xd437016e, 0x161046e0, 0x18e8f168, 0xd437016e, 0x161046e0, 0x18e8f168}},
+    {"d\xc3\xa9tente-\xff\x80", DEFAULT, {0x47d60c4c, 0x47d765f6, 0xd0f16d82, 0x1dfeb9ee, 0x40f85430, 0xcd9008ca}},
+    {"0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ", DEFAULT, {0x2180ac72, 0xf8773d34, 0xb4647536, 0x2180ac72, 0xf8773d34, 0xb4647536}},
+    {"", CUSTOM, {0x2547fc5a, 0x77665544, 0x33221100, 0x2547fc5a, 0x77665544, 0x33221100}},
+    {"a", CUSTOM, {0xe74b53e2, 0x93752ee6, 0xf9b90e84, 0xe74b53e2, 0x93752ee6, 0xf9b90e84}},
+    {"hello", CUSTOM, {0x32252546, 0x344ca36e, 0x9e019d48, 0x32252546, 0x344ca36e, 0x9e019d48}},
+    {"lost+found", CUSTOM, {0x5e2aba24, 0x1efb822c, 0xd06209f0, 0x5e2aba24, 0x1efb822c, 0xd06209f0}},
+    {"file-1234", CUSTOM, {0xd437016e, 0x08e780ba, 0x848ba8c6, 0xd437016e, 0x08e780ba, 0x848ba8c6}},
+    {"d\xc3\xa9tente-\xff\x80", CUSTOM, {0x47d60c4c, 0x2dbee3dc, 0xbeaa6694, 0x1dfeb9ee, 0x9a03e4ac, 0x52b6c102}},
+    {"0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ", CUSTOM, {0x2180ac72, 0x30f186d2, 0xd32af732, 0x2180ac72, 0x30f186d2, 0xd32af732}},
+};
+
+/// Directories large enough that e2fsck -D gives them a two-level index.
+constexpr Bench::ImageOptions INDEXED_IMAGE{
+    .BlockSize = 1024,
+    .Depth = 1,
+    .FanOut = 2,
+    .FilesPerDir = 8000,
+    .MinFileSize = 0,
+    .MaxFileSize = 0,
+    .Fragmentation = 0,
+    .Seed = 31,
+};
+} // namespace
+
+TEST(DirHashKnownAnswers) {
+    for (auto& K : KNOWN_HASHES) {
+        for (u8 Version = 0; Version < 6; Version++) {
+            auto Hash = DirHash(K.Name, HashVersion(Version), K.Seed);
+            CHECK(Hash == K.Hashes[Version]);
+        }
+    }
+
+    CHECK(not DirHash("a", HashVersion(6), DEFAULT));
+}
+
+/// Lookups in directories indexed by e2fsck find every name, both
+/// synchronously and asynchronously, and don’t find others.
+TEST(IndexedDirectoryLookup) {
+    if (std::system("command -v tune2fs >/dev/null 2>&1 && command -v e2fsck >/dev/null 2>&1") != 0) {
+        fmt::print(stderr, "tune2fs or e2fsck not found; skipping indexed directory test\n");
+        return;
+    }
+
+    TempImage Img{INDEXED_IMAGE};
+    REQUIRE(Img.Ok());
+
+    /// e2fsck -D exits with 1 if it changed the image.
+    auto Command = fmt::format("tune2fs -O dir_index '{0}' >/dev/null 2>&1 && e2fsck -fyD '{0}' >/dev/null 2>&1", Img.Path());
+    auto Status = std::system(Command.c_str());
+    REQUIRE(WIFEXITED(Status) and WEXITSTATUS(Status) <= 1);
+    CHECK(Img.Fsck());
+
+    MountOptions Options;
+    Options.ReadOnly = true;
+    Options.CacheBlocks = 64;
+    auto D = Img.Mount(Options);
+    REQUIRE(D);
+
+    /// The walk lists the entries of every directory, without the index.
+    std::unordered_map<std::string, InodeNumberType> Expected;
+    std::mutex Lock;
+    D->Walk("/", [&](std::string_view Path, InodeNumberType Inode, const struct stat&) {
+        std::unique_lock Guard{Lock};
+        Expected.emplace(Path, Inode);
+    });
+    REQUIRE(Expected.size() >= Img.Files().size());
+
+    /// Look up names on fresh mounts so that dentries don’t come from
+    /// the cache. These read through the block cache rather than a
+    /// mapping of the image, so that the blocks read are counted.
+    auto Open = [&] { return Drive::TryMount(std::make_unique<FdBlockDevice>(open(Img.Path().c_str(), O_RDONLY)), Options); };
+    auto Sync = Open();
+    auto Async = Open();
+    REQUIRE(Sync and Async);
+    for (auto& Path : Img.Files()) {
+        CHECK(Sync->InodeFromPath(Path) == Expected[Path]);
+        CHECK(RunTask(*Async, Async->AsyncInodeFromPath(Path)) == Expected[Path]);
+        CHECK(not Sync->InodeFromPath(Path + "-missing"));
+        CHECK(LastError() == ErrorCode::NotFound);
+        CHECK(not RunTask(*Async, Async->AsyncInodeFromPath(Path + "-missing")));
+    }
+
+    /// A lookup reads the root, an interior node, and a leaf at most,
+    /// whereas a scan would read half of the directory on average.
+    const u64 Lookups = 2 * Img.Files().size();
+    CHECK(Sync->Stats()[IoKind::Directory].CacheMisses <= 3 * Lookups);
+    CHECK(Async->Stats()[IoKind::Directory].CacheMisses <= 3 * Lookups);
+}
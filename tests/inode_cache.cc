@@ -0,0 +1,82 @@
+#include "test.hh"
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+constexpr Bench::ImageOptions SMALL_IMAGE{
+    .BlockSize = 1024,
+    .Depth = 1,
+    .FanOut = 1,
+    .FilesPerDir = 4,
+    .MinFileSize = 1024,
+    .MaxFileSize = 4096,
+    .Fragmentation = 0,
+    .Seed = 7,
+};
+} // namespace
+
+/// Inodes of open files must be cached even if the cache holds nothing
+/// else; otherwise writes through a handle don’t update its inode.
+TEST(InodeCacheCapacityZero) {
+    TempImage Img{SMALL_IMAGE};
+    REQUIRE(Img.Ok());
+
+    MountOptions Options;
+    Options.InodeCacheEntries = 0;
+    auto D = Img.Mount(Options);
+    REQUIRE(D);
+
+    auto Path = Img.Files().front();
+    auto F = D->OpenFile(Path);
+    REQUIRE(F);
+
+    /// Two writes past the end, the second of which must see the blocks
+    /// and size of the first.
+    auto First = Pattern(20'000, 1);
+    auto Second = Pattern(30'000, 2);
+    CHECK(F->PWrite(0, First) == First.size());
+    CHECK(F->Sync());
+    CHECK(F->PWrite(First.size(), Second) == Second.size());
+    CHECK(F->Sync());
+
+    auto Expected = First;
+    Expected.insert(Expected.end(), Second.begin(), Second.end());
+    CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+    CHECK(D->Stat(Path)->st_size == off_t(Expected.size()));
+
+    F.reset();
+    D.reset();
+    CHECK(Img.Fsck());
+
+    /// And the data is on the drive.
+    D = Img.Mount(Options);
+    REQUIRE(D);
+    F = D->OpenFile(Path);
+    REQUIRE(F);
+    CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+}
+
+/// Lazily updated access times are written back even if the inode
+/// cache holds nothing but them.
+TEST(InodeCacheCapacityZeroLazyAtime) {
+    TempImage Img{SMALL_IMAGE};
+    REQUIRE(Img.Ok());
+
+    MountOptions ReadOnly;
+    ReadOnly.ReadOnly = true;
+    auto Path = Img.Files().front();
+    auto Before = Img.Mount(ReadOnly)->Stat(Path)->st_atime;
+
+    {
+        MountOptions Options;
+        Options.InodeCacheEntries = 0;
+        Options.LazyTime = true;
+        auto D = Img.Mount(Options);
+        REQUIRE(D);
+        CHECK(D->Stat(Path));
+        CHECK(D->Sync());
+    }
+
+    CHECK(Img.Mount(ReadOnly)->Stat(Path)->st_atime > Before);
+}
@@ -0,0 +1,87 @@
+#include "test.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Ext2::Tests {
+namespace {
+usz Failures = 0;
+} // namespace
+
+auto Registry() -> std::vector<TestCase>& {
+    static std::vector<TestCase> Tests;
+    return Tests;
+}
+
+void Fail(std::string_view Expression, std::string_view File, int Line) {
+    fmt::print(stderr, "{}:{}: check failed: {}\n", File, Line, Expression);
+    Failures++;
+}
+
+TempImage::TempImage(const Bench::ImageOptions& Options) {
+    char Template[] = "/tmp/ext2++-test-XXXXXX.img";
+    auto Fd = mkstemps(Template, 4);
+    if (Fd < 0) {
+        fmt::print(stderr, "Failed to create temporary image: {}\n", strerror(errno));
+        return;
+    }
+
+    close(Fd);
+    ImagePath = Template;
+    Contents = Bench::GenerateImage(ImagePath, Options);
+}
+
+TempImage::~TempImage() {
+    if (not ImagePath.empty()) unlink(ImagePath.c_str());
+}
+
+auto TempImage::Mount(const MountOptions& Options) const -> std::shared_ptr<Drive> {
+    return Drive::TryMount(open(ImagePath.c_str(), Options.ReadOnly ? O_RDONLY : O_RDWR), Options);
+}
+
+bool TempImage::Fsck() const {
+    if (std::system("command -v e2fsck >/dev/null 2>&1") != 0) {
+        fmt::print(stderr, "e2fsck not found; skipping filesystem check\n");
+        return true;
+    }
+
+    return std::system(fmt::format("e2fsck -fn '{}' >/dev/null 2>&1", ImagePath).c_str()) == 0;
+}
+
+auto Pattern(usz Size, u64 Seed) -> std::vector<u8> {
+    Bench::Random Rng{Seed};
+    std::vector<u8> Data(Size);
+    for (auto& B : Data) B = u8(Rng());
+    return Data;
+}
+
+auto ReadAll(File& F, u64 Offset, usz Size) -> std::optional<std::vector<u8>> {
+    std::vector<u8> Data(Size);
+    auto Read = F.PRead(Offset, Data);
+    if (not Read or *Read != Size) return std::nullopt;
+    return Data;
+}
+} // namespace Ext2::Tests
+
+/// Run all tests, or those whose name contains the first argument.
+int main(int argc, char** argv) {
+    using namespace Ext2;
+    using namespace Ext2::Tests;
+    std::string_view Filter = argc > 1 ? argv[1] : "";
+    usz Ran = 0, Failed = 0;
+    for (auto& T : Registry()) {
+        if (not T.Name.contains(Filter)) continue;
+        auto Before = Failures;
+        T.Run();
+        Ran++;
+        if (Failures != Before) {
+            Failed++;
+            fmt::print(stderr, "FAILED {}\n", T.Name);
+        } else {
+            fmt::print("passed {}\n", T.Name);
+        }
+    }
+
+    fmt::print("{} of {} tests passed\n", Ran - Failed, Ran);
+    return Failed or not Ran ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#ifndef EXT2_TESTS_TEST_HH
+#define EXT2_TESTS_TEST_HH
+
+#include "image.hh"
+
+#include <ext2++/core.hh>
+#include <string>
+
+namespace Ext2::Tests {
+/// A test case. Tests register themselves with TEST() and report
+/// failures with CHECK() and REQUIRE().
+struct TestCase {
+    std::string_view Name;
+    void (*Run)();
+};
+
+/// Get all registered tests.
+auto Registry() -> std::vector<TestCase>&;
+
+struct Registration {
+    Registration(std::string_view Name, void (*Run)()) { Registry().push_back({Name, Run}); }
+};
+
+/// Record that a check in the current test failed.
+void Fail(std::string_view Expression, std::string_view File, int Line);
+
+/// Generated image in a temporary file that is deleted when this goes out
+/// of scope. Check Ok() before using it.
+class TempImage {
+    std::string ImagePath;
+    std::optional<Bench::Image> Contents;
+
+public:
+    explicit TempImage(const Bench::ImageOptions& Options = {});
+    ~TempImage();
+    TempImage(const TempImage&) = delete;
+    TempImage& operator=(const TempImage&) = delete;
+
+    [[nodiscard]] bool Ok() const { return Contents.has_value(); }
+    [[nodiscard]] auto Path() const -> const std::string& { return ImagePath; }
+    [[nodiscard]] auto Files() const -> const std::vector<std::string>& { return Contents->Files; }
+
+    /// Mount the image on a file descriptor.
+    [[nodiscard]] auto Mount(const MountOptions& Options = {}) const -> std::shared_ptr<Drive>;
+
+    /// Check the image with e2fsck -fn. Passes if e2fsck isn’t installed.
+    [[nodiscard]] bool Fsck() const;
+};
+
+/// Bytes that differ from one offset to the next, so that misplaced
+/// data is noticed.
+auto Pattern(usz Size, u64 Seed) -> std::vector<u8>;
+
+/// Read a whole range of a file.
+auto ReadAll(File& F, u64 Offset, usz Size) -> std::optional<std::vector<u8>>;
+
+/// Run a task of the asynchronous API to completion.
+template <typename T>
+auto RunTask(Drive& D, Task<T> Body) -> T {
+    std::optional<T> Result;
+    auto Wrapper = [](Task<T> Inner, std::optional<T>& Out) -> Task<void> {
+        Out.emplace(co_await std::move(Inner));
+    };
+
+    Detach(Wrapper(std::move(Body), Result));
+    while (not Result) D.Poll(true);
+    return std::move(*Result);
+}
+} // namespace Ext2::Tests
+
+#define EXT2_TEST_CONCAT_IMPL(A, B) A##B
+#define EXT2_TEST_CONCAT(A, B) EXT2_TEST_CONCAT_IMPL(A, B)
+
+/// Define a test.
+#define TEST(Name)                                                                            \
+    static void Name();                                                                       \
+    static ::Ext2::Tests::Registration EXT2_TEST_CONCAT(Name, Registration){#Name, Name};     \
+    static void Name()
+
+/// Check a condition and keep going if it fails.
+#define CHECK(...)                                                                              \
+    do {                                                                                        \
+        if (not(__VA_ARGS__)) ::Ext2::Tests::Fail(#__VA_ARGS__, __FILE__, __LINE__);           \
+    } while (false)
+
+/// Check a condition and end the test if it fails.
+#define REQUIRE(...)                                                                            \
+    do {                                                                                        \
+        if (not(__VA_ARGS__)) {                                                                 \
+            ::Ext2::Tests::Fail(#__VA_ARGS__, __FILE__, __LINE__);                              \
+            return;                                                                             \
+        }                                                                                       \
+    } while (false)
+
+#endif // EXT2_TESTS_TEST_HH
@@ -0,0 +1,133 @@
+#include "test.hh"
+
+using namespace Ext2;
+using namespace Ext2::Tests;
+
+namespace {
+constexpr u64 BLOCK_SIZE = 1024;
+
+constexpr Bench::ImageOptions DELAYED_IMAGE{
+    .BlockSize = BLOCK_SIZE,
+    .Depth = 1,
+    .FanOut = 1,
+    .FilesPerDir = 4,
+    .MinFileSize = 8 * 1024,
+    .MaxFileSize = 16 * 1024,
+    .Fragmentation = 0,
+    .Seed = 23,
+};
+
+/// Apply a write to the expected contents of a file.
+void Put(std::vector<u8>& Contents, u64 Offset, std::span<const u8> Data) {
+    if (Contents.size() < Offset + Data.size()) Contents.resize(Offset + Data.size());
+    std::ranges::copy(Data, Contents.begin() + isz(Offset));
+}
+} // namespace
+
+/// Truncating a file cuts through delayed runs, and only what is left
+/// of them is allocated when they are flushed.
+TEST(DelayedTruncateAndFlush) {
+    TempImage Img{DELAYED_IMAGE};
+    REQUIRE(Img.Ok());
+
+    auto Path = Img.Files().front();
+    std::vector<u8> Expected;
+    u64 FreeBefore{};
+    {
+        auto D = Img.Mount();
+        REQUIRE(D);
+        FreeBefore = D->StatFs()->FreeBlocks;
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        auto Size = usz(D->Stat(Path)->st_size);
+        auto Contents = ReadAll(*F, 0, Size);
+        REQUIRE(Contents);
+        Expected = std::move(*Contents);
+
+        /// A delayed run past the end, cut off in the middle of a block.
+        auto Tail = Pattern(300 * BLOCK_SIZE, 1);
+        CHECK(F->PWrite(Size, Tail) == Tail.size());
+        Put(Expected, Size, Tail);
+        const u64 Cut = Size + 100 * BLOCK_SIZE + 123;
+        CHECK(F->Truncate(Cut));
+        Expected.resize(Cut);
+        CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+
+        /// The rest of the cut block reads as zeroes when the file grows
+        /// again, and so does the hole before a run written after it.
+        const u64 Far = Cut + 50 * BLOCK_SIZE + 7;
+        auto Run = Pattern(20 * BLOCK_SIZE + 500, 2);
+        CHECK(F->PWrite(Far, Run) == Run.size());
+        Put(Expected, Far, Run);
+        CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+
+        /// Cut into the middle of that run, then below the original size,
+        /// which frees blocks that are on the drive as well.
+        const u64 InRun = Far + 10 * BLOCK_SIZE + 1;
+        CHECK(F->Truncate(InRun));
+        Expected.resize(InRun);
+        CHECK(F->Truncate(Size / 2 + 5));
+        Expected.resize(Size / 2 + 5);
+
+        /// And a last delayed run into single indirect blocks.
+        auto Last = Pattern(40 * BLOCK_SIZE, 3);
+        CHECK(F->PWrite(Size / 2 + 5 + 2 * BLOCK_SIZE, Last) == Last.size());
+        Put(Expected, Size / 2 + 5 + 2 * BLOCK_SIZE, Last);
+
+        CHECK(F->Sync());
+        CHECK(D->Stat(Path)->st_size == off_t(Expected.size()));
+        CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+    }
+
+    CHECK(Img.Fsck());
+
+    auto D = Img.Mount();
+    REQUIRE(D);
+    auto F = D->OpenFile(Path);
+    REQUIRE(F);
+    CHECK(D->Stat(Path)->st_size == off_t(Expected.size()));
+    CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+
+    /// Only the blocks that are left were allocated; the file had at most
+    /// 16 blocks before, and now needs 63 including an indirect block.
+    const u64 FreeAfter = D->StatFs()->FreeBlocks;
+    CHECK(FreeAfter <= FreeBefore);
+    CHECK(FreeBefore - FreeAfter <= 63);
+}
+
+/// Dropping a file's delayed blocks entirely leaves nothing to flush.
+TEST(DelayedTruncateToOriginalSize) {
+    TempImage Img{DELAYED_IMAGE};
+    REQUIRE(Img.Ok());
+
+    auto Path = Img.Files().front();
+    std::vector<u8> Expected;
+    u64 FreeBefore{};
+    {
+        auto D = Img.Mount();
+        REQUIRE(D);
+        FreeBefore = D->StatFs()->FreeBlocks;
+        auto F = D->OpenFile(Path);
+        REQUIRE(F);
+        auto Size = usz(D->Stat(Path)->st_size);
+        auto Contents = ReadAll(*F, 0, Size);
+        REQUIRE(Contents);
+        Expected = std::move(*Contents);
+
+        auto Tail = Pattern(64 * BLOCK_SIZE, 4);
+        CHECK(F->PWrite(Size, Tail) == Tail.size());
+        CHECK(F->Truncate(Size));
+        CHECK(D->Sync());
+        CHECK(D->StatFs()->FreeBlocks == FreeBefore);
+    }
+
+    CHECK(Img.Fsck());
+
+    auto D = Img.Mount();
+    REQUIRE(D);
+    auto F = D->OpenFile(Path);
+    REQUIRE(F);
+    CHECK(D->Stat(Path)->st_size == off_t(Expected.size()));
+    CHECK(ReadAll(*F, 0, Expected.size()) == Expected);
+    CHECK(D->StatFs()->FreeBlocks == FreeBefore);
+}